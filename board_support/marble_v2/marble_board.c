@@ -35,6 +35,7 @@
 #include "console.h"
 #include "st-eeprom.h"
 #include "i2c_pm.h"
+#include "i2c_xact.h"
 #include "watchdog.h"
 
 #define UART_ECHO
@@ -44,6 +45,48 @@
 #define SMBA_PIN GPIO_PIN_15
 #endif
 
+// Console TX DMA stream (see RM0033 Table 22/23, DMA request mapping)
+#ifdef NUCLEO
+// USART3_TX: DMA1 Stream 3, Channel 4
+#define CONSOLE_DMA_STREAM                    DMA1_Stream3
+#define CONSOLE_DMA_ISR                       (DMA1->LISR)
+#define CONSOLE_DMA_IFCR                      (DMA1->LIFCR)
+#define CONSOLE_DMA_IRQn                      DMA1_Stream3_IRQn
+#define CONSOLE_DMA_IRQHandler                DMA1_Stream3_IRQHandler
+#define CONSOLE_DMA_CLK_ENABLE()              __HAL_RCC_DMA1_CLK_ENABLE()
+#else
+// USART1_TX: DMA2 Stream 7, Channel 4
+#define CONSOLE_DMA_STREAM                    DMA2_Stream7
+#define CONSOLE_DMA_ISR                       (DMA2->HISR)
+#define CONSOLE_DMA_IFCR                      (DMA2->HIFCR)
+#define CONSOLE_DMA_IRQn                      DMA2_Stream7_IRQn
+#define CONSOLE_DMA_IRQHandler                DMA2_Stream7_IRQHandler
+#define CONSOLE_DMA_CLK_ENABLE()              __HAL_RCC_DMA2_CLK_ENABLE()
+#endif
+#define CONSOLE_DMA_CHANNEL                   (4)
+// Streams 3 and 7 have their flags at the same bit positions (in LISR and HISR)
+#define CONSOLE_DMA_FLAG_TC                   DMA_HIFCR_CTCIF7
+#define CONSOLE_DMA_FLAG_TE                   DMA_HIFCR_CTEIF7
+#define CONSOLE_DMA_FLAG_ALL                  (DMA_HIFCR_CTCIF7 | DMA_HIFCR_CHTIF7 | DMA_HIFCR_CTEIF7 \
+                                               | DMA_HIFCR_CDMEIF7 | DMA_HIFCR_CFEIF7)
+// Size of each of the two ping-pong TX buffers
+#define UART_DMA_BUF_SIZE                     (128)
+
+// FPGA mailbox SPI (SPI1) bursts: RX on DMA2 Stream 0, TX on DMA2 Stream 3,
+// both Channel 3 (RM0033 Table 23)
+#define SSP_FPGA_DMA_RX_STREAM                DMA2_Stream0
+#define SSP_FPGA_DMA_TX_STREAM                DMA2_Stream3
+#define SSP_FPGA_DMA_CHANNEL                  (3)
+#define SSP_FPGA_DMA_FLAG_RX_TC               DMA_LISR_TCIF0
+#define SSP_FPGA_DMA_FLAG_ERR                 (DMA_LISR_TEIF0 | DMA_LISR_TEIF3)
+#define SSP_FPGA_DMA_FLAG_ALL                 (DMA_LIFCR_CTCIF0 | DMA_LIFCR_CHTIF0 | DMA_LIFCR_CTEIF0 \
+                                               | DMA_LIFCR_CDMEIF0 | DMA_LIFCR_CFEIF0 \
+                                               | DMA_LIFCR_CTCIF3 | DMA_LIFCR_CHTIF3 | DMA_LIFCR_CTEIF3 \
+                                               | DMA_LIFCR_CDMEIF3 | DMA_LIFCR_CFEIF3)
+// Single words are cheaper through the HAL than through DMA setup
+#define SSP_DMA_MIN_WORDS                     (2)
+#define SSP_DMA_TIMEOUT_MS                    (10)
+
 
 #define PRINT_POWER_STATE(subs, on) do {\
    char s[3] = {'f', 'f', '\0'}; \
@@ -73,6 +116,15 @@ UART_HandleTypeDef huart3;  // Used for nucleo
 
 static Marble_PCB_Rev_t marble_pcb_rev;
 
+// Console TX ping-pong buffers. While one buffer is on the wire, the other
+// is staged from UARTTX_queue so the next burst can start straight from the
+// DMA transfer-complete ISR.
+static uint8_t uart_dma_buf[2][UART_DMA_BUF_SIZE];
+static volatile uint16_t uart_dma_len[2];
+static volatile uint8_t uart_dma_active = 0;
+static volatile uint8_t uart_dma_busy = 0;
+static volatile uart_tx_stats_t uart_tx_stats;
+
 static int i2cBusStatus = 0;
 static int i2c_pm_alert = 0;
 
@@ -91,9 +143,13 @@ static void MX_SPI1_Init(void);
 static void MX_SPI2_Init(void);
 //static void MX_USART1_UART_Init(void);
 static void CONSOLE_USART_Init(void);
+static void CONSOLE_DMA_Init(void);
+static void SSP_FPGA_DMA_Init(void);
+static int SSP_FPGA_DMA_xfer(const uint16_t *tx_buf, uint16_t *rx_buf, unsigned size);
 static void MX_USART2_UART_Init(void);
 static void USART_RXNE_ISR(void);
-static void USART_TXE_ISR(void);
+static void USART_DMA_Kick(void);
+static void USART_DMA_Next(void);
 static void USART_Erase_Echo(void);
 static void USART_Erase(int n);
 static void marble_read_pcb_rev(void);
@@ -107,6 +163,7 @@ static int i2c_hook(I2C_BUS I2C_bus, uint8_t addr, uint8_t rnw,
  *  Must always return 0 (otherwise execution will terminate).
  */
 int board_service(void) {
+   i2c_xact_service();
    if (i2c_pm_alert) {
       printf("TODO - Respond to I2C_PM Alert\r\n");
       i2c_pm_alert = 0;
@@ -147,12 +204,29 @@ void pwr_autoboot(void) {
 int marble_UART_send(const char *str, int size)
 {
   //HAL_UART_Transmit(&huart_console, (const uint8_t *) str, size, 1000);
-  int txnum = USART_Tx_LL_Queue((char *)str, size);
-  // Kick off the transmission if the TX buffer is empty
-  if ((CONSOLE_USART->SR) & USART_SR_TXE) {
-    SET_BIT(CONSOLE_USART->CR1, USART_CR1_TXEIE);
+  int sent = 0;
+  // Queue in buffer-sized pieces and kick the DMA after each so a message
+  // longer than UARTTX_queue drains while the rest of it is being queued.
+  while (sent < size) {
+    int chunk = MIN(size - sent, UART_DMA_BUF_SIZE);
+    int txnum = USART_Tx_LL_Queue((char *)(str + sent), chunk);
+    USART_DMA_Kick();
+    if (txnum < 0) {
+      return txnum;
+    }
+    sent += txnum;
   }
-  return txnum;
+  return sent;
+}
+
+void marble_UART_get_tx_stats(uart_tx_stats_t *stats) {
+  uint32_t primask = __get_PRIMASK();
+  __disable_irq();
+  stats->bursts = uart_tx_stats.bursts;
+  stats->bytes = uart_tx_stats.bytes;
+  stats->max_burst = uart_tx_stats.max_burst;
+  __set_PRIMASK(primask);
+  return;
 }
 
 int marble_UART_recv(char *str, int size) {
@@ -160,8 +234,7 @@ int marble_UART_recv(char *str, int size) {
 }
 
 void CONSOLE_USART_ISR(void) {
-  USART_RXNE_ISR();   // Handle RX interrupts first
-  USART_TXE_ISR();  // Then handle TX interrupts
+  USART_RXNE_ISR();   // TX is handled by CONSOLE_DMA_IRQHandler()
   return;
 }
 
@@ -177,30 +250,40 @@ void USART_RXNE_ISR(void) {
     // Don't clear flags; the RXNE flag is cleared automatically by read from DR
     //c = (uint8_t)(huart_console.Instance->DR & (uint8_t)0x00FF);
     c = (uint8_t)(CONSOLE_USART->DR & (uint8_t)0x00FF);
-    // Look for control characters first
-    if (c == UART_MSG_ABORT) {
+    marble_UART_rx_char(c);
+  }
+  return;
+}
+
+/*
+ * void marble_UART_rx_char(uint8_t c);
+ *  Queue one received byte, acting on control characters.
+ *  Also used to replay bytes held during a flash erase.
+ */
+void marble_UART_rx_char(uint8_t c) {
+  // Look for control characters first
+  if (c == UART_MSG_ABORT) {
 #ifdef UART_ECHO
-      USART_Erase_Echo();
+    USART_Erase_Echo();
 #endif
-      // clear queue
-      UARTQUEUE_Clear();
-    } else if (c == UART_MSG_BKSP) {
+    // clear queue
+    UARTQUEUE_Clear();
+  } else if (c == UART_MSG_BKSP) {
 #ifdef UART_ECHO
-      USART_Erase(1);
+    USART_Erase(1);
 #endif
-      UARTQUEUE_Rewind(1);
-    } else {
-      if (UARTQUEUE_Add(&c) == UART_QUEUE_FULL) {
-        UARTQUEUE_SetDataLost(UART_DATA_LOST);
-        // Clear QUEUE at this point?
-      }
-      if (c == UART_MSG_TERMINATOR) {
-        console_pend_msg();
-      }
+    UARTQUEUE_Rewind(1);
+  } else {
+    if (UARTQUEUE_Add(&c) == UART_QUEUE_FULL) {
+      UARTQUEUE_SetDataLost(UART_DATA_LOST);
+      // Clear QUEUE at this point?
+    }
+    if (c == UART_MSG_TERMINATOR) {
+      console_pend_msg();
+    }
 #ifdef UART_ECHO
-      marble_UART_send((const char *)&c, 1);
+    marble_UART_send((const char *)&c, 1);
 #endif
-    }
   }
   return;
 }
@@ -242,23 +325,74 @@ static void USART_Erase(int n) {
   return;
 }
 
-void USART_TXE_ISR(void) {
-  uint8_t outByte;
-  // If char queue not empty
-  //if (__HAL_UART_GET_FLAG(&huart_console, UART_FLAG_TXE) == SET) {
-  if ((CONSOLE_USART->SR & USART_SR_TXE) == USART_SR_TXE) {
-    if (UARTTXQUEUE_Get(&outByte) != UARTTX_QUEUE_EMPTY) {
-      // Write new char to DR
-      //huart_console.Instance->DR = (uint32_t)outByte;
-      CONSOLE_USART->DR = (uint32_t)outByte;
-    } else {
-      // If the queue is empty, disable the TXE interrupt
-      CLEAR_BIT(CONSOLE_USART->CR1, USART_CR1_TXEIE);
-    }
+/*
+ * static void USART_DMA_Kick(void);
+ *  Start a DMA burst if the TX DMA stream is idle.  Safe to call from
+ *  thread mode or from an ISR (e.g. the RX echo path).
+ */
+static void USART_DMA_Kick(void) {
+  uint32_t primask = __get_PRIMASK();
+  __disable_irq();
+  if (!uart_dma_busy) {
+    USART_DMA_Next();
   }
+  __set_PRIMASK(primask);
   return;
 }
 
+/*
+ * static void USART_DMA_Fill(uint8_t nbuf);
+ *  Top up ping-pong buffer 'nbuf' from UARTTX_queue.  Must only be called
+ *  on the buffer which is not on the wire.
+ */
+static void USART_DMA_Fill(uint8_t nbuf) {
+  uint16_t n = uart_dma_len[nbuf];
+  n += UARTTXQUEUE_ShiftOut(&uart_dma_buf[nbuf][n], UART_DMA_BUF_SIZE - n);
+  uart_dma_len[nbuf] = n;
+  return;
+}
+
+/*
+ * static void USART_DMA_Next(void);
+ *  Put the staged buffer on the wire and stage the one just freed.
+ *  Called with interrupts masked or from CONSOLE_DMA_IRQHandler().
+ */
+static void USART_DMA_Next(void) {
+  uint8_t next = uart_dma_active ^ 1;
+  USART_DMA_Fill(next);
+  uint16_t len = uart_dma_len[next];
+  if (len == 0) {
+    return;
+  }
+  CONSOLE_DMA_IFCR = CONSOLE_DMA_FLAG_ALL;
+  CONSOLE_DMA_STREAM->M0AR = (uint32_t)uart_dma_buf[next];
+  CONSOLE_DMA_STREAM->NDTR = len;
+  uart_dma_active = next;
+  uart_dma_busy = 1;
+  SET_BIT(CONSOLE_DMA_STREAM->CR, DMA_SxCR_EN);
+  uart_tx_stats.bursts++;
+  uart_tx_stats.bytes += len;
+  if (len > uart_tx_stats.max_burst) {
+    uart_tx_stats.max_burst = len;
+  }
+  // Stage the buffer that just finished so the next burst is ready to go
+  uart_dma_len[next ^ 1] = 0;
+  USART_DMA_Fill(next ^ 1);
+  return;
+}
+
+// Override default (weak) IRQHandler
+void CONSOLE_DMA_IRQHandler(void) {
+  uint32_t flags = CONSOLE_DMA_ISR;
+  CONSOLE_DMA_IFCR = CONSOLE_DMA_FLAG_ALL;
+  if (flags & (CONSOLE_DMA_FLAG_TC | CONSOLE_DMA_FLAG_TE)) {
+    // The buffer on the wire is done (or abandoned on transfer error)
+    uart_dma_len[uart_dma_active] = 0;
+    uart_dma_busy = 0;
+    USART_DMA_Next();
+  }
+  return;
+}
 
 /************
 * LEDs
@@ -466,6 +600,7 @@ void enable_fpga(void) {
 ************/
 void FPGA_DONE_dummy(void) {}
 void (*volatile marble_FPGA_DONE_handler)(void) = FPGA_DONE_dummy;
+void (*volatile marble_FPGA_INT_handler)(void) = FPGA_DONE_dummy;
 
 
 // Override default (weak) IRQHandler and redirect to HAL shim
@@ -474,11 +609,19 @@ void EXTI0_IRQHandler(void)
    HAL_GPIO_EXTI_IRQHandler(GPIO_PIN_0);
 }
 
+// Override default (weak) IRQHandler and redirect to HAL shim
+void EXTI3_IRQHandler(void)
+{
+   HAL_GPIO_EXTI_IRQHandler(GPIO_PIN_3);
+}
+
 // Override default (weak) callback
 void HAL_GPIO_EXTI_Callback(uint16_t GPIO_Pin)
 {
    if (GPIO_Pin == GPIO_PIN_0) { // Handles any interrupt on line 0 (e.g. PA0, PB0, PC0, PD0)
       marble_FPGA_DONE_handler();
+   } else if (GPIO_Pin == GPIO_PIN_3) { // PA3 - FPGA_INT
+      marble_FPGA_INT_handler();
    } else if (GPIO_Pin == SMBA_PIN) {
       I2C_PM_smba_handler();
    }
@@ -508,6 +651,22 @@ void marble_GPIOint_handlers(void (*FPGA_DONE_handler)(void)) {
    marble_FPGA_DONE_handler = FPGA_DONE_handler;
 }
 
+/* Register the FPGA_INT handler and enable the interrupt */
+void marble_FPGAint_handler(void (*FPGA_INT_handler)(void)) {
+   marble_FPGA_INT_handler = FPGA_INT_handler;
+
+   /*Configure GPIO pin : PA3 - FPGA_INT (active low) falling edge interrupt */
+   GPIO_InitTypeDef GPIO_InitStruct = {0};
+   GPIO_InitStruct.Pin = GPIO_PIN_3;
+   GPIO_InitStruct.Mode = GPIO_MODE_IT_FALLING;
+   GPIO_InitStruct.Pull = GPIO_NOPULL;
+   HAL_GPIO_Init(GPIOA, &GPIO_InitStruct);
+
+   /* Enable interrupt in the NVIC */
+   HAL_NVIC_SetPriority(EXTI3_IRQn, 5, 0);
+   HAL_NVIC_EnableIRQ(EXTI3_IRQn);
+}
+
 static void I2C_PM_smba_handler(void) {
    i2c_pm_alert = 1;
    return;
@@ -640,7 +799,6 @@ static int marble_MGTMUX_store(void) {
 * I2C
 ************/
 #define SPEED_100KHZ 100000
-#define I2C_DELAY_MS 1000
 
 
 /* Non-destructive I2C probe function based on empty data command, i.e. S+[A,RW]+P */
@@ -650,105 +808,130 @@ int marble_I2C_probe(I2C_BUS I2C_bus, uint8_t addr) {
    return rc;
 }
 
-/* Generic I2C send function with selectable I2C bus and 8-bit I2C addresses (R/W bit = 0) */
-/* 1-byte register addresses */
-int marble_I2C_send(I2C_BUS I2C_bus, uint8_t addr, const uint8_t *data, int size) {
-   int rc = HAL_I2C_Master_Transmit(I2C_bus, (uint16_t)addr, data, size, I2C_DELAY_MS);
+/* static int i2c_xfer(const char *name, I2C_BUS I2C_bus, uint8_t addr, uint8_t rnw,
+ *                     int cmd, uint8_t cmd_len, uint8_t *data, int size);
+ *  Blocking transfer built on the queued engine: submit and service it until
+ *  it retires.  i2c_hook() runs from i2c_xact_service() on success.  The
+ *  engine's I2C_XACT_TIMEOUT_MS plays the role of the old HAL timeout.
+ */
+static int i2c_xfer(const char *name, I2C_BUS I2C_bus, uint8_t addr, uint8_t rnw,
+                    int cmd, uint8_t cmd_len, uint8_t *data, int size)
+{
+   i2c_xact_t x;
+   i2c_xact_init(&x, I2C_bus, addr, rnw, cmd, cmd_len, data, size, NULL, NULL);
+   int rc = i2c_xact_submit(&x) ? HAL_BUSY : i2c_xact_wait(&x);
    if (rc == HAL_TIMEOUT) {
-     printf("*** I2C_send TIMEOUT\r\n");
+     printf("*** I2C_%s TIMEOUT\r\n", name);
    } else if (rc == HAL_BUSY) {
-     printf("*** I2C_send BUSY\r\n");
+     printf("*** I2C_%s BUSY\r\n", name);
    }
    i2cBusStatus |= rc;
-   if (rc == HAL_OK) {
-      // rnw=0, cmd=-1
-      i2c_hook(I2C_bus, addr, 0, -1, data, size);
-   }
    return rc;
 }
 
+/* Generic I2C send function with selectable I2C bus and 8-bit I2C addresses (R/W bit = 0) */
+/* 1-byte register addresses */
+int marble_I2C_send(I2C_BUS I2C_bus, uint8_t addr, const uint8_t *data, int size) {
+   return i2c_xfer("send", I2C_bus, addr, 0, -1, 0, (uint8_t *)data, size);
+}
+
 int marble_I2C_cmdsend(I2C_BUS I2C_bus, uint8_t addr, uint8_t cmd, const uint8_t *data, int size) {
-   int rc = HAL_I2C_Mem_Write(I2C_bus, (uint16_t)addr, cmd, 1, (uint8_t *)data, size, I2C_DELAY_MS);
-   if (rc == HAL_TIMEOUT) {
-     printf("*** I2C_cmdsend TIMEOUT\r\n");
-   } else if (rc == HAL_BUSY) {
-     printf("*** I2C_cmdsend BUSY\r\n");
-   }
-   if (rc == HAL_OK) {
-      // rnw=0, cmd=cmd
-      i2c_hook(I2C_bus, addr, 0, cmd, data, size);
-   }
-   i2cBusStatus |= rc;
-   return rc;
+   return i2c_xfer("cmdsend", I2C_bus, addr, 0, cmd, 1, (uint8_t *)data, size);
 }
 
 int marble_I2C_recv(I2C_BUS I2C_bus, uint8_t addr, uint8_t *data, int size) {
-   int rc = HAL_I2C_Master_Receive(I2C_bus, (uint16_t)addr, data, size, I2C_DELAY_MS);
-   if (rc == HAL_TIMEOUT) {
-     printf("*** I2C_recv TIMEOUT\r\n");
-   } else if (rc == HAL_BUSY) {
-     printf("*** I2C_recv BUSY\r\n");
-   }
-   i2cBusStatus |= rc;
-   if (rc == HAL_OK) {
-      // rnw=1, cmd=-1
-      i2c_hook(I2C_bus, addr, 1, -1, data, size);
-   }
-   return rc;
+   return i2c_xfer("recv", I2C_bus, addr, 1, -1, 0, data, size);
 }
 
 int marble_I2C_cmdrecv(I2C_BUS I2C_bus, uint8_t addr, uint8_t cmd, uint8_t *data, int size) {
-   int rc = HAL_I2C_Mem_Read(I2C_bus, (uint16_t)addr, cmd, 1, data, size, I2C_DELAY_MS);
-   if (rc == HAL_TIMEOUT) {
-     printf("*** I2C_cmdrecv TIMEOUT\r\n");
-   } else if (rc == HAL_BUSY) {
-     printf("*** I2C_cmdrecv BUSY\r\n");
-   }
-   i2cBusStatus |= rc;
-   if (rc == HAL_OK) {
-      // rnw=1, cmd=cmd
-      i2c_hook(I2C_bus, addr, 1, cmd, data, size);
-   }
-   return rc;
+   return i2c_xfer("cmdrecv", I2C_bus, addr, 1, cmd, 1, data, size);
 }
 
 /* Same but 2-byte register addresses */
 int marble_I2C_cmdsend_a2(I2C_BUS I2C_bus, uint8_t addr, uint16_t cmd, const uint8_t *data, int size) {
-   int rc = HAL_I2C_Mem_Write(I2C_bus, (uint16_t)addr, cmd, 2, (uint8_t *)data, size, I2C_DELAY_MS);
-   if (rc == HAL_TIMEOUT) {
-     printf("*** I2C_cmdsend_a2 TIMEOUT\r\n");
-   } else if (rc == HAL_BUSY) {
-     printf("*** I2C_cmdsend_a2 BUSY\r\n");
-   }
-   i2cBusStatus |= rc;
-   if (rc == HAL_OK) {
-      // rnw=0, cmd=cmd
-      i2c_hook(I2C_bus, addr, 0, cmd, data, size);
-   }
-   return rc;
+   return i2c_xfer("cmdsend_a2", I2C_bus, addr, 0, cmd, 2, (uint8_t *)data, size);
 }
 int marble_I2C_cmdrecv_a2(I2C_BUS I2C_bus, uint8_t addr, uint16_t cmd, uint8_t *data, int size) {
-   int rc = HAL_I2C_Mem_Read(I2C_bus, (uint16_t)addr, cmd, 2, data, size, I2C_DELAY_MS);
-   if (rc == HAL_TIMEOUT) {
-     printf("*** I2C_cmdrecv_a2 TIMEOUT\r\n");
-   } else if (rc == HAL_BUSY) {
-     printf("*** I2C_cmdrecv_a2 BUSY\r\n");
+   return i2c_xfer("cmdrecv_a2", I2C_bus, addr, 1, cmd, 2, data, size);
+}
+
+/* Interrupt-driven backend for i2c_xact.c.  One transfer in flight per bus;
+ * HAL completion/error callbacks (from the EV/ER IRQs) hand it back. */
+static i2c_xact_t *volatile i2c_inflight[2];
+
+static int i2c_slot(I2C_HandleTypeDef *hi2c) {
+   return (hi2c == &hi2c1) ? 0 : 1;
+}
+
+int marble_I2C_xact_start(i2c_xact_t *x) {
+   I2C_HandleTypeDef *hi2c = x->bus;
+   uint16_t addr = (uint16_t)x->addr;
+   int rc;
+   i2c_inflight[i2c_slot(hi2c)] = x;
+   if (x->cmd_len) {
+      uint16_t msize = (x->cmd_len == 2) ? I2C_MEMADD_SIZE_16BIT : I2C_MEMADD_SIZE_8BIT;
+      if (x->rnw) {
+         rc = HAL_I2C_Mem_Read_IT(hi2c, addr, (uint16_t)x->cmd, msize, x->data, x->len);
+      } else {
+         rc = HAL_I2C_Mem_Write_IT(hi2c, addr, (uint16_t)x->cmd, msize, x->data, x->len);
+      }
+   } else {
+      if (x->rnw) {
+         rc = HAL_I2C_Master_Receive_IT(hi2c, addr, x->data, x->len);
+      } else {
+         rc = HAL_I2C_Master_Transmit_IT(hi2c, addr, x->data, x->len);
+      }
    }
-   i2cBusStatus |= rc;
-   if (rc == HAL_OK) {
-      // rnw=1, cmd=cmd
-      i2c_hook(I2C_bus, addr, 1, cmd, data, size);
+   if (rc != HAL_OK) {
+      i2c_inflight[i2c_slot(hi2c)] = NULL;
    }
    return rc;
 }
 
+/* Reinitialize the peripheral; clears BUSY/arbitration state left behind
+ * by a device holding SDA or stretching SCL indefinitely. */
+void marble_I2C_xact_abort(I2C_BUS I2C_bus) {
+   I2C_HandleTypeDef *hi2c = I2C_bus;
+   i2c_inflight[i2c_slot(hi2c)] = NULL;
+   HAL_I2C_DeInit(hi2c);
+   HAL_I2C_Init(hi2c);
+   return;
+}
+
+void marble_I2C_xact_hook(const i2c_xact_t *x) {
+   i2c_hook(x->bus, x->addr, x->rnw, x->cmd, x->data, x->len);
+   return;
+}
+
+static void i2c_it_done(I2C_HandleTypeDef *hi2c, int rc) {
+   int slot = i2c_slot(hi2c);
+   i2c_xact_t *x = i2c_inflight[slot];
+   if (x) {
+      i2c_inflight[slot] = NULL;
+      i2c_xact_complete(x, rc);
+   }
+   return;
+}
+
+// Override default (weak) HAL I2C callbacks
+void HAL_I2C_MasterTxCpltCallback(I2C_HandleTypeDef *hi2c) { i2c_it_done(hi2c, HAL_OK); }
+void HAL_I2C_MasterRxCpltCallback(I2C_HandleTypeDef *hi2c) { i2c_it_done(hi2c, HAL_OK); }
+void HAL_I2C_MemTxCpltCallback(I2C_HandleTypeDef *hi2c) { i2c_it_done(hi2c, HAL_OK); }
+void HAL_I2C_MemRxCpltCallback(I2C_HandleTypeDef *hi2c) { i2c_it_done(hi2c, HAL_OK); }
+void HAL_I2C_ErrorCallback(I2C_HandleTypeDef *hi2c) { i2c_it_done(hi2c, HAL_ERROR); }
+
+// Override default (weak) IRQHandlers
+void I2C1_EV_IRQHandler(void) { HAL_I2C_EV_IRQHandler(&hi2c1); }
+void I2C1_ER_IRQHandler(void) { HAL_I2C_ER_IRQHandler(&hi2c1); }
+void I2C3_EV_IRQHandler(void) { HAL_I2C_EV_IRQHandler(&hi2c3); }
+void I2C3_ER_IRQHandler(void) { HAL_I2C_ER_IRQHandler(&hi2c3); }
+
 /* static int i2c_hook(I2C_BUS I2C_bus, uint8_t addr, uint8_t rnw,
                        int cmd, const uint8_t *data, int len);
  *  Callback (hook) function for side-effects of I2C transactions.
- *  In blocking mode, this function is called AFTER a successful return of the I2C_write
- *  or I2C_read functions.  In non-blocking mode, this callback should be scheduled to
- *  run in the I2C_transaction_complete interrupt handler and should only be called
- *  in thread mode (not called from the ISR).
+ *  Called by i2c_xact_service() (via marble_I2C_xact_hook) in thread mode after
+ *  a transaction completes successfully, never from the I2C ISR.  This covers
+ *  both the blocking marble_I2C_* wrappers and queued i2c_xact_submit() users.
  *  @params:
  *    I2C_BUS I2C_bus: The bus on which the transaction occurred. One of I2C_PM,
  *                  or I2C_FPGA.
@@ -781,8 +964,13 @@ static void SPI_CSB_SET(SSP_PORT ssp, bool set);
 
 int marble_SSP_write16(SSP_PORT ssp, uint16_t *buffer, unsigned size)
 {
+   int rc;
    SPI_CSB_SET(ssp, false);
-   int rc = HAL_SPI_Transmit(ssp, (uint8_t*) buffer, size, HAL_MAX_DELAY);
+   if ((ssp == SSP_FPGA) && (size >= SSP_DMA_MIN_WORDS)) {
+      rc = SSP_FPGA_DMA_xfer(buffer, NULL, size);
+   } else {
+      rc = HAL_SPI_Transmit(ssp, (uint8_t*) buffer, size, HAL_MAX_DELAY);
+   }
    SPI_CSB_SET(ssp, true);
    return rc;
 }
@@ -797,12 +985,68 @@ int marble_SSP_read16(SSP_PORT ssp, uint16_t *buffer, unsigned size)
 
 int marble_SSP_exch16(SSP_PORT ssp, uint16_t *tx_buf, uint16_t *rx_buf, unsigned size)
 {
+   int rc;
    SPI_CSB_SET(ssp, false);
-   int rc = HAL_SPI_TransmitReceive(ssp, (uint8_t*) tx_buf, (uint8_t*) rx_buf,size, HAL_MAX_DELAY);
+   if ((ssp == SSP_FPGA) && (size >= SSP_DMA_MIN_WORDS)) {
+      rc = SSP_FPGA_DMA_xfer(tx_buf, rx_buf, size);
+   } else {
+      rc = HAL_SPI_TransmitReceive(ssp, (uint8_t*) tx_buf, (uint8_t*) rx_buf,size, HAL_MAX_DELAY);
+   }
    SPI_CSB_SET(ssp, true);
    return rc;
 }
 
+/*
+ * static int SSP_FPGA_DMA_xfer(const uint16_t *tx_buf, uint16_t *rx_buf, unsigned size);
+ *  Full-duplex transfer of 'size' words on SSP_FPGA, back to back, by DMA.
+ *  Completion is polled since the mailbox needs the result before it moves
+ *  on; the win is no per-word HAL call or CSB cycle.  RX always runs so
+ *  the SPI cannot overrun; if 'rx_buf' is NULL it lands in a scratch word.
+ *  Caller handles CSB.
+ */
+static int SSP_FPGA_DMA_xfer(const uint16_t *tx_buf, uint16_t *rx_buf, unsigned size)
+{
+   static uint16_t rx_scratch;
+   SPI_TypeDef *spi = hspi1.Instance;
+   uint32_t cr = (SSP_FPGA_DMA_CHANNEL << DMA_SxCR_CHSEL_Pos) | DMA_SxCR_PSIZE_0 | DMA_SxCR_MSIZE_0;
+   int rc = HAL_OK;
+   // Drop any word left behind by a HAL transfer
+   if (spi->SR & SPI_SR_RXNE) {
+      (void)spi->DR;
+   }
+   DMA2->LIFCR = SSP_FPGA_DMA_FLAG_ALL;
+   SSP_FPGA_DMA_RX_STREAM->M0AR = (uint32_t)(rx_buf ? rx_buf : &rx_scratch);
+   SSP_FPGA_DMA_RX_STREAM->NDTR = size;
+   SSP_FPGA_DMA_RX_STREAM->CR = cr | (rx_buf ? DMA_SxCR_MINC : 0);
+   SSP_FPGA_DMA_TX_STREAM->M0AR = (uint32_t)tx_buf;
+   SSP_FPGA_DMA_TX_STREAM->NDTR = size;
+   SSP_FPGA_DMA_TX_STREAM->CR = cr | DMA_SxCR_MINC | DMA_SxCR_DIR_0;
+   SET_BIT(SSP_FPGA_DMA_RX_STREAM->CR, DMA_SxCR_EN);
+   SET_BIT(SSP_FPGA_DMA_TX_STREAM->CR, DMA_SxCR_EN);
+   __HAL_SPI_ENABLE(&hspi1);
+   // RX request first so the first received word is never missed
+   SET_BIT(spi->CR2, SPI_CR2_RXDMAEN);
+   SET_BIT(spi->CR2, SPI_CR2_TXDMAEN);
+   uint32_t t0 = HAL_GetTick();
+   // The last RX word arrives after the last TX word has left the shifter
+   while (!(DMA2->LISR & SSP_FPGA_DMA_FLAG_RX_TC)) {
+      if (DMA2->LISR & SSP_FPGA_DMA_FLAG_ERR) {
+         rc = HAL_ERROR;
+         break;
+      }
+      if (HAL_GetTick() - t0 > SSP_DMA_TIMEOUT_MS) {
+         rc = HAL_TIMEOUT;
+         break;
+      }
+   }
+   CLEAR_BIT(spi->CR2, SPI_CR2_RXDMAEN | SPI_CR2_TXDMAEN);
+   CLEAR_BIT(SSP_FPGA_DMA_TX_STREAM->CR, DMA_SxCR_EN);
+   CLEAR_BIT(SSP_FPGA_DMA_RX_STREAM->CR, DMA_SxCR_EN);
+   while ((SSP_FPGA_DMA_TX_STREAM->CR | SSP_FPGA_DMA_RX_STREAM->CR) & DMA_SxCR_EN);
+   DMA2->LIFCR = SSP_FPGA_DMA_FLAG_ALL;
+   return rc;
+}
+
 /************
 * MDIO to PHY
 ************/
@@ -846,6 +1090,21 @@ uint32_t marble_get_tick(void) {
   return (uint32_t)HAL_GetTick();
 }
 
+/*
+ * uint32_t marble_get_us(void);
+ *  HAL tick (ms) extended with the SysTick down-counter for sub-ms
+ *  resolution.  Re-reads if the tick advanced mid-sample.
+ */
+uint32_t marble_get_us(void) {
+   uint32_t ms, val;
+   do {
+      ms = HAL_GetTick();
+      val = SysTick->VAL;
+   } while (ms != HAL_GetTick());
+   uint32_t load = SysTick->LOAD + 1;
+   return ms*1000U + ((load - val)*1000U)/load;
+}
+
 /* Register user-defined interrupt handlers */
 void marble_SYSTIMER_handler(void (*handler)(void)) {
    marble_SysTick_Handler = handler;
@@ -1107,6 +1366,10 @@ static void MX_I2C1_Init(void)
    if (HAL_I2C_Init(&hi2c1) != HAL_OK) {
       Error_Handler();
    }
+   HAL_NVIC_SetPriority(I2C1_EV_IRQn, 1, 0);
+   HAL_NVIC_EnableIRQ(I2C1_EV_IRQn);
+   HAL_NVIC_SetPriority(I2C1_ER_IRQn, 1, 0);
+   HAL_NVIC_EnableIRQ(I2C1_ER_IRQn);
    I2C_FPGA = &hi2c1;  // set global
 }
 
@@ -1125,6 +1388,10 @@ static void MX_I2C3_Init(void)
    {
       Error_Handler();
    }
+   HAL_NVIC_SetPriority(I2C3_EV_IRQn, 1, 0);
+   HAL_NVIC_EnableIRQ(I2C3_EV_IRQn);
+   HAL_NVIC_SetPriority(I2C3_ER_IRQn, 1, 0);
+   HAL_NVIC_EnableIRQ(I2C3_ER_IRQn);
    I2C_PM = &hi2c3;  // set global
 }
 
@@ -1147,6 +1414,22 @@ static void MX_SPI1_Init(void)
       Error_Handler();
    }
    SSP_FPGA = &hspi1;
+   SSP_FPGA_DMA_Init();
+}
+
+/* Stream addresses are fixed; memory address, length and direction-specific
+ * bits are filled in per burst by SSP_FPGA_DMA_xfer() */
+static void SSP_FPGA_DMA_Init(void)
+{
+   __HAL_RCC_DMA2_CLK_ENABLE();
+   CLEAR_BIT(SSP_FPGA_DMA_RX_STREAM->CR, DMA_SxCR_EN);
+   CLEAR_BIT(SSP_FPGA_DMA_TX_STREAM->CR, DMA_SxCR_EN);
+   while ((SSP_FPGA_DMA_TX_STREAM->CR | SSP_FPGA_DMA_RX_STREAM->CR) & DMA_SxCR_EN);
+   SSP_FPGA_DMA_RX_STREAM->PAR = (uint32_t)&hspi1.Instance->DR;
+   SSP_FPGA_DMA_TX_STREAM->PAR = (uint32_t)&hspi1.Instance->DR;
+   SSP_FPGA_DMA_RX_STREAM->FCR = 0;
+   SSP_FPGA_DMA_TX_STREAM->FCR = 0;
+   DMA2->LIFCR = SSP_FPGA_DMA_FLAG_ALL;
 }
 
 static void MX_SPI2_Init(void)
@@ -1216,8 +1499,30 @@ static void CONSOLE_USART_Init(void) {
   {
      Error_Handler();
   }
-  // Enable RXNE, TXE interrupts
+  // Enable RXNE interrupt; TX is driven by DMA
   SET_BIT(CONSOLE_USART->CR1, USART_CR1_RXNEIE);
+  CONSOLE_DMA_Init();
+  return;
+}
+
+/* Memory-to-peripheral, byte-wide, direct mode; buffer address and length
+ * are filled in per burst by USART_DMA_Next() */
+static void CONSOLE_DMA_Init(void) {
+  CONSOLE_DMA_CLK_ENABLE();
+  CLEAR_BIT(CONSOLE_DMA_STREAM->CR, DMA_SxCR_EN);
+  while (CONSOLE_DMA_STREAM->CR & DMA_SxCR_EN);
+  CONSOLE_DMA_STREAM->PAR = (uint32_t)&CONSOLE_USART->DR;
+  CONSOLE_DMA_STREAM->CR = (CONSOLE_DMA_CHANNEL << DMA_SxCR_CHSEL_Pos) | DMA_SxCR_MINC
+                           | DMA_SxCR_DIR_0 | DMA_SxCR_TCIE | DMA_SxCR_TEIE;
+  CONSOLE_DMA_STREAM->FCR = 0;
+  CONSOLE_DMA_IFCR = CONSOLE_DMA_FLAG_ALL;
+  uart_dma_len[0] = 0;
+  uart_dma_len[1] = 0;
+  uart_dma_busy = 0;
+  // Same priority as the console USART IRQ so neither preempts the other
+  HAL_NVIC_SetPriority(CONSOLE_DMA_IRQn, 0, 0);
+  HAL_NVIC_EnableIRQ(CONSOLE_DMA_IRQn);
+  SET_BIT(CONSOLE_USART->CR3, USART_CR3_DMAT);
   return;
 }
 
@@ -1307,7 +1612,7 @@ static void MX_GPIO_Init(void)
    GPIO_InitStruct.Pull = GPIO_NOPULL;
    HAL_GPIO_Init(GPIOA, &GPIO_InitStruct);
 
-   /*Configure GPIO pin : PA3 - FPGA_INT (just an input for now; not an interrupt) */
+   /*Configure GPIO pin : PA3 - FPGA_INT (input until marble_FPGAint_handler()) */
    GPIO_InitStruct.Pin = GPIO_PIN_3;
    GPIO_InitStruct.Mode = GPIO_MODE_INPUT;
    GPIO_InitStruct.Pull = GPIO_NOPULL;
@@ -10,19 +10,43 @@
 #include "marble_api.h"
 #include "flash.h"
 #include "stm32f2xx_hal.h"
+#include "stm32f2xx_it.h"
+#include "uart_fifo.h"
 
 //#define DEBUG_PRINT
 #include "dbg.h"
 #undef DEBUG_PRINT
 
 #define FLASH_ERROR_TIMEOUT       0xFFFFFF
+// Console bytes kept while an erase runs; any beyond are reported lost
+#define ERASE_RX_HOLD             (256)
+
+// Copied to RAM with .data by the startup code (see the linker script)
+#define RAMFUNC __attribute__((section(".RamFunc"), noinline))
+
+// What happened while an erase held the CPU in RAM
+typedef struct {
+  uint32_t ticks;               // SysTick periods elapsed
+  unsigned nrx;                 // Console bytes received ...
+  unsigned rx_lost;             // ... and those which did not fit
+  uint8_t rx[ERASE_RX_HOLD];
+} erase_hold_t;
 
 static int fmc_flash_unlock(volatile FLASH_TypeDef * const hw);
 static void fmc_flash_lock(volatile FLASH_TypeDef * const hw);
 static int fmc_flash_wait_idle(volatile FLASH_TypeDef * const hw);
+static int fmc_flash_erase_setup(volatile FLASH_TypeDef * const hw, unsigned sectorn);
+static int fmc_flash_erase_run(volatile FLASH_TypeDef * const hw);
+static void fmc_flash_erase_hold(volatile FLASH_TypeDef * const hw, erase_hold_t *hold) RAMFUNC;
+
+// Nonzero when an fmc_flash_erase_start() erase has a result to collect
+static volatile int erase_pending = 0;
+static int erase_result = 0;
+static erase_hold_t erase_hold;
 
 int fmc_flash_init(void) {
-  // TODO anything?
+  // For fmc_crc32()
+  __HAL_RCC_CRC_CLK_ENABLE();
   return 0;
 }
 
@@ -141,9 +165,11 @@ done:
   return ret;
 }
 
-int fmc_flash_erase_sector(unsigned sectorn)
+/* Unlock and program CR for a sector erase, short of setting STRT.
+ * On failure the controller is left locked.
+ */
+static int fmc_flash_erase_setup(volatile FLASH_TypeDef * const hw, unsigned sectorn)
 {
-  volatile FLASH_TypeDef * const hw = FLASH; /* see "stm32f207xx.h" */
   uint8_t psize = 0;
   unsigned maxn = FLASH_CR_SNB_GET(0xffffffff);
 
@@ -164,7 +190,8 @@ int fmc_flash_erase_sector(unsigned sectorn)
   }
 
   if(!!(ret = fmc_flash_wait_idle(hw))) {
-    goto done;
+    fmc_flash_lock(hw);
+    return ret;
   }
 
   hw->SR |=FLASH_SR_OPERR|FLASH_SR_PGAERR|FLASH_SR_PGPERR|FLASH_SR_PGSERR;
@@ -175,14 +202,96 @@ int fmc_flash_erase_sector(unsigned sectorn)
   cr |= FLASH_CR_SER;
   cr &= ~(FLASH_CR_PG|FLASH_CR_MER);
   hw->CR = cr;
+  return 0;
+}
+
+/* The flash has a single bank, and any read of it (instruction fetch and
+ * vector fetch included) stalls until an erase completes.  So the erase
+ * is started and waited on from RAM with interrupts masked, keeping what
+ * their handlers would have lost: elapsed SysTick periods and console
+ * input.  Once it is done, SysTick_Handler() is run once per period and
+ * the console bytes are handed on, in order, before interrupts are
+ * unmasked.  Other interrupts stay pending until then.
+ * Leaves the controller locked.
+ */
+static int fmc_flash_erase_run(volatile FLASH_TypeDef * const hw)
+{
   INTERRUPTS_DISABLE();
+  erase_hold.ticks = 0;
+  erase_hold.nrx = 0;
+  erase_hold.rx_lost = 0;
+  fmc_flash_erase_hold(hw, &erase_hold);
+
+  int ret = fmc_flash_wait_idle(hw);  // collects the error flags
+  for(uint32_t n = 0; n < erase_hold.ticks; n++) {
+    SysTick_Handler();
+  }
+  for(unsigned n = 0; n < erase_hold.nrx; n++) {
+    marble_UART_rx_char(erase_hold.rx[n]);
+  }
+  if(erase_hold.rx_lost) {
+    UARTQUEUE_SetDataLost(UART_DATA_LOST);
+  }
+  fmc_flash_lock(hw);  // calls INTERRUPTS_ENABLE();
+  return ret;
+}
+
+/* Runs from RAM: no calls, and nothing read from flash until BSY clears */
+static void fmc_flash_erase_hold(volatile FLASH_TypeDef * const hw, erase_hold_t *hold)
+{
+  USART_TypeDef * const usart = CONSOLE_USART;
   hw->CR |= FLASH_CR_STRT;
+  while(hw->SR & FLASH_SR_BSY) {
+    if(SCB->ICSR & SCB_ICSR_PENDSTSET_Msk) {
+      SCB->ICSR = SCB_ICSR_PENDSTCLR_Msk;
+      hold->ticks++;
+    }
+    if(usart->SR & USART_SR_RXNE) {
+      uint8_t c = (uint8_t)(usart->DR & 0xff);  // clears RXNE
+      if(hold->nrx < ERASE_RX_HOLD) {
+        hold->rx[hold->nrx++] = c;
+      } else {
+        hold->rx_lost++;
+      }
+    }
+  }
+}
 
-  ret = fmc_flash_wait_idle(hw);
+int fmc_flash_erase_sector(unsigned sectorn)
+{
+  volatile FLASH_TypeDef * const hw = FLASH; /* see "stm32f207xx.h" */
 
-done:
-  fmc_flash_lock(hw);  // calls INTERRUPTS_ENABLE();
-  return ret;
+  int ret = fmc_flash_erase_setup(hw, sectorn);
+  if(ret) {
+    return ret;
+  }
+  return fmc_flash_erase_run(hw);
+}
+
+int fmc_flash_erase_start(unsigned sectorn)
+{
+  volatile FLASH_TypeDef * const hw = FLASH; /* see "stm32f207xx.h" */
+
+  if(erase_pending) {
+    return -EBUSY;
+  }
+  int ret = fmc_flash_erase_setup(hw, sectorn);
+  if(ret) {
+    return ret;
+  }
+  // Complete on return; see fmc_flash_erase_run()
+  erase_result = fmc_flash_erase_run(hw);
+  erase_pending = 1;
+  return 0;
+}
+
+int fmc_flash_erase_poll(void)
+{
+  if(!erase_pending) {
+    return 0;
+  }
+  erase_pending = 0;
+  return erase_result;
 }
 
 void fmc_flash_cache_flush_all(void)
@@ -213,3 +322,12 @@ int restore_flash(void) {
   return 0;
 }
 
+uint32_t fmc_crc32(const uint32_t *pword, size_t nwords, int reset)
+{
+  if(reset)
+      CRC->CR = CRC_CR_RESET;
+  while(nwords--)
+      CRC->DR = *pword++;
+  return CRC->DR;
+}
+
@@ -9,8 +9,10 @@
 #include "flash.h"
 #include "st-eeprom.h"
 
-ee_frame eeprom0_base;    // Should be defined in linker file when implemented
-ee_frame eeprom1_base;    // Should be defined in linker file when implemented
+// Should be defined in linker file when implemented
+uint32_t eeprom0_base[4];
+uint32_t eeprom1_base[4];
+uint32_t eeprom2_base[4];
 
 int fmc_flash_init(void) {
   return 0;
@@ -28,6 +30,15 @@ int fmc_flash_erase_sector(unsigned sectorn) {
   return 0;
 }
 
+int fmc_flash_erase_start(unsigned sectorn) {
+  _UNUSED(sectorn);
+  return 0;
+}
+
+int fmc_flash_erase_poll(void) {
+  return 0;
+}
+
 void fmc_flash_cache_flush_all(void) {
   return;
 }
@@ -33,6 +33,7 @@
 #include "chip.h"
 #include "stopwatch.h"
 #include "marble_api.h"
+#include "i2c_xact.h"
 #include "string.h"
 #include <stdio.h>
 
@@ -58,6 +59,7 @@ I2C_BUS I2C_IPMB;
  */
 int board_service(void) {
    // TODO - Any board-specific maintenance for the main loop
+   i2c_xact_service();
    return 0;
 }
 
@@ -128,6 +130,12 @@ int marble_UART_send(const char *str, int size)
    return sent;
 }
 
+/* TX goes through the LPCOpen ring buffer; no burst accounting here */
+void marble_UART_get_tx_stats(uart_tx_stats_t *stats)
+{
+   memset(stats, 0, sizeof(*stats));
+}
+
 /* Read at most size-1 bytes (due to \0) from UART. Returns bytes read */
 int marble_UART_recv(char *str, int size)
 {
@@ -306,8 +314,10 @@ void disable_fpga(void) {
 * GPIO interrupt setup and user-defined handlers
 ************/
 const uint8_t FPGA_DONE_INT_PIN = 5;
+const uint8_t FPGA_INT_PIN = 19;
 void FPGA_DONE_dummy(void) {}
 void (*volatile marble_FPGA_DONE_handler)(void) = FPGA_DONE_dummy;
+void (*volatile marble_FPGA_INT_handler)(void) = FPGA_DONE_dummy;
 
 // Override default (weak) IRQHandler
 void GPIO_IRQHandler(void)
@@ -321,6 +331,11 @@ void GPIO_IRQHandler(void)
          marble_FPGA_DONE_handler();
       }
    }
+   /* FPGA_INT P0[19] */
+   if ((gpioint_rs & (1 << FPGA_INT_PIN)) != 0) {
+      Chip_GPIOINT_ClearIntStatus(LPC_GPIOINT, GPIOINT_PORT0, 1 << FPGA_INT_PIN);
+      marble_FPGA_INT_handler();
+   }
 }
 
 void marble_GPIOint_init(void)
@@ -340,6 +355,15 @@ void marble_GPIOint_handlers(void (*FPGA_DONE_handler)(void)) {
    marble_FPGA_DONE_handler = FPGA_DONE_handler;
 }
 
+/* Register the FPGA_INT handler and enable the interrupt */
+void marble_FPGAint_handler(void (*FPGA_INT_handler)(void)) {
+   marble_FPGA_INT_handler = FPGA_INT_handler;
+   /* FPGA_INT P0[19]; asserted high, see marble_FPGAint_get() */
+   Chip_GPIO_WriteDirBit(LPC_GPIO, GPIOINT_PORT0, FPGA_INT_PIN, false);
+   Chip_GPIOINT_SetIntRising(LPC_GPIOINT, GPIOINT_PORT0,
+         Chip_GPIOINT_GetIntRising(LPC_GPIOINT, GPIOINT_PORT0) | (1 << FPGA_INT_PIN));
+}
+
 /************
 * MGT Multiplexer (NO-OP for API compatibility with marble v2)
 ************/
@@ -503,6 +527,41 @@ int marble_I2C_cmdrecv_a2(I2C_BUS I2C_bus, uint8_t addr, uint16_t cmd, uint8_t *
    return xfer.rxSz != 0;
 }
 
+/* Backend for i2c_xact.c; the LPC transfers are polled, so each one
+ * completes before marble_I2C_xact_start() returns. */
+int marble_I2C_xact_start(i2c_xact_t *x) {
+   int rc;
+   if (x->rnw) {
+      if (x->cmd_len == 2) {
+         rc = marble_I2C_cmdrecv_a2(x->bus, x->addr, (uint16_t)x->cmd, x->data, x->len);
+      } else if (x->cmd_len == 1) {
+         rc = marble_I2C_cmdrecv(x->bus, x->addr, (uint8_t)x->cmd, x->data, x->len);
+      } else {
+         rc = marble_I2C_recv(x->bus, x->addr, x->data, x->len);
+      }
+   } else {
+      if (x->cmd_len == 2) {
+         rc = marble_I2C_cmdsend_a2(x->bus, x->addr, (uint16_t)x->cmd, x->data, x->len);
+      } else if (x->cmd_len == 1) {
+         rc = marble_I2C_cmdsend(x->bus, x->addr, (uint8_t)x->cmd, x->data, x->len);
+      } else {
+         rc = marble_I2C_send(x->bus, x->addr, x->data, x->len);
+      }
+   }
+   i2c_xact_complete(x, rc ? I2C_XACT_ERROR : I2C_XACT_OK);
+   return I2C_XACT_OK;
+}
+
+void marble_I2C_xact_abort(I2C_BUS I2C_bus) {
+   (void) I2C_bus;
+   return;
+}
+
+void marble_I2C_xact_hook(const i2c_xact_t *x) {
+   (void) x;
+   return;
+}
+
 int getI2CBusStatus(void) {
   // TODO - Implement
   return 0;
@@ -632,6 +691,10 @@ uint32_t marble_get_tick(void) {
   return _systick;
 }
 
+uint32_t marble_get_us(void) {
+  return _systick*1000U;
+}
+
 /* Register user-defined interrupt handlers */
 void marble_SYSTIMER_handler(void (*handler)(void)) {
    marble_SysTick_Handler = handler;
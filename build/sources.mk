@@ -1,11 +1,13 @@
 SOURCES += $(SOURCE_DIR)/i2c_pm.c \
 $(SOURCE_DIR)/i2c_fpga.c \
+$(SOURCE_DIR)/i2c_xact.c \
 $(SOURCE_DIR)/mailbox.c \
 $(SOURCE_DIR)/phy_mdio.c \
 $(SOURCE_DIR)/hexrec.c \
 $(SOURCE_DIR)/syscalls.c \
 $(SOURCE_DIR)/main.c \
 $(SOURCE_DIR)/uart_fifo.c \
+$(SOURCE_DIR)/spsc_ring.c \
 $(SOURCE_DIR)/console.c \
 $(SOURCE_DIR)/st-eeprom.c \
 $(SOURCE_DIR)/pmbus.c \
@@ -13,3 +15,5 @@ $(SOURCE_DIR)/ltm4673.c \
 $(SOURCE_DIR)/watchdog.c \
 $(SOURCE_DIR)/refsip.c \
 $(SOURCE_DIR)/system.c \
+$(SOURCE_DIR)/task_sched.c \
+$(SOURCE_DIR)/telem.c \
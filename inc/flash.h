@@ -77,6 +77,31 @@ int fmc_flash_program(void *paddr, const void *pvalue, size_t count);
  */
 int fmc_flash_erase_sector(unsigned sectorn);
 
+/** @brief Start erasing a FLASH sector without waiting for it
+ * @param sectorn Sector index
+ * @return 0 if started, or -errno
+ *
+ * Poll fmc_flash_erase_poll() until it stops returning -EBUSY.  Other
+ * FLASH operations may fail with -EBUSY until then.
+ *
+ * The STM32F2 has a single FLASH bank, and any read of it (instruction
+ * fetch included) stalls until the erase completes, so there the erase is
+ * done before this returns: the CPU waits in RAM with interrupts masked,
+ * then catches up on the SysTick periods and console bytes it saw.  The
+ * main loop (mailbox, watchdog) still waits for the whole erase, around
+ * 1/4 s for a 16 KiB sector.  Only the simulation erases in the background.
+ *
+ * @note As for fmc_flash_erase_sector(), the caller must
+ *       fmc_flash_cache_flush_all() after the erase completes.
+ */
+int fmc_flash_erase_start(unsigned sectorn);
+
+/** @brief Check on an erase started by fmc_flash_erase_start()
+ * @return 0 when complete (or none was started), -EBUSY while in progress,
+ *         or -errno if the erase failed
+ */
+int fmc_flash_erase_poll(void);
+
 /** @brief Synchronize FLASH read cache after erase operations
  * @return
  */
@@ -84,6 +109,17 @@ void fmc_flash_cache_flush_all(void);
 
 int restore_flash(void);
 
+/** @brief CRC-32 of whole words with the STM32F2 CRC unit (marble_v2)
+ * @param pword Words to add
+ * @param nwords Number of words
+ * @param reset Nonzero to start over from 0xffffffff, else continue
+ * @return CRC of all words since the last reset
+ *
+ * Polynomial 0x04c11db7, each word taken MSB first, no final XOR.
+ * Other platforms use the software version in st-eeprom.c.
+ */
+uint32_t fmc_crc32(const uint32_t *pword, size_t nwords, int reset);
+
 #ifdef __cplusplus
 }
 #endif /* __cplusplus */
@@ -0,0 +1,83 @@
+/*
+ * File: i2c_xact.h
+ * Desc: Queued, non-blocking I2C transaction engine.  Callers submit
+ *       descriptors; the board backend drives them from interrupts and
+ *       i2c_xact_service() (thread mode) delivers completions, runs the
+ *       board's I2C hook and invokes the per-transaction callback.
+ */
+
+#ifndef I2C_XACT_H_
+#define I2C_XACT_H_
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+#include <stdint.h>
+#include "marble_api.h"
+
+#define I2C_XACT_MAX_BUSES      (2)
+#define I2C_XACT_TIMEOUT_MS  (1000)
+
+// Result codes; numerically identical to HAL_StatusTypeDef on the STM32
+#define I2C_XACT_OK             (0)
+#define I2C_XACT_ERROR          (1)
+#define I2C_XACT_BUSY           (2)
+#define I2C_XACT_TIMEOUT        (3)
+
+typedef enum {
+  I2C_XACT_IDLE = 0,        // Not submitted, or retired (rc valid)
+  I2C_XACT_QUEUED,
+  I2C_XACT_ACTIVE,
+  I2C_XACT_DONE             // Finished by the backend, not yet retired
+} i2c_xact_state_t;
+
+typedef struct i2c_xact i2c_xact_t;
+typedef void (*i2c_xact_cb_t)(i2c_xact_t *x);
+
+/* Descriptor memory belongs to the caller and must stay valid until the
+ * callback has run (or i2c_xact_wait() returned). */
+struct i2c_xact {
+  I2C_BUS bus;
+  uint8_t addr;             // 8-bit (not 7-bit) device address
+  uint8_t rnw;              // 0=Write, 1=Read
+  uint8_t cmd_len;          // Command/register bytes: 0, 1 or 2
+  int cmd;                  // -1 when cmd_len == 0
+  uint8_t *data;
+  int len;
+  i2c_xact_cb_t cb;         // Optional, thread mode
+  void *ctx;                // For the callback's use
+  // Owned by the engine
+  volatile int rc;
+  volatile i2c_xact_state_t state;
+  uint32_t t_start;
+  i2c_xact_t *next;
+};
+
+/* Fill in a descriptor.  'cmd' < 0 means no command byte(s). */
+void i2c_xact_init(i2c_xact_t *x, I2C_BUS bus, uint8_t addr, uint8_t rnw,
+                   int cmd, uint8_t cmd_len, uint8_t *data, int len,
+                   i2c_xact_cb_t cb, void *ctx);
+
+/* Queue 'x'.  Returns 0, or -1 if 'x' is already in flight or the bus
+ * table is full. */
+int i2c_xact_submit(i2c_xact_t *x);
+
+/* Called by the board backend (typically from an ISR) when the transfer
+ * started by marble_I2C_xact_start() finishes. */
+void i2c_xact_complete(i2c_xact_t *x, int rc);
+
+/* Call from the main loop. */
+void i2c_xact_service(void);
+
+/* Spin on i2c_xact_service() until 'x' is retired; returns x->rc. */
+int i2c_xact_wait(i2c_xact_t *x);
+
+/* Number of queued or active transactions on all buses. */
+int i2c_xact_pending(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* I2C_XACT_H_ */
@@ -140,9 +140,26 @@
 #define LTM4673_MFR_VIN_MIN                      (0xfc)
 #define LTM4673_MFR_TEMPERATURE_1_MIN            (0xfd)
 
+// Telemetry registers read by ltm4673_read_telem() on each page
+#define LTM4673_TELEM_NPAGES                     (4)
+#define LTM4673_TELEM_NREGS                      (22)
+
+typedef struct {
+  uint8_t reg;
+  const char *desc;
+} ltm4673_telem_t;
+
+extern const ltm4673_telem_t ltm4673_telem_table[LTM4673_TELEM_NREGS];
+
 void ltm4673_init(void);
 uint8_t ltm4673_get_page(void);
+int ltm4673_page_cached(uint8_t page);
+void ltm4673_page_invalidate(void);
+uint8_t ltm4673_first_page(void);
+int ltm4673_page_select(uint8_t dev, uint8_t page);
+int ltm4673_page_read(uint8_t dev, uint8_t page, uint8_t cmd, uint8_t *data, int len);
 void ltm4673_read_telem(uint8_t dev);
+void ltm4673_print_telem(const uint16_t telem[][LTM4673_TELEM_NREGS]);
 int ltm4673_ch_status(uint8_t dev);
 int ltm4673_apply_limits(uint16_t *xact, int len);
 int ltm4673_hook_read(uint8_t addr, int cmd, const uint8_t *data, int len);
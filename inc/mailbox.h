@@ -8,6 +8,30 @@
 #include "console.h"
 #include "mailbox_def.h"
 
+// Page holding DOORBELL/DOORBELL_ACK in inc/mbox.def
+#define MBOX_DOORBELL_PAGE                (9)
+
+// Update period limits and default adaptive floor (ms)
+#define MBOX_PERIOD_MIN_MS               (50)
+#define MBOX_PERIOD_MAX_MS            (10000)
+#define MBOX_PERIOD_FAST_MS             (100)
+
+// Layout of the non-volatile ee_mbox_period tag (MSB first):
+//   [0:1] period (ms): the fixed period, or the idle ceiling in adaptive mode
+//   [2:3] fast period (ms): the adaptive floor
+//   [4]   nonzero for adaptive mode
+#define MBOX_PERIOD_ASSEMBLE(data, period, fast, adaptive) \
+  do { \
+    (data)[0] = (uint8_t)(((period) >> 8) & 0xff); \
+    (data)[1] = (uint8_t)((period) & 0xff); \
+    (data)[2] = (uint8_t)(((fast) >> 8) & 0xff); \
+    (data)[3] = (uint8_t)((fast) & 0xff); \
+    (data)[4] = (uint8_t)((adaptive) ? 1 : 0); \
+  } while (0)
+#define MBOX_PERIOD_GET_PERIOD(data) (uint32_t)(((data)[0] << 8) | (data)[1])
+#define MBOX_PERIOD_GET_FAST(data) (uint32_t)(((data)[2] << 8) | (data)[3])
+#define MBOX_PERIOD_GET_ADAPTIVE(data) (int)((data)[4] != 0)
+
 #define MBOX_PRINT_PAGE(npage) do { \
   printf("Page %d\r\n", npage); \
   for (int n = 0; n < MB ## npage ## _SIZE; n++) { \
@@ -20,11 +44,20 @@ void mbox_enable(void);
 void mbox_disable(void);
 int mbox_get_enable(void);
 void mbox_set_enable(int enabled);
+void mbox_init(void);
 void mbox_update(bool verbose);
+int mbox_set_period(uint32_t period_ms, uint32_t fast_ms, int adaptive);
+uint32_t mbox_get_period(void);
+void mbox_print_period(void);
 uint16_t mbox_get_update_count(void);
 void mbox_reset_update_count(void);
 void mbox_read_page(uint8_t page_no, uint8_t page_sz, uint8_t *page);
 void mbox_write_page(uint8_t page_no, uint8_t page_sz, const uint8_t page[]);
+void mbox_write_page_changed(uint8_t page_no, uint8_t page_sz, const uint8_t page[], uint8_t shadow[]);
+void mbox_write_page_masked(uint8_t page_no, uint8_t page_sz, const uint8_t page[], uint16_t mask);
+int mbox_service_doorbell(void);
+void mbox_refresh(void);
+void mbox_print_stats(void);
 // The below write/read to/from the currently selected page
 void mbox_write_entry(uint8_t entry_no, uint8_t data);
 uint8_t mbox_read_entry(uint8_t entry_no);
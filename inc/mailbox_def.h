@@ -0,0 +1,221 @@
+/*
+ * File: mailbox_def.h
+ * Desc: Header file for inc/mailbox_def. Auto-generated by scripts/mkmbox.py.
+ */
+
+#ifndef __MAILBOX_DEF_H_
+#define __MAILBOX_DEF_H_
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+/* ============= DO NOT EDIT THIS AUTO-GENERATED FILE DIRECTLY ============== */
+/* ============== Define mailbox structure in scripts/mbox.def ============== */
+
+typedef enum {
+  MB2_FMC_MGT_CTL,
+  MB2_SIZE // 1
+} PAGE2_ENUM;
+
+typedef enum {
+  MB3_COUNT_1,
+  MB3_COUNT_0,
+  MB3_PAD2,
+  MB3_PAD3,
+  MB3_LM75_0_1,
+  MB3_LM75_0_0,
+  MB3_LM75_1_1,
+  MB3_LM75_1_0,
+  MB3_FMC_ST,
+  MB3_PWR_ST,
+  MB3_MGTMUX_ST,
+  MB3_PAD11,
+  MB3_GIT32_3,
+  MB3_GIT32_2,
+  MB3_GIT32_1,
+  MB3_GIT32_0,
+  MB3_SIZE // 16
+} PAGE3_ENUM;
+
+typedef enum {
+  MB4_MAX_T1_HI,
+  MB4_MAX_T1_LO,
+  MB4_MAX_T2_HI,
+  MB4_MAX_T2_LO,
+  MB4_MAX_F1_TACH,
+  MB4_MAX_F2_TACH,
+  MB4_MAX_F1_DUTY,
+  MB4_MAX_F2_DUTY,
+  MB4_PCB_REV,
+  MB4_PAD11,
+  MB4_COUNT_1,
+  MB4_COUNT_0,
+  MB4_HASH_3,
+  MB4_HASH_2,
+  MB4_HASH_1,
+  MB4_HASH_0,
+  MB4_SIZE // 16
+} PAGE4_ENUM;
+
+typedef enum {
+  MB5_I2C_BUS_STATUS,
+  MB5_SIZE // 1
+} PAGE5_ENUM;
+
+typedef enum {
+  MB6_FSYNTH_I2C_ADDR,
+  MB6_FSYNTH_CONFIG,
+  MB6_FSYNTH_FREQ_3,
+  MB6_FSYNTH_FREQ_2,
+  MB6_FSYNTH_FREQ_1,
+  MB6_FSYNTH_FREQ_0,
+  MB6_SIZE // 6
+} PAGE6_ENUM;
+
+typedef enum {
+  MB7_WD_NONCE_7,
+  MB7_WD_NONCE_6,
+  MB7_WD_NONCE_5,
+  MB7_WD_NONCE_4,
+  MB7_WD_NONCE_3,
+  MB7_WD_NONCE_2,
+  MB7_WD_NONCE_1,
+  MB7_WD_NONCE_0,
+  MB7_SIZE // 8
+} PAGE7_ENUM;
+
+typedef enum {
+  MB8_WD_HASH_7,
+  MB8_WD_HASH_6,
+  MB8_WD_HASH_5,
+  MB8_WD_HASH_4,
+  MB8_WD_HASH_3,
+  MB8_WD_HASH_2,
+  MB8_WD_HASH_1,
+  MB8_WD_HASH_0,
+  MB8_SIZE // 8
+} PAGE8_ENUM;
+
+typedef enum {
+  MB9_DOORBELL_1,
+  MB9_DOORBELL_0,
+  MB9_DOORBELL_ACK_1,
+  MB9_DOORBELL_ACK_0,
+  MB9_SIZE // 4
+} PAGE9_ENUM;
+
+typedef enum {
+  MB10_VOUT_1,
+  MB10_VOUT_0,
+  MB10_VOUT_MIN_1,
+  MB10_VOUT_MIN_0,
+  MB10_VOUT_MAX_1,
+  MB10_VOUT_MAX_0,
+  MB10_IOUT_1,
+  MB10_IOUT_0,
+  MB10_IOUT_MIN_1,
+  MB10_IOUT_MIN_0,
+  MB10_IOUT_MAX_1,
+  MB10_IOUT_MAX_0,
+  MB10_TEMP_1,
+  MB10_TEMP_0,
+  MB10_TEMP_MAX_1,
+  MB10_TEMP_MAX_0,
+  MB10_SIZE // 16
+} PAGE10_ENUM;
+
+typedef enum {
+  MB11_VOUT_1,
+  MB11_VOUT_0,
+  MB11_VOUT_MIN_1,
+  MB11_VOUT_MIN_0,
+  MB11_VOUT_MAX_1,
+  MB11_VOUT_MAX_0,
+  MB11_IOUT_1,
+  MB11_IOUT_0,
+  MB11_IOUT_MIN_1,
+  MB11_IOUT_MIN_0,
+  MB11_IOUT_MAX_1,
+  MB11_IOUT_MAX_0,
+  MB11_TEMP_1,
+  MB11_TEMP_0,
+  MB11_TEMP_MAX_1,
+  MB11_TEMP_MAX_0,
+  MB11_SIZE // 16
+} PAGE11_ENUM;
+
+typedef enum {
+  MB12_VOUT_1,
+  MB12_VOUT_0,
+  MB12_VOUT_MIN_1,
+  MB12_VOUT_MIN_0,
+  MB12_VOUT_MAX_1,
+  MB12_VOUT_MAX_0,
+  MB12_IOUT_1,
+  MB12_IOUT_0,
+  MB12_IOUT_MIN_1,
+  MB12_IOUT_MIN_0,
+  MB12_IOUT_MAX_1,
+  MB12_IOUT_MAX_0,
+  MB12_TEMP_1,
+  MB12_TEMP_0,
+  MB12_TEMP_MAX_1,
+  MB12_TEMP_MAX_0,
+  MB12_SIZE // 16
+} PAGE12_ENUM;
+
+typedef enum {
+  MB13_VOUT_1,
+  MB13_VOUT_0,
+  MB13_VOUT_MIN_1,
+  MB13_VOUT_MIN_0,
+  MB13_VOUT_MAX_1,
+  MB13_VOUT_MAX_0,
+  MB13_IOUT_1,
+  MB13_IOUT_0,
+  MB13_IOUT_MIN_1,
+  MB13_IOUT_MIN_0,
+  MB13_IOUT_MAX_1,
+  MB13_IOUT_MAX_0,
+  MB13_TEMP_1,
+  MB13_TEMP_0,
+  MB13_TEMP_MAX_1,
+  MB13_TEMP_MAX_0,
+  MB13_SIZE // 16
+} PAGE13_ENUM;
+
+typedef enum {
+  MB14_VIN_1,
+  MB14_VIN_0,
+  MB14_VIN_MIN_1,
+  MB14_VIN_MIN_0,
+  MB14_VIN_MAX_1,
+  MB14_VIN_MAX_0,
+  MB14_RAIL_NSAMP,
+  MB14_PAD7,
+  MB14_RAIL_SEQ_1,
+  MB14_RAIL_SEQ_0,
+  MB14_SIZE // 10
+} PAGE14_ENUM;
+
+
+// Pages below 32 with inputs (bit n = page n)
+#define MAILBOX_INPUT_PAGES (0x324)
+
+// Pages below 32 whose input changes count as activity (bit n = page n)
+#define MAILBOX_ACTIVITY_PAGES (0x24)
+
+uint32_t mailbox_get_hash(void);
+void mailbox_update_input(void);
+void mailbox_update_output(void);
+int mailbox_update_input_page(uint8_t npage);
+int mailbox_update_output_page(uint8_t npage);
+void mailbox_read_print_all(void);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __MAILBOX_DEF_H_ */
@@ -22,11 +22,10 @@ extern "C" {
 #include <time.h>
 
 #define SIM_FLASH_FILENAME                           "flash.bin"
-#define FLASH_SECTOR_SIZE                                  (256)
-#define EEPROM_COUNT ((size_t)FLASH_SECTOR_SIZE/sizeof(ee_frame))
+#define FLASH_SECTOR_SIZE                                 (4096)
 
 #define DEMO_STRING                 "Marble UART Simulation\r\n"
-#define BSP_GET_SYSTICK()     (uint32_t)((uint64_t)clock()/40)
+#define BSP_GET_SYSTICK()     marble_get_tick()
 
 # define MGT_MAX_PINS 0
 #else
@@ -97,7 +96,7 @@ extern "C" {
 #define BOARD_TYPE_MARBLE           (0x10)
 #define BOARD_TYPE_MARBLE_MINI      (0x20)
 
-// FPGA pseudo-SPI mailbox update period (in ms)
+// Default FPGA pseudo-SPI mailbox update period (in ms); see mbox_set_period()
 #define SPI_MAILBOX_PERIOD_MS       (2000)
 
 // Enum for identifying Marble PCB revisions
@@ -143,20 +142,36 @@ void print_status_counters(void);
 
 uint32_t marble_get_tick(void);
 
+// Free-running microsecond counter (wraps at 2^32) for interval measurement
+uint32_t marble_get_us(void);
+
 // Only used in simulation
 void cleanup(void);
 
 /****
 * UART
 ****/
+// Console TX accounting. A burst is one DMA transfer on hardware or one
+// service pass in simulation.
+typedef struct {
+  uint32_t bursts;
+  uint32_t bytes;
+  uint32_t max_burst;
+} uart_tx_stats_t;
+
 void marble_UART_init(void);
 
 int marble_UART_send(const char *str, int size);
 
+void marble_UART_get_tx_stats(uart_tx_stats_t *stats);
+
 int marble_UART_recv(char *str, int size);
 
 void CONSOLE_USART_ISR(void);
 
+// Handle one received console byte as CONSOLE_USART_ISR() would
+void marble_UART_rx_char(uint8_t c);
+
 /****
 * LED
 ****/
@@ -229,6 +244,8 @@ int marble_SSP_exch16(SSP_PORT ssp, uint16_t *tx_buf, uint16_t *rx_buf, unsigned
 * GPIO user-defined handlers
 ************/
 void marble_GPIOint_handlers(void (*FPGA_DONE_handler)(void));
+// Called (from interrupt context) when FPGA_INT asserts
+void marble_FPGAint_handler(void (*FPGA_INT_handler)(void));
 
 /************
 * MGT Multiplexer
@@ -272,6 +289,16 @@ int marble_I2C_cmdrecv_a2(I2C_BUS I2C_bus, uint8_t addr, uint16_t cmd, uint8_t *
 int getI2CBusStatus(void);
 void resetI2CBusStatus(void);
 
+// Backend for the queued transaction engine in i2c_xact.c
+struct i2c_xact;
+/* Start the transfer described by 'x' and call i2c_xact_complete() when it
+ * finishes (from any context).  A non-zero return means it never started. */
+int marble_I2C_xact_start(struct i2c_xact *x);
+/* Recover the bus after a transfer timed out; no completion may follow. */
+void marble_I2C_xact_abort(I2C_BUS I2C_bus);
+/* Side effects of a successful transfer; runs in thread mode. */
+void marble_I2C_xact_hook(const struct i2c_xact *x);
+
 /************
 * Freq. Synthesizer (si570)
 ************/
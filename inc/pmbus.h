@@ -277,6 +277,21 @@ int l16_to_uv_int(uint16_t l);
 float l16_to_uv_float(uint16_t l);
 double l16_to_uv_double(uint16_t l);
 
+// ========================== Fixed-point Conversion ==========================
+/* Integer-only codec in milli-units (mV, mA, mW, m-degC), for code that runs
+ * on the target: no float or double arithmetic, no loops over the exponent.
+ * Decoding rounds to the nearest milli-unit (halves round up) and saturates
+ * at INT32_MIN/INT32_MAX.  Encoding truncates the mantissa toward zero, as
+ * V_TO_L11()/V_TO_L16() in scripts/ltm4673.py do, and uses the smallest
+ * exponent that holds the value.  L16 uses _L16_EXPONENT and clips to
+ * 0..0xffff.  tests/pmbus checks all four against scripts/ltm4673.py; the
+ * firmware itself only decodes so far (telem.c, ltm4673.c).
+ */
+int32_t l11_to_milli(uint16_t l);
+uint16_t milli_to_l11(int32_t milli);
+int32_t l16_to_milli(uint16_t l);
+uint16_t milli_to_l16(int32_t milli);
+
 #ifdef __cplusplus
 }
 #endif
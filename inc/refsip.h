@@ -5,9 +5,26 @@
 extern "C" {
 #endif
 
+#include <stdint.h>
+
+// SipHash state after mixing in the key; equivalent to the key itself
+typedef struct {
+    uint64_t v[4];
+} sip_key_t;
+
 void core_siphash(unsigned char *out, const unsigned char *in,
         unsigned long inlen, const unsigned char *k);
 
+// core_siphash() split in two, for repeated use of one key
+void sip_key_init(sip_key_t *ctx, const unsigned char *k);
+void siphash_keyed(unsigned char *out, const unsigned char *in,
+        unsigned long inlen, const sip_key_t *ctx);
+// Overwrite, in a way the compiler keeps
+void sip_key_clear(sip_key_t *ctx);
+
+// Compare 8-byte MACs in constant time; 0 if equal, else -1
+int sip_verify_8(const unsigned char *x, const unsigned char *y);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,71 @@
+/*  file: spsc_ring.h
+ *  Lock-free single-producer/single-consumer byte ring.
+ *
+ *  'head' is only written by the producer and 'tail' only by the consumer.
+ *  Both are free-running 32-bit counters; the fill level is (head - tail)
+ *  and the storage index is (counter & mask), so the ring never needs a
+ *  'full' flag and the ISR and thread mode never need to mask interrupts
+ *  to share one.  The storage size must be a power of two.
+ *
+ *  The producer may also retract bytes it pushed (spsc_ring_unpush()).
+ *  A pop first claims the bytes it is about to take, by publishing
+ *  'claim', and retraction stops there; 'unpushes' tells a pop that
+ *  bytes were retracted while it was making its claim.
+ */
+
+#ifndef __SPSC_RING_H
+#define __SPSC_RING_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// ================================= Includes ==================================
+#include <stdint.h>
+
+// ============================= Exported Typedefs =============================
+typedef struct {
+  uint32_t head;      // Written by the producer only
+  uint32_t tail;      // Written by the consumer only
+  uint32_t claim;     // Consumer: end of the bytes being popped (>= tail)
+  uint32_t unpushes;  // Producer: count of spsc_ring_unpush() calls
+  uint32_t mask;      // size - 1
+  uint32_t hwm;       // Highest fill level observed by the producer
+  uint8_t *buf;
+} spsc_ring_t;
+
+// ============================== Exported Macros ==============================
+#define SPSC_RING_IS_POW2(n)         (((n) != 0) && (((n) & ((n) - 1)) == 0))
+
+/* SPSC_RING_DEFINE(name, size);
+ *  Define a static ring 'name' with 'size' bytes of static storage.
+ *  Fails to compile if 'size' is not a power of two.
+ */
+#define SPSC_RING_DEFINE(name, size) \
+  typedef char name##_size_must_be_pow2[SPSC_RING_IS_POW2(size) ? 1 : -1]; \
+  static uint8_t name##_storage[size]; \
+  static spsc_ring_t name = {0, 0, 0, 0, (size) - 1, 0, name##_storage}
+
+// ======================= Exported Function Prototypes ========================
+int spsc_ring_init(spsc_ring_t *r, uint8_t *buf, uint32_t size);
+void spsc_ring_reset(spsc_ring_t *r);
+uint32_t spsc_ring_size(const spsc_ring_t *r);
+uint32_t spsc_ring_count(const spsc_ring_t *r);
+uint32_t spsc_ring_space(const spsc_ring_t *r);
+uint32_t spsc_ring_high_water(const spsc_ring_t *r);
+
+// Producer side
+int spsc_ring_push(spsc_ring_t *r, uint8_t c);
+uint32_t spsc_ring_push_n(spsc_ring_t *r, const uint8_t *src, uint32_t n);
+uint32_t spsc_ring_unpush(spsc_ring_t *r, uint32_t n);
+
+// Consumer side
+int spsc_ring_pop(spsc_ring_t *r, uint8_t *c);
+uint32_t spsc_ring_pop_n(spsc_ring_t *r, uint8_t *dst, uint32_t n);
+uint32_t spsc_ring_pop_until(spsc_ring_t *r, uint8_t *dst, uint8_t target, uint32_t n);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // __SPSC_RING_H
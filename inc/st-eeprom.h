@@ -9,13 +9,9 @@ extern "C" {
 #endif
 
 typedef uint8_t ee_tag_t;
-typedef uint8_t ee_val_t[6];
 
-typedef struct {
-    uint8_t tag;
-    uint8_t val[6];
-    uint8_t crc;
-} ee_frame;
+// Largest record payload (bytes)
+#define EE_VAL_MAX                  (512)
 
 // ==================== Non-Volatile Parameter Management =====================
 /* Usage Instructions:
@@ -27,7 +23,7 @@ typedef struct {
  *      enumval = integer (must be unique! Just increment the last number)
  *      name = name of tag (must be unique!)
  *      type = (currently unused; came from MDS's RTEMS version)
- *      size = size of datum in bytes (must be <= 6).
+ *      size = size of datum in bytes (must be <= EE_VAL_MAX).
  *      default = default value as array literal
  *
  *    The expansion of the X-macro here and in st-eeprom.c creates the support
@@ -49,8 +45,12 @@ typedef struct {
  *    passed at call time could still result in a runtime error but the source
  *    of the problem would be more obvious.
  *
+ *    Tag numbers 9-11 (wd_key_0..2, the old three-part watchdog key) are
+ *    retired; they are only read when importing a store written by older
+ *    firmware and must not be reused.
+ *
  * Type codes (currently unused - came from MDS's RTEMS version):
- *   raw - Between 0 -> 6 space separated hex digits
+ *   raw - Space separated hex digits
  *   mac - 6 semi-colon separated hex digits
  *   ip4 - 4 dot separated decimal digits
  */
@@ -65,10 +65,9 @@ typedef struct {
   X(6, mgt_mux,   raw, 1, {0}) \
   X(7, fsynth,    raw, 6, {0, 0, 0, 0, 0, 0}) \
   X(8, wd_period, raw, 1, {0}) \
-  X(9, wd_key_0,  raw, 6, {'s','u','p','e','r',' '}) \
-  X(10,wd_key_1,  raw, 6, {'s','e','c','r','e','t'}) \
-  X(11,wd_key_2,  raw, 4, {' ','k','e','y'}) \
-  X(12,mbox_en,   raw, 1, {1})
+  X(12,mbox_en,   raw, 1, {1}) \
+  X(13,mbox_period, raw, 5, {0x07, 0xd0, 0x00, 0x64, 0}) \
+  X(14,wd_key,    raw, 16, {'s','u','p','e','r',' ','s','e','c','r','e','t',' ','k','e','y'})
 
 typedef enum {
 #define X(N, NAME, TYPE, SIZE, ...)  ee_ ## NAME = N,
@@ -92,10 +91,6 @@ int eeprom_read_ ## NAME(volatile uint8_t *pdata, int len);
 FOR_ALL_EETAGS()
 #undef X
 
-/* Hand-written functions are required for entries > 6 bytes */
-int eeprom_read_wd_key(volatile uint8_t *pdata, int len);
-int eeprom_store_wd_key(const uint8_t *pdata, int len);
-
 /** @brief Initialize EEPROM interface to Flash memory
  *  @returns 0 on Success, or negative errno
  */
@@ -107,18 +102,79 @@ int eeprom_init(void);
 int fmc_ee_reset(void);
 
 /** @brief Read from EEPROM
- * @param tag Tag ID.  in range [0, 0xff] inclusive
+ * @param tag Tag ID.  in range [1, 0xfe] inclusive
  * @param val Read buffer
- * @return 0 on Success, -ENOENT if not found, other negative errno on error
+ * @param len Size of read buffer.  Longer records are truncated.
+ * @return Length of the stored record on Success, -ENOENT if not found,
+ *         other negative errno on error
+ */
+int fmc_ee_read(ee_tags_t tag, void *val, size_t len);
+
+/** @brief As fmc_ee_read(), but a value staged in an open batch (see
+ *  eeprom_begin()) is not seen until it is committed
  */
-int fmc_ee_read(ee_tags_t tag, ee_val_t val);
+int fmc_ee_read_stored(ee_tags_t tag, void *val, size_t len);
 
 /** @brief Write to EEPROM
- * @param tag Tag ID.  in range [1, 0xff] inclusive
+ * @param tag Tag ID.  in range [1, 0xfe] inclusive
  * @param val Write buffer
+ * @param len Record length, at most EE_VAL_MAX
  * @return 0 on Success, negative errno on error
  */
-int fmc_ee_write(ee_tags_t tag, const ee_val_t val);
+int fmc_ee_write(ee_tags_t tag, const void *val, size_t len);
+
+/** @brief Print sector usage and erase counts
+ */
+void eeprom_print_status(void);
+
+/** @brief Run one bounded slice of background flash maintenance
+ *  (collecting a full sector, then writing any queued values)
+ *  @returns Nonzero while work remains
+ */
+int eeprom_service(void);
+
+/** @brief Finish all background maintenance and queued writes now
+ *  @returns 0 on Success, or negative errno
+ */
+int eeprom_flush(void);
+
+/** @brief Register the scheduler task which calls eeprom_service()
+ */
+void eeprom_task_init(void);
+
+/** @brief Open a batch.  Until the matching eeprom_commit(), writes
+ *  (fmc_ee_write() and eeprom_store_NAME()) made in its scope are staged
+ *  in RAM, where reads also see them.  Repeated writes of a tag coalesce,
+ *  and writes which leave the stored value unchanged are dropped.
+ *  Batches nest; only the outermost commit writes.
+ *  The caller is in the batch's scope from here on, until it calls
+ *  eeprom_batch_leave(); writes made out of scope (by other code, such as
+ *  mailbox handlers) go to flash as usual.
+ */
+void eeprom_begin(void);
+
+/** @brief Number of batches open (nesting depth); 0 if none
+ */
+unsigned eeprom_batch_open(void);
+
+/** @brief Return to the scope of the open batch, if any
+ */
+void eeprom_batch_enter(void);
+
+/** @brief Leave the scope of the open batch, which stays open
+ */
+void eeprom_batch_leave(void);
+
+/** @brief Write the staged values as one atomic update: after power loss
+ *  either all or none of them are found.  Waits for any background
+ *  collection to finish first.
+ *  @returns 0 on Success, -EINVAL if no batch is open, or negative errno
+ */
+int eeprom_commit(void);
+
+/** @brief Discard the staged values and close all open batches
+ */
+void eeprom_abort(void);
 
 #ifdef __cplusplus
 }
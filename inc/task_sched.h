@@ -0,0 +1,57 @@
+/*
+ * File: task_sched.h
+ * Desc: Cooperative tick-based task scheduler.  Tasks run to completion from
+ *       sched_service() in thread mode; timing is in BSP_GET_SYSTICK() ms
+ *       with runtimes measured in marble_get_us() microseconds.
+ */
+
+#ifndef TASK_SCHED_H_
+#define TASK_SCHED_H_
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+#include <stdint.h>
+
+#define SCHED_MAX_TASKS         (12)
+
+// Lower value runs first when several tasks are due in the same pass
+#define SCHED_PRIO_HIGH         (0)
+#define SCHED_PRIO_NORMAL       (1)
+#define SCHED_PRIO_LOW          (2)
+
+typedef void (*sched_fn_t)(void);
+
+/* Register a periodic task, first due 'period_ms' from now.
+ * Returns a task id (>= 0) or -1 if the table is full. */
+int sched_add_periodic(const char *name, sched_fn_t fn, uint32_t period_ms, uint8_t prio);
+
+/* Register an idle one-shot task; use sched_arm() to schedule it.
+ * Returns a task id (>= 0) or -1 if the table is full. */
+int sched_add_oneshot(const char *name, sched_fn_t fn, uint8_t prio);
+
+/* (Re)schedule task 'id' to run once 'delay_ms' from now.  ISR-safe. */
+void sched_arm(int id, uint32_t delay_ms);
+
+/* Disarm task 'id' (one-shot or periodic). */
+void sched_cancel(int id);
+
+/* Change the period of periodic task 'id'; takes effect from now. */
+void sched_set_period(int id, uint32_t period_ms);
+
+/* Run every due task, in priority order.  Call from the main loop. */
+void sched_service(void);
+
+/* Milliseconds until the earliest armed task is due (0 if one is due now),
+ * or -1 if none is armed.  Lets an idle main loop sleep until then. */
+int32_t sched_next_due(void);
+
+void sched_print_stats(void);
+void sched_reset_stats(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* TASK_SCHED_H_ */
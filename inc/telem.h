@@ -0,0 +1,117 @@
+/*
+ * File: telem.h
+ * Desc: Background telemetry sampler.  Each sensor is swept on its own
+ *       scheduler task using non-blocking I2C transactions; completed sweeps
+ *       are published into a timestamped, double-buffered snapshot which the
+ *       mailbox and console read instead of going to the bus.
+ */
+
+#ifndef TELEM_H_
+#define TELEM_H_
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+#include <stdint.h>
+#include "i2c_pm.h"
+#include "ltm4673.h"
+
+typedef enum {
+  TELEM_LM75 = 0,
+  TELEM_MAX6639,
+  TELEM_LTM4673,
+  TELEM_NSRC
+} telem_src_t;
+
+// Default sweep periods
+#define TELEM_LM75_PERIOD_MS       (1000)
+#define TELEM_MAX6639_PERIOD_MS    (1000)
+#define TELEM_LTM4673_PERIOD_MS    (2000)
+
+#define TELEM_LM75_NDEV               (2)
+// Registers are cached by address; only those in the sampled list are kept
+#define TELEM_MAX6639_NREGS        (0x40)
+
+// MAX6639 registers sampled each sweep
+#define TELEM_MAX6639_FOR_EACH_REGISTER() \
+  X(MAX6639_TEMP_CH1) \
+  X(MAX6639_TEMP_EXT_CH1) \
+  X(MAX6639_TEMP_CH2) \
+  X(MAX6639_TEMP_EXT_CH2) \
+  X(MAX6639_STATUS) \
+  X(MAX6639_FAN1_TACH_CNT) \
+  X(MAX6639_FAN2_TACH_CNT) \
+  X(MAX6639_FAN1_DUTY) \
+  X(MAX6639_FAN2_DUTY)
+
+// Sweeps kept by the LTM4673 rail history; one minute at the default period
+#define TELEM_RAIL_DEPTH             (30)
+
+typedef enum {
+  TELEM_RAIL_VOUT = 0,            // READ_VOUT
+  TELEM_RAIL_IOUT,                // READ_IOUT
+  TELEM_RAIL_TEMP,                // READ_TEMPERATURE_1
+  TELEM_RAIL_VIN,                 // READ_VIN
+  TELEM_RAIL_NQ
+} telem_rail_q_t;
+
+typedef enum {
+  TELEM_STAT_LAST = 0,
+  TELEM_STAT_MIN,
+  TELEM_STAT_MAX,
+  TELEM_STAT_MEAN,
+  TELEM_NSTAT
+} telem_stat_t;
+
+typedef struct {
+  uint32_t seq;                   // Bumped on every publish
+  uint32_t stamp[TELEM_NSRC];     // BSP_GET_SYSTICK() at end of last good sweep
+  uint8_t valid[TELEM_NSRC];      // Nonzero once a sweep has completed
+  // LM75: TEMP/HYST/OS in units of 0.5 degC, CFG raw (as LM75_read())
+  int16_t lm75[TELEM_LM75_NDEV][LM75_MAX];
+  uint8_t max6639[TELEM_MAX6639_NREGS];
+  // Raw words in ltm4673_telem_table order
+  uint16_t ltm4673[LTM4673_TELEM_NPAGES][LTM4673_TELEM_NREGS];
+} telem_snapshot_t;
+
+/* Register the sampling tasks and start the first sweeps. */
+void telem_init(void);
+
+/* Change the sweep period of 'src'; takes effect from now. */
+void telem_set_period(telem_src_t src, uint32_t period_ms);
+
+/* Latest snapshot.  Stays intact until the next publish after the one that
+ * replaced it, which only happens from i2c_xact_service() (thread mode). */
+const telem_snapshot_t *telem_get(void);
+
+/* Cached equivalents of LM75_read() and get_max6639_reg()/return_max6639_reg().
+ * The rc forms return 0, or 1 if the value has not been sampled. */
+int telem_lm75_read(uint8_t dev, LM75_REG reg, int *data);
+int telem_max6639_read(int regno, int *value);
+int telem_max6639_reg(int regno);
+
+/* Nonzero if the snapshot shows a MAX6639 status flag (alert, overtemp,
+ * THERM or fan fault) or an LM75 at or above its OS limit. */
+int telem_alarm_active(void);
+
+/* Milliseconds since the last good sweep of 'src', or -1 if never. */
+int32_t telem_age(telem_src_t src);
+
+/* LTM4673 rail history: per channel (page), the last/min/max/mean of each
+ * quantity over the last TELEM_RAIL_DEPTH published sweeps.  Units are mV
+ * (VOUT, VIN), mA (IOUT) and 0.01 degC (TEMP), clipped to int16_t.
+ * telem_rail_get() returns 0 until the first sweep. */
+int telem_rail_get(int page, telem_rail_q_t q, telem_stat_t stat);
+/* Sweeps in the window, and sweeps logged since boot (wraps at 16 bits). */
+int telem_rail_count(void);
+int telem_rail_seq(void);
+void telem_rail_print(void);
+
+void telem_print_stats(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* TELEM_H_ */
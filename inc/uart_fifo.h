@@ -1,5 +1,5 @@
 /*  file: uart_fifo.h
- *  Author: Auto-generated by mkqueue.py
+ *  Console UART RX/TX queues (see spsc_ring.h)
  */
 
 #ifndef __UART_FIFO_H
@@ -14,7 +14,7 @@ extern "C" {
 #include <stdint.h>
 
 // ============================== Exported Macros ==============================
-#define UART_QUEUE_ITEMS                            (100)
+#define UART_QUEUE_ITEMS                            (128) // Must be a power of 2
 #define UART_QUEUE_OK                              (0x00)
 #define UART_QUEUE_FULL                            (0x01)
 #define UART_QUEUE_EMPTY                           (0x02)
@@ -22,7 +22,7 @@ extern "C" {
 #define UART_DATA_NOT_LOST                            (0)
 #define UART_DATA_LOST                                (1)
 
-#define UARTTX_QUEUE_ITEMS                         (1024)
+#define UARTTX_QUEUE_ITEMS                         (1024) // Must be a power of 2
 #define UARTTX_QUEUE_OK                            (0x00)
 #define UARTTX_QUEUE_FULL                          (0x01)
 #define UARTTX_QUEUE_EMPTY                         (0x02)
@@ -34,7 +34,6 @@ void UARTQUEUE_Init(void);
 void UARTQUEUE_Clear(void);
 uint8_t UARTQUEUE_Add(uint8_t *item);
 uint8_t UARTQUEUE_Get(volatile uint8_t *item);
-uint8_t UARTQUEUE_Pop(uint8_t *item);
 uint8_t UARTQUEUE_Rewind(int n);
 uint8_t UARTQUEUE_Status(void);
 int UARTQUEUE_ShiftOut(uint8_t *pData, int len);
@@ -42,9 +41,13 @@ int UARTQUEUE_ShiftUntil(uint8_t *pData, uint8_t target, int len);
 void UARTQUEUE_SetDataLost(uint8_t lost);
 uint8_t UARTQUEUE_IsDataLost(void);
 int UARTQUEUE_FillLevel(void);
+int UARTQUEUE_HighWater(void);
 uint8_t UARTTXQUEUE_Add(uint8_t *item);
 uint8_t UARTTXQUEUE_Get(volatile uint8_t *item);
 uint8_t UARTTXQUEUE_Status(void);
+int UARTTXQUEUE_ShiftOut(uint8_t *pData, int len);
+int UARTTXQUEUE_FillLevel(void);
+int UARTTXQUEUE_HighWater(void);
 int USART_Tx_LL_Queue(char *msg, int len);
 int USART_Rx_LL_Queue(volatile char *msg, int len);
 
@@ -13,13 +13,18 @@ extern "C" {
 
 #include <stdint.h>
 
+// Timeout resolution; independent of the mailbox update period
+#define FPGAWD_POLL_PERIOD_MS         (100)
+
 void FPGAWD_GetNonce(uint8_t *pdata);
 void FPGAWD_DoneHandler(void);
 void FPGAWD_HandleHash(const uint8_t *hash);
 void FPGAWD_Poll(void);
+void FPGAWD_Hold(void);
 int FPGAWD_SetPeriod(unsigned int period);
 int FPGAWD_GetPeriod(void);
 void FPGAWD_ShowState(void);
+int FPGAWD_LoadKey(void);
 
 #ifdef __cplusplus
 }
@@ -10,7 +10,7 @@ import time
 import datetime
 import mkmbox
 import socket
-from pysiphash import SipHash_2_4
+from sipfast import siphash_nopad
 import struct
 from binascii import hexlify
 import leep
@@ -28,7 +28,7 @@ def transform(rval, key=None):
         key = "super secret key".encode()
     tkey = bytearray()
     tkey.extend(key)
-    xval = SipHash_2_4(tkey, rval).hash_nopad()
+    xval = siphash_nopad(tkey, rval)
     return xval
 
 
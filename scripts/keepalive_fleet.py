@@ -0,0 +1,312 @@
+#! /usr/bin/python3
+
+# Watchdog keep-alive for many boards at once
+# Each period, every board's WD_NONCE is read and its MAC written to WD_HASH,
+# as scripts/keepalive.py does for one board.  All boards share one UDP
+# socket and asyncio event loop; requests are matched to replies by LASS
+# transaction ID, so hundreds of handshakes are in flight together instead
+# of one blocking round trip after another.
+#
+# Boards file: one board per line, "ip[:port] [id]"; '#' starts a comment.
+# The id selects the key file as for "keepalive.py --id" (scripts/genkey.py).
+
+import os
+import sys
+import json
+import time
+import struct
+import random
+import socket
+import asyncio
+import argparse
+import datetime
+
+import mkmbox
+from sipfast import SipKey
+
+SPI_MBOX_ADDR = 0x200000  # needs to match spi_mbox base_addr in static_regmap.json
+LASS_CMD_WRITE = 0x00
+LASS_CMD_READ = 0x10
+DEFAULT_KEY = b"super secret key"
+
+
+def get_ts():
+    return datetime.datetime.utcnow().replace(microsecond=0).isoformat()
+
+
+class LassClient(asyncio.DatagramProtocol):
+    """Single-beat LASS reads and writes over one shared UDP socket"""
+    def __init__(self):
+        self.transport = None
+        self._pending = {}
+        self._session = random.getrandbits(32)
+        self._count = 0
+
+    def connection_made(self, transport):
+        self.transport = transport
+
+    def datagram_received(self, data, addr):
+        if len(data) < 8:
+            return
+        fut = self._pending.pop(data[:8], None)
+        if fut is not None and not fut.done():
+            fut.set_result(data[8:])
+
+    def error_received(self, exc):
+        pass
+
+    async def exchange(self, addr, beats, timeout):
+        """Send (cmd, address, data) beats; returns the data words of the reply"""
+        self._count = (self._count + 1) & 0xffffffff
+        txid = struct.pack("!II", self._session, self._count)
+        pkt = bytearray(txid)
+        for cmd, address, data in beats:
+            pkt += struct.pack("!II", (cmd << 24) | (address & 0xffffff), data)
+        fut = asyncio.get_running_loop().create_future()
+        self._pending[txid] = fut
+        try:
+            self.transport.sendto(bytes(pkt), addr)
+            reply = await asyncio.wait_for(fut, timeout)
+        finally:
+            self._pending.pop(txid, None)
+        if len(reply) != 8*len(beats):
+            raise IOError("short reply from {}:{}".format(*addr))
+        return [struct.unpack_from("!I", reply, 8*n + 4)[0] for n in range(len(beats))]
+
+    async def read_bytes(self, addr, base, size, timeout):
+        words = await self.exchange(addr, [(LASS_CMD_READ, base + n, 0) for n in range(size)], timeout)
+        return bytes(w & 0xff for w in words)
+
+    async def write_bytes(self, addr, base, data, timeout):
+        await self.exchange(addr, [(LASS_CMD_WRITE, base + n, b) for n, b in enumerate(data)], timeout)
+
+
+class Board():
+    def __init__(self, host, port, board_id, key):
+        self.host = host
+        self.port = port
+        self.id = board_id
+        self.sk = SipKey(key)
+        self.addr = None
+        self.ok = 0
+        self.misses = 0
+        self.consecutive_misses = 0
+        self.repeats = 0        # Same nonce as last time; the last MAC was not (yet) taken
+        self.last_nonce = None
+        self.last_ms = None
+        self.max_ms = 0.0
+        self.total_ms = 0.0
+        self.last_error = None
+
+    def name(self):
+        return "{}:{}".format(self.host, self.port)
+
+    def stats(self):
+        return {
+            "board": self.name(),
+            "id": self.id,
+            "ok": self.ok,
+            "misses": self.misses,
+            "consecutive_misses": self.consecutive_misses,
+            "nonce_repeats": self.repeats,
+            "last_ms": self.last_ms,
+            "mean_ms": self.total_ms/self.ok if self.ok else None,
+            "max_ms": self.max_ms,
+            "last_error": self.last_error,
+        }
+
+
+def load_key(board_id):
+    """Key for 'board_id' from the genkey.py store.  Boards without an id use
+    the default key file, or failing that the hard-coded default key."""
+    try:
+        import genkey
+    except ImportError:
+        genkey = None
+    if genkey is None and board_id is not None:
+        raise ValueError("genkey.py is needed for the key of id {}".format(board_id))
+    keyfile = genkey.get_default_key_file(board_id) if genkey else None
+    if keyfile is None or not os.path.exists(keyfile):
+        if board_id is not None:
+            raise FileNotFoundError("no key file {}".format(keyfile))
+        return DEFAULT_KEY
+    ss = os.stat(keyfile)
+    if (ss.st_mode & 0o077) != 0:
+        raise PermissionError("file {} mode 0{:o} is too permissive".format(keyfile, ss.st_mode & 0o777))
+    ks = genkey.get_key_string(keyfile)
+    if ks is None:
+        raise ValueError("invalid key file {}".format(keyfile))
+    return bytes.fromhex(ks.strip())
+
+
+def parse_board(spec, default_port):
+    fields = spec.split()
+    host, _, port = fields[0].partition(':')
+    board_id = fields[1] if len(fields) > 1 else None
+    return host, int(port) if port else default_port, board_id
+
+
+def read_boards_file(fname, default_port):
+    boards = []
+    with open(fname, "r") as fd:
+        for line in fd:
+            line = line.split('#', 1)[0].strip()
+            if line:
+                boards.append(parse_board(line, default_port))
+    return boards
+
+
+class Fleet():
+    def __init__(self, boards, nonce_addr, hash_addr, args):
+        self.boards = boards
+        self.nonce_addr, self.nonce_size = nonce_addr
+        self.hash_addr, self.hash_size = hash_addr
+        self.timeout = args.timeout
+        self.retries = args.retries
+        self.verbose = args.verbose
+        self.sem = asyncio.Semaphore(args.max_inflight)
+        self.lass = None
+
+    async def _try(self, op, board, *args):
+        for attempt in range(self.retries + 1):
+            try:
+                return await op(board.addr, *args, self.timeout)
+            except asyncio.TimeoutError:
+                if attempt == self.retries:
+                    raise
+
+    async def handshake(self, board, delay):
+        await asyncio.sleep(delay)
+        async with self.sem:
+            t0 = time.perf_counter()
+            try:
+                if board.addr is None:
+                    loop = asyncio.get_running_loop()
+                    info = await loop.getaddrinfo(board.host, board.port, type=socket.SOCK_DGRAM)
+                    board.addr = info[0][4][:2]
+                nonce = await self._try(self.lass.read_bytes, board, self.nonce_addr, self.nonce_size)
+                mac = board.sk.mac(nonce)
+                await self._try(self.lass.write_bytes, board, self.hash_addr, mac[:self.hash_size])
+            except (asyncio.TimeoutError, OSError) as e:
+                board.misses += 1
+                board.consecutive_misses += 1
+                board.last_error = "timeout" if isinstance(e, asyncio.TimeoutError) else str(e)
+                if self.verbose:
+                    print(get_ts() + "Z Timeout   " + board.name())
+                return
+            ms = 1e3*(time.perf_counter() - t0)
+            if nonce == board.last_nonce:
+                board.repeats += 1
+            board.last_nonce = nonce
+            board.ok += 1
+            board.consecutive_misses = 0
+            board.last_error = None
+            board.last_ms = ms
+            board.total_ms += ms
+            board.max_ms = max(board.max_ms, ms)
+            if self.verbose:
+                print(get_ts() + "Z Handshake " + board.name() + "  " + nonce.hex() + " -> " + mac.hex())
+
+    async def run_period(self, spread):
+        n = len(self.boards)
+        # Stagger the starts so that replies do not all arrive at once
+        await asyncio.gather(*[self.handshake(b, spread*ix/n) for ix, b in enumerate(self.boards)])
+
+
+def summarize(fleet, nperiod, dt):
+    lat = sorted(b.last_ms for b in fleet.boards if b.last_ms is not None and b.consecutive_misses == 0)
+    nmiss = sum(1 for b in fleet.boards if b.consecutive_misses)
+    msg = "{}Z period {}: {}/{} ok in {:.0f} ms".format(get_ts(), nperiod, len(lat), len(fleet.boards), 1e3*dt)
+    if lat:
+        msg += ", latency p50 {:.1f} p99 {:.1f} max {:.1f} ms".format(
+            lat[len(lat)//2], lat[min(len(lat)-1, (99*len(lat))//100)], lat[-1])
+    if nmiss:
+        msg += ", {} missed: {}".format(nmiss, " ".join(b.name() for b in fleet.boards if b.consecutive_misses)[:200])
+    print(msg, flush=True)
+
+
+def write_stats(fleet, fname, nperiod):
+    tmp = fname + ".tmp"
+    with open(tmp, "w") as fd:
+        json.dump({"time": get_ts() + "Z", "period": nperiod,
+                   "boards": [b.stats() for b in fleet.boards]}, fd, indent=1)
+    os.replace(tmp, fname)
+
+
+async def serve(fleet, args):
+    loop = asyncio.get_running_loop()
+    _, fleet.lass = await loop.create_datagram_endpoint(LassClient, local_addr=("0.0.0.0", 0))
+    nperiod = 0
+    next_start = loop.time()
+    try:
+        while True:
+            t0 = loop.time()
+            await fleet.run_period(args.spread*args.time)
+            nperiod += 1
+            summarize(fleet, nperiod, loop.time() - t0)
+            if args.stats:
+                write_stats(fleet, args.stats, nperiod)
+            if args.count and nperiod >= args.count:
+                break
+            next_start += args.time
+            await asyncio.sleep(max(0.0, next_start - loop.time()))
+    finally:
+        fleet.lass.transport.close()
+    return 0 if all(b.consecutive_misses == 0 for b in fleet.boards) else 1
+
+
+def main():
+    scriptPath = os.path.split(sys.argv[0])[0]
+    defaultDefFile = os.path.join(scriptPath, "../inc/mbox.def")
+    parser = argparse.ArgumentParser(description="Watchdog keep-alive server for many boards")
+    parser.add_argument('-i', '--ipAddr', action='append', default=[],
+                        help="Board as ip[:port] (repeatable); add ' id' to select its key")
+    parser.add_argument('-b', '--boards', default=None, help="File of boards, one 'ip[:port] [id]' per line")
+    parser.add_argument('-p', '--port', default=803, type=int, help="Default UDP port number")
+    parser.add_argument('-t', '--time', default=8.0, type=float, help="Refresh time interval (s)")
+    parser.add_argument('-d', '--def_file', default=defaultDefFile,
+                        help='File name for mailbox definition file to be loaded')
+    parser.add_argument('--mbox-base', default=SPI_MBOX_ADDR, type=lambda x: int(x, 0),
+                        help="LASS address of the SPI mailbox")
+    parser.add_argument('--timeout', default=0.5, type=float, help="Reply timeout per attempt (s)")
+    parser.add_argument('--retries', default=2, type=int, help="Retries after a timeout")
+    parser.add_argument('--spread', default=0.5, type=float,
+                        help="Fraction of the interval over which to stagger the boards")
+    parser.add_argument('--max-inflight', default=256, type=int, help="Most handshakes in progress at once")
+    parser.add_argument('-s', '--stats', default=None, help="Write per-board statistics (JSON) here each period")
+    parser.add_argument('-n', '--count', default=0, type=int, help="Stop after this many periods (0: run forever)")
+    parser.add_argument('-v', '--verbose', default=False, action="store_true", help="Print every handshake")
+    args = parser.parse_args()
+
+    specs = [parse_board(s, args.port) for s in args.ipAddr]
+    if args.boards is not None:
+        specs += read_boards_file(args.boards, args.port)
+    if not specs:
+        print("Please specify boards with '-i' or '-b'")
+        return 1
+
+    mi = mkmbox.MailboxInterface(inFilename=args.def_file)
+    mi.interpret()
+    nonce_off, nonce_size = mi.getElementOffsetAddressAndSize(7, "WD_NONCE")
+    hash_off, hash_size = mi.getElementOffsetAddressAndSize(8, "WD_HASH")
+    if nonce_off is None or hash_off is None:
+        print("WD_NONCE/WD_HASH not found in {}".format(args.def_file))
+        return 1
+
+    boards = []
+    for host, port, board_id in specs:
+        try:
+            boards.append(Board(host, port, board_id, load_key(board_id)))
+        except (OSError, ValueError) as e:
+            print("ERROR: {}:{}: {}".format(host, port, e))
+            return 1
+    fleet = Fleet(boards, (args.mbox_base + nonce_off, nonce_size), (args.mbox_base + hash_off, hash_size), args)
+    try:
+        return asyncio.run(serve(fleet, args))
+    except KeyboardInterrupt:
+        print("\nExiting")
+        return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
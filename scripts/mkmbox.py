@@ -366,9 +366,15 @@ class MailboxInterface():
         return
 
     def makeProtos(self):
+        self._fp("// Pages below 32 with inputs (bit n = page n)")
+        self._fp("#define MAILBOX_INPUT_PAGES (0x{:x})\n".format(self.getInputPageMask()))
+        self._fp("// Pages below 32 whose input changes count as activity (bit n = page n)")
+        self._fp("#define MAILBOX_ACTIVITY_PAGES (0x{:x})\n".format(self.getActivityPageMask()))
         self._fp("uint32_t mailbox_get_hash(void);")
         self._fp("void mailbox_update_input(void);")
         self._fp("void mailbox_update_output(void);")
+        self._fp("int mailbox_update_input_page(uint8_t npage);")
+        self._fp("int mailbox_update_output_page(uint8_t npage);")
         self._fp("void mailbox_read_print_all(void);")
         return
 
@@ -381,23 +387,18 @@ class MailboxInterface():
         return
 
     def makeUpdateInput(self):
-        self._fp("void mailbox_update_input(void) {")
         for npage, elementList in self._pageList: # Each entry is (npage, [(name, paramDict),...])
-            hasInputs = False
+            if not self._hasInputs(elementList):
+                continue
             hasBigval = False
-            hasAck = False
             mbprefix = f"MB{npage}_"
+            self._fp(f"static void {self._inputName(npage)}(void) {{")
+            self._fp(f"  uint8_t page[MB{npage}_SIZE];")
+            self._fp(f"  mbox_read_page({npage}, MB{npage}_SIZE, page);")
             for n in range(len(elementList)):
                 name, paramDict = elementList[n]
                 pinput = paramDict.get('input', None)
                 if pinput is not None:
-                    if not hasInputs:
-                        # Delay opening the code block until we know it has inputs.
-                        # If the page doesn't have inputs, will not generate the block
-                        self._fp(f"  {{\n    // Page {npage}")
-                        self._fp(f"    uint8_t page[MB{npage}_SIZE];")
-                        self._fp(f"    mbox_read_page({npage}, MB{npage}_SIZE, page);")
-                    hasInputs = True
                     if not hasattr(pinput, 'replace'):
                         print("{} is not a valid string")
                         continue
@@ -406,13 +407,13 @@ class MailboxInterface():
                     # TODO - Add 'aspointer' boolean option to mbox.def?
                     aspointer = paramDict.get('aspointer', False)
                     if (size > 4) or aspointer:    # Use array-mode for sizes > 4
-                        s = "    {};".format(pinput.replace('@', f"&page[{enumName}_{size-1}]"))
+                        s = "  {};".format(pinput.replace('@', f"&page[{enumName}_{size-1}]"))
                         s = s.replace("&&", '&')  # Replace any double-ampersands
                         self._fp(s)
                     elif size > 1:
                         if not hasBigval:
                             # We need to instantiate an int
-                            self._fp(f"    int val;")
+                            self._fp(f"  int val;")
                             hasBigval = True
                         # Break up into bytes
                         # First, get value
@@ -421,14 +422,14 @@ class MailboxInterface():
                         fmt = f"page[{enumName}_" + "{}]"
                         v = self._getShiftOR(fmt, size)
                         # Assign shifted and OR'd value to temporary variable 'val'
-                        self._fp("    val = (int)({});".format(v))
+                        self._fp("  val = (int)({});".format(v))
                         # Use the 'input' param string to return 'val' wherever it needs to go
-                        s = "    {};".format(pinput.replace('@', 'val'))
+                        s = "  {};".format(pinput.replace('@', 'val'))
                         s = s.replace("&&", '&')  # Replace any double-ampersands
                         self._fp(s)
                     else:
                         # size = 1 (nice and easy)
-                        s = "    {};".format(pinput.replace('@', f"page[{enumName}]"))
+                        s = "  {};".format(pinput.replace('@', f"page[{enumName}]"))
                         s = s.replace("&&", '&')  # Replace any double-ampersands
                         self._fp(s)
                     # Handle acks if needed
@@ -437,57 +438,158 @@ class MailboxInterface():
                         # try alternate keyword
                         ack = paramDict.get('respond', None)
                     if ack is not None:
-                        hasAck = True
                         if size > 1:
                             # Apply the ack operation to the full-sized value
-                            self._fp("    val = {};".format(ack.replace('@', 'val')))
+                            self._fp("  val = {};".format(ack.replace('@', 'val')))
                             for n in range(size):
                                 member = f"page[{enumName}_{n}]"
-                                #self._fp("    {} = {};".format(member, ack.replace('@', member)))
-                                self._fp("    mbox_write_entry({}_{}, {});".format(
+                                #self._fp("  {} = {};".format(member, ack.replace('@', member)))
+                                self._fp("  mbox_write_entry({}_{}, {});".format(
                                          enumName, n, f"(uint8_t)((val >> {8*n}) & 0xFF)"))
                         else:
-                            #self._fp("    page[{}] = {};".format(enumName, ack.replace('@', f'(page[{enumName}])')))
+                            #self._fp("  page[{}] = {};".format(enumName, ack.replace('@', f'(page[{enumName}])')))
                             member = f"page[{enumName}]"
-                            self._fp("    mbox_write_entry({}, {});".format(enumName, ack.replace('@', member)))
-            if hasInputs:
-                self._fp("  }")
-        self._fp("  return;\n}")
+                            self._fp("  mbox_write_entry({}, {});".format(enumName, ack.replace('@', member)))
+            self._fp("  return;\n}\n")
+        self._makeDispatch("input", self._hasInputs, self._inputName)
+        return
+
+    def _makeDispatch(self, direction, hasFn, nameFn):
+        """Emit mailbox_update_<direction>() which handles every page in order, and
+        mailbox_update_<direction>_page() which handles a single page by number."""
+        self._fp(f"void mailbox_update_{direction}(void) {{")
+        for npage, elementList in self._pageList:
+            if hasFn(elementList):
+                self._fp(f"  {nameFn(npage)}();")
+        self._fp("  return;\n}\n")
+        self._fp(f"int mailbox_update_{direction}_page(uint8_t npage) {{")
+        self._fp("  switch (npage) {")
+        for npage, elementList in self._pageList:
+            if hasFn(elementList):
+                self._fp(f"    case {npage}:")
+                self._fp(f"      {nameFn(npage)}();")
+                self._fp(f"      break;")
+        self._fp("    default:")
+        self._fp("      return -1;")
+        self._fp("  }")
+        self._fp("  return 0;\n}")
+        return
+
+    def getInputPageMask(self):
+        """Bitmask of the pages below 32 which have inputs (bit n = page n)."""
+        mask = 0
+        for npage, elementList in self._pageList:
+            if (npage < 32) and self._hasInputs(elementList):
+                mask |= 1 << npage
+        return mask
+
+    def getActivityPageMask(self):
+        """Bitmask of the pages below 32 with an input which counts as activity for the
+        adaptive update period (bit n = page n).  Inputs with 'activity' false don't."""
+        mask = 0
+        for npage, elementList in self._pageList:
+            if npage >= 32:
+                continue
+            for name, paramDict in elementList:
+                if (paramDict.get('input', None) is not None) and paramDict.get('activity', True):
+                    mask |= 1 << npage
+        return mask
+
+    @staticmethod
+    def _inputName(npage):
+        return f"mailbox_input_page{npage}"
+
+    @staticmethod
+    def _outputName(npage):
+        return f"mailbox_output_page{npage}"
+
+    @staticmethod
+    def _outputMask(elementList):
+        """Bitmask of the entry indices written by the MMC (bit n = entry n)."""
+        mask = 0
+        for name, paramDict in elementList:
+            if paramDict.get('output', None) is not None:
+                for n in range(paramDict.get('size', 1)):
+                    mask |= 1 << (paramDict['index'] + n)
+        return mask
+
+    @staticmethod
+    def _hasInputs(elementList):
+        for name, paramDict in elementList:
+            if paramDict.get('input', None) is not None:
+                return True
+        return False
+
+    @staticmethod
+    def _hasOutputs(elementList):
+        for name, paramDict in elementList:
+            if paramDict.get('output', None) is not None:
+                return True
+        return False
+
+    @staticmethod
+    def _shadowName(npage):
+        return f"mb{npage}_shadow"
+
+    def _isTracked(self, elementList):
+        """Output pages are dirty-tracked against a shadow copy of what was last written.
+        Pages which also carry inputs have their output entries written every cycle since
+        the FPGA may have changed the page behind the shadow's back."""
+        return self._hasOutputs(elementList) and not self._hasInputs(elementList)
+
+    def makeShadows(self):
+        self._fp("// Last contents written to each dirty-tracked output page")
+        for npage, elementList in self._pageList: # Each entry is (npage, [(name, paramDict),...])
+            if self._isTracked(elementList):
+                self._fp(f"static uint8_t {self._shadowName(npage)}[MB{npage}_SIZE];")
+        return
 
     def makeUpdateOutput(self):
-        self._fp("void mailbox_update_output(void) {")
         for npage, elementList in self._pageList: # Each entry is (npage, [(name, paramDict),...])
-            hasOutputs = False
-            hasBigval = False
+            if not self._hasOutputs(elementList):
+                continue
+            tracked = self._isTracked(elementList)
             mbprefix = f"MB{npage}_"
+            self._fp(f"static void {self._outputName(npage)}(void) {{")
+            self._fp(f"  uint8_t page[MB{npage}_SIZE];")
+            if tracked:
+                # Padding and static entries keep their last-written value
+                self._fp(f"  memcpy(page, {self._shadowName(npage)}, MB{npage}_SIZE);")
+            for name, paramDict in elementList:
+                size = paramDict.get('size', 1)
+                output = paramDict.get('output', None)
+                aspointer = paramDict.get('aspointer', False)  # TODO
+                if (output is not None) and (1 < size <= 4) and not aspointer:
+                    # We need to instantiate an int
+                    self._fp(f"  int val;")
+                    break
             for n in range(len(elementList)):
                 name, paramDict = elementList[n]
                 output = paramDict.get('output', None)
                 if output is not None:
-                    if not hasOutputs:
-                        # Delay opening the code block until we know it has outputs.
-                        # If the page doesn't have outputs, will not generate the block
-                        self._fp(f"  {{\n    // Page {npage}")
-                        self._fp(f"    uint8_t page[MB{npage}_SIZE];")
-                    hasOutputs = True
                     if not hasattr(output, 'replace'):
                         print("{} is not a valid string")
                         continue
                     enumName = f"{mbprefix}{name}"
                     size = paramDict.get('size', 1)
                     aspointer = paramDict.get('aspointer', False)  # TODO
+                    static = paramDict.get('static', False)
+                    if static and not tracked:
+                        print(f"Ignoring 'static' on {enumName}; page {npage} is not dirty-tracked")
+                        static = False
+                    ind = "  "
+                    if static:
+                        # Written after mbox_refresh() (FPGA DONE, boot or on request) only
+                        self._fp(f"  if (mbox_refreshing) {{")
+                        ind = "    "
                     if (size > 4) or aspointer:    # Use array-mode
-                        s = "    {};".format(output.replace('@', f"&page[{enumName}_{size-1}]"))
+                        s = "{}{};".format(ind, output.replace('@', f"&page[{enumName}_{size-1}]"))
                         s = s.replace("&&", '&')  # Replace any double-ampersands
                         self._fp(s)
                     elif size > 1:
-                        if not hasBigval:
-                            # We need to instantiate an int
-                            self._fp(f"    int val;")
-                            hasBigval = True
                         # Break up into bytes
                         # First, get value
-                        s = "    {};".format(output.replace('@', 'val'))
+                        s = "{}{};".format(ind, output.replace('@', 'val'))
                         s = s.replace("&&", '&')  # Replace any double-ampersands
                         self._fp(s)
                         # Then shift, mask, and assign
@@ -495,17 +597,24 @@ class MailboxInterface():
                             byteIndex = size-m-1
                             shift = 8*byteIndex
                             elementName = f"{enumName}_{byteIndex}"
-                            self._fp(f"    page[{elementName}] = (uint8_t)((val >> {shift}) & 0xff);")
+                            self._fp(f"{ind}page[{elementName}] = (uint8_t)((val >> {shift}) & 0xff);")
                     else:
                         # size = 1
-                        s = "    {};".format(output.replace('@', f"page[{enumName}]"))
+                        s = "{}{};".format(ind, output.replace('@', f"page[{enumName}]"))
                         s = s.replace("&&", '&')  # Replace any double-ampersands
                         self._fp(s)
-            if hasOutputs:
-                self._fp("    // Write page data")
-                self._fp(f"    mbox_write_page({npage}, MB{npage}_SIZE, page);")
-                self._fp("  }")
-        self._fp("  return;\n}")
+                    if static:
+                        self._fp("  }")
+            if tracked:
+                self._fp("  // Write changed entries only")
+                self._fp(f"  mbox_write_page_changed({npage}, MB{npage}_SIZE, page, {self._shadowName(npage)});")
+            else:
+                # Leave the FPGA's input entries alone
+                self._fp("  // Write output entries only")
+                self._fp(f"  mbox_write_page_masked({npage}, MB{npage}_SIZE, page, 0x{self._outputMask(elementList):x});")
+            self._fp("  return;\n}\n")
+        self._makeDispatch("output", self._hasOutputs, self._outputName)
+        return
 
     def makeGetHash(self):
         self._fp("uint32_t mailbox_get_hash(void) {")
@@ -559,6 +668,8 @@ class MailboxInterface():
         self.makeIncludes()
         self.makeGetHash()
         self._fp("")
+        self.makeShadows()
+        self._fp("")
         self.makeUpdateOutput()
         self._fp("")
         self.makeUpdateInput()
@@ -582,11 +693,43 @@ class MailboxInterface():
             prior = c
         return ''.join(l)
 
+    _spiTransportDoc = """# SPI Transport
+
+The MMC accesses the mailbox over SPI (CPOL=1, CPHA=0, MSB first) in 16-bit words:
+
+Word|Meaning
+----|-------
+0x22PP|Select page PP
+0x5EDD|Write byte DD to entry E of the selected page
+0x4E00|Read entry E of the selected page; the value is returned in the low byte of the same word
+
+By default CSB frames every word.  Firmware built with `make MBOX_BURST=1` instead transfers
+each page in a single chip-select assertion (burst): the page-select word followed by one
+write or read word per entry, back to back.  That needs gateware which acts on every 16th
+SCK edge while CSB is low rather than on the rising edge of CSB.
+
+# FPGA\_INT Doorbell
+
+Input pages are polled every few seconds.  For low latency the FPGA may instead ring the
+doorbell on page 9:
+
+1. Write the new input to page n (n < 16).
+2. Toggle bit n of DOORBELL.
+3. Assert FPGA\_INT (active low) while DOORBELL != DOORBELL\_ACK.
+
+On the falling edge of FPGA\_INT the MMC reads DOORBELL, services every input page whose bit
+differs from DOORBELL\_ACK (followed by that page's outputs, if any), then writes the serviced
+value to DOORBELL\_ACK.  Bits toggled again before the acknowledgement are picked up on the
+next pass, so no event is lost and the FPGA never needs to clear anything.  The regular poll
+still services every page.
+"""
+
     def makeDoc(self, outFilename = "mailbox.md"):
         with open(outFilename, 'w') as fd:
             def printf(*args, **kwargs):
                 print(*args, **kwargs, file=fd)
             printf("# Mailbox Documentation\n\n(autogenerated by mkmbox.py)\n")
+            printf(self._spiTransportDoc)
             for npage, elementList in self._pageList: # Each entry is (npage, [(name, paramDict),...])
                 printf(f"# Page {npage}\n")
                 printf("Offset|Name|Size|Direction|Desc|Note")
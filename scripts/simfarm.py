@@ -0,0 +1,134 @@
+#! /usr/bin/python3
+
+# Run a farm of simulated boards (out_sim/marble_mmc_sim) on one host
+# The firmware keeps its state in globals, so each board is its own process.
+# Board N listens for LASS on port BASE+N and runs in its own state directory
+# (DIR/boardNNN: flash image and console log), so boards keep their EEPROM
+# contents across runs without sharing them.  A boards file for
+# keepalive_fleet.py is written to DIR/boards.txt.
+#
+# Runs until interrupted, then stops every board with SIGINT as the console
+# would, so each flushes its flash image and console.
+
+import os
+import sys
+import time
+import signal
+import shutil
+import argparse
+import subprocess
+
+LISTENING = b"Listening on port"
+
+
+class Board():
+    def __init__(self, index, port, state_dir, log):
+        self.index = index
+        self.port = port
+        self.dir = state_dir
+        self.log = log
+        self.proc = None
+
+    def ready(self):
+        try:
+            with open(self.log, "rb") as fd:
+                return LISTENING in fd.read()
+        except OSError:
+            return False
+
+
+def start_boards(args):
+    boards = []
+    for ix in range(args.count):
+        state_dir = os.path.join(args.dir, "board{:03d}".format(ix))
+        if args.fresh and os.path.isdir(state_dir):
+            shutil.rmtree(state_dir)
+        os.makedirs(state_dir, exist_ok=True)
+        b = Board(ix, args.base_port + ix, state_dir, os.path.join(state_dir, "console.log"))
+        cmd = [args.sim, "--dir", state_dir, "--port", str(b.port), "--clock", args.clock]
+        if args.rev is not None:
+            cmd += ["--rev", args.rev]
+        if args.ctl_base:
+            cmd += ["--ctl", str(args.ctl_base + ix)]
+        cmd += args.extra
+        with open(b.log, "wb") as log:
+            b.proc = subprocess.Popen(cmd, stdin=subprocess.DEVNULL, stdout=log, stderr=subprocess.STDOUT,
+                                      start_new_session=True)
+        boards.append(b)
+    return boards
+
+
+def wait_ready(boards, timeout):
+    t_end = time.monotonic() + timeout
+    pending = list(boards)
+    while pending and time.monotonic() < t_end:
+        pending = [b for b in pending if b.proc.poll() is None and not b.ready()]
+        time.sleep(0.05)
+    return [b for b in boards if b.proc.poll() is not None or not b.ready()]
+
+
+def stop_boards(boards, timeout=5.0):
+    for b in boards:
+        if b.proc.poll() is None:
+            b.proc.send_signal(signal.SIGINT)
+    t_end = time.monotonic() + timeout
+    for b in boards:
+        try:
+            b.proc.wait(max(0.0, t_end - time.monotonic()))
+        except subprocess.TimeoutExpired:
+            b.proc.kill()
+            b.proc.wait()
+
+
+def main():
+    scriptPath = os.path.dirname(os.path.abspath(__file__))
+    defaultSim = os.path.join(scriptPath, "..", "out_sim", "marble_mmc_sim")
+    parser = argparse.ArgumentParser(description="Run many simulated boards, one process and state directory each")
+    parser.add_argument('-n', '--count', default=10, type=int, help="Number of boards")
+    parser.add_argument('-p', '--base-port', default=8003, type=int, help="LASS UDP port of board 0")
+    parser.add_argument('-d', '--dir', default="simfarm", help="Parent of the per-board state directories")
+    parser.add_argument('-s', '--sim', default=defaultSim, help="Simulator executable (make sim)")
+    parser.add_argument('-c', '--clock', default="real", help="Clock mode of every board (see sim/README_SIM.md)")
+    parser.add_argument('--ctl-base', default=0, type=int, help="Clock control UDP port of board 0 (0: none)")
+    parser.add_argument('-r', '--rev', default=None, help="PCB revision to emulate (1.2 ... 1.9)")
+    parser.add_argument('--fresh', default=False, action="store_true",
+                        help="Delete existing state first (flash images: EEPROM contents)")
+    parser.add_argument('--timeout', default=10.0, type=float, help="Seconds to wait for the boards to start")
+    parser.add_argument('extra', nargs='*', help="Further simulator options, after '--'")
+    args = parser.parse_args()
+
+    if not os.access(args.sim, os.X_OK):
+        print("{} not found; run 'make sim' first".format(args.sim))
+        return 1
+    args.sim = os.path.abspath(args.sim)
+    os.makedirs(args.dir, exist_ok=True)
+    # Stop the boards on SIGTERM too
+    signal.signal(signal.SIGTERM, lambda signum, frame: sys.exit(0))
+    boards = start_boards(args)
+    try:
+        failed = wait_ready(boards, args.timeout)
+        if failed:
+            for b in failed:
+                print("board {} (port {}) did not start; see {}".format(b.index, b.port, b.log))
+            return 1
+        boards_file = os.path.join(args.dir, "boards.txt")
+        with open(boards_file, "w") as fd:
+            for b in boards:
+                fd.write("127.0.0.1:{}\n".format(b.port))
+        print("{} boards on UDP ports {}-{}; boards file {}".format(
+            len(boards), boards[0].port, boards[-1].port, boards_file), flush=True)
+        while True:
+            for b in boards:
+                if b.proc.poll() is not None:
+                    print("board {} (port {}) exited with {}; see {}".format(b.index, b.port, b.proc.returncode, b.log))
+                    return 1
+            time.sleep(0.5)
+    except KeyboardInterrupt:
+        print("\nExiting")
+        return 0
+    finally:
+        stop_boards(boards)
+
+
+if __name__ == "__main__":
+    sys.exit(main())
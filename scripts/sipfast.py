@@ -0,0 +1,159 @@
+#! /usr/bin/python3
+
+# SipHash for the watchdog keep-alive: a ctypes binding to src/refsip.c,
+# falling back to pysiphash.py (pure Python, about 10x slower) without it.
+# Build the library with "make -C tests/sip librefsip.so", or point
+# $REFSIP_LIB at a copy built elsewhere.
+# As with core_siphash() and hash_nopad(), messages must be a multiple of
+# 8 bytes; no padding or length encoding is added.
+
+import os
+import sys
+import time
+import ctypes
+import struct
+import argparse
+
+from pysiphash import SipHash_2_4
+
+_lib = None
+
+
+def _default_lib_path():
+    here = os.path.dirname(os.path.abspath(__file__))
+    return os.environ.get("REFSIP_LIB", os.path.join(here, "..", "tests", "sip", "librefsip.so"))
+
+
+def load(path=None):
+    """Load the C library; returns True if in use, else pysiphash is used."""
+    global _lib
+    path = path or _default_lib_path()
+    try:
+        lib = ctypes.CDLL(path)
+    except OSError:
+        _lib = None
+        return False
+    lib.sip_key_init.argtypes = [ctypes.c_void_p, ctypes.c_char_p]
+    lib.sip_key_init.restype = None
+    lib.siphash_keyed.argtypes = [ctypes.c_char_p, ctypes.c_char_p, ctypes.c_ulong, ctypes.c_void_p]
+    lib.siphash_keyed.restype = None
+    lib.sip_key_clear.argtypes = [ctypes.c_void_p]
+    lib.sip_key_clear.restype = None
+    _lib = lib
+    return True
+
+
+def accelerated():
+    return _lib is not None
+
+
+class SipKey():
+    """A key, expanded once, for MACs of many messages."""
+    def __init__(self, key):
+        key = bytes(key)
+        if len(key) != 16:
+            raise ValueError("SipHash key must be 16 bytes")
+        if _lib is not None:
+            self._ctx = (ctypes.c_uint64 * 4)()
+            self._out = ctypes.create_string_buffer(8)
+            self._hash = _lib.siphash_keyed
+            _lib.sip_key_init(self._ctx, key)
+            self._key = None
+        else:
+            self._ctx = None
+            self._key = bytearray(key)
+        self._lib = _lib
+
+    def __del__(self):
+        if getattr(self, "_ctx", None) is not None and self._lib is not None:
+            self._lib.sip_key_clear(self._ctx)
+
+    def mac(self, msg):
+        """8-byte MAC, in the byte order written to WD_HASH"""
+        if type(msg) is not bytes:
+            msg = bytes(msg)
+        if len(msg) % 8:
+            raise ValueError("message length must be a multiple of 8")
+        if self._ctx is not None:
+            self._hash(self._out, msg, len(msg), self._ctx)
+            return self._out.raw
+        return struct.pack("!Q", SipHash_2_4(self._key, msg).hash_nopad())
+
+    def hash_nopad(self, msg):
+        """As pysiphash's hash_nopad(): the MAC as an integer"""
+        return struct.unpack("!Q", self.mac(msg))[0]
+
+
+def siphash_nopad(key, msg):
+    """Drop-in for SipHash_2_4(key, msg).hash_nopad()"""
+    return SipKey(key).hash_nopad(msg)
+
+
+# Pair files are those of tests/sip/sip_batch: 8-byte nonce, then its MAC
+PAIR_SIZE = 16
+
+
+def _get_key():
+    hexkey = os.environ.get("SIP_KEY")
+    return bytes.fromhex(hexkey) if hexkey else b"super secret key"
+
+
+def _gen(fname, n, sk):
+    with open(fname, "wb") as fd:
+        for _ in range(n):
+            nonce = os.urandom(8)
+            fd.write(nonce + sk.mac(nonce))
+    return 0
+
+
+def _verify(fname, sk):
+    with open(fname, "rb") as fd:
+        data = fd.read()
+    n = len(data) // PAIR_SIZE
+    t0 = time.perf_counter()
+    bad = 0
+    for ix in range(0, n*PAIR_SIZE, PAIR_SIZE):
+        if sk.mac(data[ix:ix+8]) != data[ix+8:ix+16]:
+            bad += 1
+    dt = time.perf_counter() - t0
+    print("verify {} pairs: {:.0f} ns/hash, {} mismatches".format(n, 1e9*dt/max(n, 1), bad))
+    print("FAIL" if bad or not n else "PASS")
+    return 1 if bad or not n else 0
+
+
+def _bench(n, sk):
+    nonces = [os.urandom(8) for _ in range(n)]
+    t0 = time.perf_counter()
+    for nonce in nonces:
+        sk.mac(nonce)
+    dt = time.perf_counter() - t0
+    print("{}: {:.0f} ns/hash".format("refsip.c" if accelerated() else "pysiphash", 1e9*dt/n))
+    return 0
+
+
+def main():
+    parser = argparse.ArgumentParser(description="SipHash (no padding) for watchdog nonce/MAC pairs. "
+                                     "Key is $SIP_KEY (32 hex digits) or the firmware default.")
+    group = parser.add_mutually_exclusive_group()
+    group.add_argument('--pure', default=False, action="store_true", help="Use pysiphash only")
+    group.add_argument('--lib', default=None, help="Path to librefsip.so")
+    parser.add_argument('cmd', choices=["gen", "verify", "bench"])
+    parser.add_argument('file', nargs='?', default=None, help="Pair file (gen, verify)")
+    parser.add_argument('n', nargs='?', type=int, default=100000, help="Number of pairs (gen, bench)")
+    args = parser.parse_args()
+    if args.cmd == "bench" and args.file is not None:
+        args.n = int(args.file)
+    if not args.pure and not load(args.lib):
+        print("{} not found; using pysiphash".format(args.lib or _default_lib_path()))
+    sk = SipKey(_get_key())
+    if args.cmd == "gen":
+        return _gen(args.file, args.n, sk)
+    if args.cmd == "verify":
+        return _verify(args.file, sk)
+    return _bench(args.n, sk)
+
+
+if __name__ == "__main__":
+    sys.exit(main())
+else:
+    load()
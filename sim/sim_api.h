@@ -9,7 +9,22 @@
 extern "C" {
 #endif
 
+// Command-line options (sim_opts.c), parsed before main()
+typedef struct {
+  unsigned short port;        // LASS (mailbox) UDP port
+  const char *flash_file;     // Flash image, relative to state_dir
+  const char *state_dir;      // Working directory of this instance; NULL for cwd
+  int pcb_rev;                // Marble_PCB_Rev_t
+  int board_id;               // marble_get_board_id()
+  uint32_t baud;              // Console pacing; 0 for none
+  unsigned short ctl_port;    // Clock control UDP port; 0 for none
+} sim_opts_t;
+
+extern sim_opts_t sim_opts;
+
 int sim_spi_init(void);
+bool sim_spi_fpga_int(void);
+void sim_flash_print_stats(void);
 
 #ifdef __cplusplus
 }
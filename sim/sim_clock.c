@@ -0,0 +1,253 @@
+/*
+ * File: sim_clock.c
+ * Desc: Virtual clock for the simulated platform.  See sim_clock.h.
+ */
+
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include "sim_clock.h"
+
+/* ============================= Helper Macros ============================== */
+#define CTL_MAX_MSG_SIZE        (64)
+#define CLOCK_STEP_FOREVER      (UINT64_MAX)
+
+/* ================================ Typedefs ================================ */
+typedef struct {
+  double scale;           // Virtual per wall-clock second; 0 when stepping
+  uint64_t virt_us;       // Clock as last read (or set, when stepping)
+  uint64_t virt_base_us;  // Clock at the last change of mode
+  uint64_t wall_base_us;  // CLOCK_MONOTONIC then
+  uint64_t step_to_us;    // Stepping: may advance up to here
+  char mode_str[24];
+} sim_clock_t;
+
+typedef struct {
+  int fd;
+  int waiting;            // A "step" is owed a reply
+  struct sockaddr_in waiter;
+  socklen_t waiter_len;
+} sim_clock_ctl_t;
+
+/* ============================ Static Variables ============================ */
+static sim_clock_t clk = {.scale = 1.0, .mode_str = "real"};
+static sim_clock_ctl_t ctl = {.fd = -1};
+static const struct timespec timeout_zero = {0, 0};
+
+/* =========================== Static Prototypes ============================ */
+static uint64_t wall_us(void);
+static void clock_rebase(void);
+static void clock_step(uint64_t ms);
+static void ctl_reply(const struct sockaddr_in *addr, socklen_t addr_len, const char *err);
+static void ctl_handle(char *cmd, const struct sockaddr_in *addr, socklen_t addr_len);
+
+/* ============================ Public Functions ============================ */
+int sim_clock_set_mode(const char *mode) {
+  char *end;
+  if (!strcmp(mode, "real")) {
+    clock_rebase();
+    clk.scale = 1.0;
+  } else if (!strcmp(mode, "step")) {
+    clock_rebase();
+    clk.scale = 0;
+    clk.step_to_us = clk.virt_us;
+  } else if (!strcmp(mode, "fast")) {
+    clock_rebase();
+    clk.scale = 0;
+    clk.step_to_us = CLOCK_STEP_FOREVER;
+  } else {
+    double scale = strtod(mode + (mode[0] == 'x'), &end);
+    if ((end == mode) || (*end != '\0') || !(scale > 0)) {
+      return -1;
+    }
+    clock_rebase();
+    clk.scale = scale;
+    snprintf(clk.mode_str, sizeof(clk.mode_str), "x%g", scale);
+    return 0;
+  }
+  snprintf(clk.mode_str, sizeof(clk.mode_str), "%s", mode);
+  return 0;
+}
+
+const char *sim_clock_mode_str(void) {
+  return clk.mode_str;
+}
+
+uint64_t sim_clock_us(void) {
+  if (clk.scale > 0) {
+    uint64_t dt = wall_us() - clk.wall_base_us;
+    clk.virt_us = clk.virt_base_us + ((clk.scale == 1.0) ? dt : (uint64_t)(clk.scale*dt));
+  }
+  return clk.virt_us;
+}
+
+const struct timespec *sim_clock_timeout(int idle_ms, struct timespec *ts) {
+  if (idle_ms <= 0) {
+    return &timeout_zero;
+  }
+  if (clk.scale > 0) {
+    uint64_t ns = (uint64_t)(1000000.0*idle_ms/clk.scale);
+    ts->tv_sec = ns/1000000000;
+    ts->tv_nsec = ns % 1000000000;
+    return ts;
+  }
+  if (clk.virt_us < clk.step_to_us) {
+    uint64_t dt = 1000*(uint64_t)idle_ms;
+    clk.virt_us += (dt < clk.step_to_us - clk.virt_us) ? dt : clk.step_to_us - clk.virt_us;
+    return &timeout_zero;
+  }
+  // Idle at the granted time; the step is done
+  if (ctl.waiting) {
+    ctl.waiting = 0;
+    ctl_reply(&ctl.waiter, ctl.waiter_len, NULL);
+  }
+  return NULL;
+}
+
+void sim_clock_sleep_ms(uint32_t ms) {
+  if (clk.scale > 0) {
+    uint64_t ns = (uint64_t)(1000000.0*ms/clk.scale);
+    struct timespec ts = {.tv_sec = ns/1000000000, .tv_nsec = ns % 1000000000};
+    nanosleep(&ts, NULL);
+  } else {
+    clk.virt_us += 1000*(uint64_t)ms;
+  }
+  return;
+}
+
+int sim_clock_ctl_init(unsigned short int port) {
+  struct sockaddr_in sa = {
+    .sin_family = AF_INET,
+    .sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+    .sin_port = htons(port)
+  };
+  ctl.fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (ctl.fd < 0) {
+    perror("clock control socket");
+    return -1;
+  }
+  if (bind(ctl.fd, (struct sockaddr *)&sa, sizeof(sa)) < 0) {
+    printf("could not bind clock control to udp port %u\r\n", port);
+    close(ctl.fd);
+    ctl.fd = -1;
+    return -1;
+  }
+  return 0;
+}
+
+int sim_clock_ctl_get_fd(void) {
+  return ctl.fd;
+}
+
+void sim_clock_ctl_service(void) {
+  char msg[CTL_MAX_MSG_SIZE];
+  struct sockaddr_in addr;
+  while (ctl.fd >= 0) {
+    socklen_t addr_len = sizeof(addr);
+    ssize_t rc = recvfrom(ctl.fd, msg, sizeof(msg)-1, 0, (struct sockaddr *)&addr, &addr_len);
+    if (rc < 0) {
+      return;
+    }
+    // Drop trailing whitespace ("echo step 1000 | nc -u ...")
+    while ((rc > 0) && (msg[rc-1] <= ' ')) {
+      rc--;
+    }
+    msg[rc] = '\0';
+    ctl_handle(msg, &addr, addr_len);
+  }
+  return;
+}
+
+/* ============================ Static Functions ============================ */
+static uint64_t wall_us(void) {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  uint64_t us = (uint64_t)t.tv_sec*1000000 + t.tv_nsec/1000;
+  // The clock starts at 0 at the first reading
+  if (clk.wall_base_us == 0) {
+    clk.wall_base_us = us;
+  }
+  return us;
+}
+
+static void clock_rebase(void) {
+  clk.virt_base_us = sim_clock_us();
+  clk.wall_base_us = wall_us();
+  return;
+}
+
+// Grant 'ms' more than the current time; stepping from now on
+static void clock_step(uint64_t ms) {
+  if (clk.scale > 0) {
+    sim_clock_set_mode("step");
+  }
+  clk.step_to_us = clk.virt_us + 1000*ms;
+  snprintf(clk.mode_str, sizeof(clk.mode_str), "step");
+  return;
+}
+
+static void ctl_reply(const struct sockaddr_in *addr, socklen_t addr_len, const char *err) {
+  char msg[CTL_MAX_MSG_SIZE];
+  int len;
+  if (err) {
+    len = snprintf(msg, sizeof(msg), "error %s\n", err);
+  } else {
+    len = snprintf(msg, sizeof(msg), "%llu %s\n",
+                   (unsigned long long)(sim_clock_us()/1000), clk.mode_str);
+  }
+  sendto(ctl.fd, msg, (size_t)len, 0, (const struct sockaddr *)addr, addr_len);
+  return;
+}
+
+static void ctl_handle(char *cmd, const struct sockaddr_in *addr, socklen_t addr_len) {
+  char *arg = strchr(cmd, ' ');
+  char *end;
+  if (arg) {
+    *arg++ = '\0';
+  }
+  if (!strcmp(cmd, "time")) {
+    // Just the reply
+  } else if (!strcmp(cmd, "step") && arg) {
+    unsigned long long ms = strtoull(arg, &end, 0);
+    if ((end == arg) || (*end != '\0')) {
+      ctl_reply(addr, addr_len, "bad step");
+      return;
+    }
+    // A new step supersedes one in progress; answer that one now
+    if (ctl.waiting) {
+      ctl_reply(&ctl.waiter, ctl.waiter_len, NULL);
+    }
+    clock_step(ms);
+    ctl.waiting = 1;
+    ctl.waiter = *addr;
+    ctl.waiter_len = addr_len;
+    return;  // Replied to once idle at the new time
+  } else if (!strcmp(cmd, "pause")) {
+    clock_step(0);
+  } else if (!strcmp(cmd, "scale") && arg) {
+    if (sim_clock_set_mode(arg) < 0) {
+      ctl_reply(addr, addr_len, "bad scale");
+      return;
+    }
+  } else if (!strcmp(cmd, "real") || !strcmp(cmd, "fast")) {
+    sim_clock_set_mode(cmd);
+  } else {
+    ctl_reply(addr, addr_len, "unknown command");
+    return;
+  }
+  // Leaving step mode abandons a step in progress
+  if (ctl.waiting && (clk.step_to_us == CLOCK_STEP_FOREVER || clk.scale > 0)) {
+    ctl.waiting = 0;
+    ctl_reply(&ctl.waiter, ctl.waiter_len, NULL);
+  }
+  ctl_reply(addr, addr_len, NULL);
+  return;
+}
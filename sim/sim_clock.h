@@ -0,0 +1,84 @@
+/*
+ * File: sim_clock.h
+ * Desc: Virtual clock for the simulated platform.  BSP_GET_SYSTICK(),
+ *       marble_get_us(), SysTick and console pacing all read this clock,
+ *       which runs in one of these modes:
+ *         real     Wall-clock time
+ *         scaled   Wall-clock time times a factor (e.g. 100)
+ *         step     Stands still between deadlines; advances only when told
+ *                  to over the control socket, jumping from one
+ *                  scheduled event to the next, so runs are reproducible
+ *         fast     As step, but always told to advance: as fast as the host
+ *                  can service the events
+ */
+
+#ifndef __SIM_CLOCK_H
+#define __SIM_CLOCK_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <time.h>
+
+/* int sim_clock_set_mode(const char *mode);
+ *  Select the mode by name: "real", "step", "fast" or a scale factor
+ *  ("100", "x100", "0.5").  The clock keeps its current value.
+ *  Returns 0 on success, -1 on an unknown mode.
+ */
+int sim_clock_set_mode(const char *mode);
+
+/* const char *sim_clock_mode_str(void);
+ *  The current mode, in the form sim_clock_set_mode() takes.
+ */
+const char *sim_clock_mode_str(void);
+
+/* uint64_t sim_clock_us(void);
+ *  Virtual microseconds since start-up.
+ */
+uint64_t sim_clock_us(void);
+
+/* const struct timespec *sim_clock_timeout(int idle_ms, struct timespec *ts);
+ *  Wall-clock timeout for ppoll() when nothing is due for 'idle_ms' virtual
+ *  ms.  When stepping, instead advances the clock by as much of 'idle_ms'
+ *  as has been granted and returns a zero timeout, or NULL (wait for input)
+ *  if the grant is used up.  Sends the reply to a finished "step".
+ */
+const struct timespec *sim_clock_timeout(int idle_ms, struct timespec *ts);
+
+/* void sim_clock_sleep_ms(uint32_t ms);
+ *  Let 'ms' virtual ms pass: sleep for the wall-clock equivalent, or when
+ *  stepping just advance the clock (time spent blocking is not granted).
+ */
+void sim_clock_sleep_ms(uint32_t ms);
+
+/* int sim_clock_ctl_init(unsigned short int port);
+ *  Listen for clock commands on UDP 'port' (loopback only).
+ *  Returns 0 on success, -1 on failure.
+ */
+int sim_clock_ctl_init(unsigned short int port);
+
+/* int sim_clock_ctl_get_fd(void);
+ *  The control socket, for the caller to poll() on; -1 if not listening.
+ */
+int sim_clock_ctl_get_fd(void);
+
+/* void sim_clock_ctl_service(void);
+ *  Handle pending control datagrams, one command each:
+ *    time          reply with the clock
+ *    real          run in real time
+ *    scale N       run at N times real time
+ *    fast          run as fast as possible
+ *    pause         stop the clock (step mode)
+ *    step MS       step mode; advance MS ms, replying once the simulator
+ *                  is idle at the new time
+ *  Replies are "<virtual ms> <mode>\n", or "error ..." for a bad command.
+ */
+void sim_clock_ctl_service(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // __SIM_CLOCK_H
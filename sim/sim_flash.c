@@ -1,6 +1,12 @@
 /*
  * File: sim_flash.c
  * Desc: Simulated flash memory interface for EEPROM-emulator
+ *
+ *       Behaves like NOR flash: programming can only clear bits, and only an
+ *       erase sets them again.  Erase and program operations are counted per
+ *       sector and kept in the flash file with the sector contents, so wear
+ *       can be measured over many runs.  fmc_flash_erase_start() takes
+ *       SIM_FLASH_ERASE_MS to complete, during which the controller is busy.
  */
 
 #include <stdio.h>
@@ -8,18 +14,40 @@
 #include "marble_api.h"
 #include "flash.h"
 #include "st-eeprom.h"
+#include "sim_api.h"
+#include "sim_clock.h"
 
-#define FLASH_SECTOR_SIZE_WORDS         (FLASH_SECTOR_SIZE/4)
-#define FLASH_SECTOR_SIZE_STRAY_BYTES   (FLASH_SECTOR_SIZE%4)
+#define SIM_FLASH_NSECTORS      (3)
+// Typical for STM32F2 flash (minimum over temperature)
+#define SIM_FLASH_ENDURANCE     (10000)
+// Typical 16 KiB sector erase time
+#define SIM_FLASH_ERASE_MS      (250)
 
 static int store_flash(void);
 
-size_t eeprom_count = EEPROM_COUNT;
-ee_frame eeprom0_base[EEPROM_COUNT];
-ee_frame eeprom1_base[EEPROM_COUNT];
+uint32_t eeprom0_base[FLASH_SECTOR_SIZE/4];
+uint32_t eeprom1_base[FLASH_SECTOR_SIZE/4];
+uint32_t eeprom2_base[FLASH_SECTOR_SIZE/4];
+
+// Indexed by (sector number - 1)
+static uint32_t * const sim_sectors[SIM_FLASH_NSECTORS] = {
+  eeprom0_base, eeprom1_base, eeprom2_base
+};
+
+typedef struct {
+  uint32_t erases;
+  uint32_t programs;
+  uint32_t bytes;
+} sim_flash_stats_t;
+
+static sim_flash_stats_t sim_stats[SIM_FLASH_NSECTORS];
 
 bool need_flush = false;
 
+// Sector being erased by fmc_flash_erase_start() (0 = none)
+static unsigned erase_sectorn = 0;
+static uint32_t erase_done;
+
 int fmc_flash_init(void) {
   need_flush = false;
   return 0;
@@ -27,61 +55,125 @@ int fmc_flash_init(void) {
 
 int fmc_flash_program(void *paddr, const void *pvalue, size_t count)
 {
-  memcpy(paddr, pvalue, count);
+  uint8_t *addr = (uint8_t *)paddr;
+  const uint8_t *value = (const uint8_t *)pvalue;
+  int ret = 0;
+  if (erase_sectorn) {
+    return -EBUSY;
+  }
+  for (int n = 0; n < SIM_FLASH_NSECTORS; n++) {
+    const uint8_t *base = (const uint8_t *)sim_sectors[n];
+    if ((addr >= base) && (addr < base + FLASH_SECTOR_SIZE)) {
+      sim_stats[n].programs++;
+      sim_stats[n].bytes += count;
+    }
+  }
+  for (size_t n = 0; n < count; n++) {
+    addr[n] &= value[n];
+    if (addr[n] != value[n]) {
+      ret = -EIO;   // Programming over bits which were not erased
+    }
+  }
   store_flash();
-  return 0;
+  return ret;
 }
 
 int fmc_flash_erase_sector(unsigned sectorn)
 {
-  if(sectorn==1) {
-    memset(eeprom0_base, 0xff, sizeof(eeprom0_base));
-  } else if(sectorn==2) {
-    memset(eeprom1_base, 0xff, sizeof(eeprom1_base));
-  } else {
+  if ((sectorn < 1) || (sectorn > SIM_FLASH_NSECTORS)) {
     return -1;
   }
+  sim_flash_stats_t *st = &sim_stats[sectorn-1];
+  memset(sim_sectors[sectorn-1], 0xff, FLASH_SECTOR_SIZE);
+  if (++st->erases == SIM_FLASH_ENDURANCE) {
+    printf("sim_flash: sector %u reached %u erase cycles\r\n", sectorn, SIM_FLASH_ENDURANCE);
+  }
   need_flush = true;
   store_flash();
   return 0;
 }
 
+int fmc_flash_erase_start(unsigned sectorn)
+{
+  if ((sectorn < 1) || (sectorn > SIM_FLASH_NSECTORS)) {
+    return -EINVAL;
+  }
+  if (erase_sectorn) {
+    return -EBUSY;
+  }
+  erase_sectorn = sectorn;
+  erase_done = BSP_GET_SYSTICK() + SIM_FLASH_ERASE_MS;
+  return 0;
+}
+
+int fmc_flash_erase_poll(void)
+{
+  if (!erase_sectorn) {
+    return 0;
+  }
+  if ((int32_t)(BSP_GET_SYSTICK() - erase_done) < 0) {
+    // Callers may spin on this (eeprom_flush()); when stepping, the clock
+    // would stand still for them.  The hardware stalls meanwhile anyway.
+    sim_clock_sleep_ms(1);
+    return -EBUSY;
+  }
+  unsigned sectorn = erase_sectorn;
+  erase_sectorn = 0;
+  return fmc_flash_erase_sector(sectorn);
+}
+
 void fmc_flash_cache_flush_all(void)
 {
   need_flush = false;
   return;
 }
 
+void sim_flash_print_stats(void) {
+  printf("sim flash: sector erases programs    bytes\r\n");
+  for (int n = 0; n < SIM_FLASH_NSECTORS; n++) {
+    const sim_flash_stats_t *st = &sim_stats[n];
+    printf("           %6d %6lu %8lu %8lu%s\r\n", n+1, (unsigned long)st->erases,
+           (unsigned long)st->programs, (unsigned long)st->bytes,
+           st->erases >= SIM_FLASH_ENDURANCE ? "  (worn)" : "");
+  }
+  return;
+}
+
 static int store_flash(void) {
-  //printf("Writing sizeof(eeprom0_base) = %ld\r\n", sizeof(eeprom0_base));
-  FILE *pFile = fopen(SIM_FLASH_FILENAME, "wb");
+  FILE *pFile = fopen(sim_opts.flash_file, "wb");
   if (!pFile) {
-    printf("Cannot open %s for writing.\r\n", SIM_FLASH_FILENAME);
+    printf("Cannot open %s for writing.\r\n", sim_opts.flash_file);
     return -1;
   }
-  // Write by ee_frame
-  // First eeprom0
-  size_t rval = fwrite((const void *)eeprom0_base, sizeof(ee_frame), EEPROM_COUNT, pFile);
-  // Then eeprom1
-  rval += fwrite((const void *)eeprom1_base, sizeof(ee_frame), EEPROM_COUNT, pFile);
+  // Sector images in order, then the wear counters
+  for (int n = 0; n < SIM_FLASH_NSECTORS; n++) {
+    fwrite((const void *)sim_sectors[n], 1, FLASH_SECTOR_SIZE, pFile);
+  }
+  fwrite((const void *)sim_stats, 1, sizeof(sim_stats), pFile);
   fclose(pFile);
-  //printf("Num writes = %ld\r\n", rval);
   return 0;
 }
 
 int restore_flash(void) {
-  //printf("Reading...\r\n");
-  FILE *pFile = fopen(SIM_FLASH_FILENAME, "rb");
+  FILE *pFile = fopen(sim_opts.flash_file, "rb");
   if (!pFile) {
-    printf("Cannot open %s for reading.\r\n", SIM_FLASH_FILENAME);
+    printf("Cannot open %s for reading.\r\n", sim_opts.flash_file);
     return -1;
   }
-  // Read by ee_frame
-  // First eeprom0
-  size_t rval = fread((void *)eeprom0_base, sizeof(ee_frame), EEPROM_COUNT, pFile);
-  // Then eeprom1
-  rval += fread((void *)eeprom1_base, sizeof(ee_frame), EEPROM_COUNT, pFile);
+  const long expect = SIM_FLASH_NSECTORS*FLASH_SECTOR_SIZE + (long)sizeof(sim_stats);
+  fseek(pFile, 0, SEEK_END);
+  if (ftell(pFile) != expect) {
+    // Written with a different flash geometry
+    printf("Ignoring %s (size %ld, expected %ld).\r\n", sim_opts.flash_file, ftell(pFile), expect);
+    fclose(pFile);
+    return -1;
+  }
+  rewind(pFile);
+  size_t rval = 0;
+  for (int n = 0; n < SIM_FLASH_NSECTORS; n++) {
+    rval += fread((void *)sim_sectors[n], 1, FLASH_SECTOR_SIZE, pFile);
+  }
+  rval += fread((void *)sim_stats, 1, sizeof(sim_stats), pFile);
   fclose(pFile);
-  //printf("Num reads = %ld\r\n", rval);
-  return 0;
+  return rval == (size_t)expect ? 0 : -1;
 }
@@ -5,6 +5,7 @@
 #include "marble_api.h"
 #include "i2c_pm.h"
 #include "ltm4673.h"
+#include "i2c_xact.h"
 #include <stdio.h>
 
 I2C_BUS I2C_PM = 0;
@@ -16,6 +17,7 @@ typedef struct {
   uint32_t *page1;
   uint32_t *page2;
   uint32_t *page3;
+  uint8_t page;       // PAGE as the device sees it (not the firmware's cache)
 } four_page_periph_t;
 
 uint32_t _page0[] = {
@@ -91,7 +93,7 @@ uint32_t _page3[] = {
   0x0,    0x0,    0x0,    0x0,    0x0,    0x0,    0x0,    0x7,    0x4000, 0x8000, 0x0,    0x0,    0x0,    0x0,    0x0,    0x0,     // 0xf0-0xff
 };
 
-static four_page_periph_t ltm4673 = {_page0, _page1, _page2, _page3};
+static four_page_periph_t ltm4673 = {_page0, _page1, _page2, _page3, 0};
 static uint8_t ltm4673_addrs[] = {0xb8, 0xba, 0xbc, 0xbe, 0xc0, 0xc2, 0xc4, 0xc6, 0xc8};
 #define LTM4673_MATCH_ADDRS     (sizeof(ltm4673_addrs)/sizeof(uint8_t))
 
@@ -139,7 +141,7 @@ static int i2c_emu_ltm4673(uint8_t rnw, int reg, uint8_t *data, int len) {
   int offset = 0;
   uint32_t *ppage;
   uint32_t regval = 0;
-  uint8_t page = ltm4673_get_page();
+  uint8_t page = ltm4673.page;
   switch (page) {
     case 1:
       ppage = ltm4673.page1;
@@ -186,6 +188,9 @@ static int i2c_emu_ltm4673(uint8_t rnw, int reg, uint8_t *data, int len) {
       // Write to just ppage
       ppage[(uint8_t)(reg & 0xff)] = regval;
     }
+    if (((reg & 0xff) == LTM4673_PAGE) && ((regval < 4) || (regval == 0xff))) {
+      ltm4673.page = (uint8_t)regval;
+    }
   }
   return 0;
 }
@@ -218,6 +223,29 @@ int marble_I2C_cmdrecv_a2(I2C_BUS I2C_bus, uint8_t addr, uint16_t cmd, uint8_t *
   return i2c_emu(I2C_bus, addr, 1, cmd, data, size);
 }
 
+/* Backend for i2c_xact.c.  The emulated devices answer immediately, so the
+ * transfer completes inside marble_I2C_xact_start(); the engine still
+ * defers retirement, hook and callback to i2c_xact_service() exactly as it
+ * does for the interrupt-driven hardware backend.
+ */
+int marble_I2C_xact_start(i2c_xact_t *x) {
+  int cmd = x->cmd_len ? x->cmd : (x->rnw ? 0 : -1);
+  int rc = i2c_emu(x->bus, x->addr, x->rnw, cmd, x->data, x->len);
+  i2c_xact_complete(x, rc ? I2C_XACT_ERROR : I2C_XACT_OK);
+  return I2C_XACT_OK;
+}
+
+void marble_I2C_xact_abort(I2C_BUS I2C_bus) {
+  _UNUSED(I2C_bus);
+  return;
+}
+
+// i2c_emu() already applies device side effects (ltm4673_hook_write)
+void marble_I2C_xact_hook(const i2c_xact_t *x) {
+  _UNUSED(x);
+  return;
+}
+
 int getI2CBusStatus(void) {
   return 0;
 }
@@ -19,14 +19,18 @@
 #define LASS_CMD_READ         (0x10)
 #define LASS_CMD_BURST        (0x20)
 
-// Maximum ethernet packet size (overkill by UDP header & crc32)
-#define ETH_MTU               (1500)
-
-#define UDP_MAX_MSG_SIZE      ETH_MTU
-#define LINE_WIDTH               (8)
-
 #define MAX_MEM_BLOCKS          (10)
 
+// Page table over the 24-bit LASS address space
+#define LASS_ADDR_BITS          (24)
+#define LASS_ADDR_MASK          ((1UL << LASS_ADDR_BITS) - 1)
+#define LASS_PAGE_BITS           (8)
+#define LASS_NPAGES             (1 << (LASS_ADDR_BITS - LASS_PAGE_BITS))
+#define LASS_PAGE_NONE           (0)     // Else mem_blocks index + 1
+#define LASS_PAGE_SHARED      (0xff)     // More than one block; bisect
+#define LASS_HEADER_SIZE         (8)     // Transaction ID
+#define LASS_WORD_SIZE           (4)
+
 //#define DEBUG_MEM_BLOCK_TEST
 //#define DEBUG_PRINT_REPLY
 /* ================================ Typedefs ================================ */
@@ -65,15 +69,15 @@ typedef struct {
   uint32_t size;
   uint8_t *mem;
   unsigned int asbyte;
+  unsigned int width;   // Bytes of 'mem' per LASS address
 } mem_block_t;
 
 /* ============================ Static Variables ============================ */
 #include "config_rom.h"
-static uint8_t reply_buf[ETH_MTU];
-static unsigned int to_send;
 static mem_block_t mem_blocks[MAX_MEM_BLOCKS];
 static mem_block_t *mem_blocks_sorted[MAX_MEM_BLOCKS];
 static unsigned int mem_block_next;
+static uint8_t page_table[LASS_NPAGES];
 
 /* =========================== Static Prototypes ============================ */
 void print_lass(void *pkt_data, int size);
@@ -81,18 +85,14 @@ static const char *get_lass_cmd(uint8_t cmd);
 static lass_beat_t *print_lass_beat(lass_beat_t *beat);
 static void print_64bit_msb(void *pkt);
 static unsigned int _get_rep_count(uint8_t *cnt);
-static uint32_t _get_nbytes(uint8_t *data, int nbytes, int msb);
-static void handle_beat(uint8_t cmd, uint32_t addr, uint32_t data);
-static void queue_u32(uint32_t src, int msb);
-static void init_response(uint32_t id0, uint32_t id1);
-static void send_response(void);
-static void ack_burst(unsigned int rep_count);
-static void parse_lass(void *pkt_data, int size);
-static lass_beat_t *parse_lass_beat(lass_beat_t *beat);
-static void handle_write(uint32_t addr, uint32_t data);
-static uint32_t handle_read(uint32_t addr);
+static uint32_t get_u32(const uint8_t *src);
+static void put_u32(uint8_t *dst, uint32_t val);
+static int handle_packet(const uint8_t *req, int size, uint8_t *reply);
+static void handle_run(uint8_t cmd, uint32_t addr, uint8_t *data, uint32_t n);
+static mem_block_t *find_mem_block(uint32_t addr);
 static int vet_mem_block(uint32_t base, uint32_t size);
 static void sort_mem_blocks(void);
+static void map_mem_block(unsigned int index);
 static void print_mem_blocks(void);
 #if 0
 static void print_64bit_lsb(void *pkt);
@@ -108,8 +108,8 @@ int lass_init(unsigned short int port) {
   if (udp_init(port) < 0) {
     return -1;
   }
-  to_send = 0;
   mem_block_next = 0;
+  memset(page_table, LASS_PAGE_NONE, sizeof(page_table));
 
 #ifdef DEBUG_MEM_BLOCK_TEST
   printf("Mem block test\r\n");
@@ -129,42 +129,58 @@ int lass_init(unsigned short int port) {
 }
 
 /* void lass_service(void);
- *  Handle and respond to any LASS packets over UDP
+ *  Handle and respond to pending LASS packets over UDP, up to
+ *  UDP_BATCH_MAX of them with one recvmmsg() and one sendmmsg().
  *  This function does not block (early exit when no UDP packet
  *  is pending) and should be called periodically in the main()
  *  loop or via equivalent scheduler.
  */
 void lass_service(void) {
-  uint8_t pktdata[UDP_MAX_MSG_SIZE];
-  int nsent = udp_receive(pktdata, UDP_MAX_MSG_SIZE);
-  if (nsent == 0) {
-    return;
-  }
-  printc("Received %d bytes\r\n", nsent);
-  //print_lass((void *)pktdata, nsent);
-  parse_lass((void *)pktdata, nsent);
-  if (0) {
-    for (int n = 0; n < nsent; n++) {
-      printc("%02x ", pktdata[n]);
-      if (((n % LINE_WIDTH) == LINE_WIDTH-1) || (n == nsent-1)) { printc("\r\n") };
+  static udp_msg_t rx[UDP_BATCH_MAX];
+  static udp_msg_t tx[UDP_BATCH_MAX];
+  int nrx = udp_receive_batch(rx, UDP_BATCH_MAX);
+  int ntx = 0;
+  for (int k = 0; k < nrx; k++) {
+    printc("Received %d bytes\r\n", rx[k].len);
+    //print_lass((void *)rx[k].buf, rx[k].len);
+    tx[ntx].len = handle_packet(rx[k].buf, rx[k].len, tx[ntx].buf);
+    if (tx[ntx].len > 0) {
+      tx[ntx].addr = rx[k].addr;
+      tx[ntx].addrlen = rx[k].addrlen;
+#ifdef DEBUG_PRINT_REPLY
+      printc("======================== DEBUG reply ========================\r\n");
+      print_lass(tx[ntx].buf, tx[ntx].len);
+#endif
+      ntx++;
     }
   }
+  if ((ntx > 0) && (udp_send_batch(tx, ntx) < ntx)) {
+    printc("sim_lass: sent only part of %d replies\r\n", ntx);
+  }
   return;
 }
 
+int lass_get_fd(void) {
+  return udp_get_fd();
+}
+
 int lass_mem_add(uint32_t base, uint32_t size, void *mem, unsigned int asbyte) {
-  if (vet_mem_block(base, size)) {
+  static const unsigned int widths[] = {1, 2, 4};  // Indexed by ACCESS_...
+  if ((size == 0) || (base > LASS_ADDR_MASK) || (size > LASS_ADDR_MASK + 1 - base)
+      || (asbyte > ACCESS_WORD) || (mem_block_next >= MAX_MEM_BLOCKS)) {
     return -1;
   }
-  mem_block_t *pmem;
-  if (mem_block_next < MAX_MEM_BLOCKS) {
-    pmem = &mem_blocks[mem_block_next++];
-    pmem->base = base;
-    pmem->size = size;
-    pmem->mem = (uint8_t *)mem;
-    pmem->asbyte = asbyte;
+  if (vet_mem_block(base, size)) {
+    return -1;
   }
+  mem_block_t *pmem = &mem_blocks[mem_block_next++];
+  pmem->base = base;
+  pmem->size = size;
+  pmem->mem = (uint8_t *)mem;
+  pmem->asbyte = asbyte;
+  pmem->width = widths[asbyte];
   sort_mem_blocks();
+  map_mem_block(mem_block_next-1);
   return 0;
 }
 
@@ -193,7 +209,7 @@ static void sort_mem_blocks(void) {
   mem_block_t *pmem = &mem_blocks[mem_block_next-1];
   uint32_t base;
   unsigned int n;
-  unsigned int index = 0;
+  unsigned int index = mem_block_next-1;  // Above all others
   // Find the index where pmem should be inserted
   for (n = 0; n < mem_block_next-1; n++) {
     base = mem_blocks_sorted[n]->base;
@@ -211,6 +227,50 @@ static void sort_mem_blocks(void) {
   return;
 }
 
+/* static void map_mem_block(unsigned int index);
+ *  Enter mem_blocks[index] in the page table.  A page partly covered by
+ *  two blocks is marked shared and resolved by find_mem_block().
+ */
+static void map_mem_block(unsigned int index) {
+  const mem_block_t *pmem = &mem_blocks[index];
+  for (uint32_t page = pmem->base >> LASS_PAGE_BITS;
+       page <= (pmem->base + pmem->size - 1) >> LASS_PAGE_BITS; page++) {
+    page_table[page] = (page_table[page] == LASS_PAGE_NONE) ? (uint8_t)(index + 1) : LASS_PAGE_SHARED;
+  }
+  return;
+}
+
+/* static mem_block_t *find_mem_block(uint32_t addr);
+ *  The block holding LASS address 'addr', or NULL if unmapped.  One
+ *  page-table lookup; on a shared page, a bisection of mem_blocks_sorted.
+ */
+static mem_block_t *find_mem_block(uint32_t addr) {
+  mem_block_t *pmem;
+  addr &= LASS_ADDR_MASK;
+  uint8_t entry = page_table[addr >> LASS_PAGE_BITS];
+  if (entry == LASS_PAGE_NONE) {
+    return NULL;
+  } else if (entry != LASS_PAGE_SHARED) {
+    pmem = &mem_blocks[entry - 1];
+  } else {
+    // Last block starting at or below 'addr'
+    unsigned int lo = 0, hi = mem_block_next;
+    while (lo < hi) {
+      unsigned int mid = (lo + hi)/2;
+      if (mem_blocks_sorted[mid]->base <= addr) {
+        lo = mid + 1;
+      } else {
+        hi = mid;
+      }
+    }
+    if (lo == 0) {
+      return NULL;
+    }
+    pmem = mem_blocks_sorted[lo - 1];
+  }
+  return (addr - pmem->base < pmem->size) ? pmem : NULL;
+}
+
 static int vet_mem_block(uint32_t base, uint32_t size) {
   int overlap = 0;
   uint32_t _base, _size;
@@ -236,161 +296,99 @@ static int vet_mem_block(uint32_t base, uint32_t size) {
   return 0;
 }
 
-static void parse_lass(void *pkt_data, int size) {
-  lass_pkt_t *pkt = (lass_pkt_t *)pkt_data;
-  uint32_t trans_id_0, trans_id_1;
-  trans_id_0 = _get_nbytes(pkt->transaction_id, 4, 1);
-  trans_id_1 = _get_nbytes((pkt->transaction_id+4), 4, 1);
-  init_response(trans_id_0, trans_id_1);
-  lass_beat_t *next = (lass_beat_t *)&(pkt->cmd);
-  while (next < (lass_beat_t *)(((char *)pkt)+size-1)) {
-    next = parse_lass_beat(next);
+/* static int handle_packet(const uint8_t *req, int size, uint8_t *reply);
+ *  Build the reply to the 'size'-byte request 'req' in 'reply': as from
+ *  mem_gate, the request itself with the data of every read filled in.
+ *  A burst (rep_count words from one cmd/addr word) accesses consecutive
+ *  addresses.  Returns the reply length, which leaves out any incomplete
+ *  trailing beat; 0 for no reply.
+ */
+static int handle_packet(const uint8_t *req, int size, uint8_t *reply) {
+  int pos = LASS_HEADER_SIZE;
+  if (size < LASS_HEADER_SIZE) {
+    return 0;
   }
-#ifdef DEBUG_PRINT_REPLY
-  printc("======================== DEBUG reply ========================\r\n");
-  print_lass(reply_buf, to_send);
-#endif
-  send_response();
-  return;
-}
-static void send_response(void) {
-  int rval = udp_reply((const void *)reply_buf, to_send);
-  if (rval > 0) {
-    to_send = 0;
-  } else {
-    printc("sim_lass: send_response; rval = %d\r\n", rval);
+  memcpy(reply, req, (size_t)size);
+  while (pos + 2*LASS_WORD_SIZE <= size) {
+    uint32_t word = get_u32(req + pos);
+    uint8_t cmd = (uint8_t)(word >> 24);
+    if (cmd == LASS_CMD_BURST) {
+      uint32_t rep_count = word & LASS_ADDR_MASK;
+      uint32_t avail = (uint32_t)(size - pos - 2*LASS_WORD_SIZE)/LASS_WORD_SIZE;
+      rep_count = MIN(rep_count, avail);
+      word = get_u32(req + pos + LASS_WORD_SIZE);
+      handle_run((uint8_t)(word >> 24), word & LASS_ADDR_MASK, reply + pos + 2*LASS_WORD_SIZE, rep_count);
+      pos += 2*LASS_WORD_SIZE + LASS_WORD_SIZE*(int)rep_count;
+    } else {
+      handle_run(cmd, word & LASS_ADDR_MASK, reply + pos + LASS_WORD_SIZE, 1);
+      pos += 2*LASS_WORD_SIZE;
+    }
   }
-  return;
-}
-
-static void init_response(uint32_t id0, uint32_t id1) {
-  printc("trans_id = %08x %08x\r\n", id0, id1);
-  to_send = 0;
-  queue_u32(id0, 1);
-  queue_u32(id1, 1);
-  return;
+  return pos;
 }
 
-static void handle_beat(uint8_t cmd, uint32_t addr, uint32_t data) {
-  switch (cmd) {
-    case LASS_CMD_WRITE:
-      handle_write(addr, data);
-      break;
-    case LASS_CMD_READ:
-      data = handle_read(addr);
-      break;
-    default:  // BURST should not end up here
-      break;
+/* static void handle_run(uint8_t cmd, uint32_t addr, uint8_t *data, uint32_t n);
+ *  Apply 'cmd' to the 'n' consecutive addresses from 'addr', whose data
+ *  words (network order) are at 'data': read into, or write from.  Each
+ *  memory block is looked up once and copied as one contiguous run.
+ *  Unmapped addresses read as 0 and ignore writes.
+ */
+static void handle_run(uint8_t cmd, uint32_t addr, uint8_t *data, uint32_t n) {
+  if ((cmd != LASS_CMD_READ) && (cmd != LASS_CMD_WRITE)) {
+    return;  // Echoed as received
   }
-  // Copy cmd & addr to response buffer
-  addr += (cmd << 24);
-  queue_u32(addr, 1);
-  // Copy data to response buffer
-  queue_u32(data, 1);
-  return;
-}
-
-static void handle_write(uint32_t addr, uint32_t data) {
-  printc("WRITE: addr = 0x%08x, data = 0x%08x\r\n", addr, data);
-  mem_block_t *pmem;
-  for (unsigned int n = 0; n < mem_block_next; n++) {
-    pmem = mem_blocks_sorted[n];
-    if ((addr >= pmem->base) && (addr <= pmem->base + pmem->size - 1)) {
-      if (pmem->asbyte == ACCESS_BYTES) {
-        // Store just 1 byte
-        *(pmem->mem + (addr - pmem->base)) = (uint8_t)(data & 0xff);
-      } else if (pmem->asbyte == ACCESS_HALFWORD) {
-        // Store 2 bytes (half-word)
-        // Let's try a simple memcpy. Might get the byte-order wrong
-        memcpy((pmem->mem + (addr - pmem->base)), &data, 2);
-      } else if (pmem->asbyte == ACCESS_WORD) {
-        // Store 4 bytes (word)
-        // Let's try a simple memcpy. Might get the byte-order wrong
-        memcpy((pmem->mem + (addr - pmem->base)), &data, 4);
+  printc("%s: addr = 0x%06x, %u word(s)\r\n", get_lass_cmd(cmd), addr, n);
+  while (n > 0) {
+    mem_block_t *pmem = find_mem_block(addr);
+    uint32_t run = 1;
+    if (pmem == NULL) {
+      if (cmd == LASS_CMD_READ) {
+        memset(data, 0, LASS_WORD_SIZE);
       }
-      break;
-    }
-  }
-  return;
-}
-
-static uint32_t handle_read(uint32_t addr) {
-  mem_block_t *pmem;
-  uint32_t data = 0;
-  for (unsigned int n = 0; n < mem_block_next; n++) {
-    pmem = mem_blocks_sorted[n];
-    if ((addr >= pmem->base) && (addr <= (pmem->base + pmem->size - 1))) {
-      if (pmem->asbyte == ACCESS_BYTES) {
-        // Fetch just 1 byte
-        data = (uint32_t)*(pmem->mem + (addr - pmem->base));
-      } else if (pmem->asbyte == ACCESS_HALFWORD) {
-        // Fetch 4 bytes (word)
-        memcpy(&data, (pmem->mem + 2*(addr - pmem->base)), 2);
-      } else if (pmem->asbyte == ACCESS_WORD) {
-        // Fetch 4 bytes (word)
-        memcpy(&data, (pmem->mem + 4*(addr - pmem->base)), 4);
+    } else {
+      uint32_t off = (addr & LASS_ADDR_MASK) - pmem->base;
+      uint8_t *mem = pmem->mem + pmem->width*off;
+      run = MIN(n, pmem->size - off);
+      if ((cmd == LASS_CMD_READ) && (pmem->width == 1)) {
+        memset(data, 0, LASS_WORD_SIZE*run);
+        for (uint32_t k = 0; k < run; k++) {
+          data[LASS_WORD_SIZE*k + 3] = mem[k];
+        }
+      } else if (cmd == LASS_CMD_READ) {
+        for (uint32_t k = 0; k < run; k++) {
+          uint32_t val = 0;
+          // Host (little-endian) order in memory
+          memcpy(&val, mem + pmem->width*k, pmem->width);
+          put_u32(data + LASS_WORD_SIZE*k, val);
+        }
+      } else if (pmem->width == 1) {
+        for (uint32_t k = 0; k < run; k++) {
+          mem[k] = data[LASS_WORD_SIZE*k + 3];
+        }
+      } else {
+        for (uint32_t k = 0; k < run; k++) {
+          uint32_t val = get_u32(data + LASS_WORD_SIZE*k);
+          memcpy(mem + pmem->width*k, &val, pmem->width);
+        }
       }
-      break;
-    }
-  }
-  printc("READ: addr = 0x%08x, data = 0x%08x\r\n", addr, data);
-  return data;
-}
-
-static void ack_burst(unsigned int rep_count) {
-  uint32_t burst_rep = (LASS_CMD_BURST << 24) | rep_count;
-  queue_u32(burst_rep, 1);
-  return;
-}
-
-static void queue_u32(uint32_t src, int msb) {
-  if (msb) {
-    for (int n = 0; n < 4; n++) {
-      reply_buf[to_send++] = (src >> 8*(3-n)) & 0xff;
-    }
-  } else {
-    for (int n = 0; n < 4; n++) {
-      reply_buf[to_send++] = (src >> 8*n) & 0xff;
     }
+    addr += run;
+    data += LASS_WORD_SIZE*run;
+    n -= run;
   }
   return;
 }
 
-static lass_beat_t *parse_lass_beat(lass_beat_t *beat) {
-  unsigned int rep_count;
-  unsigned int addr;
-  unsigned int data;
-  if (beat->cmd == LASS_CMD_BURST) {
-    lass_burst_beat_t *beat_b = (lass_burst_beat_t *)beat;
-    rep_count = _get_rep_count(beat_b->rep_count);
-    addr = _get_nbytes(beat_b->addr, 3, 1);
-    ack_burst(rep_count);
-    for (unsigned int n = 0; n < rep_count; n++) {
-      data = _get_nbytes(&(beat_b->data[4*n]), 4, 1);
-      handle_beat(beat_b->cmd, addr, data);
-    }
-  } else {
-    rep_count = 0;
-    addr = _get_nbytes(beat->addr, 3, 1);
-    data = _get_nbytes(beat->data, 4, 1);
-    handle_beat(beat->cmd, addr, data);
-  }
-  return (lass_beat_t *)(((char *)beat->data) + 4*(rep_count+1));
+static uint32_t get_u32(const uint8_t *src) {
+  return ((uint32_t)src[0] << 24) | ((uint32_t)src[1] << 16) | ((uint32_t)src[2] << 8) | src[3];
 }
 
-static uint32_t _get_nbytes(uint8_t *data, int nbytes, int msb) {
-  uint32_t acc = 0;
-  nbytes = MIN(nbytes, 4);
-  if (msb) {
-    for (int n = 0; n < nbytes; n++) {
-      acc += data[nbytes-1-n] << 8*n;
-    }
-  } else {
-    for (int n = 0; n < nbytes; n++) {
-      acc += data[n] << 8*n;
-    }
-  }
-  return acc;
+static void put_u32(uint8_t *dst, uint32_t val) {
+  dst[0] = (uint8_t)(val >> 24);
+  dst[1] = (uint8_t)(val >> 16);
+  dst[2] = (uint8_t)(val >> 8);
+  dst[3] = (uint8_t)val;
+  return;
 }
 
 static unsigned int _get_rep_count(uint8_t *cnt) {
@@ -31,6 +31,12 @@ int lass_init(unsigned short int port);
  */
 void lass_service(void);
 
+/* int lass_get_fd(void);
+ *  The UDP socket lass_service() reads, for the caller to poll() on.
+ *  Returns -1 before lass_init().
+ */
+int lass_get_fd(void);
+
 /* int lass_mem_add(uint32_t base, uint32_t size, void *mem, unsigned int asbyte);
  *  Add a memory region for access via LASS device simulator.
  *  The memory region will extend from address 'base' to 'base+size-1' in the
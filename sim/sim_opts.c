@@ -0,0 +1,201 @@
+/*
+ * File: sim_opts.c
+ * Desc: Command-line options of the simulator.  main() is shared with the
+ *       firmware and takes no arguments, so they are parsed before it runs,
+ *       from a constructor which glibc passes (argc, argv, envp).  Each
+ *       option may also be given in the environment (MARBLE_SIM_...); the
+ *       command line takes precedence.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <getopt.h>
+#include "marble_api.h"
+#include "sim_api.h"
+#include "sim_clock.h"
+
+#define SIM_DEFAULT_PORT            (8003)
+// Board ID reported when the PCB revision is Marble_Simulator
+#define SIM_DEFAULT_ID_REV          (Marble_v1_4)
+
+sim_opts_t sim_opts = {
+  .port = SIM_DEFAULT_PORT,
+  .flash_file = SIM_FLASH_FILENAME,
+  .state_dir = NULL,
+  .pcb_rev = Marble_Simulator,
+  .board_id = -1,
+  .baud = 0,
+  .ctl_port = 0
+};
+
+static const struct {
+  const char *env;
+  int opt;
+} sim_env_opts[] = {
+  {"MARBLE_SIM_PORT",     'p'},
+  {"MARBLE_SIM_FLASH",    'f'},
+  {"MARBLE_SIM_DIR",      'd'},
+  {"MARBLE_SIM_REV",      'r'},
+  {"MARBLE_SIM_BOARD_ID", 'i'},
+  {"MARBLE_SIM_BAUD",     'b'},
+  {"MARBLE_SIM_CLOCK",    'c'},
+  {"MARBLE_SIM_CTL",      'C'},
+};
+
+static void sim_opts_parse(int argc, char *argv[], char *envp[]);
+static int sim_opt_set(int opt, const char *arg);
+static int parse_uint(const char *arg, unsigned long max, unsigned long *val);
+static int parse_rev(const char *arg);
+static void usage(const char *name);
+
+__attribute__((section(".init_array"), used))
+static void (* const sim_opts_init)(int, char *[], char *[]) = sim_opts_parse;
+
+static void usage(const char *name) {
+  fprintf(stderr,
+    "Usage: %s [options]\n"
+    "  -p, --port PORT      LASS (mailbox) UDP port [%d]\n"
+    "  -f, --flash FILE     flash image [%s]\n"
+    "  -d, --dir DIR        run in DIR, which holds this instance's state\n"
+    "  -r, --rev REV        PCB revision: 1.2 ... 1.9, nucleo or sim [sim]\n"
+    "  -i, --board-id ID    board ID byte [PCB revision | 0x%02x]\n"
+    "  -b, --baud BAUD      pace console output at BAUD [unpaced]\n"
+    "  -c, --clock MODE     real (default), step, fast, or a rate such as x100\n"
+    "  -C, --ctl PORT       accept clock commands on loopback UDP PORT\n"
+    "  -h, --help           this message\n"
+    "Each option may instead be set in the environment as:\n",
+    name, SIM_DEFAULT_PORT, SIM_FLASH_FILENAME, BOARD_TYPE_SIMULATION);
+  for (unsigned n = 0; n < sizeof(sim_env_opts)/sizeof(sim_env_opts[0]); n++) {
+    fprintf(stderr, "  %s\n", sim_env_opts[n].env);
+  }
+  return;
+}
+
+static void sim_opts_parse(int argc, char *argv[], char *envp[]) {
+  static const struct option longopts[] = {
+    {"port",     required_argument, NULL, 'p'},
+    {"flash",    required_argument, NULL, 'f'},
+    {"dir",      required_argument, NULL, 'd'},
+    {"rev",      required_argument, NULL, 'r'},
+    {"board-id", required_argument, NULL, 'i'},
+    {"baud",     required_argument, NULL, 'b'},
+    {"clock",    required_argument, NULL, 'c'},
+    {"ctl",      required_argument, NULL, 'C'},
+    {"help",     no_argument,       NULL, 'h'},
+    {NULL, 0, NULL, 0}
+  };
+  int opt;
+  for (unsigned n = 0; n < sizeof(sim_env_opts)/sizeof(sim_env_opts[0]); n++) {
+    const char *val = getenv(sim_env_opts[n].env);
+    if (val && (sim_opt_set(sim_env_opts[n].opt, val) < 0)) {
+      fprintf(stderr, "Invalid %s '%s'\n", sim_env_opts[n].env, val);
+      exit(2);
+    }
+  }
+  while ((opt = getopt_long(argc, argv, "p:f:d:r:i:b:c:C:h", longopts, NULL)) != -1) {
+    if (opt == 'h') {
+      usage(argv[0]);
+      exit(0);
+    } else if (opt == '?') {
+      usage(argv[0]);
+      exit(2);
+    } else if (sim_opt_set(opt, optarg) < 0) {
+      fprintf(stderr, "Invalid argument '%s' to -%c\n", optarg, opt);
+      exit(2);
+    }
+  }
+  if (optind < argc) {
+    usage(argv[0]);
+    exit(2);
+  }
+  if (sim_opts.board_id < 0) {
+    int rev = sim_opts.pcb_rev <= Marble_v1_9 ? sim_opts.pcb_rev : SIM_DEFAULT_ID_REV;
+    sim_opts.board_id = (rev & 0xf) | BOARD_TYPE_SIMULATION;
+  }
+  // Relative paths (the flash image) are then within the state directory
+  if (sim_opts.state_dir && (chdir(sim_opts.state_dir) < 0)) {
+    perror(sim_opts.state_dir);
+    exit(2);
+  }
+  return;
+}
+
+/* static int sim_opt_set(int opt, const char *arg);
+ *  Apply option 'opt' (its short form) with argument 'arg'.
+ *  Returns 0 on success, -1 on an invalid argument.
+ */
+static int sim_opt_set(int opt, const char *arg) {
+  unsigned long val;
+  switch (opt) {
+    case 'p':
+      if (parse_uint(arg, UINT16_MAX, &val) < 0 || (val == 0)) {
+        return -1;
+      }
+      sim_opts.port = (unsigned short)val;
+      break;
+    case 'f':
+      if (arg[0] == '\0') {
+        return -1;
+      }
+      sim_opts.flash_file = arg;
+      break;
+    case 'd':
+      sim_opts.state_dir = arg;
+      break;
+    case 'r':
+      if ((sim_opts.pcb_rev = parse_rev(arg)) < 0) {
+        return -1;
+      }
+      break;
+    case 'i':
+      if (parse_uint(arg, UINT8_MAX, &val) < 0) {
+        return -1;
+      }
+      sim_opts.board_id = (int)val;
+      break;
+    case 'b':
+      if (parse_uint(arg, UINT32_MAX, &val) < 0) {
+        return -1;
+      }
+      sim_opts.baud = (uint32_t)val;
+      break;
+    case 'c':
+      return sim_clock_set_mode(arg);
+    case 'C':
+      if (parse_uint(arg, UINT16_MAX, &val) < 0) {
+        return -1;
+      }
+      sim_opts.ctl_port = (unsigned short)val;
+      break;
+    default:
+      return -1;
+  }
+  return 0;
+}
+
+static int parse_uint(const char *arg, unsigned long max, unsigned long *val) {
+  char *end;
+  if ((arg[0] < '0') || (arg[0] > '9')) {
+    return -1;
+  }
+  *val = strtoul(arg, &end, 0);
+  return ((*end != '\0') || (*val > max)) ? -1 : 0;
+}
+
+// "1.2" ... "1.9", "nucleo" or "sim"; returns a Marble_PCB_Rev_t, or -1
+static int parse_rev(const char *arg) {
+  if (!strcmp(arg, "sim")) {
+    return Marble_Simulator;
+  } else if (!strcmp(arg, "nucleo")) {
+    return Marble_Nucleo;
+  } else if ((arg[0] == '1') && (arg[1] == '.') && (arg[2] >= '2') && (arg[2] <= '9')
+             && (arg[3] == '\0')) {
+    return Marble_v1_2 + (arg[2] - '2');
+  }
+  return -1;
+}
@@ -7,87 +7,141 @@
 #include <string.h>
 #include <stdio.h>
 #include <signal.h>
-#include <sys/time.h> // Needed for struct timeval
+#include <errno.h>
+#include <time.h>
+#include <poll.h>
 #include <unistd.h>   // For STDIN_FILENO
 #include <stdlib.h>   // For posix_openpt et al
 #include <fcntl.h>    // For fcntl()
 #include "marble_api.h"
 #include "console.h"
 #include "uart_fifo.h"
+#include "i2c_xact.h"
+#include "task_sched.h"
 #include "st-eeprom.h"
 #include "sim_api.h"
 #include "sim_lass.h"
+#include "sim_clock.h"
 
 /*
  * On the simulated platform, the "UART" console process will be the following:
  *  * In main loop:
- *  *   Shift in all bytes currently waiting in stdin into the FIFO
- *  *   If any byte is '\n', set msgReady flag
- *  *   If msgReady, Shift message out of FIFO
+ *  *   Shift bytes from stdin into the FIFO, up to and including one '\n'
+ *  *   On '\n', pend the message for console_service()
  *  *   handleMsg(msg);
+ *
+ * board_service() ends by sleeping in poll() on stdin, the LASS UDP socket
+ * and the clock control socket, until one of them is ready or the next
+ * scheduled task or SysTick is due.  An idle simulator uses no CPU.  All
+ * timing follows the virtual clock of sim_clock.c.
  */
 
 #define DEBUG_TX_OUT
-#define BOARD_SERVICE_SLEEP_MS       (50)
+#define SIM_SYSTICK_MIN_MS           (50)
 #define SIM_FPGA_DONE_DELAY_MS      (100)
 #define SIM_FPGA_RESETS               (0)
+// Longest sleep in poll(), in case a wake-up source was missed
+#define SIM_IDLE_MAX_MS            (1000)
+#define SIM_RX_CHUNK                (256)
+#define SIM_UART_BITS_PER_CHAR       (10)  // 8N1
 
 // Defined in sim_i2c.c; declared here to avoid creating a "real" i2c_init function in marble_api.h
 void init_sim_ltm4673(void);
 
 typedef struct {
   int toExit;
-  int msgReady;
+  int msgPending;   // Pended, not yet taken by console_service()
 } sim_console_state_t;
 
+enum {SIM_FD_STDIN, SIM_FD_LASS, SIM_FD_CTL, SIM_NFDS};
+
 // Local static variables
 static void dummy_handler(void) {}
 static int32_t _fpgaDoneTimeStart;
-static int32_t _systickIrqTimeStart;
 static int _fpgaDonePend;
 static void (*volatile marble_FPGA_DONE_handler)(void) = dummy_handler;
+static void (*volatile marble_FPGA_INT_handler)(void) = dummy_handler;
+static bool _fpgaIntLast;
 static sim_console_state_t sim_console_state;
 static void (*volatile marble_SysTick_Handler)(void) = dummy_handler;
 static uint32_t sim_systick_period_ms = 1;
+static uint64_t sim_systick_next_us;   // Virtual time of the next SysTick
 static int fpga_resets = 0;
 static int fpga_enabled = 1;
+static uart_tx_stats_t uart_tx_stats;
+static struct pollfd sim_fds[SIM_NFDS];
+// stdin bytes read but not yet shifted into the FIFO
+static uint8_t rx_buf[SIM_RX_CHUNK];
+static int rx_head, rx_len;
+// Console pacing; 0 writes everything queued at once
+static uint32_t sim_uart_baud = 0;
+static uint64_t sim_uart_free_ns;   // When the line finishes what it was given
 
 // Static Prototypes
-static int shiftMessage(void);
+static void shiftMessage(void);
 static void _sigHandler(int c);
+static void sim_systick_arm(void);
+static void sim_systick_service(void);
+static int sim_idle_ms(uint32_t now);
+static void sim_wait(int timeout_ms);
+static void sim_fpga_int_poll(void);
+static void sim_uart_drain(int room);
+static int sim_uart_wait_ms(void);
+#ifdef DEBUG_TX_OUT
+static ssize_t sim_stdout_write(void *cookie, const char *buf, size_t size);
+#endif
 
-#define MAILBOX_PORT      (8003)
 uint32_t marble_init(void) {
   _fpgaDoneTimeStart = BSP_GET_SYSTICK();
-  _systickIrqTimeStart = BSP_GET_SYSTICK();
   _fpgaDonePend = 1;
   signal(SIGINT, _sigHandler);
   fcntl(STDIN_FILENO, F_SETFL, O_NONBLOCK);
+#ifdef DEBUG_TX_OUT
+  // printf() reaches the console through the TX ring, as __io_putchar()
+  // does on hardware, so it stays in order with marble_UART_send()
+  FILE *uart = fopencookie(NULL, "w", (cookie_io_functions_t){.write = sim_stdout_write});
+  if (uart) {
+    setvbuf(uart, NULL, _IONBF, 0);
+    stdout = uart;
+  }
+#endif
+  // Set to a baud rate (e.g. 115200) to pace console output like the UART
+  sim_uart_baud = sim_opts.baud;
+  if (sim_uart_baud) {
+    printf("Console paced at %u baud\r\n", (unsigned)sim_uart_baud);
+  }
   sim_console_state.toExit = 0;
-  sim_console_state.msgReady = 0;
+  sim_console_state.msgPending = 0;
   eeprom_init();
   init_sim_ltm4673();
-  if (lass_init(MAILBOX_PORT) < 0) {
+  if (lass_init(sim_opts.port) < 0) {
     return -1;
   }
   sim_spi_init();
-  printf("Listening on port %d\r\n", MAILBOX_PORT);
+  sim_fds[SIM_FD_STDIN] = (struct pollfd){.fd = STDIN_FILENO, .events = POLLIN};
+  sim_fds[SIM_FD_LASS] = (struct pollfd){.fd = lass_get_fd(), .events = POLLIN};
+  if (sim_opts.ctl_port && (sim_clock_ctl_init(sim_opts.ctl_port) < 0)) {
+    return -1;
+  }
+  sim_fds[SIM_FD_CTL] = (struct pollfd){.fd = sim_clock_ctl_get_fd(), .events = POLLIN};
+  sim_systick_arm();
+  printf("Listening on port %u\r\n", sim_opts.port);
+  printf("Clock %s", sim_clock_mode_str());
+  if (sim_opts.ctl_port) {
+    printf(", control on port %u", sim_opts.ctl_port);
+  }
+  printf("\r\n");
   return 0;
 }
 
 // Emulate USART_RXNE_ISR() from marble_board.c but with keyboard input from stdin
 // Also emulate USART_TXE_ISR() for printf()
 int board_service(void) {
-  uint8_t outByte;
-  shiftMessage();
-  if (sim_console_state.msgReady) {
-    console_pend_msg();
-    sim_console_state.msgReady = 0;
-  }
-  // If char queue not empty
-  if (UARTTXQUEUE_Get(&outByte) != UARTTX_QUEUE_EMPTY) {
-    putchar((char)outByte);
+  // system_service() has just taken one pended message
+  if (sim_console_state.msgPending) {
+    sim_console_state.msgPending--;
   }
+  sim_uart_drain(0);
   // If enough time has elapsed, simulate the FPGA_DONE signal arrival
   uint32_t now = BSP_GET_SYSTICK();
   if (_fpgaDonePend) {
@@ -101,59 +155,204 @@ int board_service(void) {
       }
     }
   }
-  if (now - _systickIrqTimeStart >= sim_systick_period_ms) {
-    //printf("now-start = %d\r\n", now - _systickIrqTimeStart);
-    marble_SysTick_Handler();
-    _systickIrqTimeStart = now;
-  }
-  lass_service();
+  i2c_xact_service();
+  sim_fpga_int_poll();
 
   // Keep the system responsive, but don't hog resources
-  sleep(BOARD_SERVICE_SLEEP_MS/1000);
+  sim_wait(sim_idle_ms(BSP_GET_SYSTICK()));
   return sim_console_state.toExit;
 }
 
+// Emulate the FPGA_INT edge interrupt
+static void sim_fpga_int_poll(void) {
+  bool fpga_int = marble_FPGAint_get();
+  if (fpga_int && !_fpgaIntLast) {
+    marble_FPGA_INT_handler();
+  }
+  _fpgaIntLast = fpga_int;
+  return;
+}
+
+/* static int sim_idle_ms(uint32_t now);
+ *  How long the main loop may sleep: 0 while work is queued, else until
+ *  the next scheduled task, SysTick or the simulated FPGA_DONE, at most
+ *  SIM_IDLE_MAX_MS.  Everything else arrives on a polled descriptor.
+ */
+static int sim_idle_ms(uint32_t now) {
+  if (sim_console_state.toExit || sim_console_state.msgPending || (rx_head < rx_len)
+      || i2c_xact_pending()) {
+    return 0;
+  }
+  int32_t ms = sim_uart_wait_ms();
+  int32_t due = sched_next_due();
+  if ((due >= 0) && ((ms < 0) || (due < ms))) {
+    ms = due;
+  }
+  uint64_t t = sim_clock_us();
+  int32_t tick = (sim_systick_next_us > t) ? (int32_t)((sim_systick_next_us - t + 999)/1000) : 0;
+  ms = ((ms < 0) || (tick < ms)) ? tick : ms;
+  if (_fpgaDonePend) {
+    int32_t done = SIM_FPGA_DONE_DELAY_MS + 1 - (int32_t)(now - _fpgaDoneTimeStart);
+    done = done < 0 ? 0 : done;
+    ms = ((ms < 0) || (done < ms)) ? done : ms;
+  }
+  return ((ms < 0) || (ms > SIM_IDLE_MAX_MS)) ? SIM_IDLE_MAX_MS : (int)ms;
+}
+
+/* static void sim_wait(int timeout_ms);
+ *  Sleep until a descriptor is ready or 'timeout_ms' of virtual time
+ *  passes (when stepping, advance the clock instead), then service
+ *  whatever is ready: console input, LASS packets, clock commands, SysTick.
+ */
+static void sim_wait(int timeout_ms) {
+  struct timespec ts;
+  // Leftover input is shifted before any more is read
+  sim_fds[SIM_FD_STDIN].events = (rx_head < rx_len) ? 0 : POLLIN;
+  int rc = ppoll(sim_fds, SIM_NFDS, sim_clock_timeout(timeout_ms, &ts), NULL);
+  if ((rc < 0) && (errno != EINTR)) {
+    perror("poll");
+    sim_console_state.toExit = 1;
+    return;
+  }
+  if ((rx_head < rx_len) || ((rc > 0) && sim_fds[SIM_FD_STDIN].revents)) {
+    shiftMessage();
+  }
+  if ((rc > 0) && (sim_fds[SIM_FD_LASS].revents & POLLIN)) {
+    lass_service();
+    sim_fpga_int_poll();
+  }
+  if ((rc > 0) && (sim_fds[SIM_FD_CTL].revents & POLLIN)) {
+    sim_clock_ctl_service();
+  }
+  sim_systick_service();
+  return;
+}
+
+/* static int sim_uart_credit_chars(void);
+ *  Characters the emulated line could have finished sending by now.
+ *  An idle line (nothing queued) banks no credit, so output after a
+ *  pause is paced from when it is queued.
+ */
+static int sim_uart_credit_chars(void) {
+  uint64_t now = sim_clock_us()*1000;
+  uint64_t char_ns = SIM_UART_BITS_PER_CHAR*1000000000ULL/sim_uart_baud;
+  if ((UARTTXQUEUE_FillLevel() == 0) && (now > sim_uart_free_ns)) {
+    sim_uart_free_ns = now;
+  }
+  return (now > sim_uart_free_ns) ? (int)((now - sim_uart_free_ns)/char_ns) : 0;
+}
+
+// Write all of 'buf', waiting out a non-blocking terminal
+static void sim_write_all(const uint8_t *buf, int len) {
+  while (len > 0) {
+    ssize_t rc = write(STDOUT_FILENO, buf, (size_t)len);
+    if (rc > 0) {
+      buf += rc;
+      len -= (int)rc;
+    } else if ((rc < 0) && ((errno == EAGAIN) || (errno == EINTR))) {
+      struct pollfd pfd = {.fd = STDOUT_FILENO, .events = POLLOUT};
+      poll(&pfd, 1, 100);
+    } else {
+      return;
+    }
+  }
+  return;
+}
+
+/* static void sim_uart_drain(int room);
+ *  Stand-in for the TX DMA: move the queued bytes to stdout with one
+ *  write(), or only as many as the emulated baud rate allows so far.
+ *  Returns once at least 'room' bytes of the ring are free, waiting for
+ *  the line if paced, as a full ring makes the sender wait on hardware.
+ */
+static void sim_uart_drain(int room) {
+  static uint8_t buf[UARTTX_QUEUE_ITEMS];
+  while (1) {
+    int n = UARTTXQUEUE_FillLevel();
+    if (sim_uart_baud) {
+      int credit = sim_uart_credit_chars();
+      n = n < credit ? n : credit;
+    }
+    if (n > 0) {
+      n = UARTTXQUEUE_ShiftOut(buf, n);
+      sim_write_all(buf, n);
+      if (sim_uart_baud) {
+        sim_uart_free_ns += (uint64_t)n*SIM_UART_BITS_PER_CHAR*1000000000ULL/sim_uart_baud;
+      }
+      uart_tx_stats.bursts++;
+      uart_tx_stats.bytes += n;
+      if ((uint32_t)n > uart_tx_stats.max_burst) {
+        uart_tx_stats.max_burst = n;
+      }
+    }
+    if (UARTTX_QUEUE_ITEMS - UARTTXQUEUE_FillLevel() >= room) {
+      return;
+    }
+    int ms = sim_uart_wait_ms();
+    if (ms > 0) {
+      sim_clock_sleep_ms((uint32_t)ms);
+    }
+  }
+}
+
+/* static int sim_uart_wait_ms(void);
+ *  Until the paced line can take the next queued byte: 0 if now (or not
+ *  paced), -1 if nothing is queued.
+ */
+static int sim_uart_wait_ms(void) {
+  if (UARTTXQUEUE_FillLevel() == 0) {
+    return -1;
+  }
+  if ((sim_uart_baud == 0) || (sim_uart_credit_chars() > 0)) {
+    return 0;
+  }
+  uint64_t char_ns = SIM_UART_BITS_PER_CHAR*1000000000ULL/sim_uart_baud;
+  uint64_t wait_ns = sim_uart_free_ns + char_ns - sim_clock_us()*1000;
+  return (int)((wait_ns + 999999)/1000000);
+}
+
 static void _sigHandler(int c) {
-  printf("Exiting...\r\n");
   sim_console_state.toExit = 1;
   return;
 }
 
 void cleanup(void) {
+  printf("Exiting...\r\n");
+  // Whatever is still queued, at the line rate if paced
+  sim_uart_drain(UARTTX_QUEUE_ITEMS);
   return;
 }
 
-static int shiftMessage(void) {
-  fd_set rset;        // A file-descriptor set for read mode
-  int ri, rval;
-  char rc;
-  struct timeval timeout;
-  FD_ZERO(&rset);     // Initialize the data to 0s
-  // NOTE: select() MODIFIES TIMEOUT!!!   Need to reinitialize every time.
-  timeout.tv_sec = 0;
-  timeout.tv_usec = 1000;  // 1ms timeout
-  FD_SET(STDIN_FILENO, &rset);    // Add STDIN to the read set
-  rval = select(STDIN_FILENO+1, &rset, NULL, NULL, &timeout);
-  int n = UART_QUEUE_ITEMS;
-  if (rval) {
-    while (n--) {
-      ri = fgetc(stdin);
-      if ((ri == EOF) || (ri == 0)) {
-        break;
-      }
-      rc = (char)(ri & 0xff);
-      UARTQUEUE_Add((uint8_t *)&rc);
-      if (rc == UART_MSG_TERMINATOR) {
-        sim_console_state.msgReady = 1;
-        //sim_console_state.inputMsg[sim_console_state.mPtr++] = '\0';
-        break;
-      } else if (rc == UART_MSG_ABORT) {
-        UARTQUEUE_Clear();
-        break;
-      }
+/* static void shiftMessage(void);
+ *  Shift buffered stdin bytes into the FIFO, stopping after a message
+ *  terminator so that the console sees one message per pass, as it would
+ *  from the UART.  Reads stdin only once the buffer is used up.
+ */
+static void shiftMessage(void) {
+  if (rx_head == rx_len) {
+    int rc = read(STDIN_FILENO, rx_buf, sizeof(rx_buf));
+    rx_head = 0;
+    rx_len = rc > 0 ? rc : 0;
+    if ((rc == 0) || ((rc < 0) && (errno != EAGAIN) && (errno != EINTR))) {
+      // End of input; keep serving LASS without polling stdin
+      sim_fds[SIM_FD_STDIN].fd = -1;
     }
   }
-  return 0;
+  while (rx_head < rx_len) {
+    uint8_t rc = rx_buf[rx_head++];
+    if (rc == 0) {
+      continue;
+    }
+    UARTQUEUE_Add(&rc);
+    if (rc == UART_MSG_TERMINATOR) {
+      console_pend_msg();
+      sim_console_state.msgPending++;
+      break;
+    } else if (rc == UART_MSG_ABORT) {
+      UARTQUEUE_Clear();
+    }
+  }
+  return;
 }
 
 void pwr_autoboot(void) {
@@ -161,17 +360,24 @@ void pwr_autoboot(void) {
 }
 
 Marble_PCB_Rev_t marble_get_pcb_rev(void) {
-  return Marble_Simulator;
+  // Marble_Simulator unless emulating a revision (--rev)
+  return (Marble_PCB_Rev_t)sim_opts.pcb_rev;
 }
 
 void marble_print_pcb_rev(void) {
-  printf("PCB Rev: Marble Simulator\r\n");
+  if (sim_opts.pcb_rev <= Marble_v1_9) {
+    printf("PCB Rev: Marble Simulator (as v1.%d)\r\n", sim_opts.pcb_rev - Marble_v1_2 + 2);
+  } else if (sim_opts.pcb_rev == Marble_Nucleo) {
+    printf("PCB Rev: Marble Simulator (as Nucleo)\r\n");
+  } else {
+    printf("PCB Rev: Marble Simulator\r\n");
+  }
   return;
 }
 
 uint8_t marble_get_board_id(void) {
-  // Emulating Marble v1.4
-  return ((uint8_t)Marble_v1_4 & 0xf) | (uint8_t)BOARD_TYPE_SIMULATION;
+  // By default emulating Marble v1.4; see sim_opts.c
+  return (uint8_t)sim_opts.board_id;
 }
 
 void marble_UART_init(void) {
@@ -180,14 +386,39 @@ void marble_UART_init(void) {
 
 int marble_UART_send(const char *str, int size) {
 #ifdef DEBUG_TX_OUT
-  USART_Tx_LL_Queue((char *)str, size);
+  // As marble_v2: queue in ring-sized pieces, making room for each first,
+  // so a long message never waits on USART_Tx_LL_Queue()
+  int sent = 0;
+  while (sent < size) {
+    int chunk = MIN(size - sent, UARTTX_QUEUE_ITEMS);
+    sim_uart_drain(chunk);
+    int txnum = USART_Tx_LL_Queue((char *)(str + sent), chunk);
+    if (txnum < 0) {
+      return txnum;
+    }
+    sent += txnum;
+  }
+  return sent;
 #else
   char termStr[size+1];
   memcpy(termStr, str, size);
   termStr[size] = '\0';
   printf("%s", termStr);
-#endif
   return 0;
+#endif
+}
+
+#ifdef DEBUG_TX_OUT
+static ssize_t sim_stdout_write(void *cookie, const char *buf, size_t size) {
+  _UNUSED(cookie);
+  int rc = marble_UART_send(buf, (int)size);
+  return rc < 0 ? -1 : rc;
+}
+#endif
+
+void marble_UART_get_tx_stats(uart_tx_stats_t *stats) {
+  *stats = uart_tx_stats;
+  return;
 }
 
 int marble_UART_recv(char *str, int size) {
@@ -221,7 +452,7 @@ bool marble_SW_get(void) {
 }
 
 bool marble_FPGAint_get(void) {
-  return 0;
+  return sim_spi_fpga_int();
 }
 
 void marble_FMC_pwr(bool on) {
@@ -271,6 +502,11 @@ void marble_GPIOint_handlers(void (*FPGA_DONE_handler)(void)) {
   return;
 }
 
+void marble_FPGAint_handler(void (*FPGA_INT_handler)(void)) {
+  marble_FPGA_INT_handler = FPGA_INT_handler;
+  return;
+}
+
 void marble_MGTMUX_config(uint8_t mgt_msg, uint8_t store, uint8_t print) {
   _UNUSED(mgt_msg);
   _UNUSED(store);
@@ -295,10 +531,27 @@ uint32_t marble_MDIO_read(uint16_t reg) {
 }
 
 uint32_t marble_SYSTIMER_ms(uint32_t delay) {
-  sim_systick_period_ms = BOARD_SERVICE_SLEEP_MS > delay ? BOARD_SERVICE_SLEEP_MS : delay;
+  // Ticks are serviced by waking the main loop; keep the rate modest
+  sim_systick_period_ms = SIM_SYSTICK_MIN_MS > delay ? SIM_SYSTICK_MIN_MS : delay;
+  sim_systick_arm();
   return sim_systick_period_ms;
 }
 
+static void sim_systick_arm(void) {
+  sim_systick_next_us = sim_clock_us() + 1000*(uint64_t)sim_systick_period_ms;
+  return;
+}
+
+// Every SysTick period that has passed on the virtual clock
+static void sim_systick_service(void) {
+  uint64_t now = sim_clock_us();
+  while (now >= sim_systick_next_us) {
+    marble_SysTick_Handler();
+    sim_systick_next_us += 1000*(uint64_t)sim_systick_period_ms;
+  }
+  return;
+}
+
 void marble_SYSTIMER_handler(void (*handler)(void)) {
   marble_SysTick_Handler = handler;
   return;
@@ -315,7 +568,11 @@ void marble_SLEEP_us(uint32_t delay) {
 }
 
 uint32_t marble_get_tick(void) {
-  return BSP_GET_SYSTICK();
+  return (uint32_t)(sim_clock_us()/1000);
+}
+
+uint32_t marble_get_us(void) {
+  return (uint32_t)sim_clock_us();
 }
 
 void bsp_FPGAWD_set_period(uint16_t preload) {
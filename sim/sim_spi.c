@@ -2,12 +2,14 @@
  */
 
 #include <stdint.h>
+#include <stdbool.h>
 
 //#define DEBUG_PRINT
 #include <stdio.h>
 #include "sim_lass.h"
 #include "sim_api.h"
 #include "dbg.h"
+#include "mailbox.h"
 
 typedef void *SSP_PORT;
 
@@ -33,28 +35,53 @@ int sim_spi_init(void) {
   return rval;
 }
 
-int marble_SSP_write16(SSP_PORT ssp, uint16_t *buffer, unsigned size) {
-  if (ssp != SSP_FPGA) {
-    return 0;
-  }
-  uint8_t upper = (uint8_t)((*buffer) >> 8);
+/* bool sim_spi_fpga_int(void);
+ *  Level of the (virtual) FPGA_INT line.  As the gateware would, keep it
+ *  asserted while a LASS client's DOORBELL differs from the MMC's
+ *  DOORBELL_ACK (see doc/mailbox.md).
+ */
+bool sim_spi_fpga_int(void) {
+  const uint8_t *db = mailbox[MBOX_DOORBELL_PAGE];
+  return (db[MB9_DOORBELL_1] != db[MB9_DOORBELL_ACK_1]) ||
+         (db[MB9_DOORBELL_0] != db[MB9_DOORBELL_ACK_0]);
+}
+
+/* static uint16_t sim_spi_word(uint16_t word);
+ *  Decode one 16-bit word as the gateware does and return the word shifted
+ *  back out on MISO.  Every word of a multi-word (burst) transfer is handled
+ *  independently, so a page select may be followed by any number of entry
+ *  accesses under one chip select (see doc/mailbox.md).
+ */
+static uint16_t sim_spi_word(uint16_t word) {
+  uint8_t upper = (uint8_t)(word >> 8);
   if (upper == 0x22) {  // Set page
-    npage = (unsigned int)((*buffer) & 0x7f);
+    npage = (unsigned int)(word & 0x7f);
     printd("Set page %d\r\n", npage);
   } else if ((upper & 0xf0) == 0x50) {  // Mailbox write
-    mailbox[npage][(upper & 0x0f)] = (uint8_t)((*buffer) & 0xff);
+    mailbox[npage][(upper & 0x0f)] = (uint8_t)(word & 0xff);
+  } else if ((upper & 0xf0) == 0x40) {  // Mailbox read
+    return (uint16_t)mailbox[npage][(upper & 0x0f)];
   } // Ignore IP/MAC/port config and enable/disable rx for now
   return 0;
 }
 
+int marble_SSP_write16(SSP_PORT ssp, uint16_t *buffer, unsigned size) {
+  if (ssp != SSP_FPGA) {
+    return 0;
+  }
+  for (unsigned n = 0; n < size; n++) {
+    sim_spi_word(buffer[n]);
+  }
+  return 0;
+}
+
 int marble_SSP_read16(SSP_PORT ssp, uint16_t *buffer, unsigned size) {
   // Unused in application as of writing
   if (ssp != SSP_FPGA) {
     return 0;
   }
-  uint8_t upper = (uint8_t)((*buffer) >> 8);
-  if ((upper & 0xf0) == 0x40) {  // Mailbox read
-    *buffer = (uint16_t)mailbox[npage][(upper & 0x0f)];
+  for (unsigned n = 0; n < size; n++) {
+    buffer[n] = sim_spi_word(buffer[n]);
   }
   return 0;
 }
@@ -63,9 +90,8 @@ int marble_SSP_exch16(SSP_PORT ssp, uint16_t *tx_buf, uint16_t *rx_buf, unsigned
   if (ssp != SSP_FPGA) {
     return 0;
   }
-  uint8_t upper = (uint8_t)((*tx_buf) >> 8);
-  if ((upper & 0xf0) == 0x40) {  // Mailbox read
-    *rx_buf = (uint16_t)mailbox[npage][(upper & 0x0f)];
+  for (unsigned n = 0; n < size; n++) {
+    rx_buf[n] = sim_spi_word(tx_buf[n]);
   }
   return 0;
 }
@@ -3,6 +3,7 @@
  *        context.
  */
 
+#define _GNU_SOURCE   /* recvmmsg(), sendmmsg() */
 #include <sys/socket.h>
 #include <arpa/inet.h>
 #include <stdlib.h>
@@ -107,7 +108,66 @@ int udp_reply(const void *src, int nchars) {
   return rc;
 }
 
+// For poll(); -1 before udp_init()
+int udp_get_fd(void) {
+  return initialized ? udpfd : -1;
+}
+
 int udp_send(const void *src, int nchars, struct sockaddr *dest_addr, socklen_t dest_len) {
   int rc = sendto(udpfd, (char *)src, nchars, 0, dest_addr, dest_len);
   return rc;
 }
+
+/* Receive up to 'n' (at most UDP_BATCH_MAX) waiting datagrams with one
+ * recvmmsg(); returns how many, 0 if none or -errno */
+int udp_receive_batch(udp_msg_t *msgs, int n) {
+  struct mmsghdr hdrs[UDP_BATCH_MAX];
+  struct iovec iovs[UDP_BATCH_MAX];
+  if (!initialized) {
+    return -1;
+  }
+  n = n > UDP_BATCH_MAX ? UDP_BATCH_MAX : n;
+  for (int k = 0; k < n; k++) {
+    iovs[k] = (struct iovec){.iov_base = msgs[k].buf, .iov_len = ETH_MAXLEN};
+    hdrs[k] = (struct mmsghdr){.msg_hdr = {.msg_name = &msgs[k].addr,
+      .msg_namelen = sizeof(msgs[k].addr), .msg_iov = &iovs[k], .msg_iovlen = 1}};
+  }
+  int rc = recvmmsg(udpfd, hdrs, (unsigned int)n, MSG_DONTWAIT, NULL);
+  if (rc < 0) {
+    if ((errno == EAGAIN) || (errno == EINTR)) {
+      return 0;
+    }
+    printf("Error; errno = %s (%d)\r\n", strerror(errno), errno);
+    return (int)(-errno);
+  }
+  for (int k = 0; k < rc; k++) {
+    msgs[k].len = (int)hdrs[k].msg_len;
+    msgs[k].addrlen = hdrs[k].msg_hdr.msg_namelen;
+  }
+  return rc;
+}
+
+/* Send each of 'n' (at most UDP_BATCH_MAX) datagrams to its 'addr' with
+ * sendmmsg(); returns how many were sent */
+int udp_send_batch(const udp_msg_t *msgs, int n) {
+  struct mmsghdr hdrs[UDP_BATCH_MAX];
+  struct iovec iovs[UDP_BATCH_MAX];
+  int sent = 0;
+  n = n > UDP_BATCH_MAX ? UDP_BATCH_MAX : n;
+  for (int k = 0; k < n; k++) {
+    iovs[k] = (struct iovec){.iov_base = (void *)msgs[k].buf, .iov_len = (size_t)msgs[k].len};
+    hdrs[k] = (struct mmsghdr){.msg_hdr = {.msg_name = (void *)&msgs[k].addr,
+      .msg_namelen = msgs[k].addrlen, .msg_iov = &iovs[k], .msg_iovlen = 1}};
+  }
+  while (sent < n) {
+    int rc = sendmmsg(udpfd, hdrs + sent, (unsigned int)(n - sent), 0);
+    if (rc <= 0) {
+      if ((rc < 0) && (errno == EINTR)) {
+        continue;
+      }
+      break;
+    }
+    sent += rc;
+  }
+  return sent;
+}
@@ -5,10 +5,13 @@
 extern "C" {
 #endif
 
+#include <stdint.h>
 #include <sys/socket.h>
+#include <netinet/in.h>
 #include <unistd.h>   /* socklen_t read() and write() */
 
 #define ETH_MAXLEN 1500   /* maximum line nchars */
+#define UDP_BATCH_MAX 32  /* most datagrams per udp_receive_batch() */
 
 #define PROTOCOL_IPV4 0x0800
 
@@ -61,11 +64,22 @@ typedef union {
   uint16_t shorts[sizeof(eth_packet_t)/sizeof(uint16_t)];
 } eth_union_t;
 
+/* One datagram of a batch; 'addr' is the sender, or the destination */
+typedef struct {
+  uint8_t buf[ETH_MAXLEN];
+  int len;
+  struct sockaddr_in addr;
+  socklen_t addrlen;
+} udp_msg_t;
+
 int udp_init(unsigned short port);
 int udp_receive(void *dest, int nchars);
 int udp_receive_meta(eth_packet_t *pkt);
 int udp_reply(const void *src, int nchars);
 int udp_send(const void *src, int nchars, struct sockaddr *dest_addr, socklen_t dest_len);
+int udp_get_fd(void);
+int udp_receive_batch(udp_msg_t *msgs, int n);
+int udp_send_batch(const udp_msg_t *msgs, int n);
 
 #ifdef __cplusplus
 }
@@ -19,11 +19,14 @@
 #include "st-eeprom.h"
 #include "ltm4673.h"
 #include "watchdog.h"
+#include "task_sched.h"
 
 #define AUTOPUSH
 // TODO - Put this in a better place
 #define FAN_SPEED_MAX           (120)
 #define OVERTEMP_HARD_MAXIMUM   (125)
+// An EEPROM batch ('y begin') left this long without console input is discarded
+#define EE_BATCH_TIMEOUT_MS     (300000)
 
 const char unk_str[] = "> Unknown option\r\n";
 
@@ -57,16 +60,20 @@ const char *menu_str[] = {"\r\n",
   "o - SI570 status\r\n",
   "p speed[%] - Set fan speed (0-120 or 0%-100%)\r\n",
   "q otemp - Set overtemperature threshold (degC)\r\n",
-  "r enable - Set mailbox enable/disable (1/0, on/off)\r\n",
+  "r enable - Set mailbox enable/disable (1/0, on/off), or 'r refresh'\r\n",
   "s addr_hex freq_hz config_hex - Set Si570 configuration\r\n",
   "t pmbus_msg - Forward PMBus transaction to LTM4673\r\n",
   "u period - Set/get watchdog timeout period (in seconds)\r\n",
-  "v key - Set a new 128-bit secret key (non-volatile, write only).\r\n"
+  "v key - Set a new 128-bit secret key (non-volatile, write only).\r\n",
+  "w [reset] - Scheduler task timing (jitter, runtime, CPU share)\r\n",
+  "x [period [fast]] - Set/get mailbox update period (ms); 'fast' selects adaptive mode\r\n",
+  "y [begin|commit|abort] - EEPROM status, or group settings into one atomic update\r\n"
 };
 #define MENU_LEN (sizeof(menu_str)/sizeof(*menu_str))
 
 static uint8_t _msgCount;
 static uint8_t _fpgaEnable;
+static int ee_batch_task = -1;
 
 // TODO - find a better home for these
 static int console_handle_msg(char *rx_msg, int len);
@@ -81,6 +88,8 @@ static int handle_msg_fan_speed(char *rx_msg, int len);
 static int handle_msg_overtemp(char *rx_msg, int len);
 static int handle_msg_watchdog(char *rx_msg, int len);
 static int handle_msg_key(char *rx_msg, int len);
+static int handle_msg_mbox_period(char *rx_msg, int len);
+static int handle_msg_eeprom(char *rx_msg, int len);
 static int handle_mailbox_enable(char *rx_msg, int len);
 static int handle_msg_MGTMUX(char *rx_msg, int len);
 //static void print_mac_ip(mac_ip_data_t *pmac_ip_data);
@@ -104,6 +113,8 @@ static int PMBridgeConsumeArg(const char *s, int len, volatile int *arg);
 static int xatoi(char c);
 static int htoi(char c);
 static void console_print_fsynth(void);
+static void console_batch_watch(void);
+static void task_ee_batch_timeout(void);
 
 int console_init(void) {
   _msgCount = 0;
@@ -271,6 +282,18 @@ static int console_handle_msg(char *rx_msg, int len)
         case 'v':
            handle_msg_key(rx_msg, len);
            break;
+        case 'w':
+           if ((len > 2) && (rx_msg[2] == 'r')) {
+              sched_reset_stats();
+           }
+           sched_print_stats();
+           break;
+        case 'x':
+           handle_msg_mbox_period(rx_msg, len);
+           break;
+        case 'y':
+           handle_msg_eeprom(rx_msg, len);
+           break;
         default:
            printf(unk_str);
            break;
@@ -371,6 +394,7 @@ static int handle_mailbox_enable(char *rx_msg, int len) {
   //  r     Print status
   //  r on  Enable
   //  r off Disable
+  //  r refresh  Rewrite all outputs (incl. static) on the next update
   int en = 0;
   int query = 0;
   char c;
@@ -409,6 +433,11 @@ static int handle_mailbox_enable(char *rx_msg, int len) {
     }
   }
   if (argp > 0) {
+    if ((arg[0] == 'r') || (arg[0] == 'R')) {
+      printf("Refreshing all mailbox outputs\r\n");
+      mbox_refresh();
+      return 0;
+    }
     if ((arg[0] == 'o') || (arg[0] == 'O')) {
       if ((arg[1] == 'n') || (arg[1] == 'N')) {
         en = 1;
@@ -643,7 +672,12 @@ int console_service(void) {
     len = console_shift_msg(msg);
     _msgCount--;
     if (len) {
-      return console_handle_msg((char *)msg, len);
+      // Only the console's own settings go into its EEPROM batch
+      eeprom_batch_enter();
+      int rval = console_handle_msg((char *)msg, len);
+      eeprom_batch_leave();
+      console_batch_watch();
+      return rval;
     }
   }
   if (_fpgaEnable) {
@@ -862,6 +896,106 @@ static int handle_msg_watchdog(char *rx_msg, int len) {
   return 0;
 }
 
+static int handle_msg_mbox_period(char *rx_msg, int len) {
+  //  Msg             Action
+  //  x               Print current setting
+  //  x period        Update every 'period' ms
+  //  x period fast   Adaptive; between 'fast' (activity) and 'period' (idle) ms
+  int index = sscanfNext(rx_msg, len);
+  int period, fast;
+  int adaptive = 0;
+  uint8_t data[5];
+  if (index < 0) {
+    mbox_print_period();
+    return -1;
+  }
+  period = sscanfUnsignedDecimal((rx_msg + index), len-index);
+  fast = period;
+  int next = sscanfNext((rx_msg + index), len-index);
+  if (next > 0) {
+    index += next;
+    fast = sscanfUnsignedDecimal((rx_msg + index), len-index);
+    adaptive = 1;
+  }
+  if ((period < 0) || (fast < 0)) {
+    printf("Failed to parse\r\n");
+    return -1;
+  }
+  // Set and peg to limits
+  period = mbox_set_period((uint32_t)period, (uint32_t)fast, adaptive);
+  // Store what mbox_set_period() applied, not what was typed
+  fast = MIN(MAX(fast, MBOX_PERIOD_MIN_MS), period);
+  MBOX_PERIOD_ASSEMBLE(data, period, fast, adaptive);
+  eeprom_store_mbox_period((const uint8_t *)data, 5);
+  mbox_print_period();
+  return 0;
+}
+
+/*
+ * static void console_batch_watch(void);
+ *  (Re)start the idle timeout of an open EEPROM batch, or stop it once the
+ *  batch is closed.
+ */
+static void console_batch_watch(void) {
+  if (eeprom_batch_open()) {
+    if (ee_batch_task < 0) {
+      ee_batch_task = sched_add_oneshot("ee_batch", task_ee_batch_timeout, SCHED_PRIO_LOW);
+    }
+    sched_arm(ee_batch_task, EE_BATCH_TIMEOUT_MS);
+  } else {
+    sched_cancel(ee_batch_task);
+  }
+  return;
+}
+
+static void task_ee_batch_timeout(void) {
+  if (eeprom_batch_open()) {
+    eeprom_abort();
+    FPGAWD_LoadKey();
+    printf("EEPROM batch idle for %d s; staged settings discarded\r\n", EE_BATCH_TIMEOUT_MS/1000);
+  }
+  return;
+}
+
+static int handle_msg_eeprom(char *rx_msg, int len) {
+  //  Msg             Action
+  //  y               Print EEPROM status
+  //  y begin         Stage console settings from now on (see EE_BATCH_TIMEOUT_MS)
+  //  y commit        Store the staged settings together
+  //  y abort         Discard the staged settings (those applied stay in effect)
+  int index = sscanfNext(rx_msg, len);
+  int rval;
+  if (index < 0) {
+    eeprom_print_status();
+    return 0;
+  }
+  switch (rx_msg[index]) {
+    case 'b':
+      eeprom_begin();
+      printf("Batch open; settings are staged until 'y commit'\r\n");
+      break;
+    case 'c':
+      rval = eeprom_commit();
+      // The watchdog only uses a committed key
+      FPGAWD_LoadKey();
+      if (rval) {
+        printf("Commit failed (%d)\r\n", rval);
+        return -1;
+      }
+      printf("Committed\r\n");
+      break;
+    case 'a':
+      eeprom_abort();
+      FPGAWD_LoadKey();
+      printf("Batch discarded\r\n");
+      break;
+    default:
+      printf("Unknown: %c\r\n", rx_msg[index]);
+      return -1;
+  }
+  return 0;
+}
+
 #define KEY_LEN     (16)
 static int handle_msg_key(char *rx_msg, int len) {
   int index = sscanfNext(rx_msg, len);
@@ -890,6 +1024,7 @@ static int handle_msg_key(char *rx_msg, int len) {
   }
   // Store non-volatile
   eeprom_store_wd_key((const uint8_t *)key, KEY_LEN);
+  FPGAWD_LoadKey();
   // Clobber the stack memory before exiting.
   memset(key, 0xaa, KEY_LEN);
   return 0;
@@ -6,6 +6,7 @@
 #include "max6639.h"
 #include "math.h"
 #include "ltm4673.h"
+#include "telem.h"
 
 /* ============================= Helper Macros ============================== */
 #define MAX6639_GET_TEMP_DOUBLE(rTemp, rTempExt) \
@@ -18,6 +19,8 @@ extern I2C_BUS I2C_PM;
 static int set_max6639_reg(int regno, int value);
 static int PMBridge_do_sanitized_xact(uint16_t *xact, int len);
 static void PMBridge_hook_read(uint8_t addr, uint8_t cmd, const uint8_t *data, int len);
+static int LM75_read_cached(uint8_t dev, LM75_REG reg, int *data);
+static void print_telem_age(telem_src_t src);
 //static void PMBridge_hook_write(uint8_t addr, const uint8_t *data, int len);  // DELETEME
 
 /* ========================== Function Definitions ========================== */
@@ -113,7 +116,8 @@ void print_max6639_decoded(void)
   double temp;
   int rTemp, rTempExt;
   int rval;
-  printf("MAX6639 Temperatures:\n");
+  printf("MAX6639 Temperatures:");
+  print_telem_age(TELEM_MAX6639);
   // Read/decode temperature for channels 1 and 2
   for (int nChan = 1; nChan < 3; nChan++) {
     if (nChan == 1) {
@@ -123,8 +127,13 @@ void print_max6639_decoded(void)
       rTemp = MAX6639_TEMP_CH2;
       rTempExt = MAX6639_TEMP_EXT_CH2;
     }
-    rval = get_max6639_reg(rTemp, &vTemp);
-    rval |= get_max6639_reg(rTempExt, &vTempExt);
+    // Prefer the telemetry snapshot; fall back to the bus if not yet sampled
+    rval = telem_max6639_read(rTemp, &vTemp);
+    rval |= telem_max6639_read(rTempExt, &vTempExt);
+    if (rval) {
+      rval = get_max6639_reg(rTemp, &vTemp);
+      rval |= get_max6639_reg(rTempExt, &vTempExt);
+    }
     if (rval) {
       printf("I2C fault!\r\n");
       return;
@@ -209,7 +218,7 @@ void LM75_print(uint8_t dev)
    char p_buf[40];
 
    for (i = 0; i < LM75_MAX; i++) {
-      if (LM75_read(dev, rlist[i], &recv) == 0) {
+      if (LM75_read_cached(dev, rlist[i], &recv) == 0) {
          snprintf(p_buf, 40, ok_str, dev, rlist[i], recv);
       } else {
          snprintf(p_buf, 40, fail_str, dev, rlist[i]);
@@ -222,13 +231,14 @@ void LM75_print_decoded(uint8_t dev)
 {
   int vTemp;
   if (dev == LM75_0) {
-    printf("LM75_0 (U29) Registers:\n");
+    printf("LM75_0 (U29) Registers:");
   } else {
-    printf("LM75_1 (U28) Registers:\n");
+    printf("LM75_1 (U28) Registers:");
   }
+  print_telem_age(TELEM_LM75);
 #define X(name, val) \
   do{ \
-    LM75_read(dev, val, &vTemp); \
+    LM75_read_cached(dev, val, &vTemp); \
     printf("  %s (0x%X) = %d\n", #name, val, vTemp); \
   }while(0);
   LM75_FOR_EACH_REGISTER()
@@ -236,6 +246,30 @@ void LM75_print_decoded(uint8_t dev)
   return;
 }
 
+/*
+ * static int LM75_read_cached(uint8_t dev, LM75_REG reg, int *data);
+ *  Console readers use the telemetry snapshot, going to the bus only if
+ *  the sampler has not produced one (yet).
+ */
+static int LM75_read_cached(uint8_t dev, LM75_REG reg, int *data)
+{
+   if (telem_lm75_read(dev, reg, data) == 0) {
+      return 0;
+   }
+   return LM75_read(dev, reg, data);
+}
+
+static void print_telem_age(telem_src_t src)
+{
+  int32_t age = telem_age(src);
+  if (age < 0) {
+    printf(" (live)\n");
+  } else {
+    printf(" (cached, %ld ms old)\n", (long)age);
+  }
+  return;
+}
+
 /*
  */
 void LM75_Init(void) {
@@ -314,6 +348,10 @@ void I2C_PM_bus_display(void)
    LM75_print(LM75_0);
    LM75_print(LM75_1);
    if ((marble_get_board_id() & 0xf) < Marble_v1_4) xrp_dump(XRP7724);
+   else if (telem_get()->valid[TELEM_LTM4673]) {
+      ltm4673_print_telem(telem_get()->ltm4673);
+      telem_rail_print();
+   }
    else ltm4673_read_telem(LTM4673);
 }
 
@@ -444,6 +482,7 @@ static int PMBridge_do_sanitized_xact(uint16_t *xact, int len) {
     rval = marble_I2C_cmdrecv(I2C_PM, (uint8_t)xact[0], (uint8_t)xact[1], data, len-4);
     PMBridge_hook_read((uint8_t)xact[0], (uint8_t)xact[1], data, len-4);
     if (rval != HAL_OK) {
+      ltm4673_page_invalidate();
       printf("Read failed with code: 0x%x\r\n", rval);
     } else {
       // Readback
@@ -458,6 +497,9 @@ static int PMBridge_do_sanitized_xact(uint16_t *xact, int len) {
       // Data to send must be uint8_t, not uint16_t
       data[n] = (uint8_t)(xact[n+1] & 0xff);
     }
+    // Forget the cached LTM4673 PAGE on any host write; if this is a PAGE
+    // write and it succeeds, the hook re-establishes it.
+    ltm4673_page_invalidate();
     rval = marble_I2C_send(I2C_PM, (uint8_t)xact[0], data, len-1);
     //PMBridge_hook_write((uint8_t)xact[0], data, len-1);
     if (rval != HAL_OK) {
@@ -0,0 +1,153 @@
+/*
+ * File: i2c_xact.c
+ * Desc: Queued, non-blocking I2C transaction engine (see i2c_xact.h).
+ *
+ *       Each bus has a FIFO of descriptors and at most one active transfer.
+ *       Only the active descriptor is touched from interrupt context, and
+ *       only through i2c_xact_complete(); queue manipulation, timeouts and
+ *       callbacks all happen in thread mode.
+ */
+
+#include "i2c_xact.h"
+#include <stddef.h>
+
+typedef struct {
+  int used;
+  I2C_BUS bus;
+  i2c_xact_t *head;         // Queued, not yet started
+  i2c_xact_t *tail;
+  i2c_xact_t *active;
+} i2c_xact_bus_t;
+
+static i2c_xact_bus_t buses[I2C_XACT_MAX_BUSES];
+
+static i2c_xact_bus_t *find_bus(I2C_BUS bus) {
+  for (int n = 0; n < I2C_XACT_MAX_BUSES; n++) {
+    if (buses[n].used && (buses[n].bus == bus)) {
+      return &buses[n];
+    }
+  }
+  for (int n = 0; n < I2C_XACT_MAX_BUSES; n++) {
+    if (!buses[n].used) {
+      buses[n].used = 1;
+      buses[n].bus = bus;
+      return &buses[n];
+    }
+  }
+  return NULL;
+}
+
+void i2c_xact_init(i2c_xact_t *x, I2C_BUS bus, uint8_t addr, uint8_t rnw,
+                   int cmd, uint8_t cmd_len, uint8_t *data, int len,
+                   i2c_xact_cb_t cb, void *ctx) {
+  x->bus = bus;
+  x->addr = addr;
+  x->rnw = rnw;
+  x->cmd = cmd < 0 ? -1 : cmd;
+  x->cmd_len = cmd < 0 ? 0 : cmd_len;
+  x->data = data;
+  x->len = len;
+  x->cb = cb;
+  x->ctx = ctx;
+  x->rc = I2C_XACT_OK;
+  x->state = I2C_XACT_IDLE;
+  x->next = NULL;
+  return;
+}
+
+static void start_next(i2c_xact_bus_t *b) {
+  i2c_xact_t *x = b->head;
+  if ((b->active != NULL) || (x == NULL)) {
+    return;
+  }
+  b->head = x->next;
+  if (b->head == NULL) {
+    b->tail = NULL;
+  }
+  x->next = NULL;
+  x->state = I2C_XACT_ACTIVE;
+  x->t_start = BSP_GET_SYSTICK();
+  b->active = x;
+  int rc = marble_I2C_xact_start(x);
+  if (rc != I2C_XACT_OK) {
+    i2c_xact_complete(x, rc);
+  }
+  return;
+}
+
+int i2c_xact_submit(i2c_xact_t *x) {
+  if (x->state != I2C_XACT_IDLE) {
+    return -1;
+  }
+  i2c_xact_bus_t *b = find_bus(x->bus);
+  if (b == NULL) {
+    return -1;
+  }
+  x->next = NULL;
+  x->rc = I2C_XACT_OK;
+  x->state = I2C_XACT_QUEUED;
+  if (b->tail) {
+    b->tail->next = x;
+  } else {
+    b->head = x;
+  }
+  b->tail = x;
+  start_next(b);
+  return 0;
+}
+
+void i2c_xact_complete(i2c_xact_t *x, int rc) {
+  x->rc = rc;
+  x->state = I2C_XACT_DONE;
+  return;
+}
+
+void i2c_xact_service(void) {
+  for (int n = 0; n < I2C_XACT_MAX_BUSES; n++) {
+    i2c_xact_bus_t *b = &buses[n];
+    i2c_xact_t *x = b->active;
+    if (x == NULL) {
+      continue;
+    }
+    if ((x->state != I2C_XACT_DONE) &&
+        (BSP_GET_SYSTICK() - x->t_start >= I2C_XACT_TIMEOUT_MS)) {
+      // Stuck peripheral or bus; recover so the rest of the queue can run
+      marble_I2C_xact_abort(x->bus);
+      i2c_xact_complete(x, I2C_XACT_TIMEOUT);
+    }
+    if (x->state != I2C_XACT_DONE) {
+      continue;
+    }
+    // Retire before running the hook/callback; either may submit more work
+    b->active = NULL;
+    x->state = I2C_XACT_IDLE;
+    start_next(b);
+    if (x->rc == I2C_XACT_OK) {
+      marble_I2C_xact_hook(x);
+    }
+    if (x->cb) {
+      x->cb(x);
+    }
+  }
+  return;
+}
+
+int i2c_xact_wait(i2c_xact_t *x) {
+  while (x->state != I2C_XACT_IDLE) {
+    i2c_xact_service();
+  }
+  return x->rc;
+}
+
+int i2c_xact_pending(void) {
+  int count = 0;
+  for (int n = 0; n < I2C_XACT_MAX_BUSES; n++) {
+    if (buses[n].active) {
+      count++;
+    }
+    for (const i2c_xact_t *x = buses[n].head; x != NULL; x = x->next) {
+      count++;
+    }
+  }
+  return count;
+}
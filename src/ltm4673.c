@@ -12,8 +12,9 @@
 /* ============================ Static Variables ============================ */
 extern I2C_BUS I2C_PM;
 static uint8_t ltm4673_page = 0;
+// Nonzero while ltm4673_page is known to match the device's PAGE register
+static uint8_t ltm4673_page_known = 0;
 
-#define FLOAT_LIMITS
 #define PM_LIMITS_COLS 4
 // Linear11 Signed PMBus data format
 #define LTM4673_L16_LIMIT_MV(cmd, min_mv, max_mv) \
@@ -362,14 +363,7 @@ static const uint8_t ltm4673_encodings[256] = {
   LTM4673_UNUSED, // 0xff
 };
 
-#ifdef FLOAT_LIMITS
-static float ltm4673_decode_float(uint8_t cmd, uint16_t data);
-static uint16_t ltm4673_encode_float(uint8_t cmd, float val);
-#else
-static int ltm4673_decode(uint8_t cmd, uint16_t data);
-static uint16_t ltm4673_encode(uint8_t cmd, int val);
-#endif
-
+static int32_t ltm4673_decode(uint8_t cmd, uint16_t data);
 
 static uint16_t ltm4673_apply_limits_cmd(uint8_t cmd, uint16_t val_enc, uint16_t mask,
                                      uint16_t min_enc, uint16_t max_enc);
@@ -381,6 +375,9 @@ void ltm4673_init(void) {
   uint8_t page;
   if (marble_I2C_cmdrecv(I2C_PM, LTM4673_DEV_ADDR_8BIT, LTM4673_PAGE, &page, 1) == HAL_OK) {
     ltm4673_page = page;
+    ltm4673_page_known = 1;
+  } else {
+    ltm4673_page_known = 0;
   }
   return;
 }
@@ -389,64 +386,77 @@ uint8_t ltm4673_get_page(void) {
   return ltm4673_page;
 }
 
-#ifdef FLOAT_LIMITS
-static float ltm4673_decode_float(uint8_t cmd, uint16_t data) {
-  uint8_t encoding = ltm4673_encodings[cmd];
-  float val = 0;
-  if (encoding == LTM4673_ENCODING_RAW) {
-    val = (float)data;
-  } else if (encoding == LTM4673_ENCODING_L11) {
-    // Defaulting to V encoding
-    val = l11_to_v_float(data);
-  } else if (encoding == LTM4673_ENCODING_L16) {
-    val = l16_to_v_float(data);
+/* int ltm4673_page_cached(uint8_t page);
+ *  Nonzero if 'page' is known to be selected, i.e. a PAGE write can be skipped.
+ *  The cache follows every successful PAGE write or read seen by the hooks.
+ */
+int ltm4673_page_cached(uint8_t page) {
+  return ltm4673_page_known && (ltm4673_page == page);
+}
+
+/* void ltm4673_page_invalidate(void);
+ *  Forget the selected page after a failed transaction (a PAGE write may or
+ *  may not have landed) or a write the hooks cannot account for.  The next
+ *  ltm4673_page_select() then writes PAGE unconditionally.
+ */
+void ltm4673_page_invalidate(void) {
+  ltm4673_page_known = 0;
+  return;
+}
+
+/* uint8_t ltm4673_first_page(void);
+ *  Where to start a walk over all channels: the selected channel if known,
+ *  else page 0.  Visiting (first + n) % LTM4673_TELEM_NPAGES saves one PAGE
+ *  write per walk.
+ */
+uint8_t ltm4673_first_page(void) {
+  if (ltm4673_page_known && (ltm4673_page < LTM4673_TELEM_NPAGES)) {
+    return ltm4673_page;
   }
-  return val;
+  return 0;
 }
 
-static uint16_t ltm4673_encode_float(uint8_t cmd, float val) {
-  uint16_t data = 0;
-  uint8_t encoding = ltm4673_encodings[cmd];
-  if (encoding == LTM4673_ENCODING_RAW) {
-    data = (uint16_t)val;
-  } else if (encoding == LTM4673_ENCODING_L11) {
-    // Defaulting to V encoding
-    data = v_to_l11_float(val);
-  } else if (encoding == LTM4673_ENCODING_L16) {
-    data = v_to_l16_float(val);
+/* int ltm4673_page_select(uint8_t dev, uint8_t page);
+ *  Write PAGE unless 'page' is already selected.  Returns 0 on success.
+ */
+int ltm4673_page_select(uint8_t dev, uint8_t page) {
+  if (ltm4673_page_cached(page)) {
+    return HAL_OK;
+  }
+  int rc = marble_I2C_cmdsend(I2C_PM, dev, LTM4673_PAGE, &page, 1);
+  if (rc != HAL_OK) {
+    ltm4673_page_invalidate();
   }
-  return data;
+  return rc;
 }
 
-#else
-static int ltm4673_decode(uint8_t cmd, uint16_t data) {
-  uint8_t encoding = ltm4673_encodings[cmd];
-  int val = 0;
-  if (encoding == LTM4673_ENCODING_RAW) {
-    val = (int)data;
-  } else if (encoding == LTM4673_ENCODING_L11) {
-    // Defaulting to mV encoding
-    val = l11_to_mv_int(data);
-  } else if (encoding == LTM4673_ENCODING_L16) {
-    val = L16_TO_MV(data);
+/* int ltm4673_page_read(uint8_t dev, uint8_t page, uint8_t cmd, uint8_t *data, int len);
+ *  Read 'len' bytes of register 'cmd' on channel 'page'.  Returns 0 on success.
+ */
+int ltm4673_page_read(uint8_t dev, uint8_t page, uint8_t cmd, uint8_t *data, int len) {
+  int rc = ltm4673_page_select(dev, page);
+  if (rc == HAL_OK) {
+    rc = marble_I2C_cmdrecv(I2C_PM, dev, cmd, data, len);
   }
-  return val;
+  if (rc != HAL_OK) {
+    ltm4673_page_invalidate();
+  }
+  return rc;
 }
 
-static uint16_t ltm4673_encode(uint8_t cmd, int val) {
-  uint16_t data = 0;
+/* Register value in milli-units (mV, mA, m-degC) */
+static int32_t ltm4673_decode(uint8_t cmd, uint16_t data) {
   uint8_t encoding = ltm4673_encodings[cmd];
+  int32_t val = 0;
   if (encoding == LTM4673_ENCODING_RAW) {
-    data = (uint16_t)val;
+    val = (int32_t)data;
   } else if (encoding == LTM4673_ENCODING_L11) {
-    // Defaulting to mV encoding
-    data = mv_to_l11_int(val);
+    val = l11_to_milli(data);
   } else if (encoding == LTM4673_ENCODING_L16) {
-    data = MV_TO_L16(val);
+    val = l16_to_milli(data);
   }
-  return data;
+  return val;
 }
-#endif
 
 int ltm4673_ch_status(uint8_t dev)
 {
@@ -456,14 +466,13 @@ int ltm4673_ch_status(uint8_t dev)
   }
    const uint8_t STATUS_WORD = 0x79;
    uint8_t i2c_dat[4];
-   for (unsigned jx = 0; jx < 4; jx++) {
+   uint8_t first = ltm4673_first_page();
+   for (unsigned jx = 0; jx < LTM4673_TELEM_NPAGES; jx++) {
       marble_SLEEP_ms(200);
-      // start selecting channel/page 0 until you finish reading
-      // data for all 4 channels
-      uint8_t page = 0x00 + jx;
-      marble_I2C_cmdsend(I2C_PM, dev, 0x00, &page, 1);
+      // Visit all 4 channels, starting from the one already selected
+      uint8_t page = (first + jx) % LTM4673_TELEM_NPAGES;
       // marble_I2C_cmd_recv should return 0, if everything is good, see page 100
-      int rc = marble_I2C_cmdrecv(I2C_PM, dev, STATUS_WORD, i2c_dat, 2);
+      int rc = ltm4673_page_read(dev, page, STATUS_WORD, i2c_dat, 2);
       if (rc == HAL_OK) {
           uint16_t word0 = ((unsigned int) i2c_dat[1] << 8) | i2c_dat[0];
           if (word0) {
@@ -475,68 +484,91 @@ int ltm4673_ch_status(uint8_t dev)
    return 1;
 }
 
+// Telemetry registers, see page 105
+const ltm4673_telem_t ltm4673_telem_table[LTM4673_TELEM_NREGS] = {
+   {LTM4673_READ_VIN,              "V     READ_VIN"},
+   {LTM4673_READ_IIN,              "A     READ_IIN"},
+   {LTM4673_READ_PIN,              "W     READ_PIN"},
+   {LTM4673_READ_VOUT,             "V     READ_VOUT"},
+   {LTM4673_READ_IOUT,             "A     READ_IOUT"},
+   {LTM4673_READ_TEMPERATURE_1,    "degC  READ_TEMPERATURE_1"},
+   {LTM4673_READ_TEMPERATURE_2,    "degC  READ_TEMPERATURE_2"},
+   {LTM4673_READ_POUT,             "W     READ_POUT"},
+   {LTM4673_MFR_READ_IOUT,         "mA    MFR_READ_IOUT"},
+   {LTM4673_MFR_IIN_PEAK,          "A     MFR_IIN_PEAK"},
+   {LTM4673_MFR_IIN_MIN,           "A     MFR_IIN_MIN"},
+   {LTM4673_MFR_PIN_PEAK,          "W     MFR_PIN_PEAK"},
+   {LTM4673_MFR_PIN_MIN,           "W     MFR_PIN_MIN"},
+   {LTM4673_MFR_IOUT_SENSE_VOLTAGE,"V     MFR_IOUT_SENSE_VOLTAGE"},
+   {LTM4673_MFR_VIN_PEAK,          "V     MFR_VIN_PEAK"},
+   {LTM4673_MFR_VOUT_PEAK,         "V     MFR_VOUT_PEAK"},
+   {LTM4673_MFR_IOUT_PEAK,         "A     MFR_IOUT_PEAK"},
+   {LTM4673_MFR_TEMPERATURE_1_PEAK,"degC  MFR_TEMPERATURE_1_PEAK"},
+   {LTM4673_MFR_VIN_MIN,           "V     MFR_VIN_MIN"},
+   {LTM4673_MFR_VOUT_MIN,          "V     MFR_VOUT_MIN"},
+   {LTM4673_MFR_IOUT_MIN,          "A     MFR_IOUT_MIN"},
+   {LTM4673_MFR_TEMPERATURE_1_MIN, "degC  MFR_TEMPERATURE_1_MIN"}};
+
+static void ltm4673_print_telem_word(unsigned ix, uint16_t word0) {
+   int regno = ltm4673_telem_table[ix].reg;
+   int32_t milli;  // thousandths of the unit in the description
+   if ((uint8_t)regno == LTM4673_MFR_READ_IOUT) {
+       milli = 2500*(int32_t)word0;  // special for MFR_READ_IOUT (2.5 mA/count)
+   } else if ((uint8_t)regno == LTM4673_MFR_IOUT_SENSE_VOLTAGE) {
+       milli = l16_to_milli(word0/40); // special case for MFR_IOUT_SENSE_VOLTAGE
+   } else if (ltm4673_encodings[(uint8_t)regno] == LTM4673_ENCODING_L11) {
+       milli = l11_to_milli(word0);
+   } else if (ltm4673_encodings[(uint8_t)regno] == LTM4673_ENCODING_L16) {
+       milli = l16_to_milli(word0);
+   } else {
+       milli = 1000*(int32_t)word0;
+   }
+   // As %7.3f, without floating point
+   unsigned long mag = milli < 0 ? 0UL - (unsigned long)milli : (unsigned long)milli;
+   char num[16];
+   snprintf(num, sizeof(num), "%s%lu.%03lu", milli < 0 ? "-" : "", mag/1000, mag%1000);
+   printf("r[%2.2x] = 0x%4.4x = %5d = %7s %s\r\n", regno, word0, word0, num, ltm4673_telem_table[ix].desc);
+   return;
+}
+
 void ltm4673_read_telem(uint8_t dev) {
-   struct {int b; const char *m;} r_table[] = {
-      // see page 105
-      {LTM4673_READ_VIN,              "V     READ_VIN"},
-      {LTM4673_READ_IIN,              "A     READ_IIN"},
-      {LTM4673_READ_PIN,              "W     READ_PIN"},
-      {LTM4673_READ_VOUT,             "V     READ_VOUT"},
-      {LTM4673_READ_IOUT,             "A     READ_IOUT"},
-      {LTM4673_READ_TEMPERATURE_1,    "degC  READ_TEMPERATURE_1"},
-      {LTM4673_READ_TEMPERATURE_2,    "degC  READ_TEMPERATURE_2"},
-      {LTM4673_READ_POUT,             "W     READ_POUT"},
-      {LTM4673_MFR_READ_IOUT,         "mA    MFR_READ_IOUT"},
-      {LTM4673_MFR_IIN_PEAK,          "A     MFR_IIN_PEAK"},
-      {LTM4673_MFR_IIN_MIN,           "A     MFR_IIN_MIN"},
-      {LTM4673_MFR_PIN_PEAK,          "W     MFR_PIN_PEAK"},
-      {LTM4673_MFR_PIN_MIN,           "W     MFR_PIN_MIN"},
-      {LTM4673_MFR_IOUT_SENSE_VOLTAGE,"V     MFR_IOUT_SENSE_VOLTAGE"},
-      {LTM4673_MFR_VIN_PEAK,          "V     MFR_VIN_PEAK"},
-      {LTM4673_MFR_VOUT_PEAK,         "V     MFR_VOUT_PEAK"},
-      {LTM4673_MFR_IOUT_PEAK,         "A     MFR_IOUT_PEAK"},
-      {LTM4673_MFR_TEMPERATURE_1_PEAK,"degC  MFR_TEMPERATURE_1_PEAK"},
-      {LTM4673_MFR_VIN_MIN,           "V     MFR_VIN_MIN"},
-      {LTM4673_MFR_VOUT_MIN,          "V     MFR_VOUT_MIN"},
-      {LTM4673_MFR_IOUT_MIN,          "A     MFR_IOUT_MIN"},
-      {LTM4673_MFR_TEMPERATURE_1_MIN, "degC  MFR_TEMPERATURE_1_MIN"}};
    printf("LTM4673 Telemetry register dump:\n");
-   //float L16 = 0.0001220703125;  // 2**(-13)
-   for (unsigned jx = 0; jx < 4; jx++) {
-      // start selecting channel/page 0 until you finish reading
-      // telemetry data for all 4 channels
-      uint8_t page = 0x00 + jx;
-      marble_I2C_cmdsend(I2C_PM, dev, 0x00, &page, 1);
+   uint8_t first = ltm4673_first_page();
+   for (unsigned jx = 0; jx < LTM4673_TELEM_NPAGES; jx++) {
+      // Visit all 4 channels, starting from the one already selected;
+      // PAGE is only written when changing channel
+      uint8_t page = (first + jx) % LTM4673_TELEM_NPAGES;
       printf("> Read page/channel: %x\n", page);
-      const unsigned tlen = sizeof(r_table)/sizeof(r_table[0]);
-      for (unsigned ix=0; ix<tlen; ix++) {
+      for (unsigned ix=0; ix<LTM4673_TELEM_NREGS; ix++) {
           uint8_t i2c_dat[4];
-          int regno = r_table[ix].b;
-          int rc = marble_I2C_cmdrecv(I2C_PM, dev, regno, i2c_dat, 2);
-          uint16_t word0 = ((unsigned int) i2c_dat[1] << 8) | i2c_dat[0];
-          float phys_unit;
-          //int mask, comp2;
+          int regno = ltm4673_telem_table[ix].reg;
+          int rc = ltm4673_page_read(dev, page, regno, i2c_dat, 2);
           if (rc == HAL_OK) {
-              if ((uint8_t)regno == LTM4673_MFR_READ_IOUT) {
-                  phys_unit = word0*2.5;  // special for MFR_READ_IOUT
-              } else if ((uint8_t)regno == LTM4673_MFR_IOUT_SENSE_VOLTAGE) {
-                  phys_unit = l16_to_v_float(word0*0.025); // special case for MFR_IOUT_SENSE_VOLTAGE
-              } else if (ltm4673_encodings[(uint8_t)regno] == LTM4673_ENCODING_L11) {
-                  phys_unit = l11_to_v_float(word0);
-              } else if (ltm4673_encodings[(uint8_t)regno] == LTM4673_ENCODING_L16) {
-                  phys_unit = l16_to_v_float(word0);
-              } else {
-                  phys_unit = (float)word0;
-              }
-              printf("r[%2.2x] = 0x%4.4x = %5d = %7.3f %s\r\n", regno, word0, word0, phys_unit, r_table[ix].m);
+              ltm4673_print_telem_word(ix, ((unsigned int) i2c_dat[1] << 8) | i2c_dat[0]);
           } else {
-              printf("r[%2.2x]    unread          (%s)\r\n", regno, r_table[ix].m);
+              printf("r[%2.2x]    unread          (%s)\r\n", regno, ltm4673_telem_table[ix].desc);
           }
       }
    }
    return;
 }
 
+/*
+ * void ltm4673_print_telem(const uint16_t telem[][LTM4673_TELEM_NREGS]);
+ *  Same output as ltm4673_read_telem() but from words already read (e.g. by
+ *  the telemetry sampler) in ltm4673_telem_table order, one row per page.
+ */
+void ltm4673_print_telem(const uint16_t telem[][LTM4673_TELEM_NREGS]) {
+   printf("LTM4673 Telemetry register dump:\n");
+   for (unsigned jx = 0; jx < LTM4673_TELEM_NPAGES; jx++) {
+      printf("> Read page/channel: %x\n", jx);
+      for (unsigned ix=0; ix<LTM4673_TELEM_NREGS; ix++) {
+          ltm4673_print_telem_word(ix, telem[jx][ix]);
+      }
+   }
+   return;
+}
+
 int ltm4673_hook_write(uint8_t addr, int cmd, const uint8_t *data, int len) {
   int matched = 0;
   // Look for LTM4673 writes
@@ -564,14 +596,18 @@ int ltm4673_hook_write(uint8_t addr, int cmd, const uint8_t *data, int len) {
   if (cmd_byte == LTM4673_PAGE) {
     if (xact_len < 1) {
       printf("Invalid PAGE write length %d\r\n", xact_len);
+      ltm4673_page_known = 0;
     } else if (*pdata == 0xff) {
       printf("# LTM4673_PAGE 0xff\r\n");
       ltm4673_page = 0xff;
+      ltm4673_page_known = 1;
     } else if (*pdata < 4) {
       printf("# LTM4673_PAGE 0x%02x\r\n", *pdata);
       ltm4673_page = *pdata;
+      ltm4673_page_known = 1;
     } else {
       printf("LTM4673 invalid PAGE write: 0x%02x\r\n", *pdata);
+      ltm4673_page_known = 0;
     }
   }
   return matched;
@@ -607,11 +643,14 @@ int ltm4673_hook_read(uint8_t addr, int cmd, const uint8_t *data, int len) {
     } else if (*pdata == 0xff) {
       printf("# LTM4673_PAGE 0xff\r\n");
       ltm4673_page = 0xff;
+      ltm4673_page_known = 1;
     } else if (*pdata < 4) {
       printf("# LTM4673_PAGE 0x%02x\r\n", *pdata);
       ltm4673_page = *pdata;
+      ltm4673_page_known = 1;
     } else {
       printf("LTM4673 invalid PAGE returned on read: 0x%02x\r\n", *pdata);
+      ltm4673_page_known = 0;
     }
   }
   return matched;
@@ -668,47 +707,30 @@ static uint16_t ltm4673_apply_limits_cmd(uint8_t cmd, uint16_t val_enc, uint16_t
     val_enc = val_enc < min_enc ? min_enc : val_enc;
     val_enc = val_enc > max_enc ? max_enc : val_enc;
   } else {
-#ifdef FLOAT_LIMITS
-    float val_dec, lim_dec;
-    // Decode the set value and limits before comparing
-    val_dec = ltm4673_decode_float(cmd, val_enc);
-    // FIXME DEBUG
-    printf("  [Limits] %f ->", val_dec);
-    // Clip at lower limit
-    lim_dec = ltm4673_decode_float(cmd, min_enc);
-    printf(" (min_enc = 0x%04x)", min_enc);
-    printf(" (min_dec = %f)", lim_dec);
-    val_dec = val_dec < lim_dec ? lim_dec : val_dec;
-    // Clip at upper limit
-    lim_dec = ltm4673_decode_float(cmd, max_enc);
-    printf(" (max_enc = 0x%04x)", max_enc);
-    printf(" (max_dec = %f)", lim_dec);
-    val_dec = val_dec > lim_dec ? lim_dec : val_dec;
-    // FIXME DEBUG
-    printf(" -> %f\r\n", val_dec);
-    // Encode the bytes before storing
-    val_enc = ltm4673_encode_float(cmd, val_dec);
-#else
-    int val_dec, lim_dec;
+    int32_t val_dec, lim_dec;
     // Decode the set value and limits before comparing
     val_dec = ltm4673_decode(cmd, val_enc);
     // FIXME DEBUG
-    printf("  [Limits] %d ->", val_dec);
-    // Clip at lower limit
+    printf("  [Limits] %ld ->", (long)val_dec);
+    // Clip at lower limit; a clipped value takes the limit's own encoding,
+    // an unclipped one keeps its original bits
     lim_dec = ltm4673_decode(cmd, min_enc);
     printf(" (min_enc = 0x%04x)", min_enc);
-    printf(" (min_dec = %d)", lim_dec);
-    val_dec = val_dec < lim_dec ? lim_dec : val_dec;
+    printf(" (min_dec = %ld)", (long)lim_dec);
+    if (val_dec < lim_dec) {
+      val_dec = lim_dec;
+      val_enc = min_enc;
+    }
     // Clip at upper limit
     lim_dec = ltm4673_decode(cmd, max_enc);
     printf(" (max_enc = 0x%04x)", max_enc);
-    printf(" (max_dec = %d)", lim_dec);
-    val_dec = val_dec > lim_dec ? lim_dec : val_dec;
+    printf(" (max_dec = %ld)", (long)lim_dec);
+    if (val_dec > lim_dec) {
+      val_dec = lim_dec;
+      val_enc = max_enc;
+    }
     // FIXME DEBUG
-    printf(" -> %d\r\n", val_dec);
-    // Encode the bytes before storing
-    val_enc = ltm4673_encode(cmd, val_dec);
-#endif
+    printf(" -> %ld\r\n", (long)val_dec);
   }
   return val_enc;
 }
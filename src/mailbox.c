@@ -1,11 +1,14 @@
 #include "marble_api.h"
 #include <stdio.h>
+#include <string.h>
 #include "i2c_pm.h"
 #include "mailbox.h"
 #include "max6639.h"
 #include "watchdog.h"
 #include "rev.h"
 #include "st-eeprom.h"
+#include "telem.h"
+#include "task_sched.h"
 
 /* ============================= Helper Macros ============================== */
 // Define SPI_SWITCH to re-route SPI bound for FPGA to PMOD for debugging
@@ -16,14 +19,48 @@
 #define SSP_TARGET        SSP_FPGA
 #endif
 
+// MBOX_BURST (make MBOX_BURST=1) transfers each page as a single SPI
+// transaction (see doc/mailbox.md).  Off by default, for gateware which
+// needs CSB to frame every word.
+
+#define MBOX_PAGE_SIZE                (16)
+#define MBOX_CMD_PAGE(page)       (0x2200 + (page))
+#define MBOX_CMD_WRITE(ent, dat)  (0x5000 + ((ent)<<8) + (dat))
+#define MBOX_CMD_READ(ent)        (0x4000 + ((ent)<<8))
+
 /* ============================ Static Variables ============================ */
 extern SSP_PORT SSP_FPGA;
 extern SSP_PORT SSP_PMOD;
 uint16_t update_count = 0;
 static uint8_t mbox_is_enabled = 1;
+// Set by mbox_refresh(); latched into mbox_refreshing for one update cycle,
+// during which static entries are evaluated and every entry is written.
+static volatile uint8_t mbox_refresh_pending = 1;
+static uint8_t mbox_refreshing = 0;
+static uint32_t mbox_entries_written = 0;
+static uint32_t mbox_pages_unchanged = 0;
+// FPGA_INT doorbell (page MBOX_DOORBELL_PAGE): last DOORBELL value serviced
+static uint16_t mbox_doorbell_ack = 0;
+static int mbox_doorbell_pages = 0;     // Pages serviced by the last mbox_doorbell()
+static uint32_t mbox_doorbell_rings = 0;
+static uint32_t mbox_doorbell_serviced = 0;
+// Update period; see mbox_set_period()
+static int mbox_task = -1;
+static uint32_t mbox_period_slow = SPI_MAILBOX_PERIOD_MS;
+static uint32_t mbox_period_fast = MBOX_PERIOD_FAST_MS;
+static uint8_t mbox_adaptive = 0;
+static uint32_t mbox_period_ms = SPI_MAILBOX_PERIOD_MS;  // Current
+static uint32_t mbox_period_changes = 0;
+// Fingerprint of the input pages read this update cycle and the last
+static uint32_t mbox_input_fold = 0;
+static uint32_t mbox_input_fold_last = 0;
+static uint8_t mbox_activity = 0;
 
 /* =========================== Static Prototypes ============================ */
 static void mbox_handleI2CBusStatusMsg(uint8_t msg);
+static void mbox_doorbell(int doorbell);
+static void mbox_apply_period(uint32_t period);
+static uint16_t mbox_doorbell_get_ack(void);
 
 // XXX Including auto-generated source file! This is atypical, but works nicely.
 #include "mailbox_def.c"
@@ -32,6 +69,7 @@ static void mbox_handleI2CBusStatusMsg(uint8_t msg);
 
 void mbox_enable(void) {
   mbox_is_enabled = 1;
+  mbox_refresh();
   eeprom_store_mbox_en(&mbox_is_enabled, 1);
   return;
 }
@@ -52,6 +90,7 @@ void mbox_disable(void) {
 void mbox_set_enable(int enabled) {
   if (enabled) {
     mbox_is_enabled = 1;
+    mbox_refresh();
   } else {
     mbox_is_enabled = 0;
   }
@@ -65,27 +104,71 @@ int mbox_get_enable(void) {
   return 0;
 }
 
-static void mbox_set_page(uint8_t page_no)
-{
-   uint16_t ssp_buf;
-   ssp_buf = 0x2200 + page_no;
-   marble_SSP_write16(SSP_FPGA, &ssp_buf, 1);
-}
-
 void mbox_write_entry(uint8_t entry_no, uint8_t data) {
-   uint16_t ssp_buf = 0x5000 + (entry_no<<8) + data;
+   uint16_t ssp_buf = MBOX_CMD_WRITE(entry_no, data);
    marble_SSP_write16(SSP_FPGA, &ssp_buf, 1);
 }
 
 uint8_t mbox_read_entry(uint8_t entry_no) {
-   uint16_t ssp_recv, ssp_buf = 0x4000 + (entry_no<<8);
+   uint16_t ssp_recv, ssp_buf = MBOX_CMD_READ(entry_no);
    marble_SSP_exch16(SSP_FPGA, &ssp_buf, &ssp_recv, 1);
    return (ssp_recv & 0xff);
 }
 
+/* FNV-1a over the input pages read from the FPGA, for change detection.
+ * Pages outside MAILBOX_ACTIVITY_PAGES (the watchdog hash, petted by every
+ * keep-alive, and the doorbell) are left out; see mbox_adapt(). */
+static void mbox_fold_input(uint8_t page_no, uint8_t page_sz, const uint8_t *page) {
+   if ((page_no >= 32) || !((MAILBOX_ACTIVITY_PAGES >> page_no) & 1)) {
+      return;
+   }
+   uint32_t h = mbox_input_fold ^ page_no;
+   for (unsigned jx=0; jx<page_sz; jx++) {
+      h = (h ^ page[jx]) * 16777619u;
+   }
+   mbox_input_fold = h;
+}
+
+#ifdef MBOX_BURST
+/* Page select followed by one word per entry, all under one CSB assertion.
+ * The board layer moves multi-word transfers with DMA. */
 void mbox_write_page(uint8_t page_no, uint8_t page_sz, const uint8_t page[]) {
+   uint16_t ssp_buf[1+MBOX_PAGE_SIZE];
    // Write at most 16 bytes to page
-   if (page_sz > 16) page_sz = 16;
+   if (page_sz > MBOX_PAGE_SIZE) page_sz = MBOX_PAGE_SIZE;
+   ssp_buf[0] = MBOX_CMD_PAGE(page_no);
+   for (unsigned jx=0; jx<page_sz; jx++) {
+      ssp_buf[1+jx] = MBOX_CMD_WRITE(jx, page[jx]);
+   }
+   marble_SSP_write16(SSP_FPGA, ssp_buf, 1+page_sz);
+}
+
+void mbox_read_page(uint8_t page_no, uint8_t page_sz, uint8_t *page) {
+   uint16_t ssp_buf[1+MBOX_PAGE_SIZE];
+   uint16_t ssp_recv[1+MBOX_PAGE_SIZE];
+   // Read at most 16 bytes from page
+   if (page_sz > MBOX_PAGE_SIZE) page_sz = MBOX_PAGE_SIZE;
+   ssp_buf[0] = MBOX_CMD_PAGE(page_no);
+   for (unsigned jx=0; jx<page_sz; jx++) {
+      ssp_buf[1+jx] = MBOX_CMD_READ(jx);
+   }
+   marble_SSP_exch16(SSP_FPGA, ssp_buf, ssp_recv, 1+page_sz);
+   for (unsigned jx=0; jx<page_sz; jx++) {
+      page[jx] = ssp_recv[1+jx] & 0xff;
+   }
+   mbox_fold_input(page_no, page_sz, page);
+}
+#else
+static void mbox_set_page(uint8_t page_no)
+{
+   uint16_t ssp_buf;
+   ssp_buf = MBOX_CMD_PAGE(page_no);
+   marble_SSP_write16(SSP_FPGA, &ssp_buf, 1);
+}
+
+void mbox_write_page(uint8_t page_no, uint8_t page_sz, const uint8_t page[]) {
+   // Write at most 16 bytes to page
+   if (page_sz > MBOX_PAGE_SIZE) page_sz = MBOX_PAGE_SIZE;
    mbox_set_page(page_no);
    //printf("write_page %d, size %d\r\n", page_no, page_sz);
    for (unsigned jx=0; jx<page_sz; jx++) {
@@ -95,12 +178,110 @@ void mbox_write_page(uint8_t page_no, uint8_t page_sz, const uint8_t page[]) {
 
 void mbox_read_page(uint8_t page_no, uint8_t page_sz, uint8_t *page) {
    // Write at most 16 bytes to page
-   if (page_sz > 16) page_sz = 16;
+   if (page_sz > MBOX_PAGE_SIZE) page_sz = MBOX_PAGE_SIZE;
    mbox_set_page(page_no);
    //printf("read_page %d, size %d\r\n", page_no, page_sz);
    for (unsigned jx=0; jx<page_sz; jx++) {
       page[jx] = mbox_read_entry(jx);
    }
+   mbox_fold_input(page_no, page_sz, page);
+}
+#endif /* MBOX_BURST */
+
+static void mbox_write_words(uint16_t ssp_buf[], unsigned nwords) {
+   mbox_entries_written += nwords - 1;
+#ifdef MBOX_BURST
+   marble_SSP_write16(SSP_FPGA, ssp_buf, nwords);
+#else
+   for (unsigned jx=0; jx<nwords; jx++) {
+      marble_SSP_write16(SSP_FPGA, &ssp_buf[jx], 1);
+   }
+#endif
+}
+
+/*
+ * void mbox_write_page_changed(uint8_t page_no, uint8_t page_sz, const uint8_t page[], uint8_t shadow[]);
+ *  Write only the entries of 'page' which differ from 'shadow' (what was last
+ *  written), then bring 'shadow' up to date.  Every entry is written during a
+ *  refresh cycle.  Each entry costs one SPI word whether or not its neighbours
+ *  are written, so the sparse write is never dearer than the whole page.
+ */
+void mbox_write_page_changed(uint8_t page_no, uint8_t page_sz, const uint8_t page[], uint8_t shadow[]) {
+   uint16_t ssp_buf[1+MBOX_PAGE_SIZE];
+   unsigned nwords = 0;
+   if (page_sz > MBOX_PAGE_SIZE) page_sz = MBOX_PAGE_SIZE;
+   ssp_buf[nwords++] = MBOX_CMD_PAGE(page_no);
+   for (unsigned jx=0; jx<page_sz; jx++) {
+      if (mbox_refreshing || (page[jx] != shadow[jx])) {
+         ssp_buf[nwords++] = MBOX_CMD_WRITE(jx, page[jx]);
+         shadow[jx] = page[jx];
+      }
+   }
+   if (nwords == 1) {
+      mbox_pages_unchanged++;
+      return;
+   }
+   mbox_write_words(ssp_buf, nwords);
+}
+
+/*
+ * void mbox_write_page_masked(uint8_t page_no, uint8_t page_sz, const uint8_t page[], uint16_t mask);
+ *  Write only the entries of 'page' whose bit is set in 'mask' (bit n = entry n).
+ *  Used for pages shared with the FPGA so that its input entries are not clobbered.
+ */
+void mbox_write_page_masked(uint8_t page_no, uint8_t page_sz, const uint8_t page[], uint16_t mask) {
+   uint16_t ssp_buf[1+MBOX_PAGE_SIZE];
+   unsigned nwords = 0;
+   if (page_sz > MBOX_PAGE_SIZE) page_sz = MBOX_PAGE_SIZE;
+   ssp_buf[nwords++] = MBOX_CMD_PAGE(page_no);
+   for (unsigned jx=0; jx<page_sz; jx++) {
+      if (mask & (1 << jx)) {
+         ssp_buf[nwords++] = MBOX_CMD_WRITE(jx, page[jx]);
+      }
+   }
+   if (nwords > 1) {
+      mbox_write_words(ssp_buf, nwords);
+   }
+}
+
+/* void mbox_refresh(void);
+ *  Rewrite every output entry, including 'static' ones, on the next update.
+ *  Call whenever the FPGA's copy may have been lost (e.g. reconfiguration). */
+void mbox_refresh(void) {
+  mbox_refresh_pending = 1;
+  return;
+}
+
+/*
+ * static void mbox_adapt(void);
+ *  In adaptive mode, drop straight to the fast period while the FPGA is
+ *  changing inputs (or ringing the doorbell for them) or a telemetry alarm
+ *  is active, and otherwise double the period each quiet update up to the
+ *  ceiling.  Only pages in MAILBOX_ACTIVITY_PAGES count, so watchdog
+ *  keep-alives alone leave the period at the ceiling.
+ */
+static void mbox_adapt(void) {
+  uint32_t period = mbox_period_slow;
+  if (mbox_adaptive) {
+    if (mbox_activity || (mbox_input_fold != mbox_input_fold_last) || telem_alarm_active()) {
+      period = mbox_period_fast;
+    } else if (2*mbox_period_ms < mbox_period_slow) {
+      period = 2*mbox_period_ms;
+    }
+  }
+  mbox_activity = 0;
+  mbox_input_fold_last = mbox_input_fold;
+  mbox_apply_period(period);
+  return;
+}
+
+static void mbox_apply_period(uint32_t period) {
+  if (period != mbox_period_ms) {
+    mbox_period_ms = period;
+    sched_set_period(mbox_task, period);
+    mbox_period_changes++;
+  }
+  return;
 }
 
 void mbox_update(bool verbose)
@@ -109,13 +290,127 @@ void mbox_update(bool verbose)
     return;
   }
 
-  FPGAWD_Poll();
   _UNUSED(verbose);
   update_count++;
+  mbox_refreshing = mbox_refresh_pending;
+  mbox_refresh_pending = 0;
+  mbox_input_fold = 0;
   // Note! Input function must come before output function or any input values will
   // be clobbered by their output value before reading.
   mailbox_update_input();   // This function is auto-generated in src/mailbox_def.c
   mailbox_update_output();  // This function is auto-generated in src/mailbox_def.c
+  mbox_refreshing = 0;
+  mbox_adapt();
+  return;
+}
+
+static void task_mbox_update(void) {
+  mbox_update(false);
+  // Use LED2 for SPI heartbeat
+  marble_LED_toggle(2);
+  return;
+}
+
+/* void mbox_init(void);
+ *  Register the update task.  Call after any mbox_set_period() from
+ *  non-volatile parameters. */
+void mbox_init(void) {
+  mbox_task = sched_add_periodic("mailbox", task_mbox_update, mbox_period_ms, SCHED_PRIO_NORMAL);
+  return;
+}
+
+/*
+ * int mbox_set_period(uint32_t period_ms, uint32_t fast_ms, int adaptive);
+ *  Fixed mode updates every 'period_ms'.  Adaptive mode moves between
+ *  'fast_ms' and 'period_ms' (see mbox_adapt()), starting fast.  Both are
+ *  pegged to MBOX_PERIOD_MIN_MS..MBOX_PERIOD_MAX_MS, and 'fast_ms' to at
+ *  most 'period_ms'.  Returns the resulting period.
+ */
+int mbox_set_period(uint32_t period_ms, uint32_t fast_ms, int adaptive) {
+  period_ms = MIN(MAX(period_ms, MBOX_PERIOD_MIN_MS), MBOX_PERIOD_MAX_MS);
+  fast_ms = MIN(MAX(fast_ms, MBOX_PERIOD_MIN_MS), period_ms);
+  mbox_period_slow = period_ms;
+  mbox_period_fast = fast_ms;
+  mbox_adaptive = adaptive ? 1 : 0;
+  mbox_period_ms = mbox_adaptive ? fast_ms : period_ms;
+  sched_set_period(mbox_task, mbox_period_ms);
+  return (int)period_ms;
+}
+
+uint32_t mbox_get_period(void) {
+  return mbox_period_ms;
+}
+
+void mbox_print_period(void) {
+  if (mbox_adaptive) {
+    printf("Mailbox period: adaptive %lu-%lu ms, now %lu ms\r\n", (unsigned long)mbox_period_fast,
+           (unsigned long)mbox_period_slow, (unsigned long)mbox_period_ms);
+  } else {
+    printf("Mailbox period: %lu ms\r\n", (unsigned long)mbox_period_ms);
+  }
+  return;
+}
+
+/*
+ * static void mbox_doorbell(int doorbell);
+ *  Input handler for DOORBELL (see doc/mailbox.md).  Services each input
+ *  page whose bit differs from the last value acknowledged, then records
+ *  'doorbell' as the new acknowledgement.  Runs from both the doorbell
+ *  task and the regular poll; in the latter the page has usually just been
+ *  read, and the repeat is harmless.
+ */
+static void mbox_doorbell(int doorbell) {
+  uint16_t pending = ((uint16_t)doorbell ^ mbox_doorbell_ack) & MAILBOX_INPUT_PAGES;
+  pending &= (uint16_t)~(1 << MBOX_DOORBELL_PAGE);
+  uint16_t active = pending & (uint16_t)MAILBOX_ACTIVITY_PAGES;
+  mbox_doorbell_pages = 0;
+  for (uint8_t npage = 0; pending != 0; npage++, pending >>= 1) {
+    if (pending & 1) {
+      mailbox_update_input_page(npage);
+      // Replies (e.g. I2C bus status) go out now rather than next cycle
+      mailbox_update_output_page(npage);
+      mbox_doorbell_pages++;
+    }
+  }
+  mbox_doorbell_serviced += mbox_doorbell_pages;
+  if (active) {
+    // Don't wait for the next update to speed up
+    mbox_activity = 1;
+    if (mbox_adaptive) {
+      mbox_apply_period(mbox_period_fast);
+    }
+  }
+  mbox_doorbell_ack = (uint16_t)doorbell;
+  return;
+}
+
+static uint16_t mbox_doorbell_get_ack(void) {
+  return mbox_doorbell_ack;
+}
+
+/*
+ * int mbox_service_doorbell(void);
+ *  Fast path for FPGA_INT: read DOORBELL, service the flagged pages and
+ *  write DOORBELL_ACK.  Returns the number of pages serviced.
+ */
+int mbox_service_doorbell(void) {
+  if (!mbox_is_enabled) {
+    return 0;
+  }
+  mbox_doorbell_rings++;
+  mailbox_update_input_page(MBOX_DOORBELL_PAGE);
+  mailbox_update_output_page(MBOX_DOORBELL_PAGE);
+  return mbox_doorbell_pages;
+}
+
+void mbox_print_stats(void) {
+  printf("Mailbox: %u updates, %lu entries written, %lu pages unchanged\r\n",
+         update_count, (unsigned long)mbox_entries_written, (unsigned long)mbox_pages_unchanged);
+  printf("Doorbell: %lu rings, %lu pages serviced, ack 0x%04x\r\n",
+         (unsigned long)mbox_doorbell_rings, (unsigned long)mbox_doorbell_serviced,
+         mbox_doorbell_ack);
+  mbox_print_period();
+  printf("  %lu period changes\r\n", (unsigned long)mbox_period_changes);
   return;
 }
 
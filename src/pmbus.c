@@ -4,8 +4,6 @@
 
 #include "pmbus.h"
 
-static double _shift(double f, int ord);
-
 #ifndef INT_MAX
 //#define INT_MAX 0x7fffffff
 // Silly little two-step hack to keep the compiler from warning about
@@ -172,7 +170,7 @@ double l11_to_v_double(uint16_t l) {
     a -= 0x400;
   }
   if (l & 0x8000) {
-    return _shift(a, n-16);
+    return a/(1 << (16-n));
   }
   return (a*(1 << n));
 }
@@ -206,7 +204,7 @@ double l11_to_mv_double(uint16_t l) {
     a -= 0x400;
   }
   if (l & 0x8000) {
-    return _shift(1000*a, n-16);
+    return 1000*a/(1 << (16-n));
   }
   return (1000*a*(1 << n));
 }
@@ -240,7 +238,7 @@ double l11_to_uv_double(uint16_t l) {
     a -= 0x400;
   }
   if (l & 0x8000) {
-    return _shift(1000000*a, n-16);
+    return 1000000*a/(1 << (16-n));
   }
   return (1000000*a*(1 << n));
 }
@@ -326,15 +324,74 @@ double l16_to_uv_double(uint16_t l) {
   return 1000000*l16_to_v_double(l);
 }
 
-// ================================= static ==================================
-static double _shift(double f, int ord) {
-  while (ord > 0) {
-    f = f*2;
-    --ord;
-  };
-  while (ord < 0) {
-    f = f/2;
-    ++ord;
-  };
-  return f;
+// ========================== Fixed-point (milli) ============================
+/* Bounds, in milli-units, of the values whose mantissa fits in 11 bits at
+ * exponent N = k-16: 1023000*2^N rounded down and -1024000*2^N rounded up,
+ * clipped to int32_t.  Both grow with k, so the smallest usable exponent is
+ * found by bisection.
+ */
+#define L11_CLIP(x)     ((x) > INT32_MAX ? INT32_MAX : (x) < INT32_MIN ? INT32_MIN : (int32_t)(x))
+#define L11_HI(k)       L11_CLIP(((int64_t)1023000 << (k)) >> 16)
+#define L11_LO(k)       L11_CLIP(-(((int64_t)1024000 << (k)) >> 16))
+#define L11_ROW(f, k)   f(k), f(k+1), f(k+2), f(k+3), f(k+4), f(k+5), f(k+6), f(k+7)
+
+static const int32_t l11_milli_hi[32] = {
+  L11_ROW(L11_HI, 0), L11_ROW(L11_HI, 8), L11_ROW(L11_HI, 16), L11_ROW(L11_HI, 24)
+};
+static const int32_t l11_milli_lo[32] = {
+  L11_ROW(L11_LO, 0), L11_ROW(L11_LO, 8), L11_ROW(L11_LO, 16), L11_ROW(L11_LO, 24)
+};
+
+// Smallest milli-unit value that does not fit in L16 (0x10000 counts)
+#define L16_MILLI_LIMIT   (1000 << (16 - _L16_EXPONENT))
+
+int32_t l11_to_milli(uint16_t l) {
+  int32_t m = 1000*((int32_t)(l & 0x3ff) - (int32_t)(l & 0x400));
+  unsigned e = l >> 11;  // N, 5-bit two's complement
+  if (e & 0x10) {
+    unsigned s = 32 - e;  // -N, 1 to 16
+    return (m + (1 << (s - 1))) >> s;
+  }
+  if (m > (INT32_MAX >> e)) {
+    return INT32_MAX;
+  }
+  if (m < (INT32_MIN >> e)) {
+    return INT32_MIN;
+  }
+  return m*(1 << e);
+}
+
+uint16_t milli_to_l11(int32_t milli) {
+  const int32_t *lim = (milli < 0) ? l11_milli_lo : l11_milli_hi;
+  unsigned k = 0;
+  // Exponent k-16 is the first whose bounds hold milli; k = 31 always does
+  for (unsigned step = 16; step; step >>= 1) {
+    int32_t bound = lim[k + step - 1];
+    if ((milli < 0) ? (milli < bound) : (milli > bound)) {
+      k += step;
+    }
+  }
+  int32_t y;
+  if (k <= 16) {
+    // |milli| << (16-k) is at most 1024000 here
+    y = milli*(1 << (16 - k))/1000;
+  } else {
+    y = milli/1000;
+    y = (y < 0) ? -(-y >> (k - 16)) : (y >> (k - 16));
+  }
+  return (uint16_t)((((k + 16) & 0x1f) << 11) | (y & 0x7ff));
+}
+
+int32_t l16_to_milli(uint16_t l) {
+  return (int32_t)((1000*(uint32_t)l + (1 << (_L16_EXPONENT - 1))) >> _L16_EXPONENT);
+}
+
+uint16_t milli_to_l16(int32_t milli) {
+  if (milli <= 0) {
+    return 0;
+  }
+  if (milli >= L16_MILLI_LIMIT) {
+    return 0xffff;
+  }
+  return (uint16_t)(((uint32_t)milli << _L16_EXPONENT)/1000);
 }
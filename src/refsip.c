@@ -32,6 +32,9 @@ store64_be(uint8_t dst[8], uint64_t w)
 {
 #ifdef NATIVE_BIG_ENDIAN
     memcpy(dst, &w, sizeof w);
+#elif defined(NATIVE_LITTLE_ENDIAN)
+    w = __builtin_bswap64(w);
+    memcpy(dst, &w, sizeof w);
 #else
     dst[7] = (uint8_t) w; w >>= 8;
     dst[6] = (uint8_t) w; w >>= 8;
@@ -52,6 +55,10 @@ load64_be(const uint8_t src[8])
     uint64_t w;
     memcpy(&w, src, sizeof w);
     return w;
+#elif defined(NATIVE_LITTLE_ENDIAN)
+    uint64_t w;
+    memcpy(&w, src, sizeof w);
+    return __builtin_bswap64(w);
 #else
     uint64_t w = (uint64_t) src[7];
     w |= (uint64_t) src[6] <<  8;
@@ -113,23 +120,33 @@ rotl64(const uint64_t x, const int b)
         if (debug) printf("sipround out %16.16"PRIx64" %16.16"PRIx64" %16.16"PRIx64" %16.16"PRIx64"\n", v0, v1, v2, v3); \
     } while (0)
 
-void core_siphash(unsigned char *out, const unsigned char *in,
-	unsigned long inlen, const unsigned char *k)
+void sip_key_init(sip_key_t *ctx, const unsigned char *k)
 {
     /* "somepseudorandomlygeneratedbytes" */
-    uint64_t       v0 = 0x736f6d6570736575ULL;
-    uint64_t       v1 = 0x646f72616e646f6dULL;
-    uint64_t       v2 = 0x6c7967656e657261ULL;
-    uint64_t       v3 = 0x7465646279746573ULL;
-    uint64_t       b;
     uint64_t       k0 = LOAD64_LE(k);
     uint64_t       k1 = LOAD64_LE(k + 8);
+    ctx->v[0] = 0x736f6d6570736575ULL ^ k0;
+    ctx->v[1] = 0x646f72616e646f6dULL ^ k1;
+    ctx->v[2] = 0x6c7967656e657261ULL ^ k0;
+    ctx->v[3] = 0x7465646279746573ULL ^ k1;
+}
+
+void sip_key_clear(sip_key_t *ctx)
+{
+    volatile uint64_t *v = ctx->v;
+    for (unsigned ix = 0; ix < 4; ix++) v[ix] = 0;
+}
+
+void siphash_keyed(unsigned char *out, const unsigned char *in,
+	unsigned long inlen, const sip_key_t *ctx)
+{
+    uint64_t       v0 = ctx->v[0];
+    uint64_t       v1 = ctx->v[1];
+    uint64_t       v2 = ctx->v[2];
+    uint64_t       v3 = ctx->v[3];
+    uint64_t       b;
     uint64_t       m;
     const uint8_t *end  = in + inlen - (inlen % sizeof(uint64_t));
-    v3 ^= k1;
-    v2 ^= k0;
-    v1 ^= k1;
-    v0 ^= k0;
     for (; in != end; in += 8) {
         // Use little-endian because that's in the spec
         m = LOAD64_LE(in);
@@ -149,6 +166,25 @@ void core_siphash(unsigned char *out, const unsigned char *in,
     STORE64_BE(out, b);
 }
 
+void core_siphash(unsigned char *out, const unsigned char *in,
+	unsigned long inlen, const unsigned char *k)
+{
+    sip_key_t ctx;
+    sip_key_init(&ctx, k);
+    siphash_keyed(out, in, inlen, &ctx);
+    sip_key_clear(&ctx);
+}
+
+// As libsodium's crypto_verify_8(); time does not depend on the contents
+int sip_verify_8(const unsigned char *x, const unsigned char *y)
+{
+    const volatile unsigned char *vx = x;
+    const volatile unsigned char *vy = y;
+    uint_fast16_t d = 0U;
+    for (unsigned ix = 0; ix < 8; ix++) d |= vx[ix] ^ vy[ix];
+    return (1 & ((d - 1) >> 8)) - 1;
+}
+
 // end of material snarfed from libsodium
 
 // Not provided here: sip_sign() sip_check() usage() main()
@@ -0,0 +1,3 @@
+#define GIT_REV "2db0c9f7"
+#define GIT_DIRTY 1
+#define GIT_REV_32BIT 0x2db0c9f7
@@ -0,0 +1,211 @@
+/*  File: spsc_ring.c
+ *  Lock-free single-producer/single-consumer byte ring.  See spsc_ring.h.
+ *
+ *  Each side publishes its own index with release semantics after touching
+ *  the storage, and reads the other side's index with acquire semantics
+ *  before touching the storage.  On the Cortex-M3 this compiles to a plain
+ *  load/store plus DMB; on the host it also holds between threads, which
+ *  is what tests/ring exercises.
+ *
+ *  Retraction pairs a store with a load of the other side's variable on
+ *  each side ('unpushes' then 'claim' in the producer, 'claim' then
+ *  'unpushes' in the consumer), so at least one side sees the other's
+ *  store.  Those four accesses are sequentially consistent.  On one
+ *  core, where the producer is an ISR preempting the consumer, that
+ *  ordering is implied anyway.
+ */
+
+#include <string.h>
+#include "spsc_ring.h"
+
+#define LOAD_ACQ(p)        __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define STORE_REL(p, v)    __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#define LOAD_SC(p)         __atomic_load_n((p), __ATOMIC_SEQ_CST)
+#define STORE_SC(p, v)     __atomic_store_n((p), (v), __ATOMIC_SEQ_CST)
+#define MIN(a, b)          ((a) < (b) ? (a) : (b))
+
+static void copy_in(spsc_ring_t *r, uint32_t pos, const uint8_t *src, uint32_t n);
+static void copy_out(const spsc_ring_t *r, uint32_t pos, uint8_t *dst, uint32_t n);
+static uint32_t pop_claim(spsc_ring_t *r, uint8_t target, int until, uint32_t n);
+
+/*
+ * int spsc_ring_init(spsc_ring_t *r, uint8_t *buf, uint32_t size);
+ *  Attach 'size' bytes of storage at 'buf' to ring 'r' and empty it.
+ *  Returns -1 if 'size' is not a power of two, 0 otherwise.
+ */
+int spsc_ring_init(spsc_ring_t *r, uint8_t *buf, uint32_t size) {
+  if (!SPSC_RING_IS_POW2(size)) {
+    return -1;
+  }
+  r->buf = buf;
+  r->mask = size - 1;
+  spsc_ring_reset(r);
+  return 0;
+}
+
+/*
+ * void spsc_ring_reset(spsc_ring_t *r);
+ *  Empty the ring and clear the high-water mark.  Not safe against a
+ *  concurrent producer or consumer; use spsc_ring_unpush() from the
+ *  producer side to discard data on a live ring.
+ */
+void spsc_ring_reset(spsc_ring_t *r) {
+  r->head = 0;
+  r->tail = 0;
+  r->claim = 0;
+  r->unpushes = 0;
+  r->hwm = 0;
+  return;
+}
+
+uint32_t spsc_ring_size(const spsc_ring_t *r) {
+  return r->mask + 1;
+}
+
+uint32_t spsc_ring_count(const spsc_ring_t *r) {
+  return LOAD_ACQ(&r->head) - LOAD_ACQ(&r->tail);
+}
+
+uint32_t spsc_ring_space(const spsc_ring_t *r) {
+  return spsc_ring_size(r) - spsc_ring_count(r);
+}
+
+uint32_t spsc_ring_high_water(const spsc_ring_t *r) {
+  return r->hwm;
+}
+
+/*
+ * int spsc_ring_push(spsc_ring_t *r, uint8_t c);
+ *  Producer: append one byte.  Returns 0 on success, -1 if full.
+ */
+int spsc_ring_push(spsc_ring_t *r, uint8_t c) {
+  return spsc_ring_push_n(r, &c, 1) == 1 ? 0 : -1;
+}
+
+/*
+ * uint32_t spsc_ring_push_n(spsc_ring_t *r, const uint8_t *src, uint32_t n);
+ *  Producer: append up to 'n' bytes from 'src' (at most two memcpy calls).
+ *  Returns the number of bytes actually appended.
+ */
+uint32_t spsc_ring_push_n(spsc_ring_t *r, const uint8_t *src, uint32_t n) {
+  uint32_t head = r->head;
+  uint32_t fill = head - LOAD_ACQ(&r->tail);
+  n = MIN(n, spsc_ring_size(r) - fill);
+  if (n == 0) {
+    return 0;
+  }
+  copy_in(r, head, src, n);
+  STORE_REL(&r->head, head + n);
+  fill += n;
+  if (fill > r->hwm) {
+    r->hwm = fill;
+  }
+  return n;
+}
+
+/*
+ * uint32_t spsc_ring_unpush(spsc_ring_t *r, uint32_t n);
+ *  Producer: retract up to the newest 'n' bytes (e.g. console backspace,
+ *  or all of them to clear the ring), but not those which a pop in
+ *  progress has claimed.  Safe while the consumer runs.  Returns the
+ *  number of bytes retracted.
+ */
+uint32_t spsc_ring_unpush(spsc_ring_t *r, uint32_t n) {
+  uint32_t head = r->head;
+  STORE_SC(&r->unpushes, r->unpushes + 1);
+  // A pop about to retry may still claim more than is left
+  int32_t unclaimed = (int32_t)(head - LOAD_SC(&r->claim));
+  n = unclaimed > 0 ? MIN(n, (uint32_t)unclaimed) : 0;
+  STORE_REL(&r->head, head - n);
+  return n;
+}
+
+/*
+ * int spsc_ring_pop(spsc_ring_t *r, uint8_t *c);
+ *  Consumer: remove the oldest byte into 'c'.  Returns 0 on success,
+ *  -1 if empty.
+ */
+int spsc_ring_pop(spsc_ring_t *r, uint8_t *c) {
+  return spsc_ring_pop_n(r, c, 1) == 1 ? 0 : -1;
+}
+
+/*
+ * uint32_t spsc_ring_pop_n(spsc_ring_t *r, uint8_t *dst, uint32_t n);
+ *  Consumer: remove up to 'n' of the oldest bytes into 'dst' (at most two
+ *  memcpy calls).  Returns the number of bytes removed.
+ */
+uint32_t spsc_ring_pop_n(spsc_ring_t *r, uint8_t *dst, uint32_t n) {
+  uint32_t tail = r->tail;
+  n = pop_claim(r, 0, 0, n);
+  if (n == 0) {
+    return 0;
+  }
+  copy_out(r, tail, dst, n);
+  STORE_REL(&r->tail, tail + n);
+  return n;
+}
+
+/*
+ * uint32_t spsc_ring_pop_until(spsc_ring_t *r, uint8_t *dst, uint8_t target, uint32_t n);
+ *  Consumer: like spsc_ring_pop_n() but stop after the first occurrence of
+ *  'target', which is included in the output.
+ */
+uint32_t spsc_ring_pop_until(spsc_ring_t *r, uint8_t *dst, uint8_t target, uint32_t n) {
+  uint32_t tail = r->tail;
+  n = pop_claim(r, target, 1, n);
+  if (n == 0) {
+    return 0;
+  }
+  copy_out(r, tail, dst, n);
+  STORE_REL(&r->tail, tail + n);
+  return n;
+}
+
+/*
+ * static uint32_t pop_claim(spsc_ring_t *r, uint8_t target, int until, uint32_t n);
+ *  Consumer: choose how many bytes to pop (at most 'n', and if 'until', up
+ *  to the first 'target') and claim them against spsc_ring_unpush().  If
+ *  any were retracted meanwhile, choose again.  Returns the count claimed.
+ */
+static uint32_t pop_claim(spsc_ring_t *r, uint8_t target, int until, uint32_t n) {
+  const uint32_t tail = r->tail;
+  const uint32_t off = tail & r->mask;
+  const uint32_t max = n;
+  uint32_t unpushes;
+  do {
+    unpushes = LOAD_ACQ(&r->unpushes);
+    n = MIN(max, LOAD_ACQ(&r->head) - tail);
+    uint32_t seg = MIN(n, spsc_ring_size(r) - off);
+    const uint8_t *p = until ? memchr(&r->buf[off], target, seg) : NULL;
+    if (p) {
+      n = (uint32_t)(p - &r->buf[off]) + 1;
+    } else if (until && (n > seg)) {
+      p = memchr(r->buf, target, n - seg);
+      if (p) {
+        n = seg + (uint32_t)(p - r->buf) + 1;
+      }
+    }
+    STORE_SC(&r->claim, tail + n);
+  } while (LOAD_SC(&r->unpushes) != unpushes);
+  return n;
+}
+
+static void copy_in(spsc_ring_t *r, uint32_t pos, const uint8_t *src, uint32_t n) {
+  uint32_t off = pos & r->mask;
+  uint32_t seg = MIN(n, spsc_ring_size(r) - off);
+  memcpy(&r->buf[off], src, seg);
+  if (n > seg) {
+    memcpy(r->buf, src + seg, n - seg);
+  }
+  return;
+}
+
+static void copy_out(const spsc_ring_t *r, uint32_t pos, uint8_t *dst, uint32_t n) {
+  uint32_t off = pos & r->mask;
+  uint32_t seg = MIN(n, spsc_ring_size(r) - off);
+  memcpy(dst, &r->buf[off], seg);
+  if (n > seg) {
+    memcpy(dst + seg, r->buf, n - seg);
+  }
+  return;
+}
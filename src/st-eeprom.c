@@ -1,17 +1,54 @@
 /* Emulate EEPROM with FLASH
  *
- * cf. ST App. note AN3390
- * "EEPROM emulation in STM32F2xx microcontrollers"
+ * A log-structured store spread round-robin over EE_NSECTORS
+ * erase sectors.  Use "tag" instead of "address".
  *
- * Uses two sectors.  Use "tag" instead of "address".
- * Each tag selects 6 bytes.  With 1 byte CRC, this
- * gives an 8 byte block.
+ * Each sector starts with an ee_sector_t header holding its erase
+ * count, a magic number, and a sequence number which is programmed
+ * when the sector is opened for writing.  Records are appended to
+ * the open sector with the highest sequence number (the head).  Each
+ * record is an ee_rec_t header followed by up to EE_VAL_MAX bytes of
+ * payload, padded to a word.  The latest valid copy of a tag wins,
+ * comparing sequence numbers first and then position.
  *
- * The first block in search sector is a header indicating
- * the state of that sector: erased, valid, moving.
+ * When the head fills up, the erased sector with the fewest erases
+ * is opened as the new head.  If that was the last erased sector,
+ * the live records of the oldest sector are then copied into the
+ * new head and the old sector is erased.  This keeps one sector
+ * in reserve, and rotates erases evenly over all sectors.
+ *
+ * The collection runs in the background, a few records per
+ * eeprom_service() slice and then an erase through
+ * fmc_flash_erase_start() and fmc_flash_erase_poll().  (On the
+ * STM32F2 that erase still holds the main loop until it is done;
+ * see flash.h.)  Writes made meanwhile are queued in RAM (and read
+ * back from there) and written once it is done.  Until
+ * its erase starts, the old sector is just an older open sector whose
+ * records have newer copies, and copying is idempotent, so power loss
+ * at any point leaves a consistent store.  eeprom_init() restarts an
+ * interrupted collection when it finds no erased sector.
+ *
+ * Writes between eeprom_begin() and eeprom_commit() are staged in RAM
+ * while the batch is in scope (see eeprom_batch_enter()); others go
+ * straight to flash.  Staging coalesces repeated writes of a tag,
+ * dropping those which leave the stored value unchanged.  The commit
+ * programs them back to back
+ * with their EE_REC_BATCH flag cleared, then a commit record (tag
+ * EE_TAG_COMMIT) holding their count.  Batch members only count once
+ * that commit record is complete, so the update is all or nothing.
  *
  * Tags 0x00 and 0xff have special meaning, and can not
  * be used by application code.
+ *
+ * A RAM index maps each tag to its latest valid record, so reads and
+ * appends do not rescan flash.  It is built by eeprom_init() and kept
+ * up to date as records are written.
+ *
+ * Stores in the older two-sector format (cf. ST App. note AN3390,
+ * "EEPROM emulation in STM32F2xx microcontrollers", with fixed 8 byte
+ * frames) are imported by eeprom_init() on first boot.  Only the first
+ * two sectors are searched for them; the third held the application
+ * image, and is just erased.
  */
 
 #include <stdlib.h>
@@ -21,265 +58,1047 @@
 #include "flash.h"
 #include "common.h"
 #include "marble_api.h"
+#include "st-eeprom.h"
+#include "task_sched.h"
+
+#ifdef SIMULATION
+#include "sim_api.h"
+#endif
 
 //#define DEBUG_PRINT
 #include "dbg.h"
 #undef DEBUG_PRINT
 
-#ifndef SIMULATION
+#define EE_MAGIC                    (0x45456d4du)
+
+typedef struct {
+    uint32_t erase_count;   // Programmed (with magic) right after erase
+    uint32_t magic;         // EE_MAGIC once formatted
+    uint32_t seq;           // 0xffffffff until opened for writing
+    uint32_t nseq;          // ~seq; a mismatch means a torn header
+} ee_sector_t;
+
+typedef struct {
+    uint8_t tag;
+    uint8_t flags;          // EE_REC_* bits, active low; 0xff for plain records
+    uint16_t len;           // Payload bytes
+    uint16_t nlen;          // ~len; a mismatch means a torn header
+    uint16_t rsvd;          // 0xffff
+    uint32_t crc;           // CRC-32 of the words above and the padded payload
+} ee_rec_t;
+
+// Cleared on members of a batch, which only take effect at its commit record
+#define EE_REC_BATCH                (0x01u)
+// Commit record, closing a batch.  The payload is the member count (2 bytes, LE).
+#define EE_TAG_COMMIT               (0x00u)
+
+#ifdef SIMULATION
+#define EE_SECTOR_SIZE              ((size_t)FLASH_SECTOR_SIZE)
+#else
 // assigned in linker script
 // symbol value (address) is really a size in bytes
 #ifdef MARBLE_V2
 extern const char eeprom_size;
 
-#define EEPROM_COUNT ((size_t)&eeprom_size/sizeof(ee_frame))
+#define EE_SECTOR_SIZE              ((size_t)&eeprom_size)
 #else
 // FIXME - Need to implement eeprom/flash in marble_mini
-#define EEPROM_COUNT                                (1)
+#define EE_SECTOR_SIZE              (sizeof(ee_sector_t))
 #endif
-
 #endif  /* SIMULATION */
 
-#include "st-eeprom.h"
+// Defined in linker file or sim/sim_flash.c (ifdef SIMULATION)
+extern uint32_t eeprom0_base[];
+extern uint32_t eeprom1_base[];
+extern uint32_t eeprom2_base[];
+
+static const struct {
+    uint32_t *base;
+    uint8_t sectorn;        // corresponding erase sector
+    uint8_t legacy;         // May hold a legacy bank; the others held code
+} ee_layout[] = {
+    {eeprom0_base, 1, 1},
+    {eeprom1_base, 2, 1},
+    {eeprom2_base, 3, 0},
+};
+
+#define EE_NSECTORS     (sizeof(ee_layout)/sizeof(ee_layout[0]))
 
 typedef enum {
-    ee_erased = 0xff,
-    ee_valid = 0x55,
-    ee_moving = 0x00,
-    ee_invalid,
-} ee_state_t;
+    ee_sect_bad = 0,        // Unusable (or still holds a legacy store)
+    ee_sect_erased,         // Formatted, not yet opened
+    ee_sect_open,           // Holds records
+} ee_sect_state_t;
+
+typedef struct {
+    ee_sector_t *hdr;       // Also the sector base
+    ee_sect_state_t state;
+    uint32_t erase_count;
+    uint32_t seq;
+    size_t next;            // Offset of first unused byte
+} ee_sect_t;
+
+static ee_sect_t ee_sect[EE_NSECTORS];
+// Newest open sector; NULL if the store is unusable
+static ee_sect_t *ee_head;
+
+// Latest valid record of each tag (NULL = none)
+static const ee_rec_t *ee_index[1u << (8u*sizeof(ee_tag_t))];
+
+// Records copied per eeprom_service() slice while collecting a sector
+#define EE_GC_SLICE_RECS    (8u)
+// How often to check on an erase in progress
+#define EE_GC_POLL_MS       (10u)
+// RAM for writes made while a collection is in progress, and for a batch
+#define EE_QUEUE_BYTES      (1024u)
+
+typedef enum {
+    ee_gc_idle = 0,
+    ee_gc_copy,             // Copying live records into the head
+    ee_gc_erase,            // Erase started
+} ee_gc_state_t;
+
+static struct {
+    ee_gc_state_t state;
+    ee_sect_t *victim;
+    size_t off;             // Next victim record to consider
+} ee_gc;
+
+// Packed list of values; each entry is tag, len (2 bytes, LE), payload
+typedef struct {
+    uint8_t buf[EE_QUEUE_BYTES];
+    size_t used;
+} ee_queue_t;
+
+// Writes made while a collection is in progress
+static ee_queue_t ee_pending;
+// Writes staged between eeprom_begin() and eeprom_commit()
+static ee_queue_t ee_stage;
+static unsigned ee_batch_depth;
+// Writes come from the batch's owner (see eeprom_batch_enter())
+static uint8_t ee_batch_scope;
+
+static int ee_task = -1;
 
 static int eeprom_read_val(ee_tags_t tag, volatile uint8_t *paddr, int len);
 static int eeprom_store_val(ee_tags_t tag, const uint8_t *paddr, int len);
 static int eeprom_populate_val(ee_tags_t tag, const uint8_t *paddr, int len);
 static int eeprom_restore_all(void);
 
-// number of bits to encode a state
-static const size_t ee_state_bits = 2u;
+#if defined(MARBLE_V2) && !defined(SIMULATION)
+// The CRC unit (see flash.h)
+#define ee_crc32 fmc_crc32
+#else
+static uint32_t ee_crc32_val;
 
-// frame[0] is the page header.
-// frame[1] .. frame[EEPROM_COUNT-1] are possibly valid frames
-extern
-ee_frame eeprom0_base;    // Defined in linker file or sim/sim_flash.c (ifdef SIMULATION)
-extern
-ee_frame eeprom1_base;    // Defined in linker file or sim/sim_flash.c (ifdef SIMULATION)
+/* As fmc_crc32(), a word per step: each nibble folds in through a
+ * 16 entry table.
+ */
+static
+uint32_t ee_crc32(const uint32_t *p, size_t n, int reset)
+{
+    static const uint32_t nib[16] = {
+        0x00000000u, 0x04c11db7u, 0x09823b6eu, 0x0d4326d9u,
+        0x130476dcu, 0x17c56b6bu, 0x1a864db2u, 0x1e475005u,
+        0x2608edb8u, 0x22c9f00fu, 0x2f8ad6d6u, 0x2b4bcb61u,
+        0x350c9b64u, 0x31cd86d3u, 0x3c8ea00au, 0x384fbdbdu,
+    };
+    uint32_t crc = reset ? 0xffffffffu : ee_crc32_val;
+    while(n--) {
+        crc ^= *p++;
+        for(unsigned i=0u; i<8u; i++)
+            crc = (crc << 4u) ^ nib[crc >> 28u];
+    }
+    ee_crc32_val = crc;
+    return crc;
+}
+#endif
 
-// corresponding erase sectors
-static const uint8_t eeprom0_sector = 1;
-static const uint8_t eeprom1_sector = 2;
+/* CRC of a record header and its payload, taken as padded with 0xff to a
+ * word as in flash.  'val' need not be aligned.
+ */
+static
+uint32_t ee_rec_crc(const ee_rec_t *rec, const void *val)
+{
+    const size_t nfull = rec->len/4u;
+    uint32_t crc = ee_crc32((const uint32_t *)rec, 2u, 1);
+    if(((uintptr_t)val & 3u)==0u) {
+        crc = ee_crc32((const uint32_t *)val, nfull, 0);
+    } else {
+        for(size_t n=0u; n<nfull; n++) {
+            uint32_t w;
+            memcpy(&w, (const uint8_t *)val + 4u*n, 4u);
+            crc = ee_crc32(&w, 1u, 0);
+        }
+    }
+    if(rec->len & 3u) {
+        uint32_t w = 0xffffffffu;
+        memcpy(&w, (const uint8_t *)val + 4u*nfull, rec->len & 3u);
+        crc = ee_crc32(&w, 1u, 0);
+    }
+    return crc;
+}
 
 static
-ee_frame* ee_active;
+size_t ee_rec_size(size_t len)
+{
+    return sizeof(ee_rec_t) + ((len + 3u) & ~(size_t)3u);
+}
 
+/* Nonzero if the 'n' bytes at (word aligned) 'raw' are erased */
 static
-uint8_t count_bits_set(uint32_t v)
+int ee_blank(const void *raw, size_t n)
 {
-    return __builtin_popcount(v);
+    const uint32_t *w = (const uint32_t *)raw;
+    for(size_t i=0u; i<n/4u; i++) {
+        if(w[i]!=0xffffffffu)
+            return 0;
+    }
+    const uint8_t *p = (const uint8_t *)raw;
+    for(size_t i=n & ~(size_t)3u; i<n; i++) {
+        if(p[i]!=0xff)
+            return 0;
+    }
+    return 1;
 }
 
 static
-int bit_check(uint8_t cnt)
+const ee_rec_t* ee_rec_at(const ee_sect_t *s, size_t off)
 {
-    size_t nbits = 8u*sizeof(ee_frame)/ee_state_bits;
+    return (const ee_rec_t *)((const uint8_t *)s->hdr + off);
+}
 
-    if(cnt <= nbits/4u)
-        return 0;
-    else if(cnt >= (nbits/4u)*3u)
-        return 1;
-    else
-        return -1;
+static
+int ee_rec_valid(const ee_rec_t *rec)
+{
+    return rec->tag!=0xff && rec->crc==ee_rec_crc(rec, rec+1);
 }
 
+/* Step to the record after the one at '*off'.  Returns the record at '*off'
+ * and advances '*off', or returns NULL at the end of the written area.
+ * Unless 'valid' is NULL, '*valid' is set if the record passes its CRC.
+ * That includes commit records and batch members, which only
+ * ee_sector_scan() interprets.  Indexed records are known to be valid.
+ */
 static
-ee_state_t ee_page_state(void *raw)
+const ee_rec_t* ee_rec_next(const ee_sect_t *s, size_t *off, int *valid)
 {
-    const uint8_t *base = (const uint8_t *)raw;
-    uint8_t nbit0 = 0u;
-    uint8_t nbit1 = 0u;
+    if(*off + sizeof(ee_rec_t) > EE_SECTOR_SIZE)
+        return NULL;
+    const ee_rec_t *rec = ee_rec_at(s, *off);
+    if(ee_blank(rec, sizeof(*rec)))
+        return NULL;
+    if((uint16_t)(rec->len ^ rec->nlen)!=0xffffu || rec->len > EE_VAL_MAX
+       || *off + ee_rec_size(rec->len) > EE_SECTOR_SIZE) {
+        // Torn header; nothing after it can be located
+        *off = EE_SECTOR_SIZE;
+        return NULL;
+    }
+    if(valid)
+        *valid = ee_rec_valid(rec);
+    *off += ee_rec_size(rec->len);
+    return rec;
+}
 
-    for(size_t i=0u; i<sizeof(ee_frame); i++) {
-        uint8_t hdr = base[i];
-        nbit0 += count_bits_set(0x55 & (hdr >> 0u));
-        nbit1 += count_bits_set(0x55 & (hdr >> 1u));
+/* Index the members of a committed batch of 'count' records at 'off' */
+static
+void ee_batch_apply(const ee_sect_t *s, size_t off, unsigned count)
+{
+    while(count--) {
+        const ee_rec_t *rec = ee_rec_next(s, &off, NULL);
+        ee_index[rec->tag] = rec;
     }
+}
 
-    // Apply threshold test to decide if we believe this header.
-    int bit0 = bit_check(nbit0);
-    int bit1 = bit_check(nbit1);
-    if(bit0 < 0 || bit1 < 0)
-        return ee_invalid;
+/* Index the records of an open sector, which must be newer than any
+ * sector already scanned.  A batch only counts if its commit record
+ * follows the members directly; otherwise it was interrupted.  The
+ * members of an interrupted batch may directly precede those of the
+ * next one, so a commit of 'count' members takes the last 'count' of
+ * the run before it.
+ */
+static
+void ee_sector_scan(ee_sect_t *s)
+{
+    size_t off = sizeof(ee_sector_t), batch_off = 0u;
+    unsigned batch_n = 0u;
+    const ee_rec_t *rec;
+    int valid = 0;
+    for(size_t rec_off = off; (rec = ee_rec_next(s, &off, &valid)) != NULL; rec_off = off) {
+        if(!valid) {
+            batch_n = 0u;
+        } else if(rec->tag==EE_TAG_COMMIT) {
+            const uint8_t *c = (const uint8_t *)(rec+1);
+            const unsigned count = rec->len==2u ? (unsigned)(c[0] | (c[1] << 8u)) : 0u;
+            if(count && count<=batch_n) {
+                // Skip the orphans of interrupted batches
+                for(unsigned n=batch_n - count; n; n--)
+                    ee_rec_next(s, &batch_off, NULL);
+                ee_batch_apply(s, batch_off, count);
+            }
+            batch_n = 0u;
+        } else if(!(rec->flags & EE_REC_BATCH)) {
+            if(!batch_n++)
+                batch_off = rec_off;
+        } else {
+            batch_n = 0u;
+            ee_index[rec->tag] = rec;
+        }
+    }
+    s->next = off;
+}
 
-    switch((bit1<<1u) | bit0) {
-    case 0x0: return ee_moving;
-    case 0x1: return ee_valid;
-    case 0x3: return ee_erased;
-    default: return ee_invalid;
+typedef struct {
+    unsigned nlive;         // Latest record of their tag
+    unsigned nstale;        // Superseded copies, and commit records
+    unsigned nbad;          // Failing their CRC
+    size_t live;            // Bytes taken by each kind, with headers
+    size_t stale;
+    size_t bad;
+    size_t free;            // Left to write (0 after a torn header)
+} ee_usage_t;
+
+/* Account for all records of an open sector in one pass.  'live' is
+ * also the space needed to copy the sector elsewhere.  Only records
+ * which are not indexed need their CRC checked.
+ */
+static
+void ee_sector_usage(const ee_sect_t *s, ee_usage_t *u)
+{
+    size_t off = sizeof(ee_sector_t);
+    const ee_rec_t *rec;
+    memset(u, 0, sizeof(*u));
+    while((rec = ee_rec_next(s, &off, NULL)) != NULL) {
+        const size_t size = ee_rec_size(rec->len);
+        if(ee_index[rec->tag]==rec) {
+            u->nlive++;
+            u->live += size;
+        } else if(ee_rec_valid(rec)) {
+            u->nstale++;
+            u->stale += size;
+        } else {
+            u->nbad++;
+            u->bad += size;
+        }
     }
+    u->free = EE_SECTOR_SIZE - off;
 }
 
+/* Erase (if 'erase') and write the header of an unopened sector */
 static
-int ee_page_set_state(void *raw, ee_state_t state)
+int ee_format(ee_sect_t *s, uint32_t erase_count, int erase)
 {
-    uint8_t hdr_valid[sizeof(ee_frame)];
-    for(size_t i=0u; i<sizeof(hdr_valid); i++) {
-        hdr_valid[i] = (uint8_t)state;
+    const unsigned sectorn = ee_layout[s - ee_sect].sectorn;
+    s->state = ee_sect_bad;
+    s->seq = 0u;
+    s->next = EE_SECTOR_SIZE;
+    if(erase) {
+        int ret = fmc_flash_erase_sector(sectorn);
+        fmc_flash_cache_flush_all();
+        if(ret)
+            return ret;
+        erase_count++;
     }
-    return fmc_flash_program(raw, hdr_valid, sizeof(hdr_valid));
+    s->erase_count = erase_count;
+    const uint32_t hdr[2] = {erase_count, EE_MAGIC};
+    int ret = fmc_flash_program(s->hdr, hdr, sizeof(hdr));
+    if(!ret && s->hdr->magic!=EE_MAGIC)
+        ret = -EIO;
+    if(!ret)
+        s->state = ee_sect_erased;
+    printd("ee_format(%u) erases %lu = %d\r\n", sectorn, (unsigned long)erase_count, ret);
+    return ret;
 }
 
 static
-uint8_t ee_frame_crc(const ee_frame* frame)
+int ee_open(ee_sect_t *s, uint32_t seq)
 {
-    uint8_t crc = frame->tag;
+    const uint32_t hdr[2] = {seq, ~seq};
+    int ret = fmc_flash_program(&s->hdr->seq, hdr, sizeof(hdr));
+    if(!ret && s->hdr->seq!=seq)
+        ret = -EIO;
+    if(ret) {
+        s->state = ee_sect_bad;
+        return ret;
+    }
+    s->state = ee_sect_open;
+    s->seq = seq;
+    s->next = sizeof(ee_sector_t);
+    ee_head = s;
+    return 0;
+}
 
-    for(size_t i=0; i<sizeof(frame->val); i++)
-        crc ^= frame->val[i];
+/* Formatted sector with the fewest erases, or NULL */
+static
+ee_sect_t* ee_pick_erased(size_t *nerased)
+{
+    ee_sect_t *best = NULL;
+    *nerased = 0u;
+    for(size_t n=0u; n<EE_NSECTORS; n++) {
+        ee_sect_t *s = &ee_sect[n];
+        if(s->state!=ee_sect_erased)
+            continue;
+        (*nerased)++;
+        if(!best || s->erase_count < best->erase_count)
+            best = s;
+    }
+    return best;
+}
 
-    return crc;
+/* Oldest open sector other than the head, or NULL */
+static
+ee_sect_t* ee_pick_victim(void)
+{
+    ee_sect_t *oldest = NULL;
+    for(size_t n=0u; n<EE_NSECTORS; n++) {
+        ee_sect_t *s = &ee_sect[n];
+        if(s->state!=ee_sect_open || s==ee_head)
+            continue;
+        if(!oldest || s->seq < oldest->seq)
+            oldest = s;
+    }
+    return oldest;
 }
 
+/* Program 'len' bytes of 'val' as a new record in the head */
 static
-int ee_frame_check(const ee_frame* frame)
+int ee_program(uint8_t tag, uint8_t flags, const void *val, size_t len, const ee_rec_t **prec)
 {
-    return frame->tag!=0x00 && frame->tag!=0xff && frame->crc == ee_frame_crc(frame);
+    ee_sect_t *s = ee_head;
+    const size_t size = ee_rec_size(len);
+    if(s->next + size > EE_SECTOR_SIZE)
+        return -ENOSPC;
+
+    ee_rec_t hdr;
+    hdr.tag = tag;
+    hdr.flags = flags;
+    hdr.len = (uint16_t)len;
+    hdr.nlen = (uint16_t)~len;
+    hdr.rsvd = 0xffffu;
+    hdr.crc = ee_rec_crc(&hdr, val);
+
+    ee_rec_t *rec = (ee_rec_t *)((uint8_t *)s->hdr + s->next);
+    int ret = fmc_flash_program(rec, &hdr, sizeof(hdr));
+    if(!ret && len)
+        ret = fmc_flash_program(rec+1, val, len);
+    if(!ret && (memcmp(rec, &hdr, sizeof(hdr)) || memcmp(rec+1, val, len)))
+        ret = -EIO;
+    if(ret) {
+        // The slot may be blank or half written.  Zero its header, which
+        // reads as torn so the scan ends there, and close the sector, so
+        // nothing is written beyond it.
+        static const ee_rec_t torn;
+        fmc_flash_program(rec, &torn, sizeof(torn));
+        s->next = EE_SECTOR_SIZE;
+        return ret;
+    }
+    s->next += size;
+    *prec = rec;
+    return ret;
 }
 
-// search bank for last valid tag.
 static
-const ee_frame* ee_find(const ee_frame* bank, ee_tags_t tag)
+int ee_append(ee_tags_t tag, const void *val, size_t len)
 {
-    const ee_frame* found = NULL;
-    if(tag==0 || tag==0xff) {
-        return found;
+    const ee_rec_t *rec;
+    int ret = ee_program(tag, 0xff, val, len, &rec);
+    if(!ret)
+        ee_index[tag] = rec;
+    return ret;
+}
+
+/* Begin collecting the oldest sector in the background (see eeprom_service()) */
+static
+void ee_gc_start(void)
+{
+    ee_sect_t *victim = ee_pick_victim();
+    if(!victim)
+        return;
+    ee_gc.victim = victim;
+    ee_gc.off = sizeof(ee_sector_t);
+    ee_gc.state = ee_gc_copy;
+    if(ee_task >= 0)
+        sched_arm(ee_task, 0);
+}
+
+/* One bounded step of the collection.  Copies at most EE_GC_SLICE_RECS
+ * records, or starts or checks on the erase.
+ */
+static
+int ee_gc_step(void)
+{
+    ee_sect_t *victim = ee_gc.victim;
+    int ret = 0;
+
+    if(ee_gc.state==ee_gc_copy) {
+        const ee_rec_t *rec;
+        for(unsigned n=0u; n<EE_GC_SLICE_RECS; n++) {
+            if((rec = ee_rec_next(victim, &ee_gc.off, NULL)) == NULL) {
+                // All live records are in the head.  Until the erase has
+                // started this sector still reads as an older open one.
+                victim->state = ee_sect_bad;
+                ret = fmc_flash_erase_start(ee_layout[victim - ee_sect].sectorn);
+                if(!ret)
+                    ee_gc.state = ee_gc_erase;
+                break;
+            }
+            if(ee_index[rec->tag]!=rec)
+                continue;
+            ret = ee_append(rec->tag, rec+1, rec->len);
+            if(ret) {
+                printf("ERROR: migrating tag %u : %d\r\n", rec->tag, ret);
+                break;
+            }
+        }
+    } else if(ee_gc.state==ee_gc_erase) {
+        ret = fmc_flash_erase_poll();
+        if(ret==-EBUSY)
+            return 0;
+        fmc_flash_cache_flush_all();
+        if(!ret)
+            ret = ee_format(victim, victim->erase_count + 1u, 0);
+        if(!ret)
+            ee_gc.state = ee_gc_idle;
     }
-    size_t i;
-    for(i=1u; i<EEPROM_COUNT; i++) {
-        if(bank[i].tag==0xff) {
-            printd("Empty\r\n");
-            break;
+    if(ret) {
+        printf("ERROR: EEFLASH collect sector %u : %d\r\n",
+               ee_layout[victim - ee_sect].sectorn, ret);
+        ee_gc.state = ee_gc_idle;
+    }
+    return ret;
+}
+
+/* The head is full; open a new one.  If that used up the last erased
+ * sector, start collecting the oldest one.  'reserve' bytes are to be
+ * written to the new head ahead of the collection.
+ */
+static
+int ee_advance(size_t reserve)
+{
+    size_t nerased;
+    ee_sect_t *s = ee_pick_erased(&nerased);
+    if(!s)
+        return -ENOSPC;
+    if(nerased==1u) {
+        // Check before committing the reserve that the collection will fit
+        ee_sect_t *victim = ee_pick_victim();
+        ee_usage_t u;
+        if(victim) {
+            ee_sector_usage(victim, &u);
+            if(u.live + reserve > EE_SECTOR_SIZE - sizeof(ee_sector_t))
+                return -ENOSPC;
         }
-        if(bank[i].tag!=tag || !ee_frame_check(&bank[i])) {
-            continue;
+    }
+    int ret = ee_open(s, ee_head ? ee_head->seq + 1u : 1u);
+    if(!ret && nerased==1u)
+        ee_gc_start();
+    return ret;
+}
+
+/* Append, opening a new head if needed.  Returns -EAGAIN, having written
+ * nothing, if that started a collection.
+ */
+static
+int ee_store(ee_tags_t tag, const void *val, size_t len)
+{
+    int ret = ee_append(tag, val, len);
+    printd("ee_append ret = %d\r\n", ret);
+    if(ret==-ENOSPC) {
+        ret = ee_advance(0u);
+        if(!ret) {
+            // may still fail with -ENOSPC if really full.
+            ret = ee_gc.state!=ee_gc_idle ? -EAGAIN : ee_append(tag, val, len);
         }
-        found = &bank[i];
     }
-    return found;
+    return ret;
 }
 
+#define EE_QUEUE_HDR    (3u)
+
 static
-int ee_write(ee_frame* bank, ee_tags_t tag, const ee_val_t val)
+size_t ee_queue_len(const uint8_t *ent)
 {
-    const ee_frame* prev = NULL;
+    return (size_t)ent[1] | ((size_t)ent[2] << 8u);
+}
 
-    size_t n;
-    for(n=1u; n<EEPROM_COUNT; n++) {
-        const ee_frame* f = &bank[n];
+static
+uint8_t* ee_queue_find(ee_queue_t *q, ee_tags_t tag)
+{
+    for(size_t off=0u; off<q->used; off += EE_QUEUE_HDR + ee_queue_len(&q->buf[off])) {
+        if(q->buf[off]==tag)
+            return &q->buf[off];
+    }
+    return NULL;
+}
 
-        if(f->tag==0xff)
+static
+void ee_queue_drop(ee_queue_t *q, uint8_t *ent)
+{
+    const size_t size = EE_QUEUE_HDR + ee_queue_len(ent);
+    const size_t off = (size_t)(ent - q->buf);
+    memmove(ent, ent + size, q->used - off - size);
+    q->used -= size;
+}
+
+/* Add a value, replacing any earlier one of the same tag */
+static
+int ee_queue_put(ee_queue_t *q, ee_tags_t tag, const void *val, size_t len)
+{
+    uint8_t *prev = ee_queue_find(q, tag);
+    size_t avail = sizeof(q->buf) - q->used;
+    if(prev)
+        avail += EE_QUEUE_HDR + ee_queue_len(prev);
+    if(EE_QUEUE_HDR + len > avail)
+        return -ENOSPC;
+    if(prev)
+        ee_queue_drop(q, prev);
+    uint8_t *ent = &q->buf[q->used];
+    ent[0] = (uint8_t)tag;
+    ent[1] = (uint8_t)len;
+    ent[2] = (uint8_t)(len >> 8u);
+    memcpy(ent + EE_QUEUE_HDR, val, len);
+    q->used += EE_QUEUE_HDR + len;
+    return 0;
+}
+
+/* Write queued values in order, until done or a collection starts */
+static
+void ee_pending_flush(void)
+{
+    while(ee_pending.used && ee_gc.state==ee_gc_idle) {
+        uint8_t *ent = ee_pending.buf;
+        int ret = ee_store(ent[0], ent + EE_QUEUE_HDR, ee_queue_len(ent));
+        if(ret==-EAGAIN)
             break;
+        if(ret)
+            printf("ERROR: EEFLASH deferred write of tag %u : %d\r\n", ent[0], ret);
+        ee_queue_drop(&ee_pending, ent);
+    }
+}
+
+/* Latest stored value of 'tag', queued or in flash; NULL if none */
+static
+const uint8_t* ee_lookup_stored(ee_tags_t tag, size_t *len)
+{
+    if(tag==0 || tag==0xff)
+        return NULL;
+    const uint8_t *ent = ee_pending.used ? ee_queue_find(&ee_pending, tag) : NULL;
+    if(ent) {
+        *len = ee_queue_len(ent);
+        return ent + EE_QUEUE_HDR;
+    }
+    const ee_rec_t *rec = ee_index[tag];
+    if(rec) {
+        *len = rec->len;
+        return (const uint8_t *)(rec+1);
+    }
+    return NULL;
+}
 
-        if(f->tag==tag && ee_frame_check(f))
-            prev = f;
+/* As ee_lookup_stored(), but a value staged in an open batch comes first */
+static
+const uint8_t* ee_lookup(ee_tags_t tag, size_t *len)
+{
+    const uint8_t *ent = ee_stage.used ? ee_queue_find(&ee_stage, tag) : NULL;
+    if(ent) {
+        *len = ee_queue_len(ent);
+        return ent + EE_QUEUE_HDR;
     }
+    return ee_lookup_stored(tag, len);
+}
 
-    if(prev && memcmp(prev->val, val, sizeof(prev->val))==0)
-        return 0; // ignore write of duplicate
+int eeprom_service(void)
+{
+    if(ee_gc.state!=ee_gc_idle)
+        ee_gc_step();
+    if(ee_gc.state==ee_gc_idle)
+        ee_pending_flush();
+    return ee_gc.state!=ee_gc_idle || ee_pending.used;
+}
 
-    if(n==EEPROM_COUNT)
-        return -ENOSPC; // full!
+int eeprom_flush(void)
+{
+    while(eeprom_service()) {}
+    return ee_head ? 0 : -EIO;
+}
 
-    // we have space, and 'n' points to an unused block
-    ee_frame f;
-    f.tag = tag;
-    memcpy(f.val, val, sizeof(f.val));
-    f.crc = ee_frame_crc(&f);
+static
+void task_eeprom(void)
+{
+    if(eeprom_service())
+        sched_arm(ee_task, ee_gc.state==ee_gc_erase ? EE_GC_POLL_MS : 1u);
+}
 
-    return fmc_flash_program((ee_frame*)&bank[n], &f, sizeof(f));
+void eeprom_task_init(void)
+{
+    if(ee_task < 0)
+        ee_task = sched_add_oneshot("eeprom", task_eeprom, SCHED_PRIO_LOW);
+    if(ee_gc.state!=ee_gc_idle || ee_pending.used)
+        sched_arm(ee_task, 0);
 }
 
+/* Program the staged values back to back, then the commit record, all in
+ * the head.  Until the commit record is complete, none of them count.
+ */
 static
-int ee_migrate(ee_frame* __restrict__ dst, const ee_frame* __restrict__ src)
+int ee_batch_write(void)
 {
+    size_t size = ee_rec_size(2u);
+    unsigned count = 0u;
+    for(size_t off=0u; off<ee_stage.used; off += EE_QUEUE_HDR + ee_queue_len(&ee_stage.buf[off])) {
+        size += ee_rec_size(ee_queue_len(&ee_stage.buf[off]));
+        count++;
+    }
+    if(count==1u) {
+        // Atomic anyway
+        const uint8_t *ent = ee_stage.buf;
+        int ret = ee_store(ent[0], ent + EE_QUEUE_HDR, ee_queue_len(ent));
+        if(ret==-EAGAIN)
+            ret = ee_queue_put(&ee_pending, ent[0], ent + EE_QUEUE_HDR, ee_queue_len(ent));
+        return ret;
+    }
+
     int ret = 0;
+    if(ee_head->next + size > EE_SECTOR_SIZE)
+        ret = ee_advance(size);
+    if(!ret && ee_head->next + size > EE_SECTOR_SIZE)
+        ret = -ENOSPC;
+    const size_t batch_off = ee_head->next;
+    const ee_rec_t *rec;
+    for(size_t off=0u; off<ee_stage.used && !ret; off += EE_QUEUE_HDR + ee_queue_len(&ee_stage.buf[off])) {
+        const uint8_t *ent = &ee_stage.buf[off];
+        ret = ee_program(ent[0], 0xffu & ~EE_REC_BATCH, ent + EE_QUEUE_HDR, ee_queue_len(ent), &rec);
+    }
+    if(!ret) {
+        const uint8_t c[2] = {(uint8_t)count, (uint8_t)(count >> 8u)};
+        ret = ee_program(EE_TAG_COMMIT, 0xffu, c, sizeof(c), &rec);
+    }
+    if(!ret)
+        ee_batch_apply(ee_head, batch_off, count);
+    return ret;
+}
 
-    // Scan backwards in source frame to first last valid of each tag.
-    for(size_t srcn = EEPROM_COUNT-1u; srcn; srcn--) {
-        const ee_frame* sf = &src[srcn];
+/* Writes are staged only while a batch is open and its owner is writing */
+static
+int ee_staging(void)
+{
+    return ee_batch_depth && ee_batch_scope;
+}
 
-        if(!ee_frame_check(sf))
-            continue;
+void eeprom_begin(void)
+{
+    ee_batch_depth++;
+    ee_batch_scope = 1u;
+}
 
-        // does tag already exist in destination?
-        const ee_frame* df = (const ee_frame*)ee_find(dst, sf->tag);
-        if(!df) { // not found, migrate tag
-            ret = ee_write(dst, sf->tag, sf->val);
+unsigned eeprom_batch_open(void)
+{
+    return ee_batch_depth;
+}
 
-        } else { // found, assume tag already migrated
+void eeprom_batch_enter(void)
+{
+    ee_batch_scope = ee_batch_depth ? 1u : 0u;
+}
+
+void eeprom_batch_leave(void)
+{
+    ee_batch_scope = 0u;
+}
+
+int eeprom_commit(void)
+{
+    if(!ee_batch_depth)
+        return -EINVAL;
+    if(--ee_batch_depth)
+        return 0;
+    ee_batch_scope = 0u;
+    int ret = 0;
+    if(ee_stage.used) {
+        if(!ee_head) {
+            ret = -EIO;
+        } else {
+            // The batch must reach flash in one piece, after anything queued
+            if(ee_gc.state!=ee_gc_idle || ee_pending.used)
+                eeprom_flush();
+            ret = ee_batch_write();
+            if(ee_task >= 0 && ee_gc.state!=ee_gc_idle)
+                sched_arm(ee_task, 0);
         }
     }
+    ee_stage.used = 0u;
+    return ret;
+}
+
+void eeprom_abort(void)
+{
+    ee_batch_depth = 0u;
+    ee_batch_scope = 0u;
+    ee_stage.used = 0u;
+}
+
+// ======================== Legacy two sector format ==========================
+// Fixed 8 byte frames, with a page state header frame (cf. AN3390)
+
+typedef struct {
+    uint8_t tag;
+    uint8_t val[6];
+    uint8_t crc;
+} ee_legacy_frame;
+
+typedef enum {
+    ee_erased = 0xff,
+    ee_valid = 0x55,
+    ee_moving = 0x00,
+    ee_invalid,
+} ee_state_t;
+
+#define EE_LEGACY_COUNT     (EE_SECTOR_SIZE/sizeof(ee_legacy_frame))
+// The old three-part watchdog key
+#define EE_LEGACY_WD_KEY    (9)
+
+// number of bits to encode a state
+static const size_t ee_state_bits = 2u;
+
+/* Bits set in 'v', summed in parallel within the word */
+static
+unsigned count_bits_set(uint32_t v)
+{
+    v = v - ((v >> 1u) & 0x55555555u);
+    v = (v & 0x33333333u) + ((v >> 2u) & 0x33333333u);
+    v = (v + (v >> 4u)) & 0x0f0f0f0fu;
+    return (v * 0x01010101u) >> 24u;
+}
+
+static
+int bit_check(unsigned cnt)
+{
+    size_t nbits = 8u*sizeof(ee_legacy_frame)/ee_state_bits;
+
+    if(cnt <= nbits/4u)
+        return 0;
+    else if(cnt >= (nbits/4u)*3u)
+        return 1;
+    else
+        return -1;
+}
+
+static
+ee_state_t ee_page_state(const void *raw)
+{
+    const uint32_t *base = (const uint32_t *)raw;
+    unsigned nbit0 = 0u;
+    unsigned nbit1 = 0u;
+
+    for(size_t i=0u; i<sizeof(ee_legacy_frame)/4u; i++) {
+        uint32_t hdr = base[i];
+        nbit0 += count_bits_set(0x55555555u & (hdr >> 0u));
+        nbit1 += count_bits_set(0x55555555u & (hdr >> 1u));
+    }
+
+    // Apply threshold test to decide if we believe this header.
+    int bit0 = bit_check(nbit0);
+    int bit1 = bit_check(nbit1);
+    if(bit0 < 0 || bit1 < 0)
+        return ee_invalid;
+
+    switch((bit1<<1u) | bit0) {
+    case 0x0: return ee_moving;
+    case 0x1: return ee_valid;
+    case 0x3: return ee_erased;
+    default: return ee_invalid;
+    }
+}
+
+static
+int ee_legacy_frame_check(const ee_legacy_frame* frame)
+{
+    uint8_t crc = frame->tag;
+
+    for(size_t i=0; i<sizeof(frame->val); i++)
+        crc ^= frame->val[i];
+
+    return frame->tag!=0x00 && frame->tag!=0xff && frame->crc == crc;
+}
 
+static
+size_t ee_tag_size(ee_tags_t tag)
+{
+    switch(tag) {
+#define X(N, NAME, TYPE, SIZE, ...) case ee_ ## NAME: return SIZE;
+    FOR_ALL_EETAGS()
+#undef X
+    default: return sizeof(((ee_legacy_frame *)0)->val);
+    }
+}
+
+/* Copy the latest frame of each tag from a legacy bank, unless the tag is
+ * already in the store.  'key' collects the parts of the watchdog key.
+ */
+static
+int ee_import_bank(const ee_sect_t *s, uint8_t key[16], unsigned *key_found)
+{
+    const ee_legacy_frame *bank = (const ee_legacy_frame *)s->hdr;
+    size_t len;
+    uint32_t seen[(1u << (8u*sizeof(ee_tag_t)))/32u];
+    memset(seen, 0, sizeof(seen));
+
+    size_t end;
+    for(end=1u; end<EE_LEGACY_COUNT && bank[end].tag!=0xff; end++) {}
+
+    // Scan backwards, so the first valid frame found of each tag is the latest
+    for(size_t n=end-1u; n; n--) {
+        const ee_legacy_frame *f = &bank[n];
+        const uint32_t mask = 1u << (f->tag%32u);
+        if(!ee_legacy_frame_check(f) || (seen[f->tag/32u] & mask))
+            continue;
+        seen[f->tag/32u] |= mask;
+        unsigned part = f->tag - EE_LEGACY_WD_KEY;
+        if(part < 3u) {
+            if(!(*key_found & (1u << part)))
+                memcpy(&key[6u*part], f->val, part < 2u ? 6u : 4u);
+            *key_found |= 1u << part;
+        } else if(!ee_lookup(f->tag, &len)) {
+            int ret = fmc_ee_write(f->tag, f->val, ee_tag_size(f->tag));
+            if(ret)
+                return ret;
+        }
+    }
+    return 0;
+}
+
+/* Move the contents of any legacy banks into the (open) store, then
+ * reformat them.  A bank in the valid state takes precedence over one
+ * left behind by an interrupted migration.
+ */
+static
+int ee_import_legacy(const ee_state_t legacy[EE_NSECTORS])
+{
+    uint8_t key[16];
+    unsigned key_found = 0u;
+    int ret = 0;
+
+    for(size_t n=0u; n<EE_NSECTORS && !ret; n++) {
+        if(legacy[n]==ee_valid)
+            ret = ee_import_bank(&ee_sect[n], key, &key_found);
+    }
+    for(size_t n=0u; n<EE_NSECTORS && !ret; n++) {
+        if(legacy[n]==ee_moving)
+            ret = ee_import_bank(&ee_sect[n], key, &key_found);
+    }
+    size_t len;
+    if(!ret && key_found==7u && !ee_lookup(ee_wd_key, &len))
+        ret = fmc_ee_write(ee_wd_key, key, sizeof(key));
+    memset(key, 0, sizeof(key));
+    if(!ret)
+        ret = eeprom_flush();  // before the old copies go
     if(ret) {
-        printf("ERROR: migrating %p <- %p : %d\n", (void *)dst, (const void *)src, ret);
+        printf("ERROR: importing old EEFLASH : %d\r\n", ret);
+        return ret;
+    }
+    printf("Imported old EEFLASH\r\n");
+    for(size_t n=0u; n<EE_NSECTORS; n++) {
+        if(legacy[n]==ee_valid || legacy[n]==ee_moving)
+            ret |= ee_format(&ee_sect[n], 0u, 1);
     }
     return ret;
 }
 
+// ============================================================================
+
 int eeprom_init(void)
 {
     if (restore_flash() < 0) {
-      fmc_flash_erase_sector(1);
-      fmc_flash_erase_sector(2);
+      for(size_t n=0u; n<EE_NSECTORS; n++)
+          fmc_flash_erase_sector(ee_layout[n].sectorn);
+      fmc_flash_cache_flush_all();
     }
     fmc_flash_init();
-    ee_active = NULL;
+    if(ee_head)
+        eeprom_flush();
+    ee_head = NULL;
+    ee_gc.state = ee_gc_idle;
+    ee_pending.used = 0u;
+    eeprom_abort();
+    memset(ee_index, 0, sizeof(ee_index));
 
     int ret = 0;
-    ee_state_t e0 = ee_page_state(&eeprom0_base);
-    ee_state_t e1 = ee_page_state(&eeprom1_base);
-
-    if((e0==ee_valid) ^ (e1==ee_valid)) { // one bank valid
-        printd("obv\r\n");
-        if(e0==ee_valid) {
-            printd("e0v\r\n");
-            if(e1==ee_moving) {// need to finish migrating bank1
-                ret = ee_migrate(&eeprom0_base, &eeprom1_base);
-                if(!ret)
-                    ret = fmc_flash_erase_sector(eeprom1_sector);
-                fmc_flash_cache_flush_all();
-            }
-            if(!ret)
-                ee_active = &eeprom0_base;
-
-        } else { // e1==ee_valid
-            printd("e1v\r\n");
-            if(e0==ee_moving) {// need to finish migrating bank0
-                ret = ee_migrate(&eeprom1_base, &eeprom0_base);
-                if(!ret)
-                    ret = fmc_flash_erase_sector(eeprom0_sector);
-                fmc_flash_cache_flush_all();
+    ee_state_t legacy[EE_NSECTORS];
+    int nlegacy = 0;
+    uint32_t max_count = 0u;
+
+    // Classify; anything unrecognized is reformatted below
+    for(size_t n=0u; n<EE_NSECTORS; n++) {
+        ee_sect_t *s = &ee_sect[n];
+        const ee_sector_t *hdr = (const ee_sector_t *)ee_layout[n].base;
+        s->hdr = (ee_sector_t *)ee_layout[n].base;
+        s->state = ee_sect_bad;
+        s->erase_count = 0u;
+        s->seq = 0u;
+        s->next = EE_SECTOR_SIZE;
+        legacy[n] = ee_invalid;
+        if(hdr->magic==EE_MAGIC) {
+            s->erase_count = hdr->erase_count;
+            if(hdr->seq==0xffffffffu && hdr->nseq==0xffffffffu) {
+                s->state = ee_sect_erased;
+            } else if(hdr->seq==~hdr->nseq) {
+                s->state = ee_sect_open;
+                s->seq = hdr->seq;
             }
-            if(!ret)
-                ee_active = &eeprom1_base;
+            if(s->erase_count > max_count)
+                max_count = s->erase_count;
+        } else if(ee_layout[n].legacy) {
+            legacy[n] = ee_page_state(hdr);
+            if(legacy[n]==ee_valid || legacy[n]==ee_moving)
+                nlegacy++;
         }
+    }
 
-    } else {
-        printd("nov\r\n");
-        if(!(e0==ee_erased && e1==ee_erased)) {
-            printf("ERROR: EEFLASH invalid!  Reformatting...\n");
-            ret = fmc_flash_erase_sector(eeprom0_sector);
-            ret |= fmc_flash_erase_sector(eeprom1_sector);
-            fmc_flash_cache_flush_all();
+    for(size_t n=0u; n<EE_NSECTORS; n++) {
+        ee_sect_t *s = &ee_sect[n];
+        if(s->hdr->magic==EE_MAGIC) {
+            if(s->state==ee_sect_bad) // torn while opening
+                ee_format(s, s->erase_count, 1);
+        } else if(legacy[n]!=ee_valid && legacy[n]!=ee_moving) {
+            // Blank or garbage; the erase count is lost, so estimate high
+            ee_format(s, max_count, !ee_blank(s->hdr, EE_SECTOR_SIZE));
         }
-        ret = ee_page_set_state(&eeprom0_base, ee_valid);
-        if(!ret) {
-            printd("e0 active\r\n");
-            ee_active = &eeprom0_base;
-            e0 = ee_page_state(&eeprom0_base);
-            printd("e0 page_state = %d\r\n", e0);
-        } else {
-            printd("no active\r\n");
+    }
+
+    // Index open sectors oldest first
+    for(;;) {
+        ee_sect_t *next = NULL;
+        for(size_t n=0u; n<EE_NSECTORS; n++) {
+            ee_sect_t *s = &ee_sect[n];
+            if(s->state==ee_sect_open && (!ee_head || s->seq > ee_head->seq)
+               && (!next || s->seq < next->seq))
+                next = s;
         }
+        if(!next)
+            break;
+        ee_sector_scan(next);
+        ee_head = next;
     }
+
+    if(!ee_head) {
+        size_t nerased;
+        ee_sect_t *s = ee_pick_erased(&nerased);
+        ret = s ? ee_open(s, 1u) : -EIO;
+        printd("first head = %d\r\n", ret);
+    }
+
+    if(!ret && nlegacy)
+        ret = ee_import_legacy(legacy);
+
+    if(!ret) {
+        size_t nerased;
+        ee_pick_erased(&nerased);
+        if(!nerased) // finish an interrupted collection
+            ee_gc_start();
+    }
+    if(ret)
+        printf("ERROR: EEFLASH init : %d\r\n", ret);
+
     // Write default values of all missing tags
     eeprom_restore_all();
     printd("eeprom_init (%d)\r\n", ret);
@@ -290,131 +1109,151 @@ int fmc_ee_reset(void)
 {
     int ret = 0;
 
-    ee_active = NULL;
+    eeprom_flush();  // an erase may be in progress
+    ee_head = NULL;
 
-    ret |= fmc_flash_erase_sector(eeprom0_sector);
-    ret |= fmc_flash_erase_sector(eeprom1_sector);
-    fmc_flash_cache_flush_all();
+    // Keep the erase counts
+    for(size_t n=0u; n<EE_NSECTORS; n++) {
+        ee_sect_t *s = &ee_sect[n];
+        uint32_t count = s->hdr->magic==EE_MAGIC ? s->hdr->erase_count : s->erase_count;
+        ret |= ee_format(s, count, 1);
+    }
     ret |= eeprom_init();
 
     return ret;
 }
 
-int fmc_ee_read(ee_tags_t tag, ee_val_t val)
+int fmc_ee_read(ee_tags_t tag, void *val, size_t len)
 {
-    const ee_frame* bank = ee_active;
-    if(!bank) {
+    if(!ee_head) {
         return -EIO;
     }
-    const ee_frame* f = ee_find(bank, tag);
-    printd("ee_find(eeprom0_base, %d) = %p\r\n", tag, (void *)f);
-    if(f) {
-        memcpy(val, f->val, sizeof(f->val)/sizeof(uint8_t));
-        return 0;
+    size_t vlen;
+    const uint8_t *v = ee_lookup(tag, &vlen);
+    printd("ee_lookup(%d) = %p\r\n", tag, (const void *)v);
+    if(v) {
+        memcpy(val, v, MIN(len, vlen));
+        return (int)vlen;
     } else {
         return -ENOENT;
     }
 }
 
-/* Helps avoid lots of unnecessary write cycles doing in migration in the unlikely event
- * that the active bank contains only unique tags, or bad blocks.
- */
-static
-int ee_is_full(const ee_frame* bank)
+int fmc_ee_read_stored(ee_tags_t tag, void *val, size_t len)
 {
-    uint32_t found[1u+sizeof(ee_tag_t)*8u/32u];
-
-    memset(found, 0, sizeof(found)/sizeof(uint8_t));
-
-    for(size_t n=1u; n<EEPROM_COUNT; n++) {
-        const ee_frame* f = &bank[n];
-        const size_t word = f->tag/8u;
-        const uint8_t mask = 1u<<(f->tag%8u);
-
-        if(f->tag==0xff) {
-            return 0; // found an unused tag
-
-        } else if(!ee_frame_check(f)) { // presume bad sector, treat as used
-
-        } else if(found[word] & mask) {
-            // found a valid duplicate, which will be free after migration
-            return 0;
-
-        } else {
-            found[word] |= mask;
-        }
+    if(!ee_head) {
+        return -EIO;
+    }
+    size_t vlen;
+    const uint8_t *v = ee_lookup_stored(tag, &vlen);
+    if(v) {
+        memcpy(val, v, MIN(len, vlen));
+        return (int)vlen;
+    } else {
+        return -ENOENT;
     }
-
-    return 1;
 }
 
-int fmc_ee_write(ee_tags_t tag, const ee_val_t val)
+int fmc_ee_write(ee_tags_t tag, const void *val, size_t len)
 {
-    if(tag==0 || tag==0xff) {
+    if(tag==0 || tag==0xff || len > EE_VAL_MAX) {
         return -EINVAL;
     }
-    ee_frame* active = ee_active;
-
-    if (active == &eeprom0_base) {
-      printd("e0 active\r\n");
-    } else if (active == &eeprom1_base) {
-      printd("e1 active\r\n");
-    } else {
-      printd("active is %p\r\n", (void *)active);
-    }
-
-    if(!active) {
+    if(!ee_head) {
         return -EIO;
     }
-    int ret = ee_write(active, tag, val);
-    printd("ee_write ret = %d\r\n", ret);
-
-    if(ret==-ENOSPC && !ee_is_full(active)) { // Try migration
-        ee_frame* alt;
-        unsigned activen;
-        if(active==&eeprom0_base) {
-            alt = &eeprom1_base;
-            activen = eeprom0_sector;
-        } else if(active==&eeprom1_base) {
-            alt = &eeprom0_base;
-            activen = eeprom1_sector;
-        } else {
-            return -EINVAL;
-        }
-        if(ee_page_state(alt)!=ee_erased) {
-            return -EINVAL;
-        }
-        ret = ee_page_set_state((ee_frame*)active, ee_moving);
-        if(!ret) {
-            ret = ee_migrate(alt, active);
-        }
-        if(!ret) {
-            ret = ee_page_set_state(alt, ee_valid);
-        }
-        if(!ret) {
-            ret = fmc_flash_erase_sector(activen); // sets active = ee_erased
-        }
-        fmc_flash_cache_flush_all();
-
-        if(!ret) {
-            ee_active = alt;
+    size_t plen;
+    // Outside the batch, a staged value which may yet be discarded is no match
+    const uint8_t *prev = ee_staging() ? ee_lookup(tag, &plen) : ee_lookup_stored(tag, &plen);
+    if(prev && plen==len && memcmp(prev, val, len)==0)
+        return 0; // ignore write of duplicate
 
-            // retry on alternate bank
-            ret = ee_write(alt, tag, val);
-            // may still fail with -ENOSPC if really full.
+    if(ee_staging()) {
+        // Drop a staged value which the stored one makes redundant
+        uint8_t *staged = ee_queue_find(&ee_stage, tag);
+        prev = ee_lookup_stored(tag, &plen);
+        if(prev && plen==len && memcmp(prev, val, len)==0) {
+            if(staged)
+                ee_queue_drop(&ee_stage, staged);
+            return 0;
         }
+        return ee_queue_put(&ee_stage, tag, val, len);
     }
 
+    int ret = -EAGAIN;
+    // Keep order with anything already queued
+    if(ee_gc.state==ee_gc_idle && !ee_pending.used)
+        ret = ee_store(tag, val, len);
+    if(ret==-EAGAIN) {
+        ret = ee_queue_put(&ee_pending, tag, val, len);
+        if(ret==-ENOSPC) {
+            // Queue full; finish the collection here and now
+            eeprom_flush();
+            ret = ee_store(tag, val, len);
+            if(ret==-EAGAIN)
+                ret = ee_queue_put(&ee_pending, tag, val, len);
+        }
+        if(!ret && ee_task >= 0)
+            sched_arm(ee_task, 0);
+    }
     return ret;
 }
 
+/*
+ * void eeprom_print_status(void);
+ *  One line per sector.  'live' is the space its records would take if
+ *  collected now, 'stale' is superseded copies, and 'free' is what is
+ *  left to write.
+ */
+void eeprom_print_status(void)
+{
+    static const char *state_str[] = {"bad", "erased", "open"};
+    size_t ntags = 0u;
+    for(size_t n=0u; n<sizeof(ee_index)/sizeof(ee_index[0]); n++) {
+        if(ee_index[n])
+            ntags++;
+    }
+    printf("EEPROM: %u sectors of %u bytes, %u tags\r\n", (unsigned)EE_NSECTORS,
+           (unsigned)EE_SECTOR_SIZE, (unsigned)ntags);
+    for(size_t n=0u; n<EE_NSECTORS; n++) {
+        const ee_sect_t *s = &ee_sect[n];
+        printf("  sector %u: %-6s erases %6lu", ee_layout[n].sectorn,
+               state_str[s->state], (unsigned long)s->erase_count);
+        if(s->state==ee_sect_open) {
+            ee_usage_t u;
+            ee_sector_usage(s, &u);
+            printf("  seq %5lu  live %5u  stale %5u  free %5u", (unsigned long)s->seq,
+                   (unsigned)u.live, (unsigned)u.stale, (unsigned)u.free);
+            if(u.nbad)
+                printf("  bad %u", u.nbad);
+            if(s==ee_head)
+                printf("  (head)");
+        }
+        printf("\r\n");
+    }
+    if(ee_gc.state!=ee_gc_idle) {
+        printf("  %s sector %u\r\n", ee_gc.state==ee_gc_erase ? "erasing" : "collecting",
+               ee_layout[ee_gc.victim - ee_sect].sectorn);
+    }
+    if(ee_pending.used) {
+        printf("  %u bytes of writes queued\r\n", (unsigned)ee_pending.used);
+    }
+    if(ee_batch_depth) {
+        printf("  batch open, %u bytes staged\r\n", (unsigned)ee_stage.used);
+    }
+#ifdef SIMULATION
+    sim_flash_print_stats();
+#endif
+}
+
 static int eeprom_read_val(ee_tags_t tag, volatile uint8_t *paddr, int len) {
-  ee_val_t eeval;
-  len = MIN(len, (int)(sizeof(ee_val_t)/sizeof(uint8_t)));
-  int rval = fmc_ee_read(tag, eeval);
+  // Same as fmc_ee_read(), but without a bounce buffer for 'volatile'
+  size_t vlen = 0;
+  const uint8_t *val = ee_head ? ee_lookup(tag, &vlen) : NULL;
+  int rval = ee_head ? (val ? 0 : -ENOENT) : -EIO;
   if (!rval) {
-    for (int n = 0; n < len; n++) {
-      paddr[n] = eeval[n];
+    for (int n = 0; n < MIN(len, (int)vlen); n++) {
+      paddr[n] = val[n];
     }
   } else {
 #ifdef DEBUG_ENABLE_ERRNO_DECODE
@@ -428,14 +1267,10 @@ static int eeprom_read_val(ee_tags_t tag, volatile uint8_t *paddr, int len) {
 }
 
 static int eeprom_store_val(ee_tags_t tag, const uint8_t *paddr, int len) {
-  ee_val_t eeval;
-  len = MIN(len, (int)(sizeof(ee_val_t)/sizeof(uint8_t)));
-  for (int n = 0; n < len; n++) {
-    eeval[n] = paddr[n];
-  }
-  int rval = fmc_ee_write(tag, eeval);
+  len = MIN(len, (int)ee_tag_size(tag));
+  int rval = fmc_ee_write(tag, paddr, (size_t)len);
   if (!rval) {
-    printf("Success\r\n");
+    printf(ee_staging() ? "Staged\r\n" : "Success\r\n");
   } else {
 #ifdef DEBUG_ENABLE_ERRNO_DECODE
     const char *errname = decode_errno(-rval);
@@ -453,16 +1288,13 @@ static int eeprom_store_val(ee_tags_t tag, const uint8_t *paddr, int len) {
  *    found, a new copy is stored.
  */
 static int eeprom_populate_val(ee_tags_t tag, const uint8_t *paddr, int len) {
-  ee_val_t eeval;
-  len = MIN(len, (int)(sizeof(ee_val_t)/sizeof(uint8_t)));
-  // Note: fmc_ee_read() wastes a bit of ops compared to ee_find(), but I like the
-  // encapsulation, plus stack var eeval would need to exist for fmc_ee_write() anyhow
-  int rval = fmc_ee_read(tag, eeval);
-  if (rval) {
-    for (int n = 0; n < len; n++) {
-      eeval[n] = paddr[n];
-    }
-    rval = fmc_ee_write(tag, eeval);
+  int rval = 0;
+  size_t vlen;
+  if (!ee_head) {
+    return -EIO;
+  }
+  if (!ee_lookup(tag, &vlen)) {
+    rval = fmc_ee_write(tag, paddr, (size_t)len);
     if (!rval) {
       printf("Default stored\r\n");
       return 1;
@@ -496,33 +1328,3 @@ int eeprom_store_ ## NAME(const uint8_t *pdata, int len) { return eeprom_store_v
 int eeprom_read_ ## NAME(volatile uint8_t *pdata, int len) { return eeprom_read_val(ee_ ## NAME, pdata, len); }
 FOR_ALL_EETAGS()
 #undef X
-
-/* int eeprom_read_wd_key(volatile uint8_t *pdata, int len);
- *  The whole eeprom scheme is built around an 8-byte structure with a 6-byte
- *  payload, so this bespoke hack is necessary for any larger structures.
- */
-int eeprom_read_wd_key(volatile uint8_t *pdata, int len) {
-  _UNUSED(len);
-  // Read part 0 (6 bytes)
-  if (eeprom_read_wd_key_0(pdata, 6) < 0) return -1;
-  // Read part 1 (6 bytes)
-  if (eeprom_read_wd_key_1((pdata+6), 6) < 0) return -1;
-  // Read part 2 (6 bytes)
-  if (eeprom_read_wd_key_2((pdata+12), 4) < 0) return -1;
-  return 0;
-}
-
-/* int eeprom_store_wd_key(const uint8_t *pdata, int len);
- *  The whole eeprom scheme is built around an 8-byte structure with a 6-byte
- *  payload, so this bespoke hack is necessary for any larger structures.
- */
-int eeprom_store_wd_key(const uint8_t *pdata, int len) {
-  _UNUSED(len);
-  // Store part 0 (6 bytes)
-  if (eeprom_store_wd_key_0(pdata, 6) < 0) return -1;
-  // Store part 1 (6 bytes)
-  if (eeprom_store_wd_key_1((pdata+6), 6) < 0) return -1;
-  // Store part 2 (6 bytes)
-  if (eeprom_store_wd_key_2((pdata+12), 4) < 0) return -1;
-  return 0;
-}
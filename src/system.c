@@ -11,47 +11,43 @@
 #include "console.h"
 #include "ltm4673.h"
 #include "watchdog.h"
+#include "uart_fifo.h"
+#include "task_sched.h"
+#include "telem.h"
 
 #include <stdio.h>
 
 #define LED_SNAKE
 #define FPGA_PUSH_DELAY_MS              (2)
 #define FPGA_RESET_DURATION_MS         (50)
+// Re-check FPGA_INT this soon after a doorbell pass which made progress
+#define MBOX_DOORBELL_RECHECK_MS        (1)
 unsigned int live_cnt=0;
 unsigned int fpga_prog_cnt=0;
-unsigned int fpga_done_tickval=0;
-unsigned int fpga_net_prog_pend=0;
-static uint32_t fpga_disabled_time = 0;
-static int fpga_reset = 0;
 static void (*fpga_reset_callback)(void) = NULL;
-static volatile bool spi_update = false;
-static uint32_t systimer_ms=1; // System timer interrupt period
+static int task_fpga_net_prog = -1;
+static int task_fpga_reset = -1;
+static int task_mbox_doorbell_id = -1;
 
 static void system_apply_params(void);
+static void system_register_tasks(void);
 
 static void fpga_done_handler(void)
 {
    fpga_prog_cnt++;
-   fpga_net_prog_pend=1;
-   fpga_done_tickval = BSP_GET_SYSTICK();
+   sched_arm(task_fpga_net_prog, FPGA_PUSH_DELAY_MS);
    FPGAWD_DoneHandler();
    return;
 }
 
-static void timer_int_handler(void)
+static void fpga_int_handler(void)
 {
-   static uint32_t spi_ms_cnt=0;
-
-   // SPI mailbox update flag; soft-realtime
-   spi_ms_cnt += systimer_ms;
-   //printf("%d\r\n", spi_ms_cnt);
-   if (spi_ms_cnt > SPI_MAILBOX_PERIOD_MS) {
-      spi_update = true;
-      spi_ms_cnt = 0;
-      // Use LED2 for SPI heartbeat
-      marble_LED_toggle(2);
-   }
+   sched_arm(task_mbox_doorbell_id, 0);
+   return;
+}
 
+static void timer_int_handler(void)
+{
    // Snake-pattern LEDs on two LEDs
 #ifdef LED_SNAKE
    static uint16_t led_cnt = 0;
@@ -74,7 +70,7 @@ void system_init(void) {
   marble_GPIOint_handlers(fpga_done_handler);
 
   /* Configure the System Timer for 200 Hz interrupts (if supported) */
-  systimer_ms = marble_SYSTIMER_ms(5);
+  marble_SYSTIMER_ms(5);
 
   // Register System Timer interrupt handler
   marble_SYSTIMER_handler(timer_int_handler);
@@ -84,33 +80,79 @@ void system_init(void) {
 
   // Initialize subsystems
   I2C_PM_init();
+
+  system_register_tasks();
+  // FPGA_INT rings the mailbox doorbell; needs the task registered above
+  marble_FPGAint_handler(fpga_int_handler);
+  // Sensor sampling tasks; after I2C_PM_init() and the system tasks
+  telem_init();
   return;
 }
 
-void system_service(void) {
-  // Run all system update/monitoring tasks and only then handle console
-  // Handle Mailbox Updates
-  if (spi_update) {
-     mbox_update(false);
-     spi_update = false; // Clear flag
+/* ============================ Scheduled Tasks ============================= */
+static void task_wd_poll(void) {
+  // The host pets through the mailbox; hold the timeout while it is idle
+  if (mbox_get_enable()) {
+    FPGAWD_Poll();
+  } else {
+    FPGAWD_Hold();
   }
-  // Handle delayed action in response to FPGA's DONE pin asserting
-  if ((fpga_net_prog_pend) && (BSP_GET_SYSTICK() > fpga_done_tickval + FPGA_PUSH_DELAY_MS)) {
-    console_print_mac_ip();
-    console_push_fpga_mac_ip();
-    printf("DONE\r\n");
-    fpga_net_prog_pend=0;
+  return;
+}
+
+/*
+ * static void task_mbox_doorbell(void);
+ *    Armed from the FPGA_INT interrupt.  The line is level-signalled (held
+ *    while DOORBELL != DOORBELL_ACK), so if the FPGA rang again while we were
+ *    servicing there is no new edge; look again shortly instead.  Only when
+ *    the pass made progress, so a stuck line cannot spin.
+ */
+static void task_mbox_doorbell(void) {
+  if ((mbox_service_doorbell() > 0) && marble_FPGAint_get()) {
+    sched_arm(task_mbox_doorbell_id, MBOX_DOORBELL_RECHECK_MS);
   }
-  // Handle re-enabling FPGA after scheduled reset
-  // NOTE! Timing depends on BSP_GET_SYSTICK returning ms
-  if ((fpga_reset) && (BSP_GET_SYSTICK() - fpga_disabled_time >= FPGA_RESET_DURATION_MS)) {
-    enable_fpga();
-    if (fpga_reset_callback != NULL) {
-      fpga_reset_callback();
-      fpga_reset_callback = NULL;
-    }
-    fpga_reset = 0;
+  return;
+}
+
+// Delayed action in response to FPGA's DONE pin asserting
+static void task_fpga_done(void) {
+  // Freshly configured FPGA; its mailbox holds none of our outputs
+  mbox_refresh();
+  console_print_mac_ip();
+  console_push_fpga_mac_ip();
+  printf("DONE\r\n");
+  return;
+}
+
+// Re-enable FPGA after scheduled reset
+static void task_fpga_enable(void) {
+  enable_fpga();
+  if (fpga_reset_callback != NULL) {
+    fpga_reset_callback();
+    fpga_reset_callback = NULL;
   }
+  return;
+}
+
+/*
+ * static void system_register_tasks(void);
+ *    The watchdog times out in elapsed ms, so its poll only sets the
+ *    resolution and need not follow the (runtime-configurable) mailbox period.
+ */
+static void system_register_tasks(void) {
+  sched_add_periodic("wd_poll", task_wd_poll, FPGAWD_POLL_PERIOD_MS, SCHED_PRIO_HIGH);
+  mbox_init();
+  eeprom_task_init();
+  task_fpga_net_prog = sched_add_oneshot("fpga_done", task_fpga_done, SCHED_PRIO_NORMAL);
+  // NOTE! Timing depends on BSP_GET_SYSTICK returning ms
+  task_fpga_reset = sched_add_oneshot("fpga_reset", task_fpga_enable, SCHED_PRIO_HIGH);
+  task_mbox_doorbell_id = sched_add_oneshot("mbox_db", task_mbox_doorbell, SCHED_PRIO_HIGH);
+  return;
+}
+
+void system_service(void) {
+  // Run all system update/monitoring tasks and only then handle console
+  sched_service();
   console_service();
   return;
 }
@@ -153,21 +195,36 @@ static void system_apply_params(void) {
   } else {
     mbox_set_enable(val);
   }
+  // Mailbox update period
+  uint8_t period[5];
+  if (eeprom_read_mbox_period(period, 5)) {
+    printf("Could not read mailbox update period.\r\n");
+  } else {
+    mbox_set_period(MBOX_PERIOD_GET_PERIOD(period), MBOX_PERIOD_GET_FAST(period),
+                    MBOX_PERIOD_GET_ADAPTIVE(period));
+  }
   return;
 }
 
 void reset_fpga_with_callback(void (*cb)(void)) {
   fpga_reset_callback = cb;
   disable_fpga();
-  fpga_reset = 1;
-  fpga_disabled_time = BSP_GET_SYSTICK();
+  sched_arm(task_fpga_reset, FPGA_RESET_DURATION_MS);
   return;
 }
 
 void print_status_counters(void) {
+  uart_tx_stats_t tx_stats;
+  marble_UART_get_tx_stats(&tx_stats);
   printf("Live counter: %u\r\n", live_cnt);
+  printf("UART TX: %lu bytes in %lu bursts (max %lu)\r\n", (unsigned long)tx_stats.bytes,
+         (unsigned long)tx_stats.bursts, (unsigned long)tx_stats.max_burst);
+  printf("UART queue high-water: RX %d/%d TX %d/%d\r\n", UARTQUEUE_HighWater(), UART_QUEUE_ITEMS,
+         UARTTXQUEUE_HighWater(), UARTTX_QUEUE_ITEMS);
   printf("FPGA prog counter: %d\r\n", fpga_prog_cnt);
   FPGAWD_ShowState();
+  mbox_print_stats();
+  telem_print_stats();
   printf("FMC status: %x\r\n", marble_FMC_status());
   printf("PWR status: %x\r\n", marble_PWR_status());
 #ifdef MARBLE_V2
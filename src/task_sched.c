@@ -0,0 +1,205 @@
+/*
+ * File: task_sched.c
+ * Desc: Cooperative tick-based task scheduler.  A small static table of
+ *       periodic and one-shot tasks, serviced from the main loop in priority
+ *       order, with per-task jitter/runtime/overrun accounting.
+ */
+
+#include "task_sched.h"
+#include "marble_api.h"
+#include <stdio.h>
+
+typedef struct {
+  const char *name;
+  sched_fn_t fn;
+  uint32_t period_ms;           // 0 for one-shot tasks
+  volatile uint32_t due;        // Next deadline (ms)
+  volatile uint32_t arm_gen;    // Bumped by sched_arm() (may be an ISR)
+  uint32_t run_gen;             // Task is armed while run_gen != arm_gen
+  uint8_t prio;
+  // Statistics
+  uint32_t runs;
+  uint32_t overruns;            // Missed periods (periodic only)
+  uint32_t last_run;            // Start of last run (ms)
+  uint32_t late_sum;            // Sum of (start - due) (ms)
+  uint32_t late_max;
+  uint32_t rt_max_us;
+  uint64_t rt_total_us;
+} sched_task_t;
+
+static sched_task_t tasks[SCHED_MAX_TASKS];
+static uint8_t order[SCHED_MAX_TASKS];  // Task ids sorted by priority
+static int ntasks = 0;
+static uint32_t stats_start = 0;        // ms
+
+static int sched_add(const char *name, sched_fn_t fn, uint32_t period_ms, uint8_t prio) {
+  if (ntasks >= SCHED_MAX_TASKS) {
+    printf("sched: no room for task %s\r\n", name);
+    return -1;
+  }
+  int id = ntasks++;
+  sched_task_t *t = &tasks[id];
+  t->name = name;
+  t->fn = fn;
+  t->period_ms = period_ms;
+  t->prio = prio;
+  t->due = BSP_GET_SYSTICK() + period_ms;
+  t->arm_gen = 0;
+  t->run_gen = 0;
+  // Insert into the priority order (stable for equal priorities)
+  int n = id;
+  while ((n > 0) && (tasks[order[n-1]].prio > prio)) {
+    order[n] = order[n-1];
+    n--;
+  }
+  order[n] = (uint8_t)id;
+  return id;
+}
+
+int sched_add_periodic(const char *name, sched_fn_t fn, uint32_t period_ms, uint8_t prio) {
+  int id = sched_add(name, fn, period_ms, prio);
+  if (id >= 0) {
+    tasks[id].arm_gen++;
+  }
+  return id;
+}
+
+int sched_add_oneshot(const char *name, sched_fn_t fn, uint8_t prio) {
+  return sched_add(name, fn, 0, prio);
+}
+
+void sched_arm(int id, uint32_t delay_ms) {
+  if ((id < 0) || (id >= ntasks)) {
+    return;
+  }
+  // Publish the deadline before marking the task armed
+  tasks[id].due = BSP_GET_SYSTICK() + delay_ms;
+  tasks[id].arm_gen++;
+  return;
+}
+
+void sched_cancel(int id) {
+  if ((id < 0) || (id >= ntasks)) {
+    return;
+  }
+  tasks[id].run_gen = tasks[id].arm_gen;
+  return;
+}
+
+void sched_set_period(int id, uint32_t period_ms) {
+  if ((id < 0) || (id >= ntasks) || (period_ms == 0)) {
+    return;
+  }
+  tasks[id].period_ms = period_ms;
+  tasks[id].due = BSP_GET_SYSTICK() + period_ms;
+  return;
+}
+
+static void sched_run(sched_task_t *t, uint32_t now) {
+  uint32_t late = now - t->due;
+  if (t->period_ms) {
+    // Keep a fixed cadence relative to the deadline rather than the start
+    // time, so main-loop latency does not accumulate as drift.  If whole
+    // periods were missed, count them and resynchronize.
+    if (late >= t->period_ms) {
+      t->overruns += late / t->period_ms;
+      t->due = now + t->period_ms;
+    } else {
+      t->due += t->period_ms;
+    }
+  } else {
+    // Disarm before running so the task (or an ISR) may re-arm it
+    t->run_gen = t->arm_gen;
+  }
+  uint32_t t0 = marble_get_us();
+  t->fn();
+  uint32_t rt = marble_get_us() - t0;
+  t->runs++;
+  t->last_run = now;
+  t->late_sum += late;
+  if (late > t->late_max) {
+    t->late_max = late;
+  }
+  if (rt > t->rt_max_us) {
+    t->rt_max_us = rt;
+  }
+  t->rt_total_us += rt;
+  return;
+}
+
+void sched_service(void) {
+  for (int n = 0; n < ntasks; n++) {
+    sched_task_t *t = &tasks[order[n]];
+    if (t->run_gen == t->arm_gen) {
+      continue;
+    }
+    uint32_t now = BSP_GET_SYSTICK();
+    if ((int32_t)(now - t->due) >= 0) {
+      sched_run(t, now);
+    }
+  }
+  return;
+}
+
+int32_t sched_next_due(void) {
+  uint32_t now = BSP_GET_SYSTICK();
+  int32_t next = -1;
+  for (int n = 0; n < ntasks; n++) {
+    sched_task_t *t = &tasks[n];
+    if (t->run_gen == t->arm_gen) {
+      continue;
+    }
+    int32_t dt = (int32_t)(t->due - now);
+    if (dt < 0) {
+      dt = 0;
+    }
+    if ((next < 0) || (dt < next)) {
+      next = dt;
+    }
+  }
+  return next;
+}
+
+void sched_reset_stats(void) {
+  for (int n = 0; n < ntasks; n++) {
+    sched_task_t *t = &tasks[n];
+    t->runs = 0;
+    t->overruns = 0;
+    t->late_sum = 0;
+    t->late_max = 0;
+    t->rt_max_us = 0;
+    t->rt_total_us = 0;
+  }
+  stats_start = BSP_GET_SYSTICK();
+  return;
+}
+
+/*
+ * void sched_print_stats(void);
+ *  One line per task.  'late' is start time minus deadline (the jitter that
+ *  shows up as cadence drift), 'cpu' is the share of wall time spent in
+ *  the task since boot or the last sched_reset_stats().
+ */
+void sched_print_stats(void) {
+  uint32_t now = BSP_GET_SYSTICK();
+  uint32_t elapsed = now - stats_start;
+  printf("Scheduler: %d tasks, %lu ms since reset\r\n", ntasks, (unsigned long)elapsed);
+  printf("%-12s %6s %4s %7s %9s %7s %11s %4s %5s\r\n",
+         "task", "period", "prio", "runs", "late(avg)", "(max)", "run_us(max)", "ovr", "cpu");
+  for (int n = 0; n < ntasks; n++) {
+    const sched_task_t *t = &tasks[order[n]];
+    uint32_t late_avg = t->runs ? t->late_sum / t->runs : 0;
+    // us per ms is parts per thousand
+    uint32_t permille = elapsed ? (uint32_t)(t->rt_total_us / elapsed) : 0;
+    printf("%-12s %6lu %4u %7lu %9lu %7lu %11lu %4lu %2lu.%01lu%%",
+           t->name, (unsigned long)t->period_ms, t->prio, (unsigned long)t->runs,
+           (unsigned long)late_avg, (unsigned long)t->late_max,
+           (unsigned long)t->rt_max_us, (unsigned long)t->overruns,
+           (unsigned long)(permille/10), (unsigned long)(permille%10));
+    if (t->run_gen != t->arm_gen) {
+      printf("  next in %ld ms", (long)(int32_t)(t->due - now));
+    }
+    printf("\r\n");
+  }
+  return;
+}
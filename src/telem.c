@@ -0,0 +1,493 @@
+/*
+ * File: telem.c
+ * Desc: Background telemetry sampler (see telem.h).
+ *
+ *       Each source walks a fixed list of register reads ("sweep"), one
+ *       i2c_xact at a time, with the next read submitted from the previous
+ *       one's completion callback.  Results accumulate in a staging area and
+ *       are only published when the whole sweep succeeds: the current front
+ *       snapshot is copied to the back buffer, the source's fields are
+ *       replaced and the buffers are flipped.  Since completions (and so
+ *       publishes) may run inside any blocking I2C call's wait loop, readers
+ *       holding the telem_get() pointer across such a call still see one
+ *       consistent generation.
+ *
+ *       Each published LTM4673 sweep is also converted to integer units and
+ *       pushed into a per-rail history of the last TELEM_RAIL_DEPTH sweeps;
+ *       the window's min/max/mean are updated on every push, so readers
+ *       (mailbox, console) only look them up.
+ */
+
+#include "telem.h"
+#include "marble_api.h"
+#include "i2c_xact.h"
+#include "task_sched.h"
+#include "max6639.h"
+#include "pmbus.h"
+#include <stdio.h>
+#include <string.h>
+
+// Attempts per LTM4673 page before giving up on a sweep (see ltm4673_store)
+#define TELEM_LTM4673_PAGE_RETRIES    (3)
+
+extern I2C_BUS I2C_PM;
+
+typedef struct telem_chan telem_chan_t;
+
+typedef struct {
+  const char *name;
+  uint32_t period_ms;
+  int nsteps;
+  // Fill in ch->x for read/write number ch->step
+  void (*issue)(telem_chan_t *ch);
+  // Consume the result of ch->step; return the next step or -1 to abort
+  int (*store)(telem_chan_t *ch);
+} telem_ops_t;
+
+struct telem_chan {
+  const telem_ops_t *ops;
+  i2c_xact_t x;
+  uint8_t buf[2];
+  int step;
+  int retries;
+  int busy;
+  int task;
+  uint32_t t_start;
+  // Statistics
+  uint32_t sweeps;
+  uint32_t errors;
+  uint32_t skipped;             // Task fired while the previous sweep was running
+  uint32_t sweep_max;           // Longest sweep (ms)
+};
+
+static void lm75_issue(telem_chan_t *ch);
+static int lm75_store(telem_chan_t *ch);
+static void max6639_issue(telem_chan_t *ch);
+static int max6639_store(telem_chan_t *ch);
+static void ltm4673_issue(telem_chan_t *ch);
+static int ltm4673_store(telem_chan_t *ch);
+static void task_lm75(void);
+static void task_max6639(void);
+static void task_ltm4673(void);
+
+static const uint8_t lm75_devs[TELEM_LM75_NDEV] = {LM75_0, LM75_1};
+
+#define X(reg)  reg,
+static const uint8_t max6639_regs[] = {TELEM_MAX6639_FOR_EACH_REGISTER()};
+#undef X
+#define MAX6639_NSAMPLED  (sizeof(max6639_regs)/sizeof(max6639_regs[0]))
+
+static const telem_ops_t telem_ops[TELEM_NSRC] = {
+  {"lm75", TELEM_LM75_PERIOD_MS, TELEM_LM75_NDEV*LM75_MAX, lm75_issue, lm75_store},
+  {"max6639", TELEM_MAX6639_PERIOD_MS, MAX6639_NSAMPLED, max6639_issue, max6639_store},
+  // One PAGE write followed by the telemetry reads, per page
+  {"ltm4673", TELEM_LTM4673_PERIOD_MS, LTM4673_TELEM_NPAGES*(1+LTM4673_TELEM_NREGS),
+    ltm4673_issue, ltm4673_store}
+};
+
+static const sched_fn_t telem_tasks[TELEM_NSRC] = {task_lm75, task_max6639, task_ltm4673};
+
+static telem_chan_t chans[TELEM_NSRC];
+static telem_snapshot_t snap[2];
+static telem_snapshot_t *volatile front = &snap[0];
+static telem_snapshot_t stage;  // Sweeps in progress; each source owns its fields
+static uint8_t ltm4673_first;   // Channel the current LTM4673 sweep started on
+
+typedef struct {
+  int16_t hist[TELEM_RAIL_DEPTH];
+  int32_t sum;
+  int16_t stat[TELEM_NSTAT];
+} telem_rail_t;
+
+static telem_rail_t rails[LTM4673_TELEM_NPAGES][TELEM_RAIL_NQ];
+static unsigned rail_head;      // Next slot in hist[]
+static unsigned rail_count;     // Valid entries in hist[]
+static uint16_t rail_seq;       // Sweeps logged
+
+static void telem_rail_push(const uint16_t telem[][LTM4673_TELEM_NREGS]);
+
+/* ================================ Publish ================================= */
+static void telem_publish(telem_src_t src) {
+  telem_snapshot_t *back = (front == &snap[0]) ? &snap[1] : &snap[0];
+  *back = *front;
+  switch (src) {
+    case TELEM_LM75:
+      memcpy(back->lm75, stage.lm75, sizeof(back->lm75));
+      break;
+    case TELEM_MAX6639:
+      memcpy(back->max6639, stage.max6639, sizeof(back->max6639));
+      break;
+    case TELEM_LTM4673:
+      memcpy(back->ltm4673, stage.ltm4673, sizeof(back->ltm4673));
+      telem_rail_push((const uint16_t (*)[LTM4673_TELEM_NREGS])stage.ltm4673);
+      break;
+    default:
+      return;
+  }
+  back->stamp[src] = BSP_GET_SYSTICK();
+  back->valid[src] = 1;
+  back->seq++;
+  front = back;
+  return;
+}
+
+/* ============================== Rail history ============================== */
+// Registers logged for each quantity, and their encodings
+static const uint8_t rail_regs[TELEM_RAIL_NQ] = {
+  LTM4673_READ_VOUT, LTM4673_READ_IOUT, LTM4673_READ_TEMPERATURE_1, LTM4673_READ_VIN
+};
+
+static int rail_index(uint8_t reg) {
+  for (int n = 0; n < LTM4673_TELEM_NREGS; n++) {
+    if (ltm4673_telem_table[n].reg == reg) {
+      return n;
+    }
+  }
+  return -1;
+}
+
+/* Telemetry word to the units of telem_rail_get() */
+static int16_t rail_decode(telem_rail_q_t q, uint16_t word) {
+  int32_t val;
+  switch (q) {
+    case TELEM_RAIL_VOUT:
+      val = l16_to_milli(word);
+      break;
+    case TELEM_RAIL_TEMP:
+      val = l11_to_milli(word)/10;
+      break;
+    default:
+      val = l11_to_milli(word);
+      break;
+  }
+  if (val > INT16_MAX) {
+    return INT16_MAX;
+  }
+  return val < INT16_MIN ? INT16_MIN : (int16_t)val;
+}
+
+static void telem_rail_push(const uint16_t telem[][LTM4673_TELEM_NREGS]) {
+  unsigned slot = rail_head;
+  rail_head = (rail_head + 1) % TELEM_RAIL_DEPTH;
+  if (rail_count < TELEM_RAIL_DEPTH) {
+    rail_count++;
+  }
+  for (int q = 0; q < TELEM_RAIL_NQ; q++) {
+    int ix = rail_index(rail_regs[q]);
+    for (int page = 0; page < LTM4673_TELEM_NPAGES; page++) {
+      telem_rail_t *r = &rails[page][q];
+      int16_t val = ix < 0 ? 0 : rail_decode((telem_rail_q_t)q, telem[page][ix]);
+      if (rail_count == TELEM_RAIL_DEPTH) {
+        r->sum -= r->hist[slot];  // Overwriting the oldest sample
+      }
+      r->hist[slot] = val;
+      r->sum += val;
+      // Window is small; rescanning is cheaper than a monotonic deque
+      int16_t vmin = val, vmax = val;
+      for (unsigned n = 0; n < rail_count; n++) {
+        int16_t h = r->hist[n];
+        vmin = h < vmin ? h : vmin;
+        vmax = h > vmax ? h : vmax;
+      }
+      int32_t half = (int32_t)(rail_count/2);
+      r->stat[TELEM_STAT_LAST] = val;
+      r->stat[TELEM_STAT_MIN] = vmin;
+      r->stat[TELEM_STAT_MAX] = vmax;
+      r->stat[TELEM_STAT_MEAN] = (int16_t)((r->sum + (r->sum < 0 ? -half : half))/(int32_t)rail_count);
+    }
+  }
+  rail_seq++;
+  return;
+}
+
+/* ================================ Sweeps ================================== */
+static void telem_sweep_cb(i2c_xact_t *x);
+
+static void telem_sweep_issue(telem_chan_t *ch) {
+  ch->ops->issue(ch);
+  if (i2c_xact_submit(&ch->x) != 0) {
+    ch->errors++;
+    ch->busy = 0;
+  }
+  return;
+}
+
+static void telem_sweep_cb(i2c_xact_t *x) {
+  telem_chan_t *ch = (telem_chan_t *)x->ctx;
+  int next = -1;
+  if (x->rc == I2C_XACT_OK) {
+    next = ch->ops->store(ch);
+  }
+  if (next < 0) {
+    // Abandon the sweep; the snapshot keeps the last good values
+    if ((x->rc != I2C_XACT_OK) && (ch == &chans[TELEM_LTM4673])) {
+      ltm4673_page_invalidate();
+    }
+    ch->errors++;
+    ch->busy = 0;
+    return;
+  }
+  if (next >= ch->ops->nsteps) {
+    telem_publish((telem_src_t)(ch - chans));
+    uint32_t dt = BSP_GET_SYSTICK() - ch->t_start;
+    if (dt > ch->sweep_max) {
+      ch->sweep_max = dt;
+    }
+    ch->sweeps++;
+    ch->busy = 0;
+    return;
+  }
+  ch->step = next;
+  telem_sweep_issue(ch);
+  return;
+}
+
+static void telem_sweep_start(telem_chan_t *ch) {
+  if (ch->busy) {
+    ch->skipped++;
+    return;
+  }
+  ch->busy = 1;
+  ch->step = 0;
+  ch->retries = 0;
+  ch->t_start = BSP_GET_SYSTICK();
+  telem_sweep_issue(ch);
+  return;
+}
+
+static void telem_read(telem_chan_t *ch, uint8_t addr, uint8_t cmd, int len) {
+  i2c_xact_init(&ch->x, I2C_PM, addr, 1, cmd, 1, ch->buf, len, telem_sweep_cb, ch);
+  return;
+}
+
+/* LM75: step = dev*LM75_MAX + reg */
+static void lm75_issue(telem_chan_t *ch) {
+  LM75_REG reg = (LM75_REG)(ch->step % LM75_MAX);
+  telem_read(ch, lm75_devs[ch->step / LM75_MAX], reg, reg == LM75_CFG ? 1 : 2);
+  return;
+}
+
+static int lm75_store(telem_chan_t *ch) {
+  LM75_REG reg = (LM75_REG)(ch->step % LM75_MAX);
+  int16_t val;
+  if (reg == LM75_CFG) {
+    val = ch->buf[0];
+  } else {
+    // Q7.1, i.e. resolution of 0.5 deg; 0..511 as LM75_readwrite() decodes it
+    val = ((ch->buf[0]<<8) | ch->buf[1]) >> 7;
+  }
+  stage.lm75[ch->step / LM75_MAX][reg] = val;
+  return ch->step + 1;
+}
+
+/* MAX6639: step indexes max6639_regs[] */
+static void max6639_issue(telem_chan_t *ch) {
+  telem_read(ch, MAX6639, max6639_regs[ch->step], 1);
+  return;
+}
+
+static int max6639_store(telem_chan_t *ch) {
+  stage.max6639[max6639_regs[ch->step]] = ch->buf[0];
+  return ch->step + 1;
+}
+
+/* LTM4673: per page, step 0 writes PAGE and steps 1..NREGS read the table.
+ * Pages are visited starting from the one already selected, and step 0 is
+ * skipped while the PAGE cache says the page is selected, so a sweep costs
+ * three PAGE writes rather than four.
+ * Other users of the PMBus (console, PMBridge) may change PAGE between our
+ * transactions.  Hooks run in completion order, so once a read has finished
+ * the cache reflects every PAGE write that preceded it; if it no longer
+ * matches, rewrite PAGE and repeat the read. */
+#define LTM4673_STEP_PAGE(step) \
+  ((ltm4673_first + (step)/(1+LTM4673_TELEM_NREGS)) % LTM4673_TELEM_NPAGES)
+
+static void ltm4673_issue(telem_chan_t *ch) {
+  if ((ch->step == 0) && (ch->retries == 0)) {
+    ltm4673_first = ltm4673_first_page();
+  }
+  int page = LTM4673_STEP_PAGE(ch->step);
+  int n = ch->step % (1+LTM4673_TELEM_NREGS);
+  if ((n == 0) && ltm4673_page_cached((uint8_t)page)) {
+    ch->step++;
+    n++;
+  }
+  if (n == 0) {
+    ch->buf[0] = (uint8_t)page;
+    i2c_xact_init(&ch->x, I2C_PM, LTM4673, 0, LTM4673_PAGE, 1, ch->buf, 1, telem_sweep_cb, ch);
+  } else {
+    telem_read(ch, LTM4673, ltm4673_telem_table[n-1].reg, 2);
+  }
+  return;
+}
+
+static int ltm4673_store(telem_chan_t *ch) {
+  int page = LTM4673_STEP_PAGE(ch->step);
+  int n = ch->step % (1+LTM4673_TELEM_NREGS);
+  if (n == 0) {
+    return ch->step + 1;
+  }
+  if (!ltm4673_page_cached((uint8_t)page)) {
+    if (++ch->retries > TELEM_LTM4673_PAGE_RETRIES) {
+      return -1;
+    }
+    return ch->step - n;
+  }
+  stage.ltm4673[page][n-1] = ((uint16_t)ch->buf[1] << 8) | ch->buf[0];
+  return ch->step + 1;
+}
+
+static void task_lm75(void) {
+  telem_sweep_start(&chans[TELEM_LM75]);
+  return;
+}
+
+static void task_max6639(void) {
+  telem_sweep_start(&chans[TELEM_MAX6639]);
+  return;
+}
+
+static void task_ltm4673(void) {
+  telem_sweep_start(&chans[TELEM_LTM4673]);
+  return;
+}
+
+/* ================================== API =================================== */
+/*
+ * void telem_init(void);
+ *  Call after I2C_PM_init().  The LTM4673 is only present from Marble v1.4.
+ *  Every source is swept once immediately so the snapshot is populated
+ *  before the first mailbox update.
+ */
+void telem_init(void) {
+  for (int src = 0; src < TELEM_NSRC; src++) {
+    telem_chan_t *ch = &chans[src];
+    ch->ops = &telem_ops[src];
+    ch->task = -1;
+    if ((src == TELEM_LTM4673) && (marble_get_pcb_rev() <= Marble_v1_3)) {
+      continue;
+    }
+    ch->task = sched_add_periodic(ch->ops->name, telem_tasks[src], ch->ops->period_ms, SCHED_PRIO_LOW);
+    if (ch->task >= 0) {
+      telem_sweep_start(ch);
+    }
+  }
+  return;
+}
+
+void telem_set_period(telem_src_t src, uint32_t period_ms) {
+  if (src < TELEM_NSRC) {
+    sched_set_period(chans[src].task, period_ms);
+  }
+  return;
+}
+
+const telem_snapshot_t *telem_get(void) {
+  return front;
+}
+
+int telem_lm75_read(uint8_t dev, LM75_REG reg, int *data) {
+  const telem_snapshot_t *s = front;
+  if (!s->valid[TELEM_LM75] || (reg >= LM75_MAX)) {
+    return 1;
+  }
+  for (int n = 0; n < TELEM_LM75_NDEV; n++) {
+    if (lm75_devs[n] == dev) {
+      *data = s->lm75[n][reg];
+      return 0;
+    }
+  }
+  return 1;
+}
+
+int telem_max6639_read(int regno, int *value) {
+  const telem_snapshot_t *s = front;
+  if (!s->valid[TELEM_MAX6639]) {
+    return 1;
+  }
+  for (unsigned n = 0; n < MAX6639_NSAMPLED; n++) {
+    if (max6639_regs[n] == regno) {
+      if (value) *value = s->max6639[regno];
+      return 0;
+    }
+  }
+  return 1;
+}
+
+int telem_max6639_reg(int regno) {
+  int value = 0;
+  telem_max6639_read(regno, &value);
+  return value;
+}
+
+int telem_alarm_active(void) {
+  const telem_snapshot_t *s = front;
+  if (s->valid[TELEM_MAX6639] && (s->max6639[MAX6639_STATUS] != 0)) {
+    return 1;
+  }
+  if (s->valid[TELEM_LM75]) {
+    for (int n = 0; n < TELEM_LM75_NDEV; n++) {
+      if (s->lm75[n][LM75_TEMP] >= s->lm75[n][LM75_OS]) {
+        return 1;
+      }
+    }
+  }
+  return 0;
+}
+
+int32_t telem_age(telem_src_t src) {
+  const telem_snapshot_t *s = front;
+  if ((src >= TELEM_NSRC) || !s->valid[src]) {
+    return -1;
+  }
+  return (int32_t)(BSP_GET_SYSTICK() - s->stamp[src]);
+}
+
+int telem_rail_get(int page, telem_rail_q_t q, telem_stat_t stat) {
+  if ((page < 0) || (page >= LTM4673_TELEM_NPAGES) || (q >= TELEM_RAIL_NQ) ||
+      (stat >= TELEM_NSTAT) || (rail_count == 0)) {
+    return 0;
+  }
+  return rails[page][q].stat[stat];
+}
+
+int telem_rail_count(void) {
+  return (int)rail_count;
+}
+
+int telem_rail_seq(void) {
+  return rail_seq;
+}
+
+void telem_rail_print(void) {
+  static const char *names[TELEM_RAIL_NQ] = {"VOUT mV", "IOUT mA", "TEMP cdegC", "VIN mV"};
+  if (rail_count == 0) {
+    printf("LTM4673 rails: no samples\r\n");
+    return;
+  }
+  printf("LTM4673 rails, last %u sweeps (mean min max):\r\n", rail_count);
+  for (int page = 0; page < LTM4673_TELEM_NPAGES; page++) {
+    printf("  ch%d", page);
+    for (int q = 0; q < TELEM_RAIL_NQ; q++) {
+      const int16_t *st = rails[page][q].stat;
+      printf("  %s %d %d %d", names[q], st[TELEM_STAT_MEAN], st[TELEM_STAT_MIN], st[TELEM_STAT_MAX]);
+    }
+    printf("\r\n");
+  }
+  return;
+}
+
+void telem_print_stats(void) {
+  printf("Telemetry: snapshot %lu\r\n", (unsigned long)front->seq);
+  for (int src = 0; src < TELEM_NSRC; src++) {
+    const telem_chan_t *ch = &chans[src];
+    if (ch->task < 0) {
+      continue;
+    }
+    printf("  %-8s sweeps %lu errors %lu skipped %lu max %lu ms age %ld ms\r\n",
+           ch->ops->name, (unsigned long)ch->sweeps, (unsigned long)ch->errors,
+           (unsigned long)ch->skipped, (unsigned long)ch->sweep_max,
+           (long)telem_age((telem_src_t)src));
+  }
+  return;
+}
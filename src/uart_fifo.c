@@ -1,154 +1,81 @@
 /*  File: uart_fifo.c
- *  Author: Auto-generated by mkqueue.py
+ *  Console UART RX and TX queues, built on spsc_ring.
+ *
+ *  RX: produced by the USART RXNE ISR (or sim stdin), consumed by the
+ *      console in thread mode.
+ *  TX: produced by marble_UART_send() in thread mode, consumed by the
+ *      TX DMA IRQ (or the sim board_service()).
  */
 
 #include "uart_fifo.h"
+#include "spsc_ring.h"
 #include "marble_api.h"
 
 #define BLOCK_TX_ON_FULL
 #define USART_TX_RETRY_TIMEOUT_MS   (1000)
 
-// ============================= Private Typedefs ==============================
-typedef struct {
-  uint8_t pIn;
-  uint8_t pOut;
-  uint8_t full;
-  uint8_t queue[UART_QUEUE_ITEMS];
-} UART_queue_t;
-
-typedef struct {
-  uint32_t pIn;
-  uint32_t pOut;
-  uint8_t full;
-  uint8_t queue[UARTTX_QUEUE_ITEMS];
-} UARTTX_queue_t;
-
-// ============================ Private Prototypes =============================
-static int _USART_Tx_RetryOnEmpty(uint8_t *c);
-
 // ============================= Private Variables =============================
-static UART_queue_t UART_queue;
-static UARTTX_queue_t UARTTX_queue;
+SPSC_RING_DEFINE(UART_queue, UART_QUEUE_ITEMS);
+SPSC_RING_DEFINE(UARTTX_queue, UARTTX_QUEUE_ITEMS);
 static uint8_t _dataLost = UART_DATA_NOT_LOST;
 
 // =========================== Function Definitions ============================
 void UARTQUEUE_Init(void) {
-  UART_queue.pIn = 0;
-  UART_queue.pOut = 0;
-  UART_queue.full = 0;
-  _dataLost = 0;
-  UARTTX_queue.pIn = 0;
-  UARTTX_queue.pOut = 0;
-  UARTTX_queue.full = 0;
+  spsc_ring_reset(&UART_queue);
+  spsc_ring_reset(&UARTTX_queue);
+  _dataLost = UART_DATA_NOT_LOST;
   return;
 }
 
+/*
+ * void UARTQUEUE_Clear(void);
+ *  Discard everything in the RX queue, except what the console is popping
+ *  at the time.  Producer-side (RX ISR) operation.
+ */
 void UARTQUEUE_Clear(void) {
-  UART_queue.pIn = 0;
-  UART_queue.pOut = 0;
-  UART_queue.full = 0;
+  spsc_ring_unpush(&UART_queue, UART_QUEUE_ITEMS);
   return;
 }
 
 uint8_t UARTQUEUE_Add(uint8_t *item) {
-  // If full, return error
-  if (UART_queue.full) {
+  if (spsc_ring_push(&UART_queue, *item) < 0) {
     return UART_QUEUE_FULL;
   }
-  // Copy item into queue
-  for (unsigned int n = 0; n < sizeof(uint8_t); n++) {
-    *((uint8_t *)&(UART_queue.queue[UART_queue.pIn]) + n) = *((uint8_t *)item + n);
-  }
-  // Wrap pIn at boundary
-  if (UART_queue.pIn == UART_QUEUE_ITEMS - 1) {
-    UART_queue.pIn = 0;
-  } else {
-    UART_queue.pIn++;
-  }
-  // Check for full condition
-  if (UART_queue.pIn == UART_queue.pOut) {
-    UART_queue.full = 1;
-  }
   return UART_QUEUE_OK;
 }
 
 /*
- * Like _Get but removes the newest (last-added) item rather than the oldest item
- */
-uint8_t UARTQUEUE_Pop(uint8_t *item) {
-  // Check for empty queue
-  if ((UART_queue.pIn == UART_queue.pOut) && (UART_queue.full == 0)) {
-    return UART_QUEUE_EMPTY;
-  }
-  // Rewind pIn and wrap at boundary
-  if (UART_queue.pIn == 0) {
-    UART_queue.pIn = UART_QUEUE_ITEMS - 1;
-  } else {
-    UART_queue.pIn--;
-  }
-  // Copy newest data from the queue to item
-  for (unsigned int n = 0; n < sizeof(uint8_t); n++) {
-    *((uint8_t *)item + n) = *((uint8_t *)&(UART_queue.queue[UART_queue.pIn]) + n);
-  }
-  // Clear full condition
-  UART_queue.full = 0;
-  return UART_QUEUE_OK;
-}
-
-/*
- * Pop and discard the newest 'n' entries
+ * uint8_t UARTQUEUE_Rewind(int n);
+ *  Discard the newest 'n' entries, unless the console is popping them.
+ *  Producer-side (RX ISR) operation.
  */
 uint8_t UARTQUEUE_Rewind(int n) {
-  // No-op if n=0
-  if (n == 0) {
+  if (n <= 0) {
     return UART_QUEUE_OK;
   }
-  // Check for empty queue
-  if ((UART_queue.pIn == UART_queue.pOut) && (UART_queue.full == 0)) {
+  if (spsc_ring_unpush(&UART_queue, (uint32_t)n) == 0) {
     return UART_QUEUE_EMPTY;
   }
-  // n = min(n, fill-level)
-  int fill = UARTQUEUE_FillLevel();
-  n = n > fill ? fill : n;
-  // Rewind pIn and wrap at boundary
-  if ((uint8_t)n > UART_queue.pIn) {
-    UART_queue.pIn = UART_QUEUE_ITEMS - ((uint8_t)n - UART_queue.pIn);
-  } else {
-    UART_queue.pIn -= (uint8_t)n;
-  }
-  // Clear full condition
-  UART_queue.full = 0;
   return UART_QUEUE_OK;
 }
 
 uint8_t UARTQUEUE_Get(volatile uint8_t *item) {
-  // Check for empty queue
-  if ((UART_queue.pIn == UART_queue.pOut) && (UART_queue.full == 0)) {
+  uint8_t c;
+  if (spsc_ring_pop(&UART_queue, &c) < 0) {
     return UART_QUEUE_EMPTY;
   }
-  // Copy next data from the queue to item
-  for (unsigned int n = 0; n < sizeof(uint8_t); n++) {
-    *((volatile uint8_t *)item + n) = *((volatile uint8_t *)&(UART_queue.queue[UART_queue.pOut]) + n);
-  }
-  // Wrap pOut at boundary
-  if (UART_queue.pOut == UART_QUEUE_ITEMS - 1) {
-    UART_queue.pOut = 0;
-  } else {
-    UART_queue.pOut++;
-  }
-  // Clear full condition
-  UART_queue.full = 0;
+  *item = c;
   return UART_QUEUE_OK;
 }
 
 uint8_t UARTQUEUE_Status(void) {
-  if ((UART_queue.pIn == UART_queue.pOut) && (UART_queue.full == 0)) {
+  uint32_t fill = spsc_ring_count(&UART_queue);
+  if (fill == 0) {
     return UART_QUEUE_EMPTY;
   }
-  if (UART_queue.full) {
+  if (fill == UART_QUEUE_ITEMS) {
     return UART_QUEUE_FULL;
   }
-  // If not full or empty, it is non-empty (at least one item in queue)
   return UART_QUEUE_OK;
 }
 
@@ -157,15 +84,10 @@ uint8_t UARTQUEUE_Status(void) {
  *  Shift up to 'len'
  */
 int UARTQUEUE_ShiftOut(uint8_t *pData, int len) {
-  int nShifted = 0;
-  uint8_t dataOut;
-  while (UARTQUEUE_Get(&dataOut) != UART_QUEUE_EMPTY) {
-    *(pData++) = dataOut;
-    if (++nShifted == len) {
-      break;
-    }
+  if (len <= 0) {
+    return 0;
   }
-  return nShifted;
+  return (int)spsc_ring_pop_n(&UART_queue, pData, (uint32_t)len);
 }
 
 /*
@@ -173,15 +95,10 @@ int UARTQUEUE_ShiftOut(uint8_t *pData, int len) {
  *  Shift until finding byte 'target' (up to 'len')
  */
 int UARTQUEUE_ShiftUntil(uint8_t *pData, uint8_t target, int len) {
-  int nShifted = 0;
-  uint8_t dataOut;
-  while (UARTQUEUE_Get(&dataOut) != UART_QUEUE_EMPTY) {
-    *(pData++) = dataOut;
-    if ((++nShifted == len) || (dataOut == target)) {
-      break;
-    }
+  if (len <= 0) {
+    return 0;
   }
-  return nShifted;
+  return (int)spsc_ring_pop_until(&UART_queue, pData, target, (uint32_t)len);
 }
 
 void UARTQUEUE_SetDataLost(uint8_t lost) {
@@ -203,113 +120,93 @@ uint8_t UARTQUEUE_IsDataLost(void) {
  *    Return the number of items currently in the queue.
  */
 int UARTQUEUE_FillLevel(void) {
-  if (UART_queue.full) {
-    return UART_QUEUE_ITEMS;
-  } else if (UART_queue.pIn == UART_queue.pOut) {
-    return 0;
-  } else if (UART_queue.pIn > UART_queue.pOut) {
-    return (int)(UART_queue.pIn - UART_queue.pOut);
-  } else {
-    return (int)(UART_QUEUE_ITEMS + UART_queue.pIn - UART_queue.pOut);
-  }
+  return (int)spsc_ring_count(&UART_queue);
+}
+
+int UARTQUEUE_HighWater(void) {
+  return (int)spsc_ring_high_water(&UART_queue);
 }
 
 uint8_t UARTTXQUEUE_Add(uint8_t *item) {
-  // If full, return error
-  if (UARTTX_queue.full) {
+  if (spsc_ring_push(&UARTTX_queue, *item) < 0) {
     return UARTTX_QUEUE_FULL;
   }
-  // Copy item into queue
-  for (unsigned int n = 0; n < sizeof(uint8_t); n++) {
-    *((uint8_t *)&(UARTTX_queue.queue[UARTTX_queue.pIn]) + n) = *((uint8_t *)item + n);
-  }
-  // Wrap pIn at boundary
-  if (UARTTX_queue.pIn == UARTTX_QUEUE_ITEMS - 1) {
-    UARTTX_queue.pIn = 0;
-  } else {
-    UARTTX_queue.pIn++;
-  }
-  // Check for full condition
-  if (UARTTX_queue.pIn == UARTTX_queue.pOut) {
-    UARTTX_queue.full = 1;
-  }
   return UARTTX_QUEUE_OK;
 }
 
 uint8_t UARTTXQUEUE_Get(volatile uint8_t *item) {
-  // Check for empty queue
-  if ((UARTTX_queue.pIn == UARTTX_queue.pOut) && (UARTTX_queue.full == 0)) {
+  uint8_t c;
+  if (spsc_ring_pop(&UARTTX_queue, &c) < 0) {
     return UARTTX_QUEUE_EMPTY;
   }
-  // Copy next data from the queue to item
-  for (unsigned int n = 0; n < sizeof(uint8_t); n++) {
-    *((volatile uint8_t *)item + n) = *((volatile uint8_t *)&(UARTTX_queue.queue[UARTTX_queue.pOut]) + n);
-  }
-  // Wrap pOut at boundary
-  if (UARTTX_queue.pOut == UARTTX_QUEUE_ITEMS - 1) {
-    UARTTX_queue.pOut = 0;
-  } else {
-    UARTTX_queue.pOut++;
-  }
-  // Clear full condition
-  UARTTX_queue.full = 0;
+  *item = c;
   return UARTTX_QUEUE_OK;
 }
 
 uint8_t UARTTXQUEUE_Status(void) {
-  if ((UARTTX_queue.pIn == UARTTX_queue.pOut) && (UARTTX_queue.full == 0)) {
+  uint32_t fill = spsc_ring_count(&UARTTX_queue);
+  if (fill == 0) {
     return UARTTX_QUEUE_EMPTY;
   }
-  if (UARTTX_queue.full) {
+  if (fill == UARTTX_QUEUE_ITEMS) {
     return UARTTX_QUEUE_FULL;
   }
-  // If not full or empty, it is non-empty (at least one item in queue)
   return UARTTX_QUEUE_OK;
 }
 
+/*
+ * int UARTTXQUEUE_ShiftOut(uint8_t *pData, int len);
+ *    Move up to 'len' bytes from the TX queue into 'pData'.
+ *    Returns the number of bytes moved.
+ */
+int UARTTXQUEUE_ShiftOut(uint8_t *pData, int len) {
+  if (len <= 0) {
+    return 0;
+  }
+  return (int)spsc_ring_pop_n(&UARTTX_queue, pData, (uint32_t)len);
+}
+
+/*
+ * int UARTTXQUEUE_FillLevel(void);
+ *    Return the number of bytes waiting to be sent.
+ */
+int UARTTXQUEUE_FillLevel(void) {
+  return (int)spsc_ring_count(&UARTTX_queue);
+}
+
+int UARTTXQUEUE_HighWater(void) {
+  return (int)spsc_ring_high_water(&UARTTX_queue);
+}
+
 // ========================== Non- Blocking API ===============================
 
 /*
  * int USART_Tx_LL_Queue(char *msg, int len);
  *    Returns number of bytes added to queue
- *    Returns -1 on full
+ *    Returns -1 on full (after USART_TX_RETRY_TIMEOUT_MS if BLOCK_TX_ON_FULL)
  */
 int USART_Tx_LL_Queue(char *msg, int len) {
-  // Add to byte queue
-  uint8_t rval;
-  int n = 0;
-  for (n = 0; n < len; n++) {
-    rval = UARTTXQUEUE_Add((uint8_t *)(msg + n)); // Type uint8_t* (not char*)
-    if (rval == UARTTX_QUEUE_FULL) {
+  const uint8_t *src = (const uint8_t *)msg;
+  uint32_t n = 0;
+  if (len <= 0) {
+    return 0;
+  }
+  n = spsc_ring_push_n(&UARTTX_queue, src, (uint32_t)len);
+  if (n < (uint32_t)len) {
 #ifdef BLOCK_TX_ON_FULL
-      // Wait for empty and attempt again
-      if (_USART_Tx_RetryOnEmpty((uint8_t *)(msg + n)) == UARTTX_QUEUE_FULL) {
-        // If still full after timeout, abort
+    // Keep topping up as the consumer drains, until done or timed out
+    uint32_t start = marble_get_tick();
+    while (n < (uint32_t)len) {
+      if ((marble_get_tick() - start) >= USART_TX_RETRY_TIMEOUT_MS) {
         return -1;
       }
+      n += spsc_ring_push_n(&UARTTX_queue, src + n, (uint32_t)len - n);
+    }
 #else
-      return -1;
+    return -1;
 #endif
-    }
-  }
-  return n;
-}
-
-/*
- * static int _USART_Tx_RetryOnEmpty(uint8_t *c);
- *    Wait up to USART_TX_RETRY_TIMEOUT attempts for UARTTX_QUEUE to become
- *    non-full, then attempt to add 'c' to the queue.  Returns UARTTX_QUEUE_OK
- *    on success, UARTTX_QUEUE_FULL on failure.
- */
-static int _USART_Tx_RetryOnEmpty(uint8_t *c) {
-  uint32_t start = marble_get_tick();
-  while ((marble_get_tick() - start) < USART_TX_RETRY_TIMEOUT_MS) {
-    if (UARTTXQUEUE_Status() != UARTTX_QUEUE_FULL) {
-      break;
-    }
   }
-  // If timeout expired, this should return UARTTX_QUEUE_FULL
-  return UARTTXQUEUE_Add(c);
+  return (int)n;
 }
 
 /*
@@ -318,11 +215,10 @@ static int _USART_Tx_RetryOnEmpty(uint8_t *c) {
  *    Returns number of chars read from queue.
  */
 int USART_Rx_LL_Queue(volatile char *msg, int len) {
-  int n = 0;
-  while (UARTQUEUE_Get((volatile uint8_t *)(msg + n)) != UART_QUEUE_EMPTY) {
-    if (n++ >= len) {
-      break;
-    }
+  uint8_t buf[UART_QUEUE_ITEMS];
+  int n = UARTQUEUE_ShiftOut(buf, len < UART_QUEUE_ITEMS ? len : UART_QUEUE_ITEMS);
+  for (int m = 0; m < n; m++) {
+    msg[m] = (char)buf[m];
   }
   return n;
 }
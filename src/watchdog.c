@@ -16,9 +16,8 @@
 #include "dbg.h"
 
 /* ============================= Helper Macros ============================== */
-#define MAILBOX_UPDATE_PERIOD_SECONDS (SPI_MAILBOX_PERIOD_MS/1000)
-#define MAX_WATCHDOG_TIMEOUT_PERIODS  (255)
-#define MAX_WATCHDOG_TIMEOUT_S        (MAX_WATCHDOG_TIMEOUT_PERIODS*MAILBOX_UPDATE_PERIOD_SECONDS)
+// Fits the 1-byte ee_wd_period tag
+#define MAX_WATCHDOG_TIMEOUT_S        (255)
 // Size of hash in bytes
 #define HASH_SIZE                     (8)
 #define HASH_SIZE_32                  (HASH_SIZE/4)
@@ -33,10 +32,18 @@ typedef enum {
 
 static uint8_t remote_hash[HASH_SIZE] = {0};
 static uint8_t local_nonce[HASH_SIZE] = {0};
+// MAC the host must return for local_nonce; computed with the nonce
+static uint8_t desired_mac[HASH_SIZE] = {0};
+// Key, already mixed into the SipHash initial state (see FPGAWD_LoadKey())
+static sip_key_t wd_key;
+static int wd_key_valid = 0;
 static uint32_t entropy[HASH_SIZE_32] = {0};
 static int rng_status = 0;
-static unsigned int poll_counter = 0;
-static unsigned int max_poll_counts = 10;
+// Timeout measured in elapsed ms from the last pet, independent of the
+// mailbox update period
+static uint32_t timeout_ms = 20000;
+static uint32_t last_pet = 0;
+static int wd_armed = 0;
 static FPGAWD_State_t fpga_state = STATE_BOOT;
 
 /* =========================== Static Prototypes ============================ */
@@ -63,31 +70,30 @@ void FPGAWD_GetNonce(uint8_t *pdata) {
 }
 
 int FPGAWD_SetPeriod(unsigned int period) {
-  period = MIN(period, MAX_WATCHDOG_TIMEOUT_PERIODS);
+  period = MIN(period, MAX_WATCHDOG_TIMEOUT_S);
   printd("period = %d\r\n", period);
-  max_poll_counts = (unsigned)MAX((int)((period/MAILBOX_UPDATE_PERIOD_SECONDS)-1), 0);
-  if (max_poll_counts == 0) {
+  timeout_ms = 1000*period;
+  if (timeout_ms == 0) {
     printf("Disabling watchdog\r\n");
   } else {
-    printf("Setting watchdog timeout to %d seconds.\r\n", (max_poll_counts+1)*MAILBOX_UPDATE_PERIOD_SECONDS);
+    printf("Setting watchdog timeout to %d seconds.\r\n", period);
   }
-  printd("Setting poll_counter to %d\r\n", max_poll_counts);
-  poll_counter = max_poll_counts;
+  last_pet = BSP_GET_SYSTICK();
+  wd_armed = (timeout_ms != 0);
   return period;
 }
 
 int FPGAWD_GetPeriod(void) {
-  if (max_poll_counts == 0) {
-    return 0;
-  } else {
-    return (max_poll_counts+1)*MAILBOX_UPDATE_PERIOD_SECONDS;
-  }
+  return (int)(timeout_ms/1000);
 }
 
+/* void FPGAWD_Poll(void);
+ *  Call periodically (FPGAWD_POLL_PERIOD_MS); resolution of the timeout. */
 void FPGAWD_Poll(void) {
-  if (poll_counter == 0) return;
-  if (--poll_counter == 0) {
-    printd("poll_counter reached 0\r\n");
+  if (!wd_armed) return;
+  if (BSP_GET_SYSTICK() - last_pet >= timeout_ms) {
+    printd("watchdog expired\r\n");
+    wd_armed = 0;
     if (fpga_state == STATE_USER) {
       reset_fpga_with_callback(fpga_reset_callback);
       fpga_state = STATE_RESET;
@@ -96,6 +102,14 @@ void FPGAWD_Poll(void) {
   return;
 }
 
+/* void FPGAWD_Hold(void);
+ *  Stop the clock while the host cannot pet (e.g. mailbox disabled) by
+ *  restarting the timeout without issuing a new nonce. */
+void FPGAWD_Hold(void) {
+  last_pet = BSP_GET_SYSTICK();
+  return;
+}
+
 void FPGAWD_DoneHandler(void) {
   FPGAWD_State_t old = fpga_state;
   switch (fpga_state) {
@@ -129,14 +143,15 @@ static void fpga_reset_callback(void) {
   printf("Watchdog timeout: resetting to golden image.\r\n");
   if (fpga_state == STATE_RESET) {
     fpga_state = STATE_BOOT;
-    poll_counter = 0;
+    wd_armed = 0;
   }
   return;
 }
 
 static void pet_wdog(void) {
   printd("Watchdog pet\n");
-  poll_counter = max_poll_counts;
+  last_pet = BSP_GET_SYSTICK();
+  wd_armed = (timeout_ms != 0);
   for (unsigned int ux=0; ux < HASH_SIZE_32; ux++) {
     // STM32 has a 4-entry FIFO for this feature, right?
     rng_status = get_hw_rnd(&(entropy[ux]));
@@ -160,19 +175,27 @@ static void compute_hash(void) {
     // to eight bytes?
     local_nonce[n] = (entropy[(n >> 2)] >> 8*(n % 4)) & 0xff;
   }
+  // Hash now, so that checking the reply is just a compare
+  if (!wd_key_valid) FPGAWD_LoadKey();
+  if (wd_key_valid) {
+    siphash_keyed(desired_mac, local_nonce, HASH_SIZE, &wd_key);
+  }
   return;
 }
 
 #define KEY_SIZE                (16)
 
 #ifdef KEY_BYPASS
-#define eeprom_read_wd_key get_fake_key
-int get_fake_key(volatile uint8_t *pdata, int len) {
+static int read_key(uint8_t *key) {
   uint8_t fake[] = "super secret key";  // trailing nul ignored
-  if (len != KEY_SIZE) return -1;
-  memcpy((uint8_t *) pdata, fake, KEY_SIZE);
+  memcpy(key, fake, KEY_SIZE);
   return 0;
 }
+#else
+// A key staged in an open EEPROM batch only counts once committed
+static int read_key(uint8_t *key) {
+  return fmc_ee_read_stored(ee_wd_key, key, KEY_SIZE) == KEY_SIZE ? 0 : -1;
+}
 #endif
 
 static void print64(const char *header, const uint8_t *data, unsigned len)
@@ -182,11 +205,28 @@ static void print64(const char *header, const uint8_t *data, unsigned len)
   printf("\r\n");
 }
 
-static int vet_hash(void) {
-  uint8_t desired_mac[HASH_SIZE];
+/* int FPGAWD_LoadKey(void);
+ *  Read the key from EEPROM into the pre-expanded SipHash state, and redo
+ *  the MAC of the current nonce.  Call after storing a new key, and after
+ *  an EEPROM batch is committed or aborted.
+ *  Returns 0, or -1 if the key could not be read. */
+int FPGAWD_LoadKey(void) {
   unsigned char key[KEY_SIZE];
-  int match = eeprom_read_wd_key((volatile uint8_t *)key, KEY_SIZE);
-  if (match != 0) {
+  int rval = read_key(key);
+  wd_key_valid = 0;
+  sip_key_clear(&wd_key);
+  if (rval == 0) {
+    sip_key_init(&wd_key, key);
+    siphash_keyed(desired_mac, local_nonce, HASH_SIZE, &wd_key);
+    wd_key_valid = 1;
+  }
+  memset(key, 0xcc, KEY_SIZE);  // Clobber key in RAM
+  return wd_key_valid ? 0 : -1;
+}
+
+static int vet_hash(void) {
+  int match;
+  if (!wd_key_valid && (FPGAWD_LoadKey() != 0)) {
     // Failed to retrieve key
     return -1;
   }
@@ -195,12 +235,7 @@ static int vet_hash(void) {
     match &= (remote_hash[n] == 0);
   }
   if (match) return 0;  // all zeros means disabled
-  core_siphash((unsigned char *) desired_mac, (unsigned char *) local_nonce, 8, key);
-  memset(key, 0xcc, KEY_SIZE);  // Clobber key in RAM
-  match = 1;
-  for (int n = 0; n < HASH_SIZE; n++) {
-    match &= (remote_hash[n] == desired_mac[n]);
-  }
+  match = (sip_verify_8(remote_hash, desired_mac) == 0);
   if (0) {
     print64("local_nonce = ", local_nonce, HASH_SIZE);
     print64("desired_mac = ", desired_mac, HASH_SIZE);
@@ -211,24 +246,17 @@ static int vet_hash(void) {
 }
 
 void FPGAWD_ShowState(void) {
-  uint8_t desired_mac[HASH_SIZE];
-  //const unsigned char *key = get_auth_key();
-  unsigned char key[KEY_SIZE];
-  printf("poll_counter = %d\r\n", poll_counter);
+  if (wd_armed) {
+    printf("wd time left = %ld ms\r\n", (long)(int32_t)(timeout_ms - (BSP_GET_SYSTICK() - last_pet)));
+  } else {
+    printf("wd time left = (not armed)\r\n");
+  }
   printf("FPGA state  = %s\r\n", state_str(fpga_state));
   print64("local_nonce = ", local_nonce, HASH_SIZE);
-  int rval = eeprom_read_wd_key((volatile uint8_t *)key, KEY_SIZE);
-  if (rval != 0) {
+  if (!wd_key_valid && (FPGAWD_LoadKey() != 0)) {
     // Failed to retrieve key
     printf("desired_mac unknown -- no key\r\n");
   } else {
-    if (0) {
-      printf("key");
-      for (unsigned jx=0; jx<KEY_SIZE; jx++) printf(" %2.2x", key[jx]);
-      printf("\r\n");
-    }
-    core_siphash((unsigned char *) desired_mac, (unsigned char *) local_nonce, 8, key);
-    memset(key, 0xcc, KEY_SIZE);  // Clobber key in RAM
     print64("desired_mac = ", desired_mac, HASH_SIZE);
   }
   print64("remote_hash = ", remote_hash, HASH_SIZE);
@@ -0,0 +1,458 @@
+/* Host unit test and scan benchmark for src/st-eeprom.c, on RAM flash
+ *   ./ee_test         run unit tests
+ *   ./ee_test bench   time eeprom_init() and the usage pass on full sectors
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include "marble_api.h"
+#include "flash.h"
+#include "task_sched.h"
+#include "st-eeprom.h"
+#include "sim_api.h"
+
+#define NSECTORS    (3)
+// Record header: tag, flags, len, ~len, 0xffff, CRC-32
+#define REC_HDR     (12)
+// A record of a 1 to 4 byte value
+#define REC_WORD    (REC_HDR + 4)
+
+static int fails;
+
+#define CHECK(cond) do { if (!(cond)) { \
+	printf("FAIL %s:%d: %s\n", __FILE__, __LINE__, #cond); fails++; } } while (0)
+
+// ---- RAM flash with NOR semantics, erases complete at the first poll ----
+
+uint32_t eeprom0_base[FLASH_SECTOR_SIZE/4];
+uint32_t eeprom1_base[FLASH_SECTOR_SIZE/4];
+uint32_t eeprom2_base[FLASH_SECTOR_SIZE/4];
+
+static uint32_t * const sectors[NSECTORS] = {eeprom0_base, eeprom1_base, eeprom2_base};
+static unsigned erase_sectorn;
+// Fail this many programs, as a locked controller would, writing nothing
+static unsigned fail_programs;
+
+int fmc_flash_init(void) { return 0; }
+void fmc_flash_cache_flush_all(void) { }
+int restore_flash(void) { return 0; }
+void sim_flash_print_stats(void) { }
+
+int fmc_flash_program(void *paddr, const void *pvalue, size_t count)
+{
+	uint8_t *addr = paddr;
+	const uint8_t *value = pvalue;
+	int ret = 0;
+	if (erase_sectorn) return -EBUSY;
+	if (fail_programs) {
+		fail_programs--;
+		return -EBUSY;
+	}
+	for (size_t ix=0; ix<count; ix++) {
+		addr[ix] &= value[ix];
+		if (addr[ix] != value[ix]) ret = -EIO;
+	}
+	return ret;
+}
+
+int fmc_flash_erase_sector(unsigned sectorn)
+{
+	if (sectorn < 1 || sectorn > NSECTORS) return -EINVAL;
+	memset(sectors[sectorn-1], 0xff, FLASH_SECTOR_SIZE);
+	return 0;
+}
+
+int fmc_flash_erase_start(unsigned sectorn)
+{
+	if (erase_sectorn) return -EBUSY;
+	erase_sectorn = sectorn;
+	return 0;
+}
+
+int fmc_flash_erase_poll(void)
+{
+	unsigned sectorn = erase_sectorn;
+	erase_sectorn = 0;
+	return sectorn ? fmc_flash_erase_sector(sectorn) : 0;
+}
+
+// No scheduler; tests call eeprom_flush() instead
+int sched_add_oneshot(const char *name, sched_fn_t fn, uint8_t prio)
+{
+	(void)name;  (void)fn;  (void)prio;
+	return 0;
+}
+void sched_arm(int id, uint32_t delay_ms) { (void)id;  (void)delay_ms; }
+
+// ---- helpers ----
+
+// eeprom_init() reports each tag it restores; keep that out of the results
+static int saved_stdout = -1;
+
+static void quiet(int on)
+{
+	fflush(stdout);
+	if (on) {
+		saved_stdout = dup(1);
+		if (!freopen("/dev/null", "w", stdout)) return;
+	} else if (saved_stdout >= 0) {
+		dup2(saved_stdout, 1);
+		close(saved_stdout);
+		saved_stdout = -1;
+	}
+}
+
+static void reinit(void)
+{
+	quiet(1);
+	eeprom_init();
+	quiet(0);
+}
+
+static void blank_all(void)
+{
+	for (unsigned ix=1; ix<=NSECTORS; ix++) fmc_flash_erase_sector(ix);
+}
+
+// Bit at a time, as the STM32F2 CRC unit computes it: whole little endian
+// words, MSB first
+static uint32_t crc32_ref(uint32_t crc, const uint8_t *p, size_t nwords)
+{
+	while (nwords--) {
+		crc ^= (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+		p += 4;
+		for (unsigned ix=0; ix<32; ix++)
+			crc = (crc & 0x80000000u) ? (crc << 1) ^ 0x04c11db7u : crc << 1;
+	}
+	return crc;
+}
+
+/* Call fn() on each record header of each formatted sector, past the
+ * 16 byte sector header.
+ */
+static void for_each_rec(void (*fn)(uint8_t *rec, void *arg), void *arg)
+{
+	for (unsigned sn=0; sn<NSECTORS; sn++) {
+		uint8_t *base = (uint8_t *)sectors[sn];
+		size_t off = 16;
+		while (off + REC_HDR <= FLASH_SECTOR_SIZE) {
+			uint8_t *rec = base + off;
+			uint16_t len = (uint16_t)(rec[2] | (rec[3] << 8));
+			uint16_t nlen = (uint16_t)(rec[4] | (rec[5] << 8));
+			if ((uint16_t)(len ^ nlen) != 0xffffu) break;
+			fn(rec, arg);
+			off += REC_HDR + ((len + 3u) & ~3u);
+		}
+	}
+}
+
+static void check_crc(uint8_t *rec, void *arg)
+{
+	uint16_t len = (uint16_t)(rec[2] | (rec[3] << 8));
+	uint32_t crc = (uint32_t)rec[8] | (uint32_t)rec[9] << 8 | (uint32_t)rec[10] << 16 | (uint32_t)rec[11] << 24;
+	uint32_t ref = crc32_ref(crc32_ref(0xffffffffu, rec, 2), rec + REC_HDR, (len + 3u) / 4u);
+	CHECK(crc == ref);
+	(*(unsigned *)arg)++;
+}
+
+static void find_last(uint8_t *rec, void *arg)
+{
+	uint8_t **last = arg;
+	if (rec[0] == ee_ip_addr) *last = rec;
+}
+
+static void find_commit(uint8_t *rec, void *arg)
+{
+	uint8_t **last = arg;
+	if (rec[0] == 0x00) *last = rec;
+}
+
+static int read_byte(ee_tags_t tag)
+{
+	uint8_t val = 0;
+	return fmc_ee_read(tag, &val, 1) == 1 ? val : -1;
+}
+
+static void write_pair(ee_tags_t tag_a, uint8_t a, ee_tags_t tag_b, uint8_t b)
+{
+	eeprom_begin();
+	CHECK(fmc_ee_write(tag_a, &a, 1) == 0);
+	CHECK(fmc_ee_write(tag_b, &b, 1) == 0);
+	CHECK(eeprom_commit() == 0);
+}
+
+// ---- tests ----
+
+/* Record CRCs must match the bit-wise CRC of the hardware unit.  The
+ * key's 16 bytes are staged in the batch queue, unaligned.
+ */
+static void test_crc(void)
+{
+	uint8_t key[16];
+	unsigned nrec = 0;
+	blank_all();
+	reinit();
+	for (unsigned ix=0; ix<sizeof key; ix++) key[ix] = (uint8_t)(0x5a ^ (ix * 37));
+	CHECK(fmc_ee_write(ee_wd_key, key, sizeof key) == 0);
+	eeprom_begin();
+	key[0] ^= 1;
+	CHECK(fmc_ee_write(ee_ip_addr, key, 3) == 0);
+	CHECK(fmc_ee_write(ee_wd_key, key, sizeof key) == 0);
+	CHECK(eeprom_commit() == 0);
+	for_each_rec(check_crc, &nrec);
+	CHECK(nrec > 10);
+}
+
+/* A record failing its CRC is skipped; the previous copy wins */
+static void test_corrupt(void)
+{
+	const uint8_t ip_a[4] = {10, 0, 0, 1}, ip_b[4] = {10, 0, 0, 2};
+	uint8_t ip[4] = {0}, *last = NULL;
+	blank_all();
+	reinit();
+	CHECK(fmc_ee_write(ee_ip_addr, ip_a, 4) == 0);
+	CHECK(fmc_ee_write(ee_ip_addr, ip_b, 4) == 0);
+	for_each_rec(find_last, &last);
+	CHECK(last != NULL);
+	if (!last) return;
+	last[REC_HDR] ^= 0x01;  // disturbed payload
+	reinit();
+	CHECK(fmc_ee_read(ee_ip_addr, ip, sizeof ip) == 4);
+	CHECK(memcmp(ip, ip_a, 4) == 0);
+}
+
+/* Write a bank in the old two-sector format, holding one IP address */
+static void legacy_bank(uint32_t *base, const uint8_t ip[4])
+{
+	uint8_t *frame = (uint8_t *)base + 8;
+	memset(base, 0xff, FLASH_SECTOR_SIZE);
+	memset(base, 0x55, 8);  // valid page state
+	frame[0] = ee_ip_addr;
+	memcpy(frame + 1, ip, 4);
+	frame[7] = frame[0];
+	for (unsigned ix=1; ix<7; ix++) frame[7] ^= frame[ix];
+}
+
+/* An old store is imported from the first two sectors, but leftover
+ * code in the third (the old application image) is never taken for one.
+ */
+static void test_legacy(void)
+{
+	const uint8_t ip_a[4] = {10, 0, 0, 7}, ip_def[4] = {192, 168, 19, 31};
+	uint8_t ip[4] = {0};
+	blank_all();
+	legacy_bank(eeprom1_base, ip_a);
+	reinit();
+	CHECK(fmc_ee_read(ee_ip_addr, ip, sizeof ip) == 4);
+	CHECK(memcmp(ip, ip_a, 4) == 0);
+	blank_all();
+	legacy_bank(eeprom2_base, ip_a);
+	reinit();
+	CHECK(fmc_ee_read(ee_ip_addr, ip, sizeof ip) == 4);
+	CHECK(memcmp(ip, ip_def, 4) == 0);
+	CHECK(eeprom2_base[1] == 0x45456d4du);  // reformatted
+}
+
+/* A failed program must not hide the records written after it */
+static void test_program_fail(void)
+{
+	const uint8_t ip_a[4] = {10, 0, 0, 1}, ip_b[4] = {10, 0, 0, 2};
+	uint8_t ip[4] = {0};
+	for (unsigned nfail=1; nfail<=2; nfail++) {
+		blank_all();
+		reinit();
+		fail_programs = nfail;  // 2: poisoning the slot fails too
+		CHECK(fmc_ee_write(ee_ip_addr, ip_a, 4) == -EBUSY);
+		fail_programs = 0;
+		CHECK(fmc_ee_write(ee_ip_addr, ip_b, 4) == 0);
+		reinit();
+		CHECK(fmc_ee_read(ee_ip_addr, ip, sizeof ip) == 4);
+		CHECK(memcmp(ip, ip_b, 4) == 0);
+	}
+}
+
+/* Staged values are read back, and only reach flash at the commit */
+static void test_batch(void)
+{
+	blank_all();
+	reinit();
+	eeprom_begin();
+	uint8_t fan = 40, temp = 70;
+	CHECK(fmc_ee_write(ee_fan_speed, &fan, 1) == 0);
+	CHECK(fmc_ee_write(ee_overtemp, &temp, 1) == 0);
+	CHECK(read_byte(ee_fan_speed) == 40);
+	eeprom_abort();
+	CHECK(read_byte(ee_fan_speed) == 102);
+	write_pair(ee_fan_speed, 41, ee_overtemp, 71);
+	reinit();
+	CHECK(read_byte(ee_fan_speed) == 41);
+	CHECK(read_byte(ee_overtemp) == 71);
+}
+
+/* Other code writing while a batch is open goes straight to flash: an
+ * abort, or power lost before the commit, must not take its value along.
+ */
+static void test_batch_scope(void)
+{
+	uint8_t fan = 42, temp = 75, mux = 3;
+	blank_all();
+	reinit();
+	eeprom_begin();
+	CHECK(fmc_ee_write(ee_fan_speed, &fan, 1) == 0);
+	eeprom_batch_leave();
+	CHECK(fmc_ee_write(ee_overtemp, &temp, 1) == 0);
+	CHECK(fmc_ee_write(ee_mgt_mux, &mux, 1) == 0);
+	eeprom_batch_enter();
+	temp = 76;
+	CHECK(fmc_ee_write(ee_overtemp, &temp, 1) == 0);
+	eeprom_batch_leave();
+	// Same as the staged value, but not as the stored one
+	temp = 76;
+	CHECK(fmc_ee_write(ee_overtemp, &temp, 1) == 0);
+	CHECK(eeprom_batch_open() == 1);
+	reinit();  // power loss
+	CHECK(read_byte(ee_fan_speed) == 102);
+	CHECK(read_byte(ee_overtemp) == 76);
+	CHECK(read_byte(ee_mgt_mux) == 3);
+	// And with an abort
+	eeprom_begin();
+	fan = 43;
+	CHECK(fmc_ee_write(ee_fan_speed, &fan, 1) == 0);
+	eeprom_batch_leave();
+	mux = 5;
+	CHECK(fmc_ee_write(ee_mgt_mux, &mux, 1) == 0);
+	eeprom_abort();
+	CHECK(eeprom_batch_open() == 0);
+	CHECK(read_byte(ee_fan_speed) == 102);
+	CHECK(read_byte(ee_mgt_mux) == 5);
+	reinit();
+	CHECK(read_byte(ee_mgt_mux) == 5);
+}
+
+/* Power lost before the commit record: none of the batch counts, and its
+ * orphaned members must not hide the next batch written after them.
+ */
+static void test_batch_power_loss(void)
+{
+	uint8_t *commit = NULL;
+	blank_all();
+	reinit();
+	write_pair(ee_fan_speed, 1, ee_overtemp, 2);
+	for_each_rec(find_commit, &commit);
+	CHECK(commit != NULL);
+	if (!commit) return;
+	memset(commit, 0xff, REC_WORD);  // never programmed
+	reinit();
+	CHECK(read_byte(ee_fan_speed) == 102);
+	CHECK(read_byte(ee_overtemp) == 85);
+	write_pair(ee_fan_speed, 77, ee_overtemp, 60);
+	reinit();
+	CHECK(read_byte(ee_fan_speed) == 77);
+	CHECK(read_byte(ee_overtemp) == 60);
+	// Cut after the first member of a batch
+	write_pair(ee_fan_speed, 5, ee_overtemp, 6);
+	commit = NULL;
+	for_each_rec(find_commit, &commit);
+	if (!commit) return;
+	memset(commit - REC_WORD, 0xff, 2 * REC_WORD);
+	reinit();
+	CHECK(read_byte(ee_fan_speed) == 77);
+	CHECK(read_byte(ee_overtemp) == 60);
+	write_pair(ee_fan_speed, 7, ee_overtemp, 8);
+	reinit();
+	CHECK(read_byte(ee_fan_speed) == 7);
+	CHECK(read_byte(ee_overtemp) == 8);
+}
+
+/* Many times round all sectors, reopening in between */
+static void test_rotate(void)
+{
+	uint8_t val[5] = {0}, got[5] = {0};
+	blank_all();
+	reinit();
+	for (unsigned ix=0; ix<3000; ix++) {
+		val[0] = (uint8_t)ix;
+		val[1] = (uint8_t)(ix >> 8);
+		CHECK(fmc_ee_write(ee_mbox_period, val, sizeof val) == 0);
+		CHECK(eeprom_flush() == 0);
+		if (ix % 700 == 0) reinit();
+	}
+	reinit();
+	CHECK(fmc_ee_read(ee_mbox_period, got, sizeof got) == (int)sizeof got);
+	CHECK(memcmp(got, val, sizeof val) == 0);
+}
+
+// ---- benchmark ----
+
+#define BENCH_ITERS   (2000)
+
+static double now(void)
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + 1e-9 * t.tv_nsec;
+}
+
+/* Fill the head and one older sector, so every scan covers two full
+ * sectors of small records, nearly all of them superseded.
+ */
+static int bench(void)
+{
+	uint8_t ip[4] = {10, 0, 0, 0};
+	unsigned nrec = 0;
+	blank_all();
+	reinit();
+	for (unsigned ix=0; ix<2*FLASH_SECTOR_SIZE/REC_WORD - 40; ix++) {
+		ip[2] = (uint8_t)(ix >> 8);
+		ip[3] = (uint8_t)ix;
+		if (fmc_ee_write(ee_ip_addr, ip, 4) || eeprom_flush()) {
+			printf("fill failed at %u\n", ix);
+			return 1;
+		}
+	}
+	for_each_rec(check_crc, &nrec);
+	const double bytes = (double)REC_WORD * nrec;
+
+	double t0 = now();
+	quiet(1);
+	for (unsigned ix=0; ix<BENCH_ITERS; ix++) eeprom_init();
+	quiet(0);
+	double t_init = (now() - t0) / BENCH_ITERS;
+
+	t0 = now();
+	quiet(1);
+	for (unsigned ix=0; ix<BENCH_ITERS; ix++) eeprom_print_status();
+	quiet(0);
+	double t_usage = (now() - t0) / BENCH_ITERS;
+
+	volatile uint32_t sink = 0;
+	t0 = now();
+	for (unsigned ix=0; ix<BENCH_ITERS; ix++)
+		sink ^= crc32_ref(0xffffffffu, (const uint8_t *)eeprom0_base, (size_t)bytes / 8);
+	double t_ref = (now() - t0) / BENCH_ITERS * 2;
+	(void)sink;
+
+	printf("%u records, %.0f bytes in 2 sectors\n", nrec, bytes);
+	printf("eeprom_init:         %8.1f us  %8.1f MB/s\n", 1e6 * t_init, bytes / t_init / 1e6);
+	printf("usage (status):      %8.1f us  %8.1f MB/s\n", 1e6 * t_usage, bytes / t_usage / 1e6);
+	printf("bit-wise CRC alone:  %8.1f us  %8.1f MB/s\n", 1e6 * t_ref, bytes / t_ref / 1e6);
+	return fails ? 1 : 0;
+}
+
+int main(int argc, char *argv[])
+{
+	if (argc > 1 && strcmp(argv[1], "bench") == 0) return bench();
+	test_crc();
+	test_corrupt();
+	test_legacy();
+	test_program_fail();
+	test_batch();
+	test_batch_scope();
+	test_batch_power_loss();
+	test_rotate();
+	printf(fails ? "FAIL\n" : "PASS\n");
+	return fails ? 1 : 0;
+}
@@ -0,0 +1,482 @@
+/* File: mailbox_def.c
+ * Desc: Auto-generated by ../scripts/mkmbox.py
+ */
+
+/* ============= DO NOT EDIT THIS AUTO-GENERATED FILE DIRECTLY ============== */
+/* ============== Define mailbox structure in scripts/mbox.def ============== */
+
+#include "mailbox_def.h"
+
+uint32_t mailbox_get_hash(void) {
+  return 0xb91fd19d;
+}
+
+// Last contents written to each dirty-tracked output page
+static uint8_t mb3_shadow[MB3_SIZE];
+static uint8_t mb4_shadow[MB4_SIZE];
+static uint8_t mb6_shadow[MB6_SIZE];
+static uint8_t mb7_shadow[MB7_SIZE];
+static uint8_t mb10_shadow[MB10_SIZE];
+static uint8_t mb11_shadow[MB11_SIZE];
+static uint8_t mb12_shadow[MB12_SIZE];
+static uint8_t mb13_shadow[MB13_SIZE];
+static uint8_t mb14_shadow[MB14_SIZE];
+
+static void mailbox_output_page3(void) {
+  uint8_t page[MB3_SIZE];
+  memcpy(page, mb3_shadow, MB3_SIZE);
+  int val;
+  val = mbox_get_update_count();
+  page[MB3_COUNT_1] = (uint8_t)((val >> 8) & 0xff);
+  page[MB3_COUNT_0] = (uint8_t)((val >> 0) & 0xff);
+  telem_lm75_read(LM75_0, LM75_TEMP, (int *)&val);
+  page[MB3_LM75_0_1] = (uint8_t)((val >> 8) & 0xff);
+  page[MB3_LM75_0_0] = (uint8_t)((val >> 0) & 0xff);
+  telem_lm75_read(LM75_1, LM75_TEMP, (int *)&val);
+  page[MB3_LM75_1_1] = (uint8_t)((val >> 8) & 0xff);
+  page[MB3_LM75_1_0] = (uint8_t)((val >> 0) & 0xff);
+  page[MB3_FMC_ST] = marble_FMC_status();
+  page[MB3_PWR_ST] = marble_PWR_status();
+  page[MB3_MGTMUX_ST] = marble_MGTMUX_status();
+  if (mbox_refreshing) {
+    val = GIT_REV_32BIT;
+    page[MB3_GIT32_3] = (uint8_t)((val >> 24) & 0xff);
+    page[MB3_GIT32_2] = (uint8_t)((val >> 16) & 0xff);
+    page[MB3_GIT32_1] = (uint8_t)((val >> 8) & 0xff);
+    page[MB3_GIT32_0] = (uint8_t)((val >> 0) & 0xff);
+  }
+  // Write changed entries only
+  mbox_write_page_changed(3, MB3_SIZE, page, mb3_shadow);
+  return;
+}
+
+static void mailbox_output_page4(void) {
+  uint8_t page[MB4_SIZE];
+  memcpy(page, mb4_shadow, MB4_SIZE);
+  int val;
+  page[MB4_MAX_T1_HI] = telem_max6639_reg(MAX6639_TEMP_CH1);
+  page[MB4_MAX_T1_LO] = telem_max6639_reg(MAX6639_TEMP_EXT_CH1);
+  page[MB4_MAX_T2_HI] = telem_max6639_reg(MAX6639_TEMP_CH2);
+  page[MB4_MAX_T2_LO] = telem_max6639_reg(MAX6639_TEMP_EXT_CH2);
+  page[MB4_MAX_F1_TACH] = telem_max6639_reg(MAX6639_FAN1_TACH_CNT);
+  page[MB4_MAX_F2_TACH] = telem_max6639_reg(MAX6639_FAN2_TACH_CNT);
+  page[MB4_MAX_F1_DUTY] = telem_max6639_reg(MAX6639_FAN1_DUTY);
+  page[MB4_MAX_F2_DUTY] = telem_max6639_reg(MAX6639_FAN2_DUTY);
+  if (mbox_refreshing) {
+    page[MB4_PCB_REV] = marble_get_board_id();
+  }
+  val = mbox_get_update_count();
+  page[MB4_COUNT_1] = (uint8_t)((val >> 8) & 0xff);
+  page[MB4_COUNT_0] = (uint8_t)((val >> 0) & 0xff);
+  if (mbox_refreshing) {
+    val = mailbox_get_hash();
+    page[MB4_HASH_3] = (uint8_t)((val >> 24) & 0xff);
+    page[MB4_HASH_2] = (uint8_t)((val >> 16) & 0xff);
+    page[MB4_HASH_1] = (uint8_t)((val >> 8) & 0xff);
+    page[MB4_HASH_0] = (uint8_t)((val >> 0) & 0xff);
+  }
+  // Write changed entries only
+  mbox_write_page_changed(4, MB4_SIZE, page, mb4_shadow);
+  return;
+}
+
+static void mailbox_output_page5(void) {
+  uint8_t page[MB5_SIZE];
+  page[MB5_I2C_BUS_STATUS] = (uint8_t)getI2CBusStatus();
+  // Write output entries only
+  mbox_write_page_masked(5, MB5_SIZE, page, 0x1);
+  return;
+}
+
+static void mailbox_output_page6(void) {
+  uint8_t page[MB6_SIZE];
+  memcpy(page, mb6_shadow, MB6_SIZE);
+  int val;
+  if (mbox_refreshing) {
+    page[MB6_FSYNTH_I2C_ADDR] = (uint8_t)fsynthGetAddr();
+  }
+  if (mbox_refreshing) {
+    page[MB6_FSYNTH_CONFIG] = (uint8_t)fsynthGetConfig();
+  }
+  if (mbox_refreshing) {
+    val = fsynthGetFreq();
+    page[MB6_FSYNTH_FREQ_3] = (uint8_t)((val >> 24) & 0xff);
+    page[MB6_FSYNTH_FREQ_2] = (uint8_t)((val >> 16) & 0xff);
+    page[MB6_FSYNTH_FREQ_1] = (uint8_t)((val >> 8) & 0xff);
+    page[MB6_FSYNTH_FREQ_0] = (uint8_t)((val >> 0) & 0xff);
+  }
+  // Write changed entries only
+  mbox_write_page_changed(6, MB6_SIZE, page, mb6_shadow);
+  return;
+}
+
+static void mailbox_output_page7(void) {
+  uint8_t page[MB7_SIZE];
+  memcpy(page, mb7_shadow, MB7_SIZE);
+  FPGAWD_GetNonce(&page[MB7_WD_NONCE_7]);
+  // Write changed entries only
+  mbox_write_page_changed(7, MB7_SIZE, page, mb7_shadow);
+  return;
+}
+
+static void mailbox_output_page9(void) {
+  uint8_t page[MB9_SIZE];
+  int val;
+  val = mbox_doorbell_get_ack();
+  page[MB9_DOORBELL_ACK_1] = (uint8_t)((val >> 8) & 0xff);
+  page[MB9_DOORBELL_ACK_0] = (uint8_t)((val >> 0) & 0xff);
+  // Write output entries only
+  mbox_write_page_masked(9, MB9_SIZE, page, 0xc);
+  return;
+}
+
+static void mailbox_output_page10(void) {
+  uint8_t page[MB10_SIZE];
+  memcpy(page, mb10_shadow, MB10_SIZE);
+  int val;
+  val = telem_rail_get(0, TELEM_RAIL_VOUT, TELEM_STAT_MEAN);
+  page[MB10_VOUT_1] = (uint8_t)((val >> 8) & 0xff);
+  page[MB10_VOUT_0] = (uint8_t)((val >> 0) & 0xff);
+  val = telem_rail_get(0, TELEM_RAIL_VOUT, TELEM_STAT_MIN);
+  page[MB10_VOUT_MIN_1] = (uint8_t)((val >> 8) & 0xff);
+  page[MB10_VOUT_MIN_0] = (uint8_t)((val >> 0) & 0xff);
+  val = telem_rail_get(0, TELEM_RAIL_VOUT, TELEM_STAT_MAX);
+  page[MB10_VOUT_MAX_1] = (uint8_t)((val >> 8) & 0xff);
+  page[MB10_VOUT_MAX_0] = (uint8_t)((val >> 0) & 0xff);
+  val = telem_rail_get(0, TELEM_RAIL_IOUT, TELEM_STAT_MEAN);
+  page[MB10_IOUT_1] = (uint8_t)((val >> 8) & 0xff);
+  page[MB10_IOUT_0] = (uint8_t)((val >> 0) & 0xff);
+  val = telem_rail_get(0, TELEM_RAIL_IOUT, TELEM_STAT_MIN);
+  page[MB10_IOUT_MIN_1] = (uint8_t)((val >> 8) & 0xff);
+  page[MB10_IOUT_MIN_0] = (uint8_t)((val >> 0) & 0xff);
+  val = telem_rail_get(0, TELEM_RAIL_IOUT, TELEM_STAT_MAX);
+  page[MB10_IOUT_MAX_1] = (uint8_t)((val >> 8) & 0xff);
+  page[MB10_IOUT_MAX_0] = (uint8_t)((val >> 0) & 0xff);
+  val = telem_rail_get(0, TELEM_RAIL_TEMP, TELEM_STAT_MEAN);
+  page[MB10_TEMP_1] = (uint8_t)((val >> 8) & 0xff);
+  page[MB10_TEMP_0] = (uint8_t)((val >> 0) & 0xff);
+  val = telem_rail_get(0, TELEM_RAIL_TEMP, TELEM_STAT_MAX);
+  page[MB10_TEMP_MAX_1] = (uint8_t)((val >> 8) & 0xff);
+  page[MB10_TEMP_MAX_0] = (uint8_t)((val >> 0) & 0xff);
+  // Write changed entries only
+  mbox_write_page_changed(10, MB10_SIZE, page, mb10_shadow);
+  return;
+}
+
+static void mailbox_output_page11(void) {
+  uint8_t page[MB11_SIZE];
+  memcpy(page, mb11_shadow, MB11_SIZE);
+  int val;
+  val = telem_rail_get(1, TELEM_RAIL_VOUT, TELEM_STAT_MEAN);
+  page[MB11_VOUT_1] = (uint8_t)((val >> 8) & 0xff);
+  page[MB11_VOUT_0] = (uint8_t)((val >> 0) & 0xff);
+  val = telem_rail_get(1, TELEM_RAIL_VOUT, TELEM_STAT_MIN);
+  page[MB11_VOUT_MIN_1] = (uint8_t)((val >> 8) & 0xff);
+  page[MB11_VOUT_MIN_0] = (uint8_t)((val >> 0) & 0xff);
+  val = telem_rail_get(1, TELEM_RAIL_VOUT, TELEM_STAT_MAX);
+  page[MB11_VOUT_MAX_1] = (uint8_t)((val >> 8) & 0xff);
+  page[MB11_VOUT_MAX_0] = (uint8_t)((val >> 0) & 0xff);
+  val = telem_rail_get(1, TELEM_RAIL_IOUT, TELEM_STAT_MEAN);
+  page[MB11_IOUT_1] = (uint8_t)((val >> 8) & 0xff);
+  page[MB11_IOUT_0] = (uint8_t)((val >> 0) & 0xff);
+  val = telem_rail_get(1, TELEM_RAIL_IOUT, TELEM_STAT_MIN);
+  page[MB11_IOUT_MIN_1] = (uint8_t)((val >> 8) & 0xff);
+  page[MB11_IOUT_MIN_0] = (uint8_t)((val >> 0) & 0xff);
+  val = telem_rail_get(1, TELEM_RAIL_IOUT, TELEM_STAT_MAX);
+  page[MB11_IOUT_MAX_1] = (uint8_t)((val >> 8) & 0xff);
+  page[MB11_IOUT_MAX_0] = (uint8_t)((val >> 0) & 0xff);
+  val = telem_rail_get(1, TELEM_RAIL_TEMP, TELEM_STAT_MEAN);
+  page[MB11_TEMP_1] = (uint8_t)((val >> 8) & 0xff);
+  page[MB11_TEMP_0] = (uint8_t)((val >> 0) & 0xff);
+  val = telem_rail_get(1, TELEM_RAIL_TEMP, TELEM_STAT_MAX);
+  page[MB11_TEMP_MAX_1] = (uint8_t)((val >> 8) & 0xff);
+  page[MB11_TEMP_MAX_0] = (uint8_t)((val >> 0) & 0xff);
+  // Write changed entries only
+  mbox_write_page_changed(11, MB11_SIZE, page, mb11_shadow);
+  return;
+}
+
+static void mailbox_output_page12(void) {
+  uint8_t page[MB12_SIZE];
+  memcpy(page, mb12_shadow, MB12_SIZE);
+  int val;
+  val = telem_rail_get(2, TELEM_RAIL_VOUT, TELEM_STAT_MEAN);
+  page[MB12_VOUT_1] = (uint8_t)((val >> 8) & 0xff);
+  page[MB12_VOUT_0] = (uint8_t)((val >> 0) & 0xff);
+  val = telem_rail_get(2, TELEM_RAIL_VOUT, TELEM_STAT_MIN);
+  page[MB12_VOUT_MIN_1] = (uint8_t)((val >> 8) & 0xff);
+  page[MB12_VOUT_MIN_0] = (uint8_t)((val >> 0) & 0xff);
+  val = telem_rail_get(2, TELEM_RAIL_VOUT, TELEM_STAT_MAX);
+  page[MB12_VOUT_MAX_1] = (uint8_t)((val >> 8) & 0xff);
+  page[MB12_VOUT_MAX_0] = (uint8_t)((val >> 0) & 0xff);
+  val = telem_rail_get(2, TELEM_RAIL_IOUT, TELEM_STAT_MEAN);
+  page[MB12_IOUT_1] = (uint8_t)((val >> 8) & 0xff);
+  page[MB12_IOUT_0] = (uint8_t)((val >> 0) & 0xff);
+  val = telem_rail_get(2, TELEM_RAIL_IOUT, TELEM_STAT_MIN);
+  page[MB12_IOUT_MIN_1] = (uint8_t)((val >> 8) & 0xff);
+  page[MB12_IOUT_MIN_0] = (uint8_t)((val >> 0) & 0xff);
+  val = telem_rail_get(2, TELEM_RAIL_IOUT, TELEM_STAT_MAX);
+  page[MB12_IOUT_MAX_1] = (uint8_t)((val >> 8) & 0xff);
+  page[MB12_IOUT_MAX_0] = (uint8_t)((val >> 0) & 0xff);
+  val = telem_rail_get(2, TELEM_RAIL_TEMP, TELEM_STAT_MEAN);
+  page[MB12_TEMP_1] = (uint8_t)((val >> 8) & 0xff);
+  page[MB12_TEMP_0] = (uint8_t)((val >> 0) & 0xff);
+  val = telem_rail_get(2, TELEM_RAIL_TEMP, TELEM_STAT_MAX);
+  page[MB12_TEMP_MAX_1] = (uint8_t)((val >> 8) & 0xff);
+  page[MB12_TEMP_MAX_0] = (uint8_t)((val >> 0) & 0xff);
+  // Write changed entries only
+  mbox_write_page_changed(12, MB12_SIZE, page, mb12_shadow);
+  return;
+}
+
+static void mailbox_output_page13(void) {
+  uint8_t page[MB13_SIZE];
+  memcpy(page, mb13_shadow, MB13_SIZE);
+  int val;
+  val = telem_rail_get(3, TELEM_RAIL_VOUT, TELEM_STAT_MEAN);
+  page[MB13_VOUT_1] = (uint8_t)((val >> 8) & 0xff);
+  page[MB13_VOUT_0] = (uint8_t)((val >> 0) & 0xff);
+  val = telem_rail_get(3, TELEM_RAIL_VOUT, TELEM_STAT_MIN);
+  page[MB13_VOUT_MIN_1] = (uint8_t)((val >> 8) & 0xff);
+  page[MB13_VOUT_MIN_0] = (uint8_t)((val >> 0) & 0xff);
+  val = telem_rail_get(3, TELEM_RAIL_VOUT, TELEM_STAT_MAX);
+  page[MB13_VOUT_MAX_1] = (uint8_t)((val >> 8) & 0xff);
+  page[MB13_VOUT_MAX_0] = (uint8_t)((val >> 0) & 0xff);
+  val = telem_rail_get(3, TELEM_RAIL_IOUT, TELEM_STAT_MEAN);
+  page[MB13_IOUT_1] = (uint8_t)((val >> 8) & 0xff);
+  page[MB13_IOUT_0] = (uint8_t)((val >> 0) & 0xff);
+  val = telem_rail_get(3, TELEM_RAIL_IOUT, TELEM_STAT_MIN);
+  page[MB13_IOUT_MIN_1] = (uint8_t)((val >> 8) & 0xff);
+  page[MB13_IOUT_MIN_0] = (uint8_t)((val >> 0) & 0xff);
+  val = telem_rail_get(3, TELEM_RAIL_IOUT, TELEM_STAT_MAX);
+  page[MB13_IOUT_MAX_1] = (uint8_t)((val >> 8) & 0xff);
+  page[MB13_IOUT_MAX_0] = (uint8_t)((val >> 0) & 0xff);
+  val = telem_rail_get(3, TELEM_RAIL_TEMP, TELEM_STAT_MEAN);
+  page[MB13_TEMP_1] = (uint8_t)((val >> 8) & 0xff);
+  page[MB13_TEMP_0] = (uint8_t)((val >> 0) & 0xff);
+  val = telem_rail_get(3, TELEM_RAIL_TEMP, TELEM_STAT_MAX);
+  page[MB13_TEMP_MAX_1] = (uint8_t)((val >> 8) & 0xff);
+  page[MB13_TEMP_MAX_0] = (uint8_t)((val >> 0) & 0xff);
+  // Write changed entries only
+  mbox_write_page_changed(13, MB13_SIZE, page, mb13_shadow);
+  return;
+}
+
+static void mailbox_output_page14(void) {
+  uint8_t page[MB14_SIZE];
+  memcpy(page, mb14_shadow, MB14_SIZE);
+  int val;
+  val = telem_rail_get(0, TELEM_RAIL_VIN, TELEM_STAT_MEAN);
+  page[MB14_VIN_1] = (uint8_t)((val >> 8) & 0xff);
+  page[MB14_VIN_0] = (uint8_t)((val >> 0) & 0xff);
+  val = telem_rail_get(0, TELEM_RAIL_VIN, TELEM_STAT_MIN);
+  page[MB14_VIN_MIN_1] = (uint8_t)((val >> 8) & 0xff);
+  page[MB14_VIN_MIN_0] = (uint8_t)((val >> 0) & 0xff);
+  val = telem_rail_get(0, TELEM_RAIL_VIN, TELEM_STAT_MAX);
+  page[MB14_VIN_MAX_1] = (uint8_t)((val >> 8) & 0xff);
+  page[MB14_VIN_MAX_0] = (uint8_t)((val >> 0) & 0xff);
+  page[MB14_RAIL_NSAMP] = telem_rail_count();
+  val = telem_rail_seq();
+  page[MB14_RAIL_SEQ_1] = (uint8_t)((val >> 8) & 0xff);
+  page[MB14_RAIL_SEQ_0] = (uint8_t)((val >> 0) & 0xff);
+  // Write changed entries only
+  mbox_write_page_changed(14, MB14_SIZE, page, mb14_shadow);
+  return;
+}
+
+void mailbox_update_output(void) {
+  mailbox_output_page3();
+  mailbox_output_page4();
+  mailbox_output_page5();
+  mailbox_output_page6();
+  mailbox_output_page7();
+  mailbox_output_page9();
+  mailbox_output_page10();
+  mailbox_output_page11();
+  mailbox_output_page12();
+  mailbox_output_page13();
+  mailbox_output_page14();
+  return;
+}
+
+int mailbox_update_output_page(uint8_t npage) {
+  switch (npage) {
+    case 3:
+      mailbox_output_page3();
+      break;
+    case 4:
+      mailbox_output_page4();
+      break;
+    case 5:
+      mailbox_output_page5();
+      break;
+    case 6:
+      mailbox_output_page6();
+      break;
+    case 7:
+      mailbox_output_page7();
+      break;
+    case 9:
+      mailbox_output_page9();
+      break;
+    case 10:
+      mailbox_output_page10();
+      break;
+    case 11:
+      mailbox_output_page11();
+      break;
+    case 12:
+      mailbox_output_page12();
+      break;
+    case 13:
+      mailbox_output_page13();
+      break;
+    case 14:
+      mailbox_output_page14();
+      break;
+    default:
+      return -1;
+  }
+  return 0;
+}
+
+static void mailbox_input_page2(void) {
+  uint8_t page[MB2_SIZE];
+  mbox_read_page(2, MB2_SIZE, page);
+  marble_MGTMUX_config(page[MB2_FMC_MGT_CTL], 0, 0);
+  mbox_write_entry(MB2_FMC_MGT_CTL, page[MB2_FMC_MGT_CTL] & 0x55);
+  return;
+}
+
+static void mailbox_input_page5(void) {
+  uint8_t page[MB5_SIZE];
+  mbox_read_page(5, MB5_SIZE, page);
+  mbox_handleI2CBusStatusMsg(page[MB5_I2C_BUS_STATUS]);
+  return;
+}
+
+static void mailbox_input_page8(void) {
+  uint8_t page[MB8_SIZE];
+  mbox_read_page(8, MB8_SIZE, page);
+  FPGAWD_HandleHash(&page[MB8_WD_HASH_7]);
+  return;
+}
+
+static void mailbox_input_page9(void) {
+  uint8_t page[MB9_SIZE];
+  mbox_read_page(9, MB9_SIZE, page);
+  int val;
+  val = (int)((page[MB9_DOORBELL_1] << 8) | (page[MB9_DOORBELL_0] << 0));
+  mbox_doorbell(val);
+  return;
+}
+
+void mailbox_update_input(void) {
+  mailbox_input_page2();
+  mailbox_input_page5();
+  mailbox_input_page8();
+  mailbox_input_page9();
+  return;
+}
+
+int mailbox_update_input_page(uint8_t npage) {
+  switch (npage) {
+    case 2:
+      mailbox_input_page2();
+      break;
+    case 5:
+      mailbox_input_page5();
+      break;
+    case 8:
+      mailbox_input_page8();
+      break;
+    case 9:
+      mailbox_input_page9();
+      break;
+    default:
+      return -1;
+  }
+  return 0;
+}
+
+void mailbox_read_print_all(void) {
+  {
+    // Page 2
+    uint8_t page[MB2_SIZE];
+    mbox_read_page(2, MB2_SIZE, page);
+    MBOX_PRINT_PAGE(2);
+  }
+  {
+    // Page 3
+    uint8_t page[MB3_SIZE];
+    mbox_read_page(3, MB3_SIZE, page);
+    MBOX_PRINT_PAGE(3);
+  }
+  {
+    // Page 4
+    uint8_t page[MB4_SIZE];
+    mbox_read_page(4, MB4_SIZE, page);
+    MBOX_PRINT_PAGE(4);
+  }
+  {
+    // Page 5
+    uint8_t page[MB5_SIZE];
+    mbox_read_page(5, MB5_SIZE, page);
+    MBOX_PRINT_PAGE(5);
+  }
+  {
+    // Page 6
+    uint8_t page[MB6_SIZE];
+    mbox_read_page(6, MB6_SIZE, page);
+    MBOX_PRINT_PAGE(6);
+  }
+  {
+    // Page 7
+    uint8_t page[MB7_SIZE];
+    mbox_read_page(7, MB7_SIZE, page);
+    MBOX_PRINT_PAGE(7);
+  }
+  {
+    // Page 8
+    uint8_t page[MB8_SIZE];
+    mbox_read_page(8, MB8_SIZE, page);
+    MBOX_PRINT_PAGE(8);
+  }
+  {
+    // Page 9
+    uint8_t page[MB9_SIZE];
+    mbox_read_page(9, MB9_SIZE, page);
+    MBOX_PRINT_PAGE(9);
+  }
+  {
+    // Page 10
+    uint8_t page[MB10_SIZE];
+    mbox_read_page(10, MB10_SIZE, page);
+    MBOX_PRINT_PAGE(10);
+  }
+  {
+    // Page 11
+    uint8_t page[MB11_SIZE];
+    mbox_read_page(11, MB11_SIZE, page);
+    MBOX_PRINT_PAGE(11);
+  }
+  {
+    // Page 12
+    uint8_t page[MB12_SIZE];
+    mbox_read_page(12, MB12_SIZE, page);
+    MBOX_PRINT_PAGE(12);
+  }
+  {
+    // Page 13
+    uint8_t page[MB13_SIZE];
+    mbox_read_page(13, MB13_SIZE, page);
+    MBOX_PRINT_PAGE(13);
+  }
+  {
+    // Page 14
+    uint8_t page[MB14_SIZE];
+    mbox_read_page(14, MB14_SIZE, page);
+    MBOX_PRINT_PAGE(14);
+  }
+  return;
+}
@@ -0,0 +1,58 @@
+#! /usr/bin/python3
+
+# Reference vectors for tests/pmbus/pmbus_test from the L11/L16 helpers of
+# scripts/ltm4673.py.  One "kind input expected" line each:
+#   l11d CODE MILLI   every L11 code; 1000*L11_TO_V(code), rounded half up
+#   l11e MILLI CODE   V_TO_L11(milli/1000)
+#   l16d CODE MILLI   every L16 code; 1000*L16_TO_V(code), rounded half up
+#   l16e MILLI CODE   V_TO_L16(milli/1000), for 0 <= milli < 8000
+# Decoded values are clipped to int32, as l11_to_milli() saturates.
+
+import os
+import sys
+import math
+import random
+from fractions import Fraction
+
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "..", "scripts"))
+from ltm4673 import L11_TO_V, V_TO_L11, L16_TO_V, V_TO_L16  # noqa: E402
+
+INT32_MIN = -(1 << 31)
+INT32_MAX = (1 << 31) - 1
+
+
+def to_milli(v):
+    m = math.floor(Fraction(v)*1000 + Fraction(1, 2))
+    return max(INT32_MIN, min(INT32_MAX, m))
+
+
+def l11_encode_inputs():
+    vals = set(range(-70000, 70001))
+    for k in range(32):
+        # Either side of each exponent's bounds
+        for edge in (1023000*Fraction(2)**(k-16), -1024000*Fraction(2)**(k-16)):
+            base = math.floor(edge)
+            vals.update(range(base - 2, base + 3))
+    rng = random.Random(4673)
+    for _ in range(50000):
+        vals.add(rng.randint(INT32_MIN, INT32_MAX))
+    for _ in range(50000):
+        vals.add(int(rng.choice((-1, 1))*2**rng.uniform(0, 31)))
+    return sorted(v for v in vals if INT32_MIN <= v <= INT32_MAX)
+
+
+def main(fname):
+    with open(fname, "w") as fd:
+        for code in range(1 << 16):
+            fd.write("l11d {} {}\n".format(code, to_milli(L11_TO_V(code))))
+        for milli in l11_encode_inputs():
+            fd.write("l11e {} {}\n".format(milli, V_TO_L11(milli/1000)))
+        for code in range(1 << 16):
+            fd.write("l16d {} {}\n".format(code, to_milli(L16_TO_V(code))))
+        for milli in range(8000):
+            fd.write("l16e {} {}\n".format(milli, V_TO_L16(milli/1000)))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv[1] if len(sys.argv) > 1 else "vectors.txt"))
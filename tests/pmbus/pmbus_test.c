@@ -0,0 +1,103 @@
+/* Host test and benchmark for the fixed-point codec in src/pmbus.c
+ *   ./pmbus_test FILE   check against reference vectors from pmbus_ref.py
+ *   ./pmbus_test bench  ns/conversion, fixed-point vs. the float/double functions
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "pmbus.h"
+
+#define MAX_REPORT    (10)
+
+static unsigned long fails;
+
+static void mismatch(const char *kind, long in, long got, long want)
+{
+	if (fails++ < MAX_REPORT)
+		printf("FAIL %s(%ld) = %ld, expected %ld\n", kind, in, got, want);
+}
+
+static int check(const char *fname)
+{
+	FILE *f = fopen(fname, "r");
+	char kind[8];
+	long in, want, got;
+	unsigned long n = 0;
+	if (!f) {
+		perror(fname);
+		return 2;
+	}
+	while (fscanf(f, "%7s %ld %ld", kind, &in, &want) == 3) {
+		if (!strcmp(kind, "l11d")) got = l11_to_milli((uint16_t)in);
+		else if (!strcmp(kind, "l11e")) got = milli_to_l11((int32_t)in);
+		else if (!strcmp(kind, "l16d")) got = l16_to_milli((uint16_t)in);
+		else if (!strcmp(kind, "l16e")) got = milli_to_l16((int32_t)in);
+		else {
+			printf("%s: unknown kind %s\n", fname, kind);
+			break;
+		}
+		if (got != want) mismatch(kind, in, got, want);
+		n++;
+	}
+	fclose(f);
+	// L16 clips where the Python does not
+	if (milli_to_l16(-1) != 0) mismatch("l16e", -1, milli_to_l16(-1), 0);
+	if (milli_to_l16(8000) != 0xffff) mismatch("l16e", 8000, milli_to_l16(8000), 0xffff);
+	if (milli_to_l16(INT32_MAX) != 0xffff) mismatch("l16e", INT32_MAX, milli_to_l16(INT32_MAX), 0xffff);
+	printf("%lu vectors, %lu mismatch%s\n", n, fails, fails == 1 ? "" : "es");
+	printf(fails || n == 0 ? "FAIL\n" : "PASS\n");
+	return fails || n == 0;
+}
+
+// ---- benchmark ----
+
+#define BENCH_ITERS   (200)
+
+static double now(void)
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + 1e-9 * t.tv_nsec;
+}
+
+static void report(const char *what, double t0, unsigned long n)
+{
+	printf("%-20s %6.2f ns\n", what, 1e9 * (now() - t0) / n);
+}
+
+static int bench(void)
+{
+	const unsigned long n = BENCH_ITERS * 65536UL;
+	volatile int32_t isink = 0;
+	volatile double dsink = 0;
+	volatile uint16_t usink = 0;
+	double t0;
+
+	t0 = now();
+	for (unsigned it=0; it<BENCH_ITERS; it++)
+		for (uint32_t l=0; l<65536; l++) isink += l11_to_milli((uint16_t)l);
+	report("l11_to_milli", t0, n);
+	t0 = now();
+	for (unsigned it=0; it<BENCH_ITERS; it++)
+		for (uint32_t l=0; l<65536; l++) dsink += l11_to_mv_double((uint16_t)l);
+	report("l11_to_mv_double", t0, n);
+	t0 = now();
+	for (unsigned it=0; it<BENCH_ITERS; it++)
+		for (int32_t m=-32768; m<32768; m++) usink ^= milli_to_l11(m * 61);
+	report("milli_to_l11", t0, n);
+	t0 = now();
+	for (unsigned it=0; it<BENCH_ITERS; it++)
+		for (int32_t m=-32768; m<32768; m++) usink ^= mv_to_l11_float((float)(m * 61));
+	report("mv_to_l11_float", t0, n);
+	(void)isink;  (void)dsink;  (void)usink;
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	if (argc > 1 && !strcmp(argv[1], "bench")) return bench();
+	if (argc > 1) return check(argv[1]);
+	printf("Usage: pmbus_test {FILE, bench}\n");
+	return 2;
+}
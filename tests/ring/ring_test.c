@@ -0,0 +1,248 @@
+/* Host unit test and throughput benchmark for src/spsc_ring.c
+ *   ./ring_test         run unit tests
+ *   ./ring_test bench   producer/consumer threads, bulk vs. byte-wise
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <signal.h>
+#include "spsc_ring.h"
+
+static int fails;
+
+#define CHECK(cond) do { if (!(cond)) { \
+	printf("FAIL %s:%d: %s\n", __FILE__, __LINE__, #cond); fails++; } } while (0)
+
+static void test_init(void)
+{
+	spsc_ring_t r;
+	uint8_t buf[64];
+	CHECK(spsc_ring_init(&r, buf, 48) < 0);
+	CHECK(spsc_ring_init(&r, buf, 0) < 0);
+	CHECK(spsc_ring_init(&r, buf, 64) == 0);
+	CHECK(spsc_ring_size(&r) == 64);
+	CHECK(spsc_ring_count(&r) == 0);
+	CHECK(spsc_ring_space(&r) == 64);
+}
+
+static void test_single(void)
+{
+	spsc_ring_t r;
+	uint8_t buf[8], c = 0;
+	spsc_ring_init(&r, buf, sizeof buf);
+	CHECK(spsc_ring_pop(&r, &c) < 0);
+	for (unsigned ix=0; ix<8; ix++) CHECK(spsc_ring_push(&r, (uint8_t)ix) == 0);
+	CHECK(spsc_ring_push(&r, 99) < 0);
+	CHECK(spsc_ring_count(&r) == 8);
+	for (unsigned ix=0; ix<8; ix++) {
+		CHECK(spsc_ring_pop(&r, &c) == 0);
+		CHECK(c == ix);
+	}
+	CHECK(spsc_ring_pop(&r, &c) < 0);
+}
+
+/* Walk the indices all the way around many times with odd-sized chunks so
+ * both the one- and two-segment copy paths are hit, including 32-bit
+ * counter wrap.
+ */
+static void test_bulk_wrap(void)
+{
+	spsc_ring_t r;
+	uint8_t buf[16], in[16], out[16];
+	uint8_t wseq = 0, rseq = 0;
+	spsc_ring_init(&r, buf, sizeof buf);
+	r.head = r.tail = 0xfffffff0u;
+	for (unsigned iter=0; iter<1000; iter++) {
+		unsigned n = 1 + iter % 13;
+		for (unsigned ix=0; ix<n; ix++) in[ix] = wseq + ix;
+		uint32_t pushed = spsc_ring_push_n(&r, in, n);
+		wseq += pushed;
+		uint32_t popped = spsc_ring_pop_n(&r, out, 1 + (iter * 7) % 11);
+		for (unsigned ix=0; ix<popped; ix++) {
+			if (out[ix] != rseq++) { CHECK(0); return; }
+		}
+		CHECK(spsc_ring_count(&r) <= 16);
+	}
+	CHECK(spsc_ring_high_water(&r) == 16);
+}
+
+static void test_pop_until(void)
+{
+	spsc_ring_t r;
+	uint8_t buf[8], out[8];
+	spsc_ring_init(&r, buf, sizeof buf);
+	// Put "ab\ncd\nef" across the wrap point
+	r.head = r.tail = 5;
+	CHECK(spsc_ring_push_n(&r, (const uint8_t *)"ab\ncd\nef", 8) == 8);
+	CHECK(spsc_ring_pop_until(&r, out, '\n', 8) == 3);
+	CHECK(memcmp(out, "ab\n", 3) == 0);
+	CHECK(spsc_ring_pop_until(&r, out, '\n', 8) == 3);
+	CHECK(memcmp(out, "cd\n", 3) == 0);
+	// No terminator: drain what is there
+	CHECK(spsc_ring_pop_until(&r, out, '\n', 8) == 2);
+	CHECK(memcmp(out, "ef", 2) == 0);
+	// Length limit wins over a later terminator
+	spsc_ring_push_n(&r, (const uint8_t *)"wxyz\n", 5);
+	CHECK(spsc_ring_pop_until(&r, out, '\n', 2) == 2);
+	CHECK(spsc_ring_pop_until(&r, out, '\n', 8) == 3);
+	CHECK(memcmp(out, "yz\n", 3) == 0);
+}
+
+static void test_unpush(void)
+{
+	spsc_ring_t r;
+	uint8_t buf[8], out[8];
+	spsc_ring_init(&r, buf, sizeof buf);
+	spsc_ring_push_n(&r, (const uint8_t *)"abcx", 4);
+	CHECK(spsc_ring_unpush(&r, 1) == 1);
+	spsc_ring_push(&r, 'd');
+	CHECK(spsc_ring_pop_n(&r, out, 8) == 4);
+	CHECK(memcmp(out, "abcd", 4) == 0);
+	spsc_ring_push_n(&r, (const uint8_t *)"xyz", 3);
+	CHECK(spsc_ring_unpush(&r, 10) == 3);
+	CHECK(spsc_ring_count(&r) == 0);
+	CHECK(spsc_ring_unpush(&r, 1) == 0);
+}
+
+/* A timer signal plays the RX ISR, typing lines with backspaces and
+ * clears, while the consumer pops whole lines.  Retraction must never take
+ * back bytes which a pop is taking, which would leave head behind tail.
+ */
+#define RACE_SIGNALS  (100000u)
+
+static uint8_t race_storage[16];
+static spsc_ring_t race_ring;
+static volatile sig_atomic_t race_left;
+
+static void race_isr(int sig)
+{
+	static uint32_t rnd = 1;
+	(void)sig;
+	for (unsigned ix=0; ix<4; ix++) {
+		rnd = rnd * 1103515245u + 12345u;
+		unsigned op = (rnd >> 16) % 16;
+		if (op == 0) {
+			spsc_ring_unpush(&race_ring, spsc_ring_size(&race_ring));
+		} else if (op < 5) {
+			spsc_ring_unpush(&race_ring, 1);
+		} else {
+			spsc_ring_push(&race_ring, op < 8 ? '\n' : 'a');
+		}
+	}
+	race_left--;
+}
+
+static void test_unpush_race(void)
+{
+	struct sigaction sa;
+	struct sigevent sev;
+	struct itimerspec its = {{0, 10000}, {0, 10000}};
+	timer_t timer;
+	uint8_t out[16];
+	unsigned bad = 0;
+	spsc_ring_init(&race_ring, race_storage, sizeof race_storage);
+	memset(&sa, 0, sizeof sa);
+	sa.sa_handler = race_isr;
+	sigaction(SIGALRM, &sa, NULL);
+	memset(&sev, 0, sizeof sev);
+	sev.sigev_notify = SIGEV_SIGNAL;
+	sev.sigev_signo = SIGALRM;
+	race_left = RACE_SIGNALS;
+	CHECK(timer_create(CLOCK_MONOTONIC, &sev, &timer) == 0);
+	timer_settime(timer, 0, &its, NULL);
+	while (race_left > 0) {
+		spsc_ring_pop_until(&race_ring, out, '\n', sizeof out);
+		if (spsc_ring_count(&race_ring) > spsc_ring_size(&race_ring)) bad++;
+	}
+	timer_delete(timer);
+	signal(SIGALRM, SIG_DFL);
+	CHECK(bad == 0);
+	while (spsc_ring_pop_until(&race_ring, out, '\n', sizeof out)) {}
+	CHECK(spsc_ring_count(&race_ring) == 0);
+}
+
+// ================================ Benchmark ==================================
+#define BENCH_BYTES   (32u << 20)
+#define BENCH_CHUNK   (128u)
+
+static uint8_t bench_storage[1024];
+static spsc_ring_t bench_ring;
+static int bench_bulk;
+
+static void *bench_producer(void *arg)
+{
+	uint8_t chunk[BENCH_CHUNK];
+	uint32_t seq = 0, sent = 0;
+	(void)arg;
+	while (sent < BENCH_BYTES) {
+		if (bench_bulk) {
+			for (unsigned ix=0; ix<BENCH_CHUNK; ix++) chunk[ix] = (uint8_t)(seq + ix);
+			// Re-send whatever did not fit
+			uint32_t n = spsc_ring_push_n(&bench_ring, chunk, BENCH_CHUNK);
+			seq += n;  sent += n;
+			if (n == 0) sched_yield();
+		} else if (spsc_ring_push(&bench_ring, (uint8_t)seq) == 0) {
+			seq++;  sent++;
+		} else {
+			sched_yield();
+		}
+	}
+	return NULL;
+}
+
+static double bench_run(int bulk, unsigned *errors)
+{
+	pthread_t th;
+	struct timespec t0, t1;
+	uint8_t chunk[BENCH_CHUNK], c;
+	uint32_t seq = 0, got = 0;
+	spsc_ring_init(&bench_ring, bench_storage, sizeof bench_storage);
+	bench_bulk = bulk;
+	*errors = 0;
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	pthread_create(&th, NULL, bench_producer, NULL);
+	while (got < BENCH_BYTES) {
+		if (bulk) {
+			uint32_t n = spsc_ring_pop_n(&bench_ring, chunk, BENCH_CHUNK);
+			for (unsigned ix=0; ix<n; ix++) if (chunk[ix] != (uint8_t)seq++) (*errors)++;
+			got += n;
+			if (n == 0) sched_yield();
+		} else if (spsc_ring_pop(&bench_ring, &c) == 0) {
+			if (c != (uint8_t)seq++) (*errors)++;
+			got++;
+		} else {
+			sched_yield();
+		}
+	}
+	pthread_join(th, NULL);
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	double dt = (t1.tv_sec - t0.tv_sec) + 1e-9 * (t1.tv_nsec - t0.tv_nsec);
+	return BENCH_BYTES / dt / 1e6;
+}
+
+static int bench(void)
+{
+	unsigned err_byte, err_bulk;
+	double byte = bench_run(0, &err_byte);
+	double bulk = bench_run(1, &err_bulk);
+	printf("byte-wise: %8.1f MB/s  (%u sequence errors)\n", byte, err_byte);
+	printf("bulk %3u:  %8.1f MB/s  (%u sequence errors)\n", BENCH_CHUNK, bulk, err_bulk);
+	printf("high-water: %u/%u\n", spsc_ring_high_water(&bench_ring), spsc_ring_size(&bench_ring));
+	return (err_byte || err_bulk) ? 1 : 0;
+}
+
+int main(int argc, char *argv[])
+{
+	if (argc > 1 && strcmp(argv[1], "bench") == 0) return bench();
+	test_init();
+	test_single();
+	test_bulk_wrap();
+	test_pop_until();
+	test_unpush();
+	test_unpush_race();
+	printf(fails ? "FAIL\n" : "PASS\n");
+	return fails ? 1 : 0;
+}
@@ -81,6 +81,14 @@ static int spot_check1(const unsigned char *local_nonce, const unsigned char *de
 	for (unsigned int n = 0; n < HASH_SIZE; n++) {
 		ok &= (result_mac[n] == desired_mac[n]);
 	}
+	// Same again with the key schedule kept, as the watchdog does
+	sip_key_t ctx;
+	sip_key_init(&ctx, tkey);
+	memset(result_mac, 0, HASH_SIZE);
+	siphash_keyed(result_mac, local_nonce, HASH_SIZE, &ctx);
+	ok &= (sip_verify_8(result_mac, desired_mac) == 0);
+	result_mac[HASH_SIZE-1] ^= 0x80;
+	ok &= (sip_verify_8(result_mac, desired_mac) == -1);
 	printf("%s\n", ok ? "OK" : "BAD");
 	return !ok;
 }
@@ -0,0 +1,201 @@
+/* Batch SipHash verification and throughput benchmark for src/refsip.c
+ *   ./sip_batch gen FILE N              write N (nonce, MAC) pairs
+ *   ./sip_batch verify FILE [THREADS]   check every pair; exit 1 on mismatch
+ *   ./sip_batch bench [N [THREADS]]     ns/hash over N pairs held in memory
+ * A pair is 16 bytes: an 8-byte nonce as read from WD_NONCE, then its MAC
+ * as core_siphash() writes it (what the host writes to WD_HASH).  The key
+ * is the firmware default, or 32 hex digits from $SIP_KEY.  THREADS = 0
+ * uses every online core.
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "refsip.h"
+
+#define PAIR_SIZE     (16)
+#define MAX_THREADS   (64)
+
+typedef struct {
+	const unsigned char *pairs;
+	size_t n;
+	const sip_key_t *ctx;
+	size_t bad;
+	pthread_t th;
+} batch_t;
+
+static int get_key(unsigned char key[16])
+{
+	const char *hex = getenv("SIP_KEY");
+	if (!hex) {
+		memcpy(key, "super secret key", 16);
+		return 0;
+	}
+	for (unsigned ix=0; ix<16; ix++) {
+		char hx[3] = {hex[2*ix], hex[2*ix] ? hex[2*ix+1] : '\0', '\0'};
+		if (!isxdigit((unsigned char)hx[0]) || !isxdigit((unsigned char)hx[1])) {
+			fprintf(stderr, "SIP_KEY must be 32 hex digits\n");
+			return 1;
+		}
+		key[ix] = (unsigned char)strtoul(hx, NULL, 16);
+	}
+	return 0;
+}
+
+static uint64_t xorshift64(uint64_t *s)
+{
+	*s ^= *s << 13;
+	*s ^= *s >> 7;
+	*s ^= *s << 17;
+	return *s;
+}
+
+static void fill_pairs(unsigned char *pairs, size_t n, const sip_key_t *ctx)
+{
+	uint64_t seed = 0x9e3779b97f4a7c15ULL;
+	for (size_t ix=0; ix<n; ix++) {
+		unsigned char *p = pairs + PAIR_SIZE*ix;
+		uint64_t r = xorshift64(&seed);
+		memcpy(p, &r, 8);
+		siphash_keyed(p + 8, p, 8, ctx);
+	}
+}
+
+static void *verify_part(void *arg)
+{
+	batch_t *b = arg;
+	unsigned char mac[8];
+	for (size_t ix=0; ix<b->n; ix++) {
+		const unsigned char *p = b->pairs + PAIR_SIZE*ix;
+		siphash_keyed(mac, p, 8, b->ctx);
+		if (sip_verify_8(mac, p + 8)) b->bad++;
+	}
+	return NULL;
+}
+
+/* Split the pairs over 'nthreads'; returns mismatches, '*dt' wall time */
+static size_t verify_all(const unsigned char *pairs, size_t n, unsigned nthreads,
+	const sip_key_t *ctx, double *dt)
+{
+	batch_t parts[MAX_THREADS];
+	struct timespec t0, t1;
+	size_t bad = 0, start = 0;
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	for (unsigned ix=0; ix<nthreads; ix++) {
+		size_t cnt = n/nthreads + (ix < n%nthreads);
+		parts[ix] = (batch_t){pairs + PAIR_SIZE*start, cnt, ctx, 0, 0};
+		start += cnt;
+		if (nthreads == 1) verify_part(&parts[ix]);
+		else pthread_create(&parts[ix].th, NULL, verify_part, &parts[ix]);
+	}
+	for (unsigned ix=0; ix<nthreads; ix++) {
+		if (nthreads > 1) pthread_join(parts[ix].th, NULL);
+		bad += parts[ix].bad;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	*dt = (t1.tv_sec - t0.tv_sec) + 1e-9 * (t1.tv_nsec - t0.tv_nsec);
+	return bad;
+}
+
+static unsigned get_threads(const char *arg)
+{
+	long nt = arg ? strtol(arg, NULL, 0) : 1;
+	if (nt <= 0) nt = sysconf(_SC_NPROCESSORS_ONLN);
+	if (nt < 1) nt = 1;
+	return nt > MAX_THREADS ? MAX_THREADS : (unsigned)nt;
+}
+
+static void report(const char *what, size_t n, unsigned nthreads, double dt)
+{
+	printf("%-8s %10zu pairs  %2u thread%s  %8.2f ns/hash  %8.2f Mhash/s\n", what, n,
+		nthreads, nthreads == 1 ? " " : "s", 1e9 * dt / n, n / dt / 1e6);
+}
+
+static int gen(const char *fname, size_t n, const sip_key_t *ctx)
+{
+	unsigned char *pairs = malloc(PAIR_SIZE*n);
+	FILE *f = fopen(fname, "wb");
+	int rc = 0;
+	if (!pairs || !f) {
+		perror(fname);
+		rc = 1;
+	} else {
+		fill_pairs(pairs, n, ctx);
+		rc = fwrite(pairs, PAIR_SIZE, n, f) != n;
+	}
+	if (f) fclose(f);
+	free(pairs);
+	return rc;
+}
+
+static int verify(const char *fname, unsigned nthreads, const sip_key_t *ctx)
+{
+	FILE *f = fopen(fname, "rb");
+	if (!f) {
+		perror(fname);
+		return 2;
+	}
+	fseek(f, 0, SEEK_END);
+	long size = ftell(f);
+	rewind(f);
+	size_t n = size > 0 ? (size_t)size / PAIR_SIZE : 0;
+	unsigned char *pairs = malloc(PAIR_SIZE*n + 1);
+	if (!pairs || fread(pairs, PAIR_SIZE, n, f) != n || n == 0) {
+		fprintf(stderr, "%s: no pairs read\n", fname);
+		fclose(f);
+		free(pairs);
+		return 2;
+	}
+	fclose(f);
+	double dt;
+	size_t bad = verify_all(pairs, n, nthreads, ctx, &dt);
+	report("verify", n, nthreads, dt);
+	printf("%zu mismatch%s\n%s\n", bad, bad == 1 ? "" : "es", bad ? "FAIL" : "PASS");
+	free(pairs);
+	return bad != 0;
+}
+
+static int bench(size_t n, unsigned nthreads, const sip_key_t *ctx)
+{
+	unsigned char *pairs = malloc(PAIR_SIZE*n);
+	double dt;
+	size_t bad;
+	if (!pairs) return 2;
+	fill_pairs(pairs, n, ctx);
+	bad = verify_all(pairs, n, 1, ctx, &dt);
+	report("bench", n, 1, dt);
+	if (nthreads > 1) {
+		bad += verify_all(pairs, n, nthreads, ctx, &dt);
+		report("bench", n, nthreads, dt);
+	}
+	free(pairs);
+	return bad != 0;
+}
+
+static void usage(void)
+{
+	printf("Usage: sip_batch {gen FILE N, verify FILE [THREADS], bench [N [THREADS]]}\n");
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned char key[16];
+	sip_key_t ctx;
+	int rc = 2;
+	if (get_key(key)) return 2;
+	sip_key_init(&ctx, key);
+	if (argc > 3 && !strcmp(argv[1], "gen"))
+		rc = gen(argv[2], strtoul(argv[3], NULL, 0), &ctx);
+	else if (argc > 2 && !strcmp(argv[1], "verify"))
+		rc = verify(argv[2], get_threads(argc > 3 ? argv[3] : NULL), &ctx);
+	else if (argc > 1 && !strcmp(argv[1], "bench"))
+		rc = bench(argc > 2 ? strtoul(argv[2], NULL, 0) : 4000000,
+			get_threads(argc > 3 ? argv[3] : "0"), &ctx);
+	else usage();
+	sip_key_clear(&ctx);
+	return rc;
+}